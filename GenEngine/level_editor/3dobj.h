@@ -4,44 +4,167 @@
 #include "../util/vec.h"
 #include "../util/glad/glad.h"
 #include "../renderer/Shader.h"
+#include "../renderer/gl_state.h"
+#include "../renderer/stream_buffer.h"
+#include "../renderer/vertex_format.h"
 #include <vector>
+#include <algorithm>
+#include <string.h>
 #include <deque>
 #include <bitset>
 class GenObject {
-	unsigned int VAO = 0, VBO = 0;
-	std::bitset<1>flags;
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	GLsizeiptr vbo_capacity = 0;	// Bytes allocated for VBO. Uploads that fit are copied in place instead of reallocating the buffer.
+	GLsizeiptr ebo_capacity = 0;	// Same for EBO.
+	GLsizei vertex_count = 0;		// Vertices in VBO after the last upload.
+	GLsizei index_count = 0;		// Indices in EBO after the last upload, 0 if the object isn't indexed.
+	bool has_light = false;			// VBO holds baked light and occlusion (stride 5 or more), not just positions.
+	GenEngine::vertex_quantization quantization = { vec3(0.f, 0.f, 0.f), vec3(1.f, 1.f, 1.f) };	// Of the vertices in VBO (vertex_format.h).
+	GenEngine::vertex_quantization shared_quantization = { vec3(0.f, 0.f, 0.f), vec3(0.f, 0.f, 0.f) };	// Box shared with other objects, if any.
+	bool has_shared_quantization = false;
+	std::bitset<1>flags;		// flags[0]: vertex data changed and hasn't been handed to the render thread yet.
 
 public:
 	std::vector<float>vbo_verts;
+	std::vector<unsigned int>indices;		// Into vbo_verts (util/mesh_optimize.h); empty to draw vbo_verts in order.
+	GLenum primitive = GL_TRIANGLE_STRIP;	// Primitive the vertices (or indices) are assembled into.
+	unsigned int stride = 3;				// Floats per vertex in vbo_verts: the position, then baked light and occlusion if there are 5.
 
 	inline void set_v_buffer();
 	inline void set_e_buffer();
 	inline void set_flags(const unsigned short int bitmask);
-	inline void draw(const Shader& shader, const mat4x4 view, const mat4x4 projection);
+	inline void draw(const Shader& shader, const vec3 color = vec3(0.8f, 0.8f, 0.8f));	// Expects the "Camera" uniform block to be bound.
+	inline void draw_instanced(const GLsizei instances) const;							// Expects the VAO bound and the instance streams set.
+
+	inline unsigned int get_vao()			const	{ return VAO; }
+	inline GLsizei		get_vertex_count()	const	{ return vertex_count; }
+	inline GLsizei		get_index_count()	const	{ return index_count; }
+	inline bool			has_gpu_buffers()	const	{ return VAO != 0; }
+	inline const GenEngine::vertex_quantization&	get_quantization()	const	{ return quantization; }
+	inline void			set_quantization(const Shader& shader) const;		// The uniforms that turn the packed positions back into floats.
+	inline void			set_shared_quantization(const GenEngine::vertex_quantization& q)	{ shared_quantization = q; has_shared_quantization = true; }	// Before uploads.
+	inline bool			get_bounds(vec3& min, vec3& max) const;		// Axis aligned box of vbo_verts' positions. Returns 0 if there are no vertices.
+
+	// Vertex data changes are only recorded here. The GL buffers are owned by the render thread, which receives a copy of the data in a
+	// frame packet and calls upload() with it.
+	inline void mark_dirty()			{ flags[0] = 1; }
+	inline void mark_clean()			{ flags[0] = 0; }
+	inline bool needs_upload() const	{ return flags[0]; }
+	inline void upload(const std::vector<float>& verts, const std::vector<unsigned int>& elements);
 };
 
+inline bool GenObject::get_bounds(vec3& min, vec3& max) const {
+	if (vbo_verts.size() < 3)
+		return false;
+	min = max = vec3(vbo_verts[0], vbo_verts[1], vbo_verts[2]);
+	for (size_t i = stride; i + 2 < vbo_verts.size(); i += stride) {
+		min = vec3(std::min(min.x(), vbo_verts[i]), std::min(min.y(), vbo_verts[i + 1]), std::min(min.z(), vbo_verts[i + 2]));
+		max = vec3(std::max(max.x(), vbo_verts[i]), std::max(max.y(), vbo_verts[i + 1]), std::max(max.z(), vbo_verts[i + 2]));
+	}
+	return true;
+}
+
 inline void GenObject::set_v_buffer() {
-	glGenBuffers(1, &VBO);
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vbo_verts.size() * sizeof(float), &vbo_verts[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-	glEnableVertexAttribArray(0);
-	glBindVertexArray(0);
+	upload(vbo_verts, indices);
+}
+
+// Copies data to the start of the buffer bound to target, staged in the streaming ring so the update never waits for draws still using
+// the old contents.
+inline void stage_buffer_data(const GLenum target, const void* data, const GLsizeiptr bytes) {
+	GLintptr offset;
+	void* staging = GenEngine::stream_ring.is_created() ? GenEngine::stream_ring.allocate(bytes, 4, offset) : NULL;
+	if (staging) {
+		memcpy(staging, data, bytes);
+		GenEngine::stream_ring.commit();
+		GenEngine::gl_state.bind_buffer(GL_COPY_READ_BUFFER, GenEngine::stream_ring.get_buffer());
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, target, offset, 0, bytes);
+	}
+	else
+		glBufferSubData(target, 0, bytes, data);
+}
+
+inline void GenObject::upload(const std::vector<float>& verts, const std::vector<unsigned int>& elements) {
+	const bool light = stride >= 5;
+	vertex_count = (GLsizei)(verts.size() / stride);
+	index_count = (GLsizei)elements.size();
+	GLsizeiptr bytes = vertex_count * (light ? sizeof(GenEngine::packed_vertex) : sizeof(GenEngine::packed_position));
+
+	// Reuse the buffers if they already exist, so appending vertices doesn't leak a VAO/VBO pair each time.
+	if (!VAO) {
+		glGenBuffers(1, &VBO);
+		glGenVertexArrays(1, &VAO);
+	}
+	GenEngine::gl_state.bind_vertex_array(VAO);
+	GenEngine::gl_state.bind_buffer(GL_ARRAY_BUFFER, VBO);
+
+	// Storage is only (re)allocated when the data doesn't fit, with some slack so vertices appended while editing don't reallocate every time.
+	if (bytes > vbo_capacity) {
+		vbo_capacity = bytes + bytes / 2;
+		glBufferData(GL_ARRAY_BUFFER, vbo_capacity, NULL, GL_DYNAMIC_DRAW);
+		GenEngine::set_packed_attribs(light);
+	}
+	else if (light != has_light)
+		GenEngine::set_packed_attribs(light);
+	has_light = light;
+	if (bytes) {
+		quantization = GenEngine::quantize_bounds(verts.data(), vertex_count, stride);
+
+		// Over the shared box, so vertices shared with other objects get the same values in all of them. Not if the vertices moved out of it.
+		if (has_shared_quantization && GenEngine::quantization_contains(shared_quantization, quantization))
+			quantization = shared_quantization;
+		if (light) {
+			std::vector<GenEngine::packed_vertex> packed(vertex_count);
+			GenEngine::pack_vertices(verts.data(), vertex_count, stride, quantization, packed.data());
+			stage_buffer_data(GL_ARRAY_BUFFER, packed.data(), bytes);
+		}
+		else {
+			std::vector<GenEngine::packed_position> packed(vertex_count);
+			GenEngine::pack_positions(verts.data(), vertex_count, stride, quantization, packed.data());
+			stage_buffer_data(GL_ARRAY_BUFFER, packed.data(), bytes);
+		}
+	}
+
+	// The element buffer is part of the VAO's state, so it's only made (and bound) for objects that have indices.
+	if (!index_count)
+		return;
+	bytes = elements.size() * sizeof(unsigned int);
+	if (!EBO)
+		glGenBuffers(1, &EBO);
+	GenEngine::gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	if (bytes > ebo_capacity) {
+		ebo_capacity = bytes + bytes / 2;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ebo_capacity, NULL, GL_DYNAMIC_DRAW);
+	}
+	stage_buffer_data(GL_ELEMENT_ARRAY_BUFFER, elements.data(), bytes);
 }
 
-inline void GenObject::draw(const Shader& shader, const mat4x4 view, const mat4x4 projection) {
+inline void GenObject::draw(const Shader& shader, const vec3 color) {
 	if (!VAO)
 		set_v_buffer();
 
 	shader.use();
-	shader.setMat4f("view", view);
-	shader.setMat4f("projection", projection);
-	shader.setVec3f("color", 0.8f, 0.8f, 0.8f);
-	glBindVertexArray(VAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
+	shader.setVec3f("color", color);
+	set_quantization(shader);
+	GenEngine::gl_state.enable(GL_DEPTH_TEST);
+	GenEngine::gl_state.bind_vertex_array(VAO);
+	if (!has_light)
+		GenEngine::set_unlit_attrib();
+	if (index_count)
+		glDrawElements(primitive, index_count, GL_UNSIGNED_INT, 0);
+	else
+		glDrawArrays(primitive, 0, vertex_count);
+}
+
+inline void GenObject::set_quantization(const Shader& shader) const {
+	shader.setVec3f("quant_offset", quantization.offset);
+	shader.setVec3f("quant_scale", quantization.scale);
+}
+
+inline void GenObject::draw_instanced(const GLsizei instances) const {
+	if (index_count)
+		glDrawElementsInstanced(primitive, index_count, GL_UNSIGNED_INT, 0, instances);
+	else
+		glDrawArraysInstanced(primitive, 0, vertex_count, instances);
 }
 
 class GenWall : public GenObject {
@@ -59,7 +182,10 @@ public:
 	inline void set_norms();
 };
 
+// Indexed walls (level_optimize.h) are left as they are: their vertices aren't a strip anymore.
 inline void GenWall::set_verts_p(const vec3 l, const vec3 r, const float h) {
+	if (!indices.empty())
+		return;
 
 	vbo_verts.push_back(l.x());
 	vbo_verts.push_back(l.y());
@@ -73,21 +199,25 @@ inline void GenWall::set_verts_p(const vec3 l, const vec3 r, const float h) {
 	vbo_verts.push_back(r.x());
 	vbo_verts.push_back(r.y() + h);
 	vbo_verts.push_back(r.z());
-	set_v_buffer();
+	mark_dirty();
 }
 
 inline void GenWall::append_left(const vec3 p) {
+	if (!indices.empty())
+		return;
 	vbo_verts.push_back(p.x());
 	vbo_verts.push_back(p.y());
 	vbo_verts.push_back(p.z());
-	set_v_buffer();
+	mark_dirty();
 }
 
 inline void GenWall::append_right(const vec3 p) {
+	if (!indices.empty())
+		return;
 	vbo_verts.push_back(p.x());
 	vbo_verts.push_back(p.y());
 	vbo_verts.push_back(p.z());
-	set_v_buffer();
+	mark_dirty();
 }
 
 
@@ -5,10 +5,12 @@
 #include "util/vec.h"
 #include "Shader.h"
 
+namespace GenEngine { class InstancedRenderer; }
+
 void setGradientColor(const vec3& top, const vec3& bot);
 void drawAxis(const Shader& shader);
-void drawFloorPlane(const Shader& shader, const mat4x4 view, const mat4x4 projection);
+void drawFloorPlane(const Shader& shader);
 
-void xMeasures(const Shader& shader);
+void xMeasures(GenEngine::InstancedRenderer& instancer, const int divisions);
 #endif // !EDITOR_H
 
@@ -0,0 +1,357 @@
+#pragma once
+#ifndef GEN_ENG_AO_BAKER_H
+#define GEN_ENG_AO_BAKER_H
+
+#include "level_editor/level_data.h"
+#include "level_editor/level_bvh.h"
+#include "util/job_system.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/*	Ambient occlusion baker.
+		Offline: computes the ambient occlusion of every vertex of the sections' streams (walls, floors and ceilings) by casting rays against the
+		level's BVH (level_bvh.h), and stores it in the 5th float of each vertex, where the runtime shaders can read it instead of computing it.
+
+		- Each vertex casts a fixed set of cosine distributed rays over the hemisphere of its face (oriented towards the inside of its section),
+		  rotated per vertex so the pattern doesn't show. The occlusion is the fraction of them that hit something closer than the radius.
+		- Rays go in packets of 4 from the same vertex, tested together against the BVH with SSE2 (BVH::occluded4()).
+		- The work is split in tiles of 64 vertices, spread over all cores by the job system.
+
+		Incremental and resumable:
+		- prepare() builds the BVH and gives every section a hash of what its occlusion depends on: its own geometry, that of every section within
+		  the radius, and the bake settings. Sections whose hash didn't change since the last prepare() keep their result; the rest are pending.
+		  Results are also kept by the baker, and prepare() writes them back into the streams: rebuilding a section's stream (build_vertices())
+		  resets its occlusion, even when nothing it depends on changed.
+		- bake() works through the pending sections, a batch at a time, and can be given a time budget; it returns once the budget is spent and
+		  carries on from there the next time it's called.
+		- save() writes the sections done so far, with their hash, to a bake file; load() takes back those whose hash still matches, so a bake
+		  that was interrupted (or a level edited since) only redoes what's missing.
+*/
+
+namespace GenEngine {
+
+	struct ao_bake_stats {
+		unsigned int		baked;			// Sections baked by the last bake() call.
+		unsigned int		pending;		// Sections still to bake.
+		unsigned int		loaded;			// Sections taken from the bake file by the last load().
+		unsigned long long	rays;			// Cast by the last bake() call.
+		double				ms;
+	};
+
+	class AOBaker {
+
+		static const unsigned int	tile_vertices = 64;
+		static const unsigned int	batch_vertices = 4096;		// Between time budget checks.
+		static const uint32_t		file_version = 1;
+
+		struct tile {
+			unsigned int	sect;
+			unsigned int	first, count;		// Vertices.
+		};
+
+		float						radius;
+		unsigned int				ray_count;			// Per vertex, a multiple of 4.
+		LevelBVH					level;
+		std::vector<uint64_t>		hashes;				// Per section.
+		std::vector<uint8_t>		done;
+		std::vector<std::vector<float>>	results;		// Per section done: the occlusion of each vertex.
+		std::vector<tile>			tiles;
+		ao_bake_stats				stats;
+
+		inline void		bake_tile(std::vector<section>& sections, const tile& t) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		AOBaker() : radius(1.f), ray_count(64), stats{ 0, 0, 0, 0, 0.0 } {}
+
+		// Settings (call prepare() after changing them)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_quality(const float r, const unsigned int rays)		{ radius = r; ray_count = std::max(4u, (rays + 3) / 4 * 4); }
+
+		// Baking
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		prepare(std::vector<section>& sections);		// After building the vertex streams, and after every edit.
+		inline bool		bake(std::vector<section>& sections, const double budget_ms = 0.0);		// 0: no budget. Returns 1 once all is baked.
+		inline bool		save(const char* path, const std::vector<section>& sections) const;
+		inline bool		load(const char* path, std::vector<section>& sections);
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool						is_done()		const	{ return std::find(done.begin(), done.end(), 0) == done.end(); }
+		inline const ao_bake_stats&		get_stats()		const	{ return stats; }
+	};
+
+
+	inline uint64_t fnv1a(const void* data, const size_t n, uint64_t h = 14695981039346656037ull) {
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < n; i++)
+			h = (h ^ p[i]) * 1099511628211ull;
+		return h;
+	}
+
+	inline void AOBaker::prepare(std::vector<section>& sections) {
+		const size_t n = sections.size();
+		level.update(sections);
+		std::vector<uint64_t> own(n);
+		std::vector<float> bounds(n * 6);
+		for (size_t s = 0; s < n; s++) {
+			const std::vector<float>& v = sections[s].get_vertices();
+			uint64_t h = fnv1a(&radius, sizeof(radius));
+			h = fnv1a(&ray_count, sizeof(ray_count), h);
+			float* b = &bounds[s * 6];
+			b[0] = b[1] = b[2] = 1e30f;
+			b[3] = b[4] = b[5] = -1e30f;
+			for (size_t i = 0; i + section::vertex_size <= v.size(); i += section::vertex_size) {
+				h = fnv1a(&v[i], 3 * sizeof(float), h);
+				for (int a = 0; a < 3; a++) {
+					b[a] = std::min(b[a], v[i + a]);
+					b[3 + a] = std::max(b[3 + a], v[i + a]);
+				}
+			}
+			own[s] = h;
+		}
+
+		// A section's occlusion depends on everything within the radius of it.
+		std::vector<unsigned int> near_sections;
+		std::vector<uint64_t> previous;
+		previous.swap(hashes);
+		hashes.resize(n);
+		done.resize(n, 0);
+		for (size_t s = 0; s < n; s++) {
+			const float* b = &bounds[s * 6];
+			const float lo[3] = { b[0] - radius, b[1] - radius, b[2] - radius }, hi[3] = { b[3] + radius, b[4] + radius, b[5] + radius };
+			near_sections.clear();
+			level.sections_near(lo, hi, near_sections);
+
+			uint64_t h = own[s];
+			for (unsigned int o : near_sections)
+				if (o != s)
+					h = fnv1a(&own[o], sizeof(uint64_t), h);
+			hashes[s] = h;
+			if (s >= previous.size() || previous[s] != h)
+				done[s] = 0;
+		}
+
+		// What's still valid goes back into the streams, which may have been rebuilt since.
+		results.resize(n);
+		for (size_t s = 0; s < n; s++) {
+			std::vector<float>& v = sections[s].get_vertices();
+			if (!done[s] || results[s].size() * section::vertex_size != v.size()) {
+				done[s] = 0;
+				continue;
+			}
+			for (size_t i = 0; i < results[s].size(); i++)
+				v[i * section::vertex_size + 4] = results[s][i];
+		}
+		stats.pending = (unsigned int)std::count(done.begin(), done.end(), 0);
+	}
+
+	inline void AOBaker::bake_tile(std::vector<section>& sections, const tile& t) const {
+		std::vector<float>& v = sections[t.sect].get_vertices();
+		const int vs = section::vertex_size;
+
+		// Faces are turned towards the inside of the section.
+		float center[3] = { 0.f, 0.f, 0.f };
+		const size_t vertex_count = v.size() / vs;
+		for (size_t i = 0; i < vertex_count; i++)
+			for (int a = 0; a < 3; a++)
+				center[a] += v[i * vs + a] / vertex_count;
+
+		for (unsigned int k = t.first; k < t.first + t.count; k++) {
+			const float* tri = &v[(k / 3) * 3 * vs];
+			const float* p = &v[k * vs];
+			const float e1[3] = { tri[vs] - tri[0], tri[vs + 1] - tri[1], tri[vs + 2] - tri[2] };
+			const float e2[3] = { tri[2 * vs] - tri[0], tri[2 * vs + 1] - tri[1], tri[2 * vs + 2] - tri[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (len < 1e-12f) {
+				v[k * vs + 4] = 1.f;
+				continue;
+			}
+			float centroid[3], inward = 0.f;
+			for (int a = 0; a < 3; a++) {
+				n[a] /= len;
+				centroid[a] = (tri[a] + tri[vs + a] + tri[2 * vs + a]) / 3.f;
+				inward += n[a] * (center[a] - centroid[a]);
+			}
+			if (inward < 0.f)
+				for (int a = 0; a < 3; a++)
+					n[a] = -n[a];
+
+			// Tangent frame, and an origin nudged off the surface and into the triangle, away from the edges it shares with other faces.
+			float tx[3], ty[3];
+			if (fabsf(n[0]) > 0.9f) { tx[0] = n[1]; tx[1] = -n[0]; tx[2] = 0.f; }
+			else					{ tx[0] = 0.f; tx[1] = n[2]; tx[2] = -n[1]; }
+			len = sqrtf(tx[0] * tx[0] + tx[1] * tx[1] + tx[2] * tx[2]);
+			for (int a = 0; a < 3; a++)
+				tx[a] /= len;
+			ty[0] = n[1] * tx[2] - n[2] * tx[1];
+			ty[1] = n[2] * tx[0] - n[0] * tx[2];
+			ty[2] = n[0] * tx[1] - n[1] * tx[0];
+			float o[3];
+			for (int a = 0; a < 3; a++)
+				o[a] = p[a] + (centroid[a] - p[a]) * 0.01f + n[a] * 1e-3f * radius;
+
+			// Hammersley points, shifted by a hash of the vertex.
+			const uint32_t seed = (uint32_t)fnv1a(&k, sizeof(k), t.sect);
+			const float shift_u = (seed & 0xffff) / 65536.f, shift_v = (seed >> 16) / 65536.f;
+			bvh_ray4 r;
+			r.ox = _mm_set1_ps(o[0]);
+			r.oy = _mm_set1_ps(o[1]);
+			r.oz = _mm_set1_ps(o[2]);
+			r.tmax = _mm_set1_ps(radius);
+			unsigned int hits = 0;
+			for (unsigned int s = 0; s < ray_count; s += 4) {
+				float d[3][4];
+				for (int j = 0; j < 4; j++) {
+					uint32_t bits = s + j;
+					bits = (bits << 16) | (bits >> 16);
+					bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+					bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+					bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+					bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+					float u = (s + j + 0.5f) / ray_count + shift_u, w = bits * 2.3283064e-10f + shift_v;
+					u -= floorf(u);
+					w -= floorf(w);
+					const float rad = sqrtf(u), phi = 6.2831853f * w, up = sqrtf(1.f - u);
+					const float lx = rad * cosf(phi), ly = rad * sinf(phi);
+					for (int a = 0; a < 3; a++)
+						d[a][j] = tx[a] * lx + ty[a] * ly + n[a] * up;
+				}
+				r.dx = _mm_loadu_ps(d[0]);
+				r.dy = _mm_loadu_ps(d[1]);
+				r.dz = _mm_loadu_ps(d[2]);
+				const int mask = level.get_bvh().occluded4(r);
+				hits += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+			}
+			v[k * vs + 4] = 1.f - (float)hits / ray_count;
+		}
+	}
+
+	inline bool AOBaker::bake(std::vector<section>& sections, const double budget_ms) {
+		auto start = std::chrono::steady_clock::now();
+		stats.baked = 0;
+		stats.rays = 0;
+
+		size_t next = 0;
+		while (true) {
+			// Next batch: whole sections, so a section is either done or untouched when the budget runs out.
+			tiles.clear();
+			std::vector<unsigned int> batch;
+			unsigned int vertices = 0;
+			for (; next < sections.size() && vertices < batch_vertices; next++) {
+				if (done[next])
+					continue;
+				const unsigned int count = (unsigned int)(sections[next].get_vertices().size() / section::vertex_size);
+				for (unsigned int first = 0; first < count; first += tile_vertices)
+					tiles.push_back({ (unsigned int)next, first, count - first < tile_vertices ? count - first : tile_vertices });
+				batch.push_back((unsigned int)next);
+				vertices += count;
+			}
+			if (batch.empty())
+				break;
+
+			job_system.parallel_for((unsigned int)tiles.size(), [&](unsigned int i, unsigned int) { bake_tile(sections, tiles[i]); });
+			for (unsigned int s : batch) {
+				const std::vector<float>& v = sections[s].get_vertices();
+				results[s].resize(v.size() / section::vertex_size);
+				for (size_t i = 0; i < results[s].size(); i++)
+					results[s][i] = v[i * section::vertex_size + 4];
+				done[s] = 1;
+			}
+			stats.baked += (unsigned int)batch.size();
+			stats.rays += (unsigned long long)vertices * ray_count;
+
+			if (budget_ms > 0.0 && std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budget_ms)
+				break;
+		}
+		stats.pending = (unsigned int)std::count(done.begin(), done.end(), 0);
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return !stats.pending;
+	}
+
+	// Bake file: "GEAO", version, then for every section done: ID, hash, vertex count and the occlusion of each vertex.
+	inline bool AOBaker::save(const char* path, const std::vector<section>& sections) const {
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			std::cout << "AOBaker: \"" << path << "\" could not be written.\n";
+			return false;
+		}
+		const uint32_t version = file_version, count = (uint32_t)std::count(done.begin(), done.end(), 1);
+		out.write("GEAO", 4);
+		out.write((const char*)&version, sizeof(version));
+		out.write((const char*)&count, sizeof(count));
+		for (size_t s = 0; s < sections.size() && s < done.size(); s++) {
+			if (!done[s])
+				continue;
+			const uint32_t id = (uint32_t)s, vertices = (uint32_t)results[s].size();
+			out.write((const char*)&id, sizeof(id));
+			out.write((const char*)&hashes[s], sizeof(uint64_t));
+			out.write((const char*)&vertices, sizeof(vertices));
+			out.write((const char*)results[s].data(), results[s].size() * sizeof(float));
+		}
+		return (bool)out;
+	}
+
+	inline bool AOBaker::load(const char* path, std::vector<section>& sections) {
+		stats.loaded = 0;
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return false;
+		char magic[4];
+		uint32_t version = 0, count = 0;
+		in.read(magic, 4);
+		in.read((char*)&version, sizeof(version));
+		in.read((char*)&count, sizeof(count));
+		if (!in || memcmp(magic, "GEAO", 4) || version != file_version) {
+			std::cout << "AOBaker: \"" << path << "\" is not a bake file of this version.\n";
+			return false;
+		}
+
+		std::vector<float> ao;
+		for (uint32_t e = 0; e < count; e++) {
+			uint32_t id, vertices;
+			uint64_t hash;
+			in.read((char*)&id, sizeof(id));
+			in.read((char*)&hash, sizeof(hash));
+			in.read((char*)&vertices, sizeof(vertices));
+
+			// Only if nothing it depends on changed since it was baked. The vertex count comes from the file, so it's checked against the
+			// section before anything is allocated for it; entries that don't apply are skipped over.
+			if (!in || id >= sections.size() || id >= hashes.size() || hashes[id] != hash ||
+				sections[id].get_vertices().size() != (size_t)vertices * section::vertex_size) {
+				in.seekg((std::streamoff)vertices * sizeof(float), std::ios::cur);
+				if (!in) {
+					std::cout << "AOBaker: \"" << path << "\" is truncated.\n";
+					break;
+				}
+				continue;
+			}
+			ao.resize(vertices);
+			in.read((char*)ao.data(), ao.size() * sizeof(float));
+			if (!in) {
+				std::cout << "AOBaker: \"" << path << "\" is truncated.\n";
+				break;
+			}
+			std::vector<float>& v = sections[id].get_vertices();
+			for (uint32_t i = 0; i < vertices; i++)
+				v[i * section::vertex_size + 4] = ao[i];
+			results[id].swap(ao);
+			done[id] = 1;
+			stats.loaded++;
+		}
+		stats.pending = (unsigned int)std::count(done.begin(), done.end(), 0);
+		return true;
+	}
+}
+
+#endif // !GEN_ENG_AO_BAKER_H
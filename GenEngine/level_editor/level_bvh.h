@@ -0,0 +1,113 @@
+#pragma once
+#ifndef GEN_ENG_LEVEL_BVH_H
+#define GEN_ENG_LEVEL_BVH_H
+
+#include "level_editor/level_data.h"
+#include "util/bvh.h"
+
+#include <vector>
+#include <algorithm>
+
+/*	Ray queries against the level.
+		A BVH (util/bvh.h) over the triangles of every section's vertex stream (walls, floors and ceilings), answering in terms of sections:
+		what section and which of its triangles a ray hits first, whether anything is in the way, and what sections are near a box. Used for
+		picking in the editor, occlusion baking and line of sight.
+
+		After the level is edited, update() refits the tree if every section still has the same number of triangles (vertices were only moved),
+		and rebuilds it otherwise. Refitting is several times cheaper, but the tree degrades as things move; rebuild() after large edits.
+
+		Sections must be indexed by their ID, and have their vertex stream built (section::build_vertices()).
+*/
+
+namespace GenEngine {
+
+	// First hit of a ray.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct level_hit {
+		unsigned int	sect;
+		unsigned int	triangle;		// Within the section's vertex stream: its vertices are 3 * triangle to 3 * triangle + 2.
+		float			t;				// Distance, in units of the ray's direction.
+	};
+
+	class LevelBVH {
+
+		BVH							bvh;
+		std::vector<float>			positions;
+		std::vector<unsigned int>	tri_section;		// Section of each triangle.
+		std::vector<unsigned int>	first_tri;			// First triangle of each section, and the total at the end.
+
+		inline bool		gather(const std::vector<section>& sections);		// Returns 0 if any section's triangle count changed.
+
+	public:
+
+		// Construction
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		rebuild(const std::vector<section>& sections)	{ gather(sections); bvh.build(positions.data(), tri_section.size()); }
+		inline bool		update(const std::vector<section>& sections);		// Returns 1 if it could refit the tree instead of rebuilding it.
+
+		// Queries (any thread)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		intersect(const float origin[3], const float dir[3], level_hit& hit, const float tmax = 1e30f) const;
+		inline bool		occluded(const float origin[3], const float dir[3], const float tmax) const	{ return bvh.occluded(origin, dir, tmax); }
+		inline void		sections_near(const float min[3], const float max[3], std::vector<unsigned int>& out) const;	// Sorted, no repeats.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const BVH&		get_bvh()						const	{ return bvh; }		// For packets; triangles by level index.
+		inline unsigned int		get_section(const unsigned int tri)		const	{ return tri_section[tri]; }
+		inline unsigned int		get_triangle(const unsigned int tri)	const	{ return tri - first_tri[tri_section[tri]]; }
+	};
+
+
+	inline bool LevelBVH::gather(const std::vector<section>& sections) {
+		bool same = first_tri.size() == sections.size() + 1;
+		positions.clear();
+		tri_section.clear();
+		first_tri.resize(sections.size() + 1);
+		for (size_t s = 0; s < sections.size(); s++) {
+			const unsigned int first = (unsigned int)tri_section.size();
+			same = same && first_tri[s] == first;
+			first_tri[s] = first;
+			const std::vector<float>& v = sections[s].get_vertices();
+			const size_t triangles = v.size() / (3 * section::vertex_size);
+			for (size_t i = 0; i < triangles * 3; i++)
+				positions.insert(positions.end(), &v[i * section::vertex_size], &v[i * section::vertex_size] + 3);
+			tri_section.resize(first + triangles, (unsigned int)s);
+		}
+		same = same && first_tri.back() == tri_section.size();
+		first_tri.back() = (unsigned int)tri_section.size();
+		return same;
+	}
+
+	inline bool LevelBVH::update(const std::vector<section>& sections) {
+		if (gather(sections) && bvh.get_triangle_count() == tri_section.size()) {
+			bvh.refit(positions.data());
+			return true;
+		}
+		bvh.build(positions.data(), tri_section.size());
+		return false;
+	}
+
+	inline bool LevelBVH::intersect(const float origin[3], const float dir[3], level_hit& hit, const float tmax) const {
+		float t = tmax;
+		unsigned int prim;
+		if (!bvh.intersect(origin, dir, t, prim))
+			return false;
+		hit.sect = tri_section[prim];
+		hit.triangle = prim - first_tri[hit.sect];
+		hit.t = t;
+		return true;
+	}
+
+	inline void LevelBVH::sections_near(const float min[3], const float max[3], std::vector<unsigned int>& out) const {
+		const size_t start = out.size();
+		std::vector<unsigned int> tris;
+		bvh.overlap(min, max, tris);
+		for (unsigned int t : tris)
+			out.push_back(tri_section[t]);
+		std::sort(out.begin() + start, out.end());
+		out.erase(std::unique(out.begin() + start, out.end()), out.end());
+	}
+}
+
+#endif // !GEN_ENG_LEVEL_BVH_H
@@ -3,6 +3,9 @@
 #define GEN_ENG_LEVEL_DATA_H
 
 #include "../util/vec.h"
+#include "level_editor/3dobj.h"
+
+#include <vector>
 
 namespace GenEngine {
 
@@ -10,7 +13,7 @@ namespace GenEngine {
 	//-------------------------------------------------------------------------------------------------------------------------------------------
 	struct wall_vert {
 		vec2 coords;	// x,z coords
-		int neighbor;	// Stores the ID of the 
+		int neighbor;	// Stores the ID of the section on the other side of the wall starting here (a portal), or -1 for a solid wall.
 		wall_vert* next;
 	};
 
@@ -18,9 +21,9 @@ namespace GenEngine {
 	//-------------------------------------------------------------------------------------------------------------------------------------------
 	class section {
 
-		unsigned int ID_sect;
+		unsigned int ID_sect;		// Index of the section in the level's list; neighbors are referred to by it.
 		float height;				// height of the walls in the sector.
-		float y_level;				// y-coordinate of the section, or "how high is the platform". 
+		float y_level;				// y-coordinate of the section, or "how high is the platform".
 		unsigned char mask;			/* Bitmask used for certain flags.
 										- mask & 1 (first bit):		hide ceiling if on
 									    - mask & 2 (second bit):	hide floor if on
@@ -28,27 +31,102 @@ namespace GenEngine {
 
 		wall_vert *verts;			// list of the vertices that conform the section's walls and the neighboring sections "portals".
 
+		float light_level;			// Light the section gives off by itself, 0 (dark) to 1.
+		float light;				// Light level after propagation (sector_light.h): its own, or what reaches it through portals if brighter.
+		std::vector<float> vertices;	// Level vertex stream: triangles of x, y, z, baked light and ambient occlusion (ao_baker.h).
+		GenObject mesh;					// What's drawn: the stream as of the last gen_vao().
+
 	public:
-		
+
+		static const int vertex_size = 5;	// Floats per vertex.
+
 		// Constructor and destructor
 		//-------------------------------------------------------------------------------------------------------------------------------------------
-		section() {};
-		~section() {};
+		section() : ID_sect(0), height(0.f), y_level(0.f), mask(0), verts(NULL), light_level(0.f), light(0.f) {};
+		section(const unsigned int id, const float y, const float h, wall_vert* first, const unsigned char m = 0) : ID_sect(id), height(h), y_level(y),
+			mask(m), verts(first), light_level(0.f), light(0.f) {};
+		~section() {};		// The vertex list belongs to whoever loaded the level.
 
 		// Section data retrieval functions
 		//-------------------------------------------------------------------------------------------------------------------------------------------
 		wall_vert*			get_verts()		{ return verts; }		// Returns first vertex pointer
-		inline const float	get_y_level()	{ return y_level; }		// Returns y-coordinate of the section
-		inline const float	get_height()	{ return height; }		// Returns height of the section's walls
+		const wall_vert*	get_verts()		const	{ return verts; }
+		inline unsigned int	get_id()		const	{ return ID_sect; }
+		inline float		get_y_level()	const	{ return y_level; }		// Returns y-coordinate of the section
+		inline float		get_height()	const	{ return height; }		// Returns height of the section's walls
+		inline unsigned char	get_mask()	const	{ return mask; }
+		inline float		get_light_level()	const	{ return light_level; }
+		inline float		get_light()			const	{ return light; }
+		inline const std::vector<float>&	get_vertices()	const	{ return vertices; }
+		inline GenObject&					get_mesh()				{ return mesh; }
 
 		// Data manipulation functions
 		//-------------------------------------------------------------------------------------------------------------------------------------------
-		void				gen_vao()						{}		// Creates a vertex array object for this section.
-		void				store_data(const char *file)	{}		// Stores the data from this specific section on the map data file indicated by the user.
+		inline void			gen_vao();								// Hands the vertex stream to the mesh; its VAO is made on the next upload.
+		void				store_data(const char *);				// Stores the data from this specific section on the map data file indicated by the user.
+		inline void			build_vertices();						// Walls, floor and ceiling, with no light baked yet.
+		inline void			set_verts(wall_vert* first)		{ verts = first; }		// The list stays with the caller; rebuild the vertices after.
+
+		// Lighting. Change the light level through SectorLighting, which also rebakes whatever it affects.
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void					set_light_level(const float l)	{ light_level = l; }
+		inline void					set_light(const float l)		{ light = l; }
+		inline std::vector<float>&	get_vertices()					{ return vertices; }
 	};
 
-	void section::store_data(const char *file) {
-		 
+	inline void section::store_data(const char *) {
+
+	}
+
+	// Light and occlusion go to the GPU with the positions (vertex_format.h packs them in 8 bytes a vertex), so a baked level is drawn lit for
+	// no more than the cost of an unlit one. Call it again after every rebake: the mesh keeps its own copy.
+	inline void section::gen_vao() {
+		mesh.vbo_verts = vertices;
+		mesh.indices.clear();
+		mesh.stride = vertex_size;
+		mesh.primitive = GL_TRIANGLES;
+		mesh.mark_dirty();
+	}
+
+	// Solid walls become quads from the floor to the ceiling; portals are left open. Floor and ceiling are fans, so the section is expected to be
+	// convex. The light of every vertex starts at the section's own level, with no occlusion.
+	inline void section::build_vertices() {
+		vertices.clear();
+		if (!verts)
+			return;
+
+		std::vector<vec2> ring;
+		const wall_vert* v = verts;
+		do {
+			ring.push_back(v->coords);
+			v = v->next;
+		} while (v && v != verts);
+
+		auto push = [this](const vec2& p, const float y) {
+			vertices.push_back(p.x());
+			vertices.push_back(y);
+			vertices.push_back(p.y());
+			vertices.push_back(light_level);
+			vertices.push_back(1.f);
+		};
+		const float top = y_level + height;
+		v = verts;
+		for (size_t i = 0; i < ring.size(); i++, v = v->next) {
+			if (v->neighbor >= 0)
+				continue;
+			const vec2& a = ring[i];
+			const vec2& b = ring[(i + 1) % ring.size()];
+			push(a, y_level);	push(b, y_level);	push(b, top);
+			push(a, y_level);	push(b, top);		push(a, top);
+		}
+		for (size_t i = 1; i + 1 < ring.size(); i++) {
+			if (!(mask & 2)) {
+				push(ring[0], y_level);	push(ring[i + 1], y_level);	push(ring[i], y_level);
+			}
+			if (!(mask & 1)) {
+				push(ring[0], top);		push(ring[i], top);			push(ring[i + 1], top);
+			}
+		}
 	}
 }
 
@@ -0,0 +1,445 @@
+#pragma once
+#ifndef GEN_ENG_LEVEL_OPTIMIZE_H
+#define GEN_ENG_LEVEL_OPTIMIZE_H
+
+#include "level_editor/3dobj.h"
+#include "level_editor/level_data.h"
+#include "level_editor/snap_index.h"
+#include "util/mesh_optimize.h"
+#include "util/options.h"
+#include "util/vec.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <math.h>
+
+/*	Level optimization.
+		A pass over the level to clean up what editing leaves behind: corners a hair apart, walls of no length, and long walls drawn as a row
+		of short ones. Meant to run before saving a level, or when loading one (--optimize, which runs it over the scene's walls).
+
+		- Welding: every corner within the weld distance of one already seen (in x,z through a SnapIndex, and in height) is moved onto it,
+		  so walls that should meet do so exactly and the rest of the pass can compare corners for equality.
+		- Walls whose ends are welded together, or with no height, are removed.
+		- Merging: a wall is joined to the one that starts where it ends, if both go the same way (the corner between them is within the
+		  straightness tolerance of the merged wall) and look the same (same height; GenWalls have no material, so same width too).
+		  Section walls are only merged if they also lead to the same neighbor, so portals stay where they are; a section left with less
+		  than 3 corners loses its walls, and the portals into it become solid.
+
+		index_walls() then groups the walls that aren't indexed into batches, one per cell of a grid in x,z (8 units by default, so each batch
+		keeps a small box), and builds for each batch a single indexed triangle list of its walls, welded and ordered for the vertex cache
+		(util/mesh_optimize.h). Walls meeting at a corner share its vertices once welded, which a wall on its own can't: a lone quad costs 2
+		vertices per triangle however it's indexed. The walls stay as they are, the data that's picked, culled and edited; a batch is only what
+		draws them, one draw for the whole cell, and is rebuilt (build_batch()) when one of its walls changes. Indexed walls can't be edited:
+		set_verts_p() and append_left/right() leave them as they are.
+
+		GenWalls are one draw each, so every wall merged or removed is a draw saved. Only plain walls (the 4 vertex strip GenWall makes) are
+		merged; walls with vertices appended are welded and left alone. The pass changes the vector of walls, so it must run before the render
+		thread starts and before any GL buffer is made. Sections keep their wall lists, relinked in place; the ones changed get their vertex
+		stream rebuilt (with no light baked) and are listed by get_changed().
+
+		The report gives the walls, vertices and triangles before and after the pass, the batches index_walls() made, and their average cache
+		miss ratio (ACMR) as the walls were drawn before, welded, and optimized.
+*/
+
+namespace GenEngine {
+
+	// Counters of the last pass. Before and after, in that order.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct level_optimize_stats {
+		unsigned int	walls[2];		// GenWalls are also the draws.
+		unsigned int	vertices[2];
+		unsigned int	triangles[2];
+		unsigned int	welded;			// Corners moved onto another one.
+		unsigned int	merged;			// Walls joined to the one before them.
+		unsigned int	removed;		// Walls with no length or height.
+		double			ms;
+	};
+
+	// Counters of the last index_walls(), and of the batches rebuilt since.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct wall_index_stats {
+		unsigned int	walls;			// Walls grouped into batches.
+		unsigned int	batches;		// Indexed meshes drawing them, one draw each.
+		unsigned int	drawn;			// Vertices those walls draw on their own: every vertex of their strips (glDrawArrays has no cache).
+	};
+
+	// Walls drawn together, by index_walls().
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct wall_batch {
+		std::vector<unsigned int>	walls;		// In the vector of walls.
+		GenObject					mesh;		// Their triangles, welded and indexed.
+	};
+
+	struct wall_batch_set {
+		std::vector<wall_batch>		batches;
+		std::vector<unsigned int>	batch_of;	// Per wall, its batch; ~0u for walls drawn on their own (and walls added since).
+	};
+
+	class LevelOptimizer {
+
+		float						weld_distance;
+		float						straightness;			// Farthest a corner merged away can be from the wall that replaces it.
+		float						batch_size;				// Side of the grid cells index_walls() batches the walls by.
+		SnapIndex					index;
+		MeshOptimizer				mesh;
+		std::vector<vec3>			corners;				// Welded positions, by ID in the index.
+		std::vector<unsigned int>	found;
+		std::vector<unsigned int>	changed;
+		level_optimize_stats		stats;
+		wall_index_stats			index_stats;
+		bool						enabled;
+
+		inline void		begin();
+		inline unsigned int	weld(vec3& p);		// Moves p onto its corner and returns the corner's ID.
+		inline bool		in_line(const vec2& a, const vec2& b, const vec2& c)	const;		// b can go, leaving a to c.
+		static inline void	count(const GenWall& w, unsigned int& vertices, unsigned int& triangles);
+		static inline void	append_triangles(const GenWall& w, std::vector<float>& out);		// As a triangle list, not indexed.
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		LevelOptimizer(const float weld = 1.f / 256.f, const float straight = 1.f / 256.f) : weld_distance(weld), straightness(straight), batch_size(8.f),
+			index(1.f), stats{ { 0, 0 }, { 0, 0 }, { 0, 0 }, 0, 0, 0, 0.0 }, index_stats{ 0, 0, 0 }, enabled(false) {}
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_tolerance(const float weld, const float straight)	{ weld_distance = weld; straightness = straight; }
+		inline void		set_batch_size(const float size)						{ batch_size = std::max(size, 1e-3f); }
+		inline bool		configure(const CommandLine& cmd)						{ enabled = cmd.has("--optimize"); return true; }
+
+		// Passes
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		optimize_walls(std::vector<GenWall>& walls);
+		inline void		optimize_sections(std::vector<section>& sections);		// Indexed by their ID.
+		inline void		index_walls(const std::vector<GenWall>& walls, wall_batch_set& set);
+		inline void		build_batch(const std::vector<GenWall>& walls, wall_batch& batch);		// After any of its walls changed.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const std::vector<unsigned int>&	get_changed()		const	{ return changed; }		// Sections, after optimize_sections().
+		inline const level_optimize_stats&		get_stats()			const	{ return stats; }
+		inline const wall_index_stats&			get_index_stats()	const	{ return index_stats; }
+		inline const MeshOptimizer&				get_mesh()			const	{ return mesh; }		// Welding of index_walls().
+		inline double							get_acmr(const int i)	const;							// Of index_walls()'s batches: 0 as drawn before, 1 welded, 2 optimized.
+		inline bool								is_enabled()		const	{ return enabled; }		// Asked for on the command line.
+		inline void								report(report_counters& counters) const;
+	};
+
+	LevelOptimizer level_optimizer;		// Run by the main thread on the walls before the render thread starts.
+
+
+	inline void LevelOptimizer::begin() {
+		index = SnapIndex(std::max(weld_distance * 4.f, 1e-3f));
+		corners.clear();
+		changed.clear();
+		stats = { { 0, 0 }, { 0, 0 }, { 0, 0 }, 0, 0, 0, 0.0 };
+	}
+
+	// The first corner seen within the weld distance, at the same height give or take the same; a new one at p if there's none.
+	inline unsigned int LevelOptimizer::weld(vec3& p) {
+		found.clear();
+		index.radius(vec2(p.x(), p.z()), weld_distance, found);
+		unsigned int best = SnapIndex::none;
+		for (const unsigned int id : found)
+			if (fabsf(corners[id].y() - p.y()) <= weld_distance && (best == SnapIndex::none || id < best))
+				best = id;
+		if (best == SnapIndex::none) {
+			index.insert((unsigned int)corners.size(), vec2(p.x(), p.z()));
+			corners.push_back(p);
+			return (unsigned int)corners.size() - 1;
+		}
+		if (corners[best] != p) {
+			p = corners[best];
+			stats.welded++;
+		}
+		return best;
+	}
+
+	inline bool LevelOptimizer::in_line(const vec2& a, const vec2& b, const vec2& c) const {
+		const vec2 ac = c - a, ab = b - a;
+		const float len2 = ac.squared_length();
+		if (len2 <= 0.f)
+			return false;
+		const float along = ab.x() * ac.x() + ab.y() * ac.y();
+		const float off = ab.x() * ac.y() - ab.y() * ac.x();
+		return along > 0.f && along < len2 && off * off <= straightness * straightness * len2;
+	}
+
+	inline void LevelOptimizer::count(const GenWall& w, unsigned int& vertices, unsigned int& triangles) {
+		const unsigned int n = (unsigned int)(w.vbo_verts.size() / 3);
+		vertices += n;
+		if (!w.indices.empty())
+			triangles += (unsigned int)(w.indices.size() / 3);
+		else
+			triangles += w.primitive == GL_TRIANGLES ? n / 3 : (n > 2 ? n - 2 : 0);
+	}
+
+	inline void LevelOptimizer::optimize_walls(std::vector<GenWall>& walls) {
+		auto start = std::chrono::steady_clock::now();
+		begin();
+		for (const GenWall& w : walls)
+			count(w, stats.vertices[0], stats.triangles[0]);
+		stats.walls[0] = (unsigned int)walls.size();
+
+		// Plain walls are rebuilt from their ends, the rest have every vertex welded.
+		std::vector<uint8_t> plain(walls.size()), gone(walls.size(), 0);
+		std::vector<unsigned int> l_corner(walls.size()), r_corner(walls.size());
+		for (size_t i = 0; i < walls.size(); i++) {
+			GenWall& w = walls[i];
+			plain[i] = w.primitive == GL_TRIANGLE_STRIP && w.vbo_verts.size() == 12;
+			if (plain[i]) {
+				l_corner[i] = weld(w.l_point);
+				r_corner[i] = weld(w.r_point);
+				if (l_corner[i] == r_corner[i] || fabsf(w.h_size) <= weld_distance) {
+					gone[i] = 1;
+					stats.removed++;
+				}
+				continue;
+			}
+			for (size_t v = 0; v + 2 < w.vbo_verts.size(); v += 3) {
+				vec3 p(w.vbo_verts[v], w.vbo_verts[v + 1], w.vbo_verts[v + 2]);
+				weld(p);
+				for (int k = 0; k < 3; k++)
+					w.vbo_verts[v + k] = p.e[k];
+			}
+		}
+
+		// Plain walls by the corner they start at; each takes in the walls that carry on from its end for as long as there's one.
+		std::vector<std::pair<unsigned int, unsigned int> > starts;		// (corner, wall)
+		for (unsigned int i = 0; i < walls.size(); i++)
+			if (plain[i] && !gone[i])
+				starts.push_back({ l_corner[i], i });
+		std::sort(starts.begin(), starts.end());
+
+		for (unsigned int i = 0; i < walls.size(); i++) {
+			if (!plain[i] || gone[i])
+				continue;
+			GenWall& w = walls[i];
+			bool grown = true;
+			while (grown) {
+				grown = false;
+				auto it = std::lower_bound(starts.begin(), starts.end(), std::make_pair(r_corner[i], 0u));
+				for (; it != starts.end() && it->first == r_corner[i]; ++it) {
+					const unsigned int j = it->second;
+					const GenWall& n = walls[j];
+					if (j == i || gone[j] || n.h_size != w.h_size || n.w_size != w.w_size || n.l_point.y() != n.r_point.y() ||
+						w.l_point.y() != w.r_point.y() || w.l_point.y() != n.r_point.y() ||
+						!in_line(vec2(w.l_point.x(), w.l_point.z()), vec2(w.r_point.x(), w.r_point.z()), vec2(n.r_point.x(), n.r_point.z())))
+						continue;
+					w.r_point = n.r_point;
+					r_corner[i] = r_corner[j];
+					gone[j] = 1;
+					stats.merged++;
+					grown = true;
+					break;
+				}
+			}
+			w.vbo_verts.clear();
+			w.set_verts_p(w.l_point, w.r_point, w.h_size);
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < walls.size(); i++)
+			if (!gone[i]) {
+				if (kept != i)
+					walls[kept] = std::move(walls[i]);
+				kept++;
+			}
+		walls.resize(kept);
+		for (const GenWall& w : walls)
+			count(w, stats.vertices[1], stats.triangles[1]);
+		stats.walls[1] = (unsigned int)walls.size();
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void LevelOptimizer::append_triangles(const GenWall& w, std::vector<float>& out) {
+		const float* v = w.vbo_verts.data();
+		const size_t n = w.vbo_verts.size() / 3;
+		auto corner = [&out, v](const size_t i) { out.insert(out.end(), v + i * 3, v + i * 3 + 3); };
+		for (size_t i = 0; i + 2 < n; i += w.primitive == GL_TRIANGLES ? 3 : 1) {
+			if (w.primitive == GL_TRIANGLE_FAN) {
+				corner(0);
+				corner(i + 1);
+				corner(i + 2);
+			}
+			else if (w.primitive == GL_TRIANGLE_STRIP && (i & 1)) {		// Odd triangles of a strip face the other way round.
+				corner(i + 1);
+				corner(i);
+				corner(i + 2);
+			}
+			else if (w.primitive == GL_TRIANGLES || w.primitive == GL_TRIANGLE_STRIP) {
+				corner(i);
+				corner(i + 1);
+				corner(i + 2);
+			}
+		}
+	}
+
+	inline void LevelOptimizer::index_walls(const std::vector<GenWall>& walls, wall_batch_set& set) {
+		mesh.reset_stats();
+		index_stats = { 0, 0, 0 };
+
+		// Walls not indexed by the grid cell of their center.
+		std::unordered_map<uint64_t, unsigned int> cells;
+		set.batches.clear();
+		set.batch_of.assign(walls.size(), ~0u);
+		for (unsigned int i = 0; i < walls.size(); i++) {
+			vec3 lo, hi;
+			if (!walls[i].indices.empty() || !walls[i].get_bounds(lo, hi))
+				continue;
+			const int64_t x = (int64_t)floorf((lo.x() + hi.x()) * 0.5f / batch_size), z = (int64_t)floorf((lo.z() + hi.z()) * 0.5f / batch_size);
+			auto cell = cells.insert(std::make_pair(((uint64_t)x << 32) ^ (uint32_t)z, (unsigned int)set.batches.size()));
+			if (cell.second)
+				set.batches.push_back(wall_batch());
+			set.batches[cell.first->second].walls.push_back(i);
+			set.batch_of[i] = cell.first->second;
+		}
+
+		for (wall_batch& b : set.batches) {
+			build_batch(walls, b);
+			index_stats.walls += (unsigned int)b.walls.size();
+		}
+		index_stats.batches = (unsigned int)set.batches.size();
+	}
+
+	inline void LevelOptimizer::build_batch(const std::vector<GenWall>& walls, wall_batch& batch) {
+		unsigned int triangles = 0;
+		std::vector<float>& verts = batch.mesh.vbo_verts;
+		verts.clear();
+		for (const unsigned int i : batch.walls) {
+			count(walls[i], index_stats.drawn, triangles);
+			append_triangles(walls[i], verts);
+		}
+		mesh.optimize(verts, 3, GL_TRIANGLES, batch.mesh.indices);
+		batch.mesh.primitive = GL_TRIANGLES;
+		batch.mesh.mark_dirty();
+	}
+
+	inline double LevelOptimizer::get_acmr(const int i) const {
+		const mesh_optimize_stats& ms = mesh.get_stats();
+		if (i)
+			return mesh.get_acmr(i);
+		return ms.triangles ? (double)index_stats.drawn / ms.triangles : 0.0;
+	}
+
+	inline void LevelOptimizer::optimize_sections(std::vector<section>& sections) {
+		auto start = std::chrono::steady_clock::now();
+		begin();
+
+		std::vector<wall_vert*> ring, kept;
+		std::vector<uint8_t> emptied(sections.size(), 0);
+		for (section& s : sections) {
+			ring.clear();
+			wall_vert* v = s.get_verts();
+			if (v)
+				do {
+					ring.push_back(v);
+					v = v->next;
+				} while (v && v != s.get_verts());
+			stats.walls[0] += (unsigned int)ring.size();
+			stats.vertices[0] += (unsigned int)(s.get_vertices().size() / section::vertex_size);
+			if (ring.empty())
+				continue;
+
+			bool touched = false;
+			for (wall_vert* w : ring) {
+				vec3 p(w->coords.x(), 0.f, w->coords.y());
+				weld(p);
+				if (p.x() != w->coords.x() || p.z() != w->coords.y()) {
+					w->coords = vec2(p.x(), p.z());
+					touched = true;
+				}
+			}
+
+			// Corners dropped until none can be: the start of a wall of no length (the wall before it now ends where it ended), and the
+			// corner between two walls in line to the same neighbor.
+			kept = ring;
+			for (size_t i = 0; kept.size() >= 3 && i < kept.size(); i++) {
+				const size_t n = kept.size();
+				const wall_vert* a = kept[(i + n - 1) % n];
+				const wall_vert* b = kept[i];
+				const wall_vert* c = kept[(i + 1) % n];
+				const bool no_length = b->coords.x() == c->coords.x() && b->coords.y() == c->coords.y();
+				if (!no_length && !(a->neighbor == b->neighbor && in_line(a->coords, b->coords, c->coords)))
+					continue;
+				if (no_length)
+					stats.removed++;
+				else
+					stats.merged++;
+				kept.erase(kept.begin() + i);
+				i = (size_t)-1;
+			}
+			if (kept.size() == ring.size() && !touched)
+				continue;
+			if (kept.size() < 3) {
+				s.set_verts(NULL);
+				emptied[s.get_id()] = 1;
+			}
+			else {
+				for (size_t i = 0; i < kept.size(); i++)
+					kept[i]->next = kept[(i + 1) % kept.size()];
+				s.set_verts(kept[0]);
+			}
+			changed.push_back(s.get_id());
+		}
+
+		// Portals into sections with no walls left.
+		for (section& s : sections) {
+			wall_vert* v = s.get_verts();
+			bool touched = false;
+			if (v)
+				do {
+					if (v->neighbor >= 0 && (size_t)v->neighbor < sections.size() && emptied[v->neighbor]) {
+						v->neighbor = -1;
+						touched = true;
+					}
+					v = v->next;
+				} while (v && v != s.get_verts());
+			if (touched && std::find(changed.begin(), changed.end(), s.get_id()) == changed.end())
+				changed.push_back(s.get_id());
+		}
+
+		for (const unsigned int id : changed)
+			sections[id].build_vertices();
+		for (const section& s : sections) {
+			const wall_vert* v = s.get_verts();
+			if (v)
+				do {
+					stats.walls[1]++;
+					v = v->next;
+				} while (v && v != s.get_verts());
+			stats.vertices[1] += (unsigned int)(s.get_vertices().size() / section::vertex_size);
+		}
+		stats.triangles[0] = stats.vertices[0] / 3;
+		stats.triangles[1] = stats.vertices[1] / 3;
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void LevelOptimizer::report(report_counters& counters) const {
+		if (!enabled)
+			return;
+		counters.push_back(std::make_pair("optimize walls (draws) before", (double)stats.walls[0]));
+		counters.push_back(std::make_pair("optimize walls (draws) after", (double)stats.walls[1]));
+		counters.push_back(std::make_pair("optimize vertices before", (double)stats.vertices[0]));
+		counters.push_back(std::make_pair("optimize vertices after", (double)stats.vertices[1]));
+		counters.push_back(std::make_pair("optimize triangles before", (double)stats.triangles[0]));
+		counters.push_back(std::make_pair("optimize triangles after", (double)stats.triangles[1]));
+		counters.push_back(std::make_pair("optimize corners welded", (double)stats.welded));
+		counters.push_back(std::make_pair("optimize walls merged", (double)stats.merged));
+		counters.push_back(std::make_pair("optimize walls removed", (double)stats.removed));
+		counters.push_back(std::make_pair("optimize ms", stats.ms));
+		counters.push_back(std::make_pair("optimize walls batched", (double)index_stats.walls));
+		counters.push_back(std::make_pair("optimize batches (draws)", (double)index_stats.batches));
+		counters.push_back(std::make_pair("optimize vertices indexed", (double)mesh.get_stats().vertices[1]));
+		counters.push_back(std::make_pair("optimize ACMR as drawn", get_acmr(0)));
+		counters.push_back(std::make_pair("optimize ACMR welded", get_acmr(1)));
+		counters.push_back(std::make_pair("optimize ACMR optimized", get_acmr(2)));
+		counters.push_back(std::make_pair("optimize indexing ms", mesh.get_stats().ms));
+	}
+}
+
+#endif // !GEN_ENG_LEVEL_OPTIMIZE_H
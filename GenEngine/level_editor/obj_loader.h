@@ -0,0 +1,457 @@
+#pragma once
+#ifndef GEN_ENG_OBJ_LOADER_H
+#define GEN_ENG_OBJ_LOADER_H
+
+#include "level_editor/3dobj.h"
+#include "util/mesh_optimize.h"
+#include "util/job_system.h"
+#include "util/options.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+
+/*	Wavefront OBJ loader.
+		Reads the geometry of an OBJ file into indexed triangle meshes that can be handed to a GenObject (to_object()): positions (v) and faces
+		(f), one mesh for every object or group (o, g). Texture coordinates, normals, materials and everything else are skipped, since
+		GenObjects only have positions.
+
+		- The file is memory mapped, not read, and cut into chunks at line ends which are parsed in parallel through the job system, with
+		  std::from_chars (no streams, no locale, no allocations per number).
+		- Faces are triangulated as fans. Their corners may be absolute (from 1) or relative to the last position (negative); the relative ones
+		  can only be resolved once the positions of the chunks before are counted, so they're kept as such until then.
+		- Meshes are then built in parallel: every mesh gets its own copy of the positions it uses, deduplicated through a hash table from the
+		  file's position index to the mesh's, and a triangle list of indices into them.
+		- set_optimize() also runs the meshes through the mesh optimizer (util/mesh_optimize.h), which welds equal positions and orders the
+		  triangles for the vertex cache.
+		Corners that point to no position drop their triangle, and are counted as errors; the load only fails if the file can't be read.
+		to_object() quantizes every mesh of the file over the box of all its positions (vertex_format.h), so meshes that share vertices stay
+		closed where they meet.
+
+		--obj <file> adds the meshes of a file to the scene (also outside headless runs), optimized with --optimize; the report gives the time
+		each step of the load took.
+*/
+
+namespace GenEngine {
+
+	// A file mapped read only.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	class MappedFile {
+		const char*		data;
+		size_t			size;
+#ifdef _WIN32
+		HANDLE			file, mapping;
+#endif
+
+	public:
+		MappedFile() : data(NULL), size(0) {
+#ifdef _WIN32
+			file = mapping = NULL;
+#endif
+		}
+		~MappedFile() { close(); }
+
+		inline bool		open(const char* path);
+		inline void		close();
+
+		inline const char*	get_data()	const	{ return data; }
+		inline size_t		get_size()	const	{ return size; }
+	};
+
+	// One object or group of the file.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct obj_mesh {
+		std::string					name;
+		std::vector<float>			verts;		// x, y, z.
+		std::vector<unsigned int>	indices;	// Triangle list.
+	};
+
+	struct obj_load_stats {
+		size_t			bytes;
+		unsigned int	chunks;
+		unsigned int	positions;		// In the file.
+		unsigned int	triangles;
+		unsigned int	vertices;		// Over all meshes, after deduplication.
+		unsigned int	meshes;
+		unsigned int	errors;			// Corners that point to no position.
+		unsigned int	threads;		// That parsed and built the meshes (util/job_system.h, --jobs).
+		double			map_ms, parse_ms, build_ms, ms;
+	};
+
+	class ObjLoader {
+
+		static const size_t		min_chunk = 1 << 20;		// Bytes.
+		static const int64_t	relative = 1ll << 40;		// Corners relative to the chunk's positions are stored minus this.
+
+		struct chunk {
+			const char*								begin;
+			const char*								end;
+			std::vector<float>						positions;
+			std::vector<int64_t>					corners;		// 3 per triangle: from 0, or relative (see above).
+			std::vector<std::pair<size_t, std::string> >	groups;	// Triangle where each o/g starts, and its name.
+			unsigned int							first_position;	// Positions of the chunks before.
+			size_t									first_triangle;
+		};
+
+		bool						optimize;
+		const char*					file;			// From the command line, NULL for none.
+		std::vector<chunk>			chunks;
+		std::vector<unsigned int>	corners;		// Of every triangle of the file, from 0; ~0 for bad ones.
+		std::vector<float>			positions;
+		vertex_quantization			bounds;			// Of positions.
+		std::vector<MeshOptimizer>	optimizers;		// One per thread.
+		obj_load_stats				stats;
+
+		static inline const char*	skip_blanks(const char* p, const char* end);
+		static inline const char*	read_float(const char* p, const char* end, float& v);
+		inline void					parse_chunk(chunk& c);
+		inline void					build_mesh(const size_t first, const size_t last, obj_mesh& mesh, const unsigned int thread);
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		ObjLoader() : optimize(false), file(NULL), bounds{ vec3(0.f, 0.f, 0.f), vec3(1.f, 1.f, 1.f) }, stats() {}
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_optimize(const bool on)		{ optimize = on; }
+		inline bool		configure(const CommandLine& cmd)	{ file = cmd.value("--obj"); optimize = cmd.has("--optimize"); return !cmd.has("--obj") || file; }
+
+		// Operations
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		load(const char* path, std::vector<obj_mesh>& meshes);		// Meshes are appended.
+		inline void		parse(const char* data, const size_t size, std::vector<obj_mesh>& meshes);
+		inline void		to_object(obj_mesh& mesh, GenObject& obj)	const;		// Moves the data into obj. Meshes of the last file loaded.
+		inline const vertex_quantization&	get_bounds()	const	{ return bounds; }		// Of the last file's positions.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const char*				get_file()	const	{ return file; }
+		inline const obj_load_stats&	get_stats()	const	{ return stats; }
+		inline void						report(report_counters& counters) const;
+	};
+
+	ObjLoader obj_loader;		// Run by the main thread before the render thread starts.
+
+
+	inline bool MappedFile::open(const char* path) {
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			file = NULL;
+			return false;
+		}
+		LARGE_INTEGER bytes;
+		if (!GetFileSizeEx(file, &bytes)) {
+			close();
+			return false;
+		}
+		size = (size_t)bytes.QuadPart;
+		if (!size)
+			return true;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st)) {
+			::close(fd);
+			return false;
+		}
+		size = (size_t)st.st_size;
+		if (!size) {
+			::close(fd);
+			return true;
+		}
+		void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		data = p == MAP_FAILED ? NULL : (const char*)p;
+		if (data)
+			madvise(p, size, MADV_SEQUENTIAL);
+#endif
+		if (!data) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	inline void MappedFile::close() {
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file)
+			CloseHandle(file);
+		file = mapping = NULL;
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	inline bool ObjLoader::load(const char* path, std::vector<obj_mesh>& meshes) {
+		auto start = std::chrono::steady_clock::now();
+		MappedFile file;
+		if (!file.open(path)) {
+			std::cout << "ObjLoader: can't read " << path << ".\n";
+			return false;
+		}
+		const double map_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		parse(file.get_data(), file.get_size(), meshes);
+		stats.map_ms = map_ms;
+		stats.ms += map_ms;
+		if (stats.errors)
+			std::cout << "ObjLoader: " << stats.errors << " face corners of " << path << " point to no vertex, their triangles were skipped.\n";
+		return true;
+	}
+
+	inline const char* ObjLoader::skip_blanks(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	inline const char* ObjLoader::read_float(const char* p, const char* end, float& v) {
+		p = skip_blanks(p, end);
+		if (p < end && *p == '+')
+			p++;
+		const std::from_chars_result r = std::from_chars(p, end, v);
+		if (r.ec != std::errc())
+			v = 0.f;
+		return r.ptr;
+	}
+
+	inline void ObjLoader::parse_chunk(chunk& c) {
+		c.positions.clear();
+		c.corners.clear();
+		c.groups.clear();
+		const char* p = c.begin;
+		while (p < c.end) {
+			const char* line_end = (const char*)memchr(p, '\n', c.end - p);
+			if (!line_end)
+				line_end = c.end;
+			const char* e = line_end;
+			if (e > p && e[-1] == '\r')
+				e--;
+			p = skip_blanks(p, e);
+
+			if (e - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+				float v[3];
+				const char* q = p + 2;
+				for (int k = 0; k < 3; k++)
+					q = read_float(q, e, v[k]);
+				c.positions.insert(c.positions.end(), v, v + 3);
+			}
+			else if (e - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+				// Only the position of every corner (before any /vt/vn) is read. Fans from the first corner.
+				int64_t first = 0, prev = 0;
+				int n = 0;
+				for (const char* q = skip_blanks(p + 2, e); q < e; q = skip_blanks(q, e)) {
+					long long idx = 0;
+					const std::from_chars_result r = std::from_chars(q, e, idx);
+					if (r.ec != std::errc())
+						break;
+					q = r.ptr;
+					while (q < e && *q != ' ' && *q != '\t')
+						q++;
+					const int64_t corner = idx > 0 ? idx - 1 : idx < 0 ? (int64_t)(c.positions.size() / 3) + idx - relative : -1;
+					if (n >= 2) {
+						c.corners.push_back(first);
+						c.corners.push_back(prev);
+						c.corners.push_back(corner);
+					}
+					if (!n)
+						first = corner;
+					prev = corner;
+					n++;
+				}
+			}
+			else if (e - p > 0 && (p[0] == 'o' || p[0] == 'g') && (e - p == 1 || p[1] == ' ' || p[1] == '\t')) {
+				const char* name = skip_blanks(p + 1, e);
+				const char* name_end = e;
+				while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+					name_end--;
+				c.groups.push_back(std::make_pair(c.corners.size() / 3, std::string(name, name_end)));
+			}
+			p = line_end + 1;
+		}
+	}
+
+	inline void ObjLoader::parse(const char* data, const size_t size, std::vector<obj_mesh>& meshes) {
+		auto start = std::chrono::steady_clock::now();
+		stats = obj_load_stats();
+		stats.bytes = size;
+		stats.threads = job_system.get_thread_count();
+
+		// Chunks of about the same size, a few per thread so uneven ones balance out, cut after a line end.
+		const size_t target = std::max((size_t)min_chunk, size / (job_system.get_thread_count() * 4) + 1);
+		chunks.clear();
+		for (const char* p = data; p < data + size;) {
+			const char* end = p + std::min(target, (size_t)(data + size - p));
+			const char* nl = end < data + size ? (const char*)memchr(end, '\n', data + size - end) : NULL;
+			end = nl ? nl + 1 : end < data + size ? data + size : end;
+			chunks.push_back(chunk());
+			chunks.back().begin = p;
+			chunks.back().end = end;
+			p = end;
+		}
+		job_system.parallel_for((unsigned int)chunks.size(), [this](unsigned int i, unsigned int) { parse_chunk(chunks[i]); });
+		stats.chunks = (unsigned int)chunks.size();
+
+		// Where each chunk's positions and triangles start, then every corner resolved to a position of the file.
+		unsigned int position_count = 0;
+		size_t triangle_count = 0;
+		for (chunk& c : chunks) {
+			c.first_position = position_count;
+			c.first_triangle = triangle_count;
+			position_count += (unsigned int)(c.positions.size() / 3);
+			triangle_count += c.corners.size() / 3;
+		}
+		positions.resize((size_t)position_count * 3);
+		corners.resize(triangle_count * 3);
+		std::vector<unsigned int> errors(job_system.get_thread_count(), 0);
+		job_system.parallel_for((unsigned int)chunks.size(), [&](unsigned int i, unsigned int thread) {
+			const chunk& c = chunks[i];
+			if (!c.positions.empty())
+				memcpy(&positions[(size_t)c.first_position * 3], c.positions.data(), c.positions.size() * sizeof(float));
+			for (size_t k = 0; k < c.corners.size(); k++) {
+				const int64_t corner = c.corners[k] < -relative / 2 ? c.corners[k] + relative + c.first_position : c.corners[k];
+				const bool valid = corner >= 0 && corner < (int64_t)position_count;
+				corners[c.first_triangle * 3 + k] = valid ? (unsigned int)corner : ~0u;
+				errors[thread] += !valid;
+			}
+		});
+		for (const unsigned int e : errors)
+			stats.errors += e;
+		stats.positions = position_count;
+		bounds = quantize_bounds(positions.data(), position_count, 3);
+		stats.parse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		// A mesh for every run of triangles between o/g lines. Empty ones (or left empty by bad corners) are dropped.
+		auto build_start = std::chrono::steady_clock::now();
+		std::vector<std::pair<size_t, std::string> > groups(1, std::make_pair((size_t)0, std::string()));
+		for (chunk& c : chunks)
+			for (auto& g : c.groups) {
+				if (groups.back().first == c.first_triangle + g.first)
+					groups.back().second.swap(g.second);
+				else
+					groups.push_back(std::make_pair(c.first_triangle + g.first, std::move(g.second)));
+			}
+		groups.push_back(std::make_pair(triangle_count, std::string()));
+		const size_t first_mesh = meshes.size();
+		std::vector<std::pair<size_t, size_t> > ranges;
+		for (size_t g = 0; g + 1 < groups.size(); g++)
+			if (groups[g + 1].first > groups[g].first) {
+				ranges.push_back(std::make_pair(groups[g].first, groups[g + 1].first));
+				meshes.push_back(obj_mesh());
+				meshes.back().name = groups[g].second;
+			}
+		if (optimize)
+			optimizers.resize(job_system.get_thread_count());
+		job_system.parallel_for((unsigned int)ranges.size(), [&](unsigned int i, unsigned int thread) {
+			build_mesh(ranges[i].first, ranges[i].second, meshes[first_mesh + i], thread);
+		});
+		size_t kept = first_mesh;
+		for (size_t m = first_mesh; m < meshes.size(); m++)
+			if (!meshes[m].indices.empty()) {
+				stats.triangles += (unsigned int)(meshes[m].indices.size() / 3);
+				stats.vertices += (unsigned int)(meshes[m].verts.size() / 3);
+				if (kept != m)
+					meshes[kept] = std::move(meshes[m]);
+				kept++;
+			}
+		meshes.resize(kept);
+		stats.meshes = (unsigned int)(kept - first_mesh);
+		chunks.clear();
+		stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void ObjLoader::build_mesh(const size_t first, const size_t last, obj_mesh& mesh, const unsigned int thread) {
+		// Open addressing from the file's position to the mesh's vertex: (position, vertex) pairs, ~0 for free slots.
+		size_t size = 16;
+		while (size < (last - first) * 3)
+			size *= 2;
+		std::vector<unsigned int> table(size * 2, ~0u);
+		mesh.verts.clear();
+		mesh.indices.clear();
+		mesh.indices.reserve((last - first) * 3);
+		for (size_t t = first; t < last; t++) {
+			const unsigned int* c = &corners[t * 3];
+			if (c[0] == ~0u || c[1] == ~0u || c[2] == ~0u)
+				continue;
+			for (int k = 0; k < 3; k++) {
+				size_t s = (size_t)(((uint64_t)c[k] * 0x9e3779b97f4a7c15ull) >> 32) & (size - 1);
+				while (table[s * 2] != ~0u && table[s * 2] != c[k])
+					s = (s + 1) & (size - 1);
+				if (table[s * 2] == ~0u) {
+					table[s * 2] = c[k];
+					table[s * 2 + 1] = (unsigned int)(mesh.verts.size() / 3);
+					mesh.verts.insert(mesh.verts.end(), &positions[(size_t)c[k] * 3], &positions[(size_t)c[k] * 3] + 3);
+				}
+				mesh.indices.push_back(table[s * 2 + 1]);
+			}
+		}
+		if (optimize && !mesh.indices.empty()) {
+			// The optimizer takes the triangles as a list of vertices.
+			std::vector<float> list(mesh.indices.size() * 3);
+			for (size_t i = 0; i < mesh.indices.size(); i++)
+				memcpy(&list[i * 3], &mesh.verts[(size_t)mesh.indices[i] * 3], 3 * sizeof(float));
+			optimizers[thread].optimize(list, 3, GL_TRIANGLES, mesh.indices);
+			mesh.verts.swap(list);
+		}
+	}
+
+	inline void ObjLoader::to_object(obj_mesh& mesh, GenObject& obj) const {
+		obj.vbo_verts.swap(mesh.verts);
+		obj.set_shared_quantization(bounds);
+		obj.indices.swap(mesh.indices);
+		obj.primitive = GL_TRIANGLES;
+		obj.mark_dirty();
+	}
+
+	inline void ObjLoader::report(report_counters& counters) const {
+		if (!file)
+			return;
+		counters.push_back(std::make_pair("obj MB", stats.bytes / (1024.0 * 1024.0)));
+		counters.push_back(std::make_pair("obj meshes", (double)stats.meshes));
+		counters.push_back(std::make_pair("obj triangles", (double)stats.triangles));
+		counters.push_back(std::make_pair("obj vertices", (double)stats.vertices));
+		counters.push_back(std::make_pair("obj chunks", (double)stats.chunks));
+		counters.push_back(std::make_pair("obj threads", (double)stats.threads));
+		counters.push_back(std::make_pair("obj map ms", stats.map_ms));
+		counters.push_back(std::make_pair("obj parse ms", stats.parse_ms));
+		counters.push_back(std::make_pair("obj build ms", stats.build_ms));
+		counters.push_back(std::make_pair("obj load ms", stats.ms));
+	}
+}
+
+#endif // !GEN_ENG_OBJ_LOADER_H
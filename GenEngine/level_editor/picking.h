@@ -0,0 +1,202 @@
+#pragma once
+#ifndef GEN_ENG_PICKING_H
+#define GEN_ENG_PICKING_H
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "level_editor/3dobj.h"
+#include "util/bvh.h"
+#include "util/options.h"
+#include "util/vec.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+/*	Picking.
+		What's under the cursor: a point of the screen is unprojected through the inverse of the camera's view and projection (the matrices of
+		Camera::look_at() and getProjMatrix()) into a ray from the near plane to the far one, which is cast against a BVH, so the cost grows with
+		the log of the geometry instead of with the number of walls.
+
+		- screen_ray(): ray through a point of the framebuffer, in pixels from its top left corner. cursor_position() gives that point for the
+		  GLFW cursor, or the center of the screen while the cursor is disabled for mouse look.
+		- ScenePicker: casts that ray against the renderer's walls (GenWall), keeping its own BVH of their triangles. Cheap enough to run every frame
+		  for hover highlighting; it's rebuilt only when some wall's vertices change. Headless runs pick the center of the screen every frame,
+		  and the report gives the time per pick and per BVH build.
+*/
+
+namespace GenEngine {
+
+	// From the near plane, dir unit length; tmax is the distance to the far plane.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct pick_ray {
+		vec3	origin, dir;
+		float	tmax;
+	};
+
+	// Wall picked. vertex is the nearest one of the triangle hit, numbered as in the wall's vbo_verts (3 floats each).
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct scene_pick {
+		int			wall;
+		int			vertex;
+		float		t;
+		vec3		point;
+	};
+
+	struct picking_stats {
+		unsigned int	picks;
+		unsigned int	builds;
+		double			pick_ms;		// Totals.
+		double			build_ms;
+	};
+
+	inline bool		screen_ray(const float x, const float y, const int width, const int height, mat4x4 view_proj, pick_ray& ray);	// view * projection.
+	inline void		cursor_position(GLFWwindow* w, const int fb_width, const int fb_height, float& x, float& y);
+
+	class ScenePicker {
+
+		BVH							bvh;
+		std::vector<float>			positions;
+		std::vector<unsigned int>	tri_wall;			// Wall of each triangle.
+		std::vector<unsigned int>	tri_verts;			// And its 3 vertices, in the wall's vbo_verts.
+		size_t						wall_count;
+		picking_stats				stats;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		ScenePicker() : wall_count(0), stats{ 0, 0, 0.0, 0.0 } {}
+
+		// Picking
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		build(const std::vector<GenWall>& walls);
+		inline bool		pick(const std::vector<GenWall>& walls, const pick_ray& ray, scene_pick& pick);
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline size_t					get_wall_count()	const	{ return wall_count; }
+		inline const picking_stats&		get_stats()			const	{ return stats; }
+		inline void						report(report_counters& counters) const;
+	};
+
+	ScenePicker scene_picker;		// Main thread: the wall under the cursor is picked while building every packet.
+
+
+	inline bool screen_ray(const float x, const float y, const int width, const int height, mat4x4 view_proj, pick_ray& ray) {
+		if (width <= 0 || height <= 0)
+			return false;
+		const mat4x4 inv = view_proj.inverse();
+		const float ndc[2] = { 2.f * x / width - 1.f, 1.f - 2.f * y / height };
+
+		// The point on the near plane (z = -1) and on the far plane (z = 1), back to world space.
+		float p[2][3];
+		for (int k = 0; k < 2; k++) {
+			const float z = k ? 1.f : -1.f;
+			float c[4];
+			for (int r = 0; r < 4; r++)
+				c[r] = inv.e[r] * ndc[0] + inv.e[4 + r] * ndc[1] + inv.e[8 + r] * z + inv.e[12 + r];
+			if (fabsf(c[3]) < 1e-20f)
+				return false;
+			for (int r = 0; r < 3; r++)
+				p[k][r] = c[r] / c[3];
+		}
+		ray.origin = vec3(p[0][0], p[0][1], p[0][2]);
+		ray.dir = vec3(p[1][0], p[1][1], p[1][2]) - ray.origin;
+		ray.tmax = ray.dir.length();
+		if (ray.tmax <= 0.f)
+			return false;
+		ray.dir /= ray.tmax;
+		return true;
+	}
+
+	inline void cursor_position(GLFWwindow* w, const int fb_width, const int fb_height, float& x, float& y) {
+		if (glfwGetInputMode(w, GLFW_CURSOR) == GLFW_CURSOR_DISABLED) {
+			x = fb_width * 0.5f;
+			y = fb_height * 0.5f;
+			return;
+		}
+
+		// The cursor is in screen coordinates, which may not be pixels (high DPI).
+		double cx, cy;
+		int ww, wh;
+		glfwGetCursorPos(w, &cx, &cy);
+		glfwGetWindowSize(w, &ww, &wh);
+		x = (float)(cx * fb_width / std::max(ww, 1));
+		y = (float)(cy * fb_height / std::max(wh, 1));
+	}
+
+	inline void ScenePicker::build(const std::vector<GenWall>& walls) {
+		auto start = std::chrono::steady_clock::now();
+		positions.clear();
+		tri_wall.clear();
+		tri_verts.clear();
+		for (size_t w = 0; w < walls.size(); w++) {
+			const std::vector<float>& v = walls[w].vbo_verts;
+			const std::vector<unsigned int>& e = walls[w].indices;
+			const unsigned int count = (unsigned int)(e.empty() ? v.size() / 3 : e.size());
+			for (unsigned int i = 0; i + 2 < count; i++) {
+				unsigned int t[3];
+				if (!e.empty()) {
+					if (i % 3)
+						continue;
+					t[0] = e[i]; t[1] = e[i + 1]; t[2] = e[i + 2];
+				}
+				else if (walls[w].primitive == GL_TRIANGLES) {
+					if (i % 3)
+						continue;
+					t[0] = i; t[1] = i + 1; t[2] = i + 2;
+				}
+				else if (walls[w].primitive == GL_TRIANGLE_FAN) {
+					t[0] = 0; t[1] = i + 1; t[2] = i + 2;
+				}
+				else {
+					t[0] = i; t[1] = i + 1; t[2] = i + 2;
+				}
+				for (int k = 0; k < 3; k++) {
+					positions.insert(positions.end(), &v[t[k] * 3], &v[t[k] * 3] + 3);
+					tri_verts.push_back(t[k]);
+				}
+				tri_wall.push_back((unsigned int)w);
+			}
+		}
+		bvh.build(positions.data(), tri_wall.size());
+		wall_count = walls.size();
+		stats.builds++;
+		stats.build_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline bool ScenePicker::pick(const std::vector<GenWall>& walls, const pick_ray& ray, scene_pick& pick) {
+		auto start = std::chrono::steady_clock::now();
+		float t = ray.tmax;
+		unsigned int prim;
+		const bool hit = bvh.intersect(ray.origin.e, ray.dir.e, t, prim);
+		if (hit) {
+			pick.wall = (int)tri_wall[prim];
+			pick.t = t;
+			pick.point = ray.origin + ray.dir * t;
+			const std::vector<float>& v = walls[pick.wall].vbo_verts;
+			float best = 1e30f;
+			for (int k = 0; k < 3; k++) {
+				const unsigned int i = tri_verts[prim * 3 + k];
+				const float d = (vec3(v[i * 3], v[i * 3 + 1], v[i * 3 + 2]) - pick.point).squared_length();
+				if (d < best) {
+					best = d;
+					pick.vertex = (int)i;
+				}
+			}
+		}
+		stats.picks++;
+		stats.pick_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return hit;
+	}
+
+	inline void ScenePicker::report(report_counters& counters) const {
+		counters.push_back(std::make_pair("picking ms per frame", stats.pick_ms / std::max(stats.picks, 1u)));
+		counters.push_back(std::make_pair("picking BVH builds", (double)stats.builds));
+		counters.push_back(std::make_pair("picking BVH build ms", stats.build_ms / std::max(stats.builds, 1u)));
+	}
+}
+
+#endif // !GEN_ENG_PICKING_H
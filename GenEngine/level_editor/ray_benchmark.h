@@ -0,0 +1,228 @@
+#pragma once
+#ifndef GEN_ENG_RAY_BENCHMARK_H
+#define GEN_ENG_RAY_BENCHMARK_H
+
+#include "level_editor/level_data.h"
+#include "level_editor/level_bvh.h"
+#include "util/job_system.h"
+#include "util/options.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <math.h>
+
+/*	Ray query benchmark (--rays).
+		Generates a synthetic level of about the given number of triangles: a square grid of 4x4 rooms of random floor and ceiling heights,
+		each wall solid or a portal to the next room at random. Builds the level's BVH, then times four kinds of query over the same rays,
+		first on the calling thread alone and then spread over every thread of the job system:
+		- closest hit of single rays (LevelBVH::intersect()), from random points inside the rooms in random directions.
+		- any hit of the same rays within 8 units (LevelBVH::occluded(), shadow and line of sight rays).
+		- the same two in packets of 4 rays that leave from the same point in close directions (BVH::intersect4() and occluded4(), as the AO
+		  baker does).
+		Both runs of a query trace the same rays against the same tree, so they must hit the same number of rays; the report gives both hit
+		rates and whether they agree. Last, every vertex is moved and the tree refitted, to compare with the time of the build.
+
+		It only needs the CPU, so it runs as a mode of its own: GenEngine --rays <triangles> [--report <file>] creates no window and no GL
+		context, renders no frame, and writes only its counters to the report.
+*/
+
+namespace GenEngine {
+
+	enum ray_query {
+		RAYS_CLOSEST,
+		RAYS_ANY,
+		RAYS_CLOSEST4,
+		RAYS_ANY4,
+		RAY_QUERIES
+	};
+
+	struct ray_benchmark_result {
+		unsigned int	triangles;
+		unsigned int	nodes;
+		unsigned int	threads;
+		double			build_ms;
+		double			refit_ms;
+		double			mrays[RAY_QUERIES][2];		// Millions of rays per second, on one thread and on all of them.
+		double			hit_rate[RAY_QUERIES][2];	// Fraction of the rays that hit something, on one thread and on all of them.
+		bool			agree;						// Every query hit the same number of rays on one thread and on all of them.
+
+		inline void		report(report_counters& counters) const;
+	};
+
+	// Square grid of side x side rooms of the given size, starting at origin (x, z of the first corner, y of the lowest floor). Floors are up to a
+	// quarter of size above origin and walls half to once size tall, each wall solid or a portal to the next room at random. The sections point
+	// into verts, and have their vertex streams built. Also the --rooms scene.
+	inline void build_room_grid(const int side, const float size, const vec3& origin, unsigned int& seed, std::vector<wall_vert>& verts,
+		std::vector<section>& sections) {
+		auto random = [&seed](float lo, float hi) { seed = seed * 1664525u + 1013904223u; return lo + (hi - lo) * (seed >> 8) / 16777216.f; };
+		verts.assign((size_t)side * side * 4, wall_vert());
+		sections.clear();
+		sections.reserve((size_t)side * side);
+		for (int z = 0; z < side; z++)
+			for (int x = 0; x < side; x++) {
+				const int id = z * side + x;
+				wall_vert* w = &verts[(size_t)id * 4];
+				const float x0 = origin.x() + x * size, z0 = origin.z() + z * size;
+				const vec2 corners[4] = { vec2(x0, z0), vec2(x0 + size, z0), vec2(x0 + size, z0 + size), vec2(x0, z0 + size) };
+				const int next[4] = { z > 0 ? id - side : -1, x + 1 < side ? id + 1 : -1, z + 1 < side ? id + side : -1, x > 0 ? id - 1 : -1 };
+				for (int k = 0; k < 4; k++) {
+					w[k].coords = corners[k];
+					w[k].neighbor = random(0.f, 1.f) < 0.5f ? next[k] : -1;
+					w[k].next = &w[(k + 1) % 4];
+				}
+				const float h = random(2.f, 4.f) * size / 4.f;
+				const float y = origin.y() + random(0.f, 1.f) * size / 4.f;
+				sections.push_back(section(id, y, h, w));
+				sections.back().build_vertices();
+			}
+	}
+
+	inline ray_benchmark_result run_ray_benchmark(const unsigned int triangles, const unsigned int ray_count = 1 << 19) {
+		ray_benchmark_result result = {};
+		unsigned int seed = 12345;
+		auto random = [&seed](float lo, float hi) { seed = seed * 1664525u + 1013904223u; return lo + (hi - lo) * (seed >> 8) / 16777216.f; };
+
+		// About 8 triangles per room: floor and ceiling, and half the walls.
+		const int side = std::max(1, (int)ceilf(sqrtf(triangles / 8.f)));
+		const float size = 4.f;
+		std::vector<wall_vert> verts;
+		std::vector<section> sections;
+		build_room_grid(side, size, vec3(0.f, 0.f, 0.f), seed, verts, sections);
+
+		LevelBVH level;
+		auto start = std::chrono::steady_clock::now();
+		level.rebuild(sections);
+		result.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		result.triangles = (unsigned int)level.get_bvh().get_triangle_count();
+		result.nodes = (unsigned int)level.get_bvh().get_node_count();
+		result.threads = job_system.get_thread_count();
+		result.agree = true;
+
+		// Rays in groups of 4 from the same point, in directions within about 6 degrees of each other.
+		const unsigned int count = (ray_count + 3) / 4 * 4;
+		std::vector<float> origins(count * 3), dirs(count * 3);
+		for (unsigned int i = 0; i < count; i += 4) {
+			const unsigned int room = std::min((unsigned int)random(0.f, (float)sections.size()), (unsigned int)sections.size() - 1);
+			const float ox = (room % side) * size + random(0.2f, size - 0.2f), oz = (room / side) * size + random(0.2f, size - 0.2f);
+			const float oy = sections[room].get_y_level() + random(0.2f, sections[room].get_height() - 0.2f);
+			const float cz = random(-1.f, 1.f), phi = random(0.f, 6.2831853f), r = sqrtf(1.f - cz * cz);
+			for (unsigned int j = i; j < i + 4; j++) {
+				float d[3] = { r * cosf(phi) + random(-0.05f, 0.05f), r * sinf(phi) + random(-0.05f, 0.05f), cz + random(-0.05f, 0.05f) };
+				const float len = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+				origins[j * 3] = ox;
+				origins[j * 3 + 1] = oy;
+				origins[j * 3 + 2] = oz;
+				for (int a = 0; a < 3; a++)
+					dirs[j * 3 + a] = d[a] / len;
+			}
+		}
+
+		// Rays first to last-1 of a query; returns how many hit.
+		const float any_distance = 8.f;
+		auto trace = [&](const int query, const unsigned int first, const unsigned int last) {
+			unsigned int hits = 0;
+			if (query == RAYS_CLOSEST || query == RAYS_ANY) {
+				level_hit hit;
+				for (unsigned int i = first; i < last; i++)
+					hits += query == RAYS_CLOSEST ? level.intersect(&origins[i * 3], &dirs[i * 3], hit) : level.occluded(&origins[i * 3], &dirs[i * 3], any_distance);
+				return hits;
+			}
+			bvh_ray4 r;
+			r.tmax = _mm_set1_ps(query == RAYS_CLOSEST4 ? 1e30f : any_distance);
+			float t[4];
+			unsigned int prim[4];
+			for (unsigned int i = first; i < last; i += 4) {
+				r.ox = _mm_set1_ps(origins[i * 3]);
+				r.oy = _mm_set1_ps(origins[i * 3 + 1]);
+				r.oz = _mm_set1_ps(origins[i * 3 + 2]);
+				r.dx = _mm_setr_ps(dirs[i * 3], dirs[i * 3 + 3], dirs[i * 3 + 6], dirs[i * 3 + 9]);
+				r.dy = _mm_setr_ps(dirs[i * 3 + 1], dirs[i * 3 + 4], dirs[i * 3 + 7], dirs[i * 3 + 10]);
+				r.dz = _mm_setr_ps(dirs[i * 3 + 2], dirs[i * 3 + 5], dirs[i * 3 + 8], dirs[i * 3 + 11]);
+				const int mask = query == RAYS_CLOSEST4 ? level.get_bvh().intersect4(r, t, prim) : level.get_bvh().occluded4(r);
+				hits += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+			}
+			return hits;
+		};
+
+		const unsigned int chunk = 1024;
+		const unsigned int chunks = (count + chunk - 1) / chunk;
+		std::vector<unsigned int> chunk_hits(chunks);
+		for (int q = 0; q < RAY_QUERIES; q++) {
+			start = std::chrono::steady_clock::now();
+			const unsigned int hits = trace(q, 0, count);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			result.mrays[q][0] = count / (ms * 1000.0);
+			result.hit_rate[q][0] = (double)hits / count;
+
+			start = std::chrono::steady_clock::now();
+			job_system.parallel_for(chunks, [&](unsigned int c, unsigned int) { chunk_hits[c] = trace(q, c * chunk, std::min(count, (c + 1) * chunk)); });
+			ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			result.mrays[q][1] = count / (ms * 1000.0);
+
+			unsigned int parallel_hits = 0;
+			for (const unsigned int h : chunk_hits)
+				parallel_hits += h;
+			result.hit_rate[q][1] = (double)parallel_hits / count;
+			result.agree = result.agree && parallel_hits == hits;
+		}
+
+		// Every floor and ceiling a bit higher, and every wall taller.
+		for (section& s : sections) {
+			std::vector<float>& v = s.get_vertices();
+			for (size_t i = 1; i < v.size(); i += section::vertex_size)
+				v[i] += v[i] > s.get_y_level() ? 0.25f : 0.1f;
+		}
+		start = std::chrono::steady_clock::now();
+		level.update(sections);
+		result.refit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return result;
+	}
+
+	inline void ray_benchmark_result::report(report_counters& counters) const {
+		static const char* const names[RAY_QUERIES][2] = {
+			{ "rays closest hit Mrays/s, 1 thread", "rays closest hit Mrays/s, all threads" },
+			{ "rays any hit Mrays/s, 1 thread", "rays any hit Mrays/s, all threads" },
+			{ "rays closest hit x4 Mrays/s, 1 thread", "rays closest hit x4 Mrays/s, all threads" },
+			{ "rays any hit x4 Mrays/s, 1 thread", "rays any hit x4 Mrays/s, all threads" } };
+		static const char* const rate_names[RAY_QUERIES][2] = {
+			{ "rays closest hit rate, 1 thread", "rays closest hit rate, all threads" },
+			{ "rays any hit rate, 1 thread", "rays any hit rate, all threads" },
+			{ "rays closest hit x4 rate, 1 thread", "rays closest hit x4 rate, all threads" },
+			{ "rays any hit x4 rate, 1 thread", "rays any hit x4 rate, all threads" } };
+		counters.push_back(std::make_pair("rays triangles", (double)triangles));
+		counters.push_back(std::make_pair("rays BVH nodes", (double)nodes));
+		counters.push_back(std::make_pair("rays threads", (double)threads));
+		counters.push_back(std::make_pair("rays BVH build ms", build_ms));
+		counters.push_back(std::make_pair("rays BVH refit ms", refit_ms));
+		for (int q = 0; q < RAY_QUERIES; q++) {
+			counters.push_back(std::make_pair(names[q][0], mrays[q][0]));
+			counters.push_back(std::make_pair(names[q][1], mrays[q][1]));
+		}
+		for (int q = 0; q < RAY_QUERIES; q++) {
+			counters.push_back(std::make_pair(rate_names[q][0], hit_rate[q][0]));
+			counters.push_back(std::make_pair(rate_names[q][1], hit_rate[q][1]));
+		}
+		counters.push_back(std::make_pair("rays threads agree", agree ? 1.0 : 0.0));
+	}
+
+	// The --rays mode, on the job system's threads (started by the caller). Returns 0 if the report couldn't be written.
+	inline bool run_ray_benchmark_mode(const unsigned int triangles, const char* report_path) {
+		report_counters counters;
+		const ray_benchmark_result result = run_ray_benchmark(triangles);
+		result.report(counters);
+		if (!result.agree)
+			std::cout << "Ray benchmark: the single and multithreaded runs hit different numbers of rays.\n";
+		std::ofstream out(report_path);
+		if (!out) {
+			std::cout << "Ray benchmark: report \"" << report_path << "\" could not be written.\n";
+			return false;
+		}
+		write_counters(out, counters);
+		std::cout << "Ray benchmark: report written to " << report_path << ".\n";
+		return true;
+	}
+}
+
+#endif // !GEN_ENG_RAY_BENCHMARK_H
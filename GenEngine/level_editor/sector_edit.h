@@ -0,0 +1,512 @@
+#pragma once
+#ifndef GEN_ENG_SECTOR_EDIT_H
+#define GEN_ENG_SECTOR_EDIT_H
+
+#include "level_editor/level_data.h"
+#include "util/polygon_clip.h"
+#include "util/vec.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+#include <math.h>
+
+/*	Sector editing.
+		Drawing sections over the level: adding an outline (cut out of whatever sections it overlaps), subtracting one, merging two sections
+		and splitting one along a line. Outlines are clipped as polygons (util/polygon_clip.h) with each wall's neighbor as its edge's tag, so
+		walls keep their portals through the operations. Results are cut into convex pieces, one section each, as floors and ceilings are drawn
+		as fans (section::build_vertices()); a merge whose outline isn't convex still gives more than one section.
+
+		Then portals are stitched among the sections changed and those around them: walls are split where another section's corner lies
+		along them (within the grid cell the clipper rounds to), and every wall that's new, or was a portal to a changed section, is linked to
+		the section with the same wall the other way round. New walls always link; old portals facing a solid wall, or nothing, become solid.
+		Solid walls that weren't changed stay so.
+
+		IDs don't move: a section cut in pieces keeps its ID for the first one and the rest are appended, and one cut away or merged into
+		another is left with no walls (get_verts() NULL) instead of renumbering the level. The editor owns the wall lists it makes, so it must
+		outlive the sections using them; the rest stay with whoever loaded them.
+
+		Walls are snapped to the clipper's grid. get_changed() lists the sections whose walls were rebuilt, or whose neighbors changed, for
+		the BVH (LevelBVH::update()), lighting and AO to redo; their vertex streams are rebuilt here, with no light baked.
+*/
+
+namespace GenEngine {
+
+	// Counters of the last operation.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct sector_edit_stats {
+		unsigned int	operations;		// Total.
+		unsigned int	changed;		// Sections rebuilt.
+		unsigned int	relinked;		// Walls whose neighbor changed.
+		unsigned int	splits;			// Walls split at another section's corner.
+		double			ms;
+	};
+
+	class SectorEditor {
+
+		struct properties {
+			float			y, height, light_level;
+			unsigned char	mask;
+		};
+		struct cell {
+			int64_t	x, y;
+			bool operator==(const cell& o)	const	{ return x == o.x && y == o.y; }
+			bool operator<(const cell& o)	const	{ return x < o.x || (x == o.x && y < o.y); }
+		};
+		struct cut {
+			unsigned int				id;
+			std::vector<clip_polygon>	pieces;
+		};
+
+		PolygonClipper								clipper;
+		std::vector<std::unique_ptr<wall_vert[]> >	rings;			// Wall lists made here, by section ID.
+		std::vector<unsigned int>					changed;
+		std::vector<uint8_t>						is_changed;
+		std::vector<unsigned int>					around;			// Sections to stitch.
+		std::vector<uint8_t>						is_around;
+		std::chrono::steady_clock::time_point		start;
+		sector_edit_stats							stats;
+
+		static const int	new_wall = -2;		// Tag of walls to link.
+
+		inline clip_polygon	outline(const section& s)	const;
+		inline cell			to_cell(const vec2& v)		const	{ const float g = 1.f / clipper.get_grid(); return { (int64_t)floor(v.x() * g + 0.5), (int64_t)floor(v.y() * g + 0.5) }; }
+		static inline bool	bounds(const clip_polygon& p, vec2& lo, vec2& hi);
+		static inline double	area(const clip_polygon& p);
+		static inline properties	properties_of(const section& s)	{ return { s.get_y_level(), s.get_height(), s.get_light_level(), s.get_mask() }; }
+		inline bool			cut_out(const std::vector<section>& sections, const clip_polygon& shape, const vec2& lo, const vec2& hi, std::vector<cut>& cuts);
+		inline void			begin(std::vector<section>& sections);
+		inline void			touch(const unsigned int id);
+		inline void			look_around(const unsigned int id);
+		inline void			mark(std::vector<section>& sections, const unsigned int id);
+		inline void			set_walls(std::vector<section>& sections, const unsigned int id, const clip_polygon& walls);
+		inline void			place(std::vector<section>& sections, const unsigned int* ids, const size_t id_count, const std::vector<clip_polygon>& pieces, const properties& p);
+		inline void			stitch(std::vector<section>& sections);
+		inline void			finish(std::vector<section>& sections, const vec2& lo, const vec2& hi);
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		SectorEditor(const float grid_size = 1.f / 256.f) : clipper(grid_size), stats{ 0, 0, 0, 0, 0.0 } {}
+
+		// Operations. Sections are indexed by their ID. Each returns 0, and changes nothing, if it can't be done.
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		add(std::vector<section>& sections, const clip_polygon& shape, const float y, const float height);	// New sections appended.
+		inline bool		subtract(std::vector<section>& sections, const clip_polygon& shape);
+		inline bool		merge(std::vector<section>& sections, const unsigned int a, const unsigned int b);		// Into a, with a's properties.
+		inline bool		split(std::vector<section>& sections, const unsigned int id, const vec2& p0, const vec2& p1);
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const std::vector<unsigned int>&	get_changed()	const	{ return changed; }
+		inline const sector_edit_stats&			get_stats()		const	{ return stats; }
+		inline const PolygonClipper&			get_clipper()	const	{ return clipper; }
+	};
+
+
+	inline clip_polygon SectorEditor::outline(const section& s) const {
+		clip_polygon p;
+		const wall_vert* v = s.get_verts();
+		if (v)
+			do {
+				p.points.push_back(clipper.snap(v->coords));
+				p.tags.push_back(v->neighbor);
+				v = v->next;
+			} while (v && v != s.get_verts());
+		return p;
+	}
+
+	inline bool SectorEditor::bounds(const clip_polygon& p, vec2& lo, vec2& hi) {
+		if (p.points.empty())
+			return false;
+		lo = hi = p.points[0];
+		for (const vec2& v : p.points) {
+			lo = vec2(std::min(lo.x(), v.x()), std::min(lo.y(), v.y()));
+			hi = vec2(std::max(hi.x(), v.x()), std::max(hi.y(), v.y()));
+		}
+		return true;
+	}
+
+	inline double SectorEditor::area(const clip_polygon& p) {
+		double a = 0.0;
+		for (size_t i = 0; i < p.points.size(); i++) {
+			const vec2& u = p.points[i];
+			const vec2& v = p.points[(i + 1) % p.points.size()];
+			a += (double)u.x() * v.y() - (double)u.y() * v.x();
+		}
+		return a * 0.5;
+	}
+
+	// What's left of every section the shape overlaps, in convex pieces. Sections it only touches come back with their walls split where the
+	// shape's corners are, which stitching would do anyway.
+	inline bool SectorEditor::cut_out(const std::vector<section>& sections, const clip_polygon& shape, const vec2& lo, const vec2& hi, std::vector<cut>& cuts) {
+		std::vector<clip_polygon> rest;
+		for (unsigned int s = 0; s < sections.size(); s++) {
+			const clip_polygon o = outline(sections[s]);
+			vec2 olo, ohi;
+			if (!bounds(o, olo, ohi) || olo.x() > hi.x() || ohi.x() < lo.x() || olo.y() > hi.y() || ohi.y() < lo.y())
+				continue;
+			rest.clear();
+			if (!clipper.clip(CLIP_DIFFERENCE, o, shape, rest))
+				return false;
+
+			// Same points as before: untouched.
+			if (rest.size() == 1 && rest[0].points.size() == o.points.size()) {
+				std::vector<cell> before, after;
+				for (size_t i = 0; i < o.points.size(); i++) {
+					before.push_back(to_cell(o.points[i]));
+					after.push_back(to_cell(rest[0].points[i]));
+				}
+				std::sort(before.begin(), before.end());
+				std::sort(after.begin(), after.end());
+				if (before == after)
+					continue;
+			}
+			cuts.push_back({ s, {} });
+			if (!clipper.partition(rest, new_wall, cuts.back().pieces))
+				return false;
+		}
+		return true;
+	}
+
+	inline void SectorEditor::begin(std::vector<section>& sections) {
+		start = std::chrono::steady_clock::now();
+		for (unsigned int s : changed)
+			is_changed[s] = 0;
+		for (unsigned int s : around)
+			is_around[s] = 0;
+		changed.clear();
+		around.clear();
+		is_changed.resize(sections.size(), 0);
+		is_around.resize(sections.size(), 0);
+		stats.changed = stats.relinked = stats.splits = 0;
+		stats.operations++;
+	}
+
+	inline void SectorEditor::touch(const unsigned int id) {
+		if (id >= is_changed.size())
+			is_changed.resize(id + 1, 0);
+		if (!is_changed[id]) {
+			is_changed[id] = 1;
+			changed.push_back(id);
+		}
+		look_around(id);
+	}
+
+	inline void SectorEditor::look_around(const unsigned int id) {
+		if (id >= is_around.size())
+			is_around.resize(id + 1, 0);
+		if (!is_around[id]) {
+			is_around[id] = 1;
+			around.push_back(id);
+		}
+	}
+
+	// About to change: its neighbors now are stitched too, as their portals will need to point somewhere else.
+	inline void SectorEditor::mark(std::vector<section>& sections, const unsigned int id) {
+		touch(id);
+		const wall_vert* v = sections[id].get_verts();
+		if (v)
+			do {
+				if (v->neighbor >= 0 && (size_t)v->neighbor < sections.size())
+					look_around((unsigned int)v->neighbor);
+				v = v->next;
+			} while (v && v != sections[id].get_verts());
+	}
+
+	inline void SectorEditor::set_walls(std::vector<section>& sections, const unsigned int id, const clip_polygon& walls) {
+		std::unique_ptr<wall_vert[]> ring;
+		const size_t n = walls.points.size();
+		if (n) {
+			ring.reset(new wall_vert[n]);
+			for (size_t i = 0; i < n; i++) {
+				ring[i].coords = walls.points[i];
+				ring[i].neighbor = walls.tags.empty() ? -1 : walls.tags[i];
+				ring[i].next = &ring[(i + 1) % n];
+			}
+		}
+		sections[id].set_verts(ring.get());
+		if (rings.size() <= id)
+			rings.resize(id + 1);
+		rings[id] = std::move(ring);
+	}
+
+	// Pieces into the sections given, then new ones; sections given and left over are emptied.
+	inline void SectorEditor::place(std::vector<section>& sections, const unsigned int* ids, const size_t id_count, const std::vector<clip_polygon>& pieces,
+		const properties& p) {
+		for (size_t i = 0; i < pieces.size() || i < id_count; i++) {
+			unsigned int id;
+			if (i < id_count) {
+				id = ids[i];
+				mark(sections, id);
+			}
+			else {
+				id = (unsigned int)sections.size();
+				sections.push_back(section());
+				touch(id);
+			}
+			sections[id] = section(id, p.y, p.height, NULL, p.mask);
+			sections[id].set_light_level(p.light_level);
+			set_walls(sections, id, i < pieces.size() ? pieces[i] : clip_polygon());
+		}
+	}
+
+	inline void SectorEditor::stitch(std::vector<section>& sections) {
+		const size_t count = around.size();
+		std::vector<clip_polygon> walls(count);
+		std::vector<std::vector<cell> > cells(count);
+		std::vector<std::pair<cell, uint8_t> > corners;		// And whether a changed section has it.
+		for (size_t k = 0; k < count; k++) {
+			walls[k] = outline(sections[around[k]]);
+			for (const vec2& v : walls[k].points) {
+				cells[k].push_back(to_cell(v));
+				corners.push_back({ cells[k].back(), is_changed[around[k]] });
+			}
+		}
+		std::sort(corners.begin(), corners.end());
+		size_t m = 0;
+		for (size_t i = 0; i < corners.size(); i++)
+			if (m && corners[m - 1].first == corners[i].first)
+				corners[m - 1].second |= corners[i].second;
+			else
+				corners[m++] = corners[i];
+		corners.resize(m);
+
+		// Corners inside walls, in order along them. The changed sections' corners split every wall passing through their grid cell, as
+		// the clipper rounds (PolygonClipper::snap_edges()), so walls along a clipped section bend the same way it did. Other corners only
+		// split the changed sections' walls, exactly on them: the rest were stitched with each other before. The pieces of a wall split are
+		// marked, to be linked again.
+		std::vector<uint8_t> split(count, 0);
+		std::vector<std::vector<uint8_t> > pieces(count);
+		std::vector<std::pair<int64_t, cell> > on;
+		for (size_t k = 0; k < count; k++) {
+			const size_t n = cells[k].size();
+			clip_polygon w;
+			std::vector<cell> c;
+			std::vector<uint8_t>& piece = pieces[k];
+			for (size_t i = 0; i < n; i++) {
+				const cell a = cells[k][i], b = cells[k][(i + 1) % n];
+				w.points.push_back(walls[k].points[i]);
+				w.tags.push_back(walls[k].tags[i]);
+				c.push_back(a);
+				piece.push_back(0);
+				const int64_t dx = b.x - a.x, dy = b.y - a.y;
+				on.clear();
+				const std::pair<cell, uint8_t> key = { cell{ std::min(a.x, b.x), INT64_MIN }, 0 };
+				for (auto it = std::lower_bound(corners.begin(), corners.end(), key); it != corners.end() && it->first.x <= std::max(a.x, b.x); ++it) {
+					const cell& q = it->first;
+					if (q.y < std::min(a.y, b.y) || q.y > std::max(a.y, b.y) || q == a || q == b || !(it->second || is_changed[around[k]]))
+						continue;
+					int pos = 0, neg = 0;
+					for (int j = 0; j < 4; j++) {
+						const int64_t cx = q.x * 2 + (j & 1 ? 1 : -1), cy = q.y * 2 + (j & 2 ? 1 : -1);
+						const int64_t o = dx * (cy - a.y * 2) - dy * (cx - a.x * 2);
+						pos += o > 0;
+						neg += o < 0;
+					}
+					if (it->second ? pos < 4 && neg < 4 : dx * (q.y - a.y) == dy * (q.x - a.x))
+						on.push_back({ dx * (q.x - a.x) + dy * (q.y - a.y), q });
+				}
+				std::sort(on.begin(), on.end(), [](const std::pair<int64_t, cell>& u, const std::pair<int64_t, cell>& v) { return u.first < v.first; });
+				for (const std::pair<int64_t, cell>& q : on) {
+					const float g = clipper.get_grid();
+					w.points.push_back(vec2(q.second.x * g, q.second.y * g));
+					w.tags.push_back(walls[k].tags[i]);
+					c.push_back(q.second);
+					piece.push_back(1);
+				}
+				if (!on.empty())
+					piece[piece.size() - on.size() - 1] = split[k] = 1;
+				stats.splits += (unsigned int)on.size();
+			}
+
+			// A wall bent through a corner can fold back along the next one (the section is thinner than a cell there): the spike goes,
+			// and so does the section if nothing's left.
+			for (size_t i = 0; split[k] && c.size() >= 3 && i < c.size(); i++) {
+				const size_t before = (i + c.size() - 1) % c.size(), after = (i + 1) % c.size();
+				if (!(c[before] == c[after]))
+					continue;
+				w.tags[before] = w.tags[after];
+				piece[before] = 1;
+				for (const size_t j : { std::max(i, after), std::min(i, after) }) {
+					w.points.erase(w.points.begin() + j);
+					w.tags.erase(w.tags.begin() + j);
+					c.erase(c.begin() + j);
+					piece.erase(piece.begin() + j);
+				}
+				i = (size_t)-1;
+			}
+			if (c.size() < 3) {
+				w = clip_polygon();
+				c.clear();
+				piece.clear();
+				touch(around[k]);
+			}
+			walls[k] = w;
+			cells[k] = c;
+		}
+
+		// Every wall by its ends, to find the same one the other way round.
+		struct wall_ref {
+			cell			a, b;
+			unsigned int	k, i;
+			bool operator<(const wall_ref& o) const { return a < o.a || (a == o.a && b < o.b); }
+		};
+		std::vector<wall_ref> index;
+		for (unsigned int k = 0; k < count; k++)
+			for (unsigned int i = 0; i < cells[k].size(); i++)
+				index.push_back({ cells[k][i], cells[k][(i + 1) % cells[k].size()], k, i });
+		std::sort(index.begin(), index.end());
+
+		std::vector<clip_polygon> before = walls;
+		for (const wall_ref& e : index) {
+			int& tag = walls[e.k].tags[e.i];
+			const bool stale = tag >= 0 && ((size_t)tag >= sections.size() || is_changed[tag] || is_changed[around[e.k]] || pieces[e.k][e.i]);
+			if (tag != new_wall && !stale)
+				continue;
+			const wall_ref key = { e.b, e.a, 0, 0 };
+			auto r = std::lower_bound(index.begin(), index.end(), key);
+			while (r != index.end() && r->a == e.b && r->b == e.a && r->k == e.k)
+				++r;
+			if (r == index.end() || !(r->a == e.b && r->b == e.a)) {
+				tag = -1;
+				continue;
+			}
+			int& other = walls[r->k].tags[r->i];
+			if (tag != new_wall && other == -1)
+				tag = -1;
+			else {
+				tag = (int)around[r->k];
+				other = (int)around[e.k];
+			}
+		}
+
+		for (size_t k = 0; k < count; k++) {
+			const unsigned int id = around[k];
+			if (split[k]) {
+				set_walls(sections, id, walls[k]);
+				touch(id);
+				continue;
+			}
+			wall_vert* v = sections[id].get_verts();
+			for (size_t i = 0; i < walls[k].tags.size(); i++, v = v->next)
+				if (v->neighbor != walls[k].tags[i]) {
+					v->neighbor = walls[k].tags[i];
+					touch(id);
+				}
+		}
+		for (size_t k = 0; k < count; k++)
+			for (size_t i = 0; i < walls[k].tags.size() && i < before[k].tags.size(); i++)
+				stats.relinked += walls[k].tags[i] != before[k].tags[i] && before[k].tags[i] != new_wall;
+	}
+
+	// Stitches the changed sections with those near them and rebuilds them.
+	inline void SectorEditor::finish(std::vector<section>& sections, const vec2& lo, const vec2& hi) {
+		const float g = clipper.get_grid();
+		for (unsigned int s = 0; s < sections.size(); s++) {
+			vec2 slo, shi;
+			const clip_polygon o = outline(sections[s]);
+			if (bounds(o, slo, shi) && slo.x() <= hi.x() + g && shi.x() >= lo.x() - g && slo.y() <= hi.y() + g && shi.y() >= lo.y() - g)
+				look_around(s);
+		}
+		is_changed.resize(sections.size(), 0);
+		stitch(sections);
+		for (unsigned int s : changed)
+			sections[s].build_vertices();
+		stats.changed = (unsigned int)changed.size();
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline bool SectorEditor::add(std::vector<section>& sections, const clip_polygon& shape, const float y, const float height) {
+		clip_polygon drawn;
+		drawn.points = shape.points;
+		if (area(drawn) < 0.0)
+			std::reverse(drawn.points.begin(), drawn.points.end());
+		drawn.tags.assign(drawn.points.size(), (int)new_wall);
+		vec2 lo, hi;
+		if (!bounds(drawn, lo, hi))
+			return false;
+
+		// Everything's clipped first, so nothing changes if any of it fails.
+		std::vector<cut> cuts;
+		std::vector<clip_polygon> pieces;
+		if (!cut_out(sections, drawn, lo, hi, cuts) || !clipper.partition({ drawn }, new_wall, pieces) || pieces.empty())
+			return false;
+
+		begin(sections);
+		for (const cut& c : cuts)
+			place(sections, &c.id, 1, c.pieces, properties_of(sections[c.id]));
+		const properties p = { y, height, 0.f, 0 };
+		place(sections, NULL, 0, pieces, p);
+		finish(sections, lo, hi);
+		return true;
+	}
+
+	inline bool SectorEditor::subtract(std::vector<section>& sections, const clip_polygon& shape) {
+		clip_polygon drawn;
+		drawn.points = shape.points;
+		drawn.tags.assign(drawn.points.size(), (int)new_wall);
+		vec2 lo, hi;
+		std::vector<cut> cuts;
+		if (!bounds(drawn, lo, hi) || !cut_out(sections, drawn, lo, hi, cuts))
+			return false;
+
+		begin(sections);
+		for (const cut& c : cuts)
+			place(sections, &c.id, 1, c.pieces, properties_of(sections[c.id]));
+		finish(sections, lo, hi);
+		return true;
+	}
+
+	inline bool SectorEditor::merge(std::vector<section>& sections, const unsigned int a, const unsigned int b) {
+		if (a == b || a >= sections.size() || b >= sections.size() || !sections[a].get_verts() || !sections[b].get_verts())
+			return false;
+		std::vector<clip_polygon> joined, pieces;
+		if (!clipper.clip(CLIP_UNION, outline(sections[a]), outline(sections[b]), joined))
+			return false;
+		int outers = 0;
+		for (const clip_polygon& p : joined)
+			outers += area(p) > 0.0;
+		if (outers != 1) {
+			std::cout << "SectorEditor: sections " << a << " and " << b << " don't share a wall.\n";
+			return false;
+		}
+		vec2 lo, hi;
+		if (!clipper.partition(joined, new_wall, pieces) || !bounds(joined[0], lo, hi))
+			return false;
+
+		begin(sections);
+		const unsigned int ids[2] = { a, b };
+		place(sections, ids, 2, pieces, properties_of(sections[a]));
+		finish(sections, lo, hi);
+		return true;
+	}
+
+	inline bool SectorEditor::split(std::vector<section>& sections, const unsigned int id, const vec2& p0, const vec2& p1) {
+		if (id >= sections.size() || !sections[id].get_verts())
+			return false;
+		const clip_polygon o = outline(sections[id]);
+		std::vector<clip_polygon> left, right, pieces;
+		if (!clipper.split(o, p0, p1, new_wall, left, right))
+			return false;
+		if (left.empty() || right.empty()) {
+			std::cout << "SectorEditor: the line doesn't cross section " << id << ".\n";
+			return false;
+		}
+		if (!clipper.partition(left, new_wall, pieces) || !clipper.partition(right, new_wall, pieces))
+			return false;
+		vec2 lo, hi;
+		bounds(o, lo, hi);
+
+		begin(sections);
+		place(sections, &id, 1, pieces, properties_of(sections[id]));
+		finish(sections, lo, hi);
+		return true;
+	}
+}
+
+#endif // !GEN_ENG_SECTOR_EDIT_H
@@ -0,0 +1,227 @@
+#pragma once
+#ifndef GEN_ENG_SECTOR_LIGHT_H
+#define GEN_ENG_SECTOR_LIGHT_H
+
+#include "level_editor/level_data.h"
+#include "util/job_system.h"
+
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+/*	Sector lighting.
+		Every section has a light level, and light spreads to its neighbors through portals (wall_vert::neighbor), losing a fixed fraction at each
+		one: a section's light is the brightest of its own level and its neighbors' light times portal_falloff. That's a widest path problem,
+		solved like Dijkstra's shortest paths, with the brightest section taken first.
+
+		The light is then baked into each section's vertex stream (the 4th float of every vertex), with a gradient near portals to brighter
+		sections: a vertex gets the section's light, or the neighbor's fading by distance_falloff per unit of distance from the portal, if that's
+		brighter. Drawing a lit level costs nothing more than interpolating one value per vertex.
+
+		Baking runs on the job system, one section per job; it only reads the sections' light, and each job only writes its own section's stream.
+
+		Changing one section's level (set_light_level()) only recomputes the sections it can reach: light fades below 1/256 after so many
+		portals, so anything farther can't change by a visible amount. Those sections are propagated again, taking the light coming in from the
+		rest of the level as it is, and they and their neighbors are rebaked.
+
+		Sections must be indexed by their ID, and have their vertex stream built (section::build_vertices()).
+*/
+
+namespace GenEngine {
+
+	// Counters of the last bake.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct sector_light_stats {
+		unsigned int	propagated;		// Sections whose light was recomputed.
+		unsigned int	baked;			// Sections whose vertices were rebaked.
+		unsigned int	vertices;
+		double			ms;
+	};
+
+	class SectorLighting {
+
+		float						portal_falloff;		// Light kept through each portal.
+		float						distance_falloff;	// Light kept per unit of distance away from a portal.
+		std::vector<uint8_t>		in_region;
+		std::vector<unsigned int>	region;				// Sections being propagated.
+		std::vector<unsigned int>	bake_list;
+		sector_light_stats			stats;
+
+		inline void		propagate(std::vector<section>& sections);
+		inline void		bake(std::vector<section>& sections);
+		inline void		bake_section(std::vector<section>& sections, const unsigned int id);
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		SectorLighting() : portal_falloff(0.75f), distance_falloff(0.5f), stats{ 0, 0, 0, 0.0 } {}
+
+		// Settings (rebake everything after changing them)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_falloff(const float portal, const float distance)	{ portal_falloff = portal; distance_falloff = distance; }
+
+		// Baking
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		bake_all(std::vector<section>& sections);
+		inline void		set_light_level(std::vector<section>& sections, const unsigned int id, const float level);		// Rebakes what it affects.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const sector_light_stats&	get_stats()		const	{ return stats; }
+	};
+
+
+	// Widest paths inside the region. Sections outside it keep their light, and shine into it through their portals.
+	inline void SectorLighting::propagate(std::vector<section>& sections) {
+		std::priority_queue<std::pair<float, unsigned int>> open;
+		for (unsigned int s : region) {
+			float l = sections[s].get_light_level();
+			const wall_vert* v = sections[s].get_verts();
+			if (v)
+				do {
+					if (v->neighbor >= 0 && !in_region[v->neighbor])
+						l = std::max(l, sections[v->neighbor].get_light() * portal_falloff);
+					v = v->next;
+				} while (v && v != sections[s].get_verts());
+			sections[s].set_light(l);
+			open.push(std::make_pair(l, s));
+		}
+
+		while (!open.empty()) {
+			const float l = open.top().first;
+			const unsigned int s = open.top().second;
+			open.pop();
+			if (l < sections[s].get_light())
+				continue;		// Already reached by something brighter.
+			const float through = l * portal_falloff;
+			const wall_vert* v = sections[s].get_verts();
+			if (v)
+				do {
+					if (v->neighbor >= 0 && in_region[v->neighbor] && through > sections[v->neighbor].get_light()) {
+						sections[v->neighbor].set_light(through);
+						open.push(std::make_pair(through, (unsigned int)v->neighbor));
+					}
+					v = v->next;
+				} while (v && v != sections[s].get_verts());
+		}
+		stats.propagated = (unsigned int)region.size();
+	}
+
+	inline void SectorLighting::bake_section(std::vector<section>& sections, const unsigned int id) {
+		struct portal {
+			vec2	a, ab;
+			float	inv_len2, light;
+		};
+		section& sect = sections[id];
+		const float own = sect.get_light();
+
+		// Only portals to brighter sections change anything.
+		portal portals[64];
+		int count = 0;
+		const wall_vert* v = sect.get_verts();
+		if (v)
+			do {
+				if (v->neighbor >= 0 && v->next && count < 64) {
+					const float l = sections[v->neighbor].get_light();
+					if (l > own) {
+						portal& p = portals[count++];
+						p.a = v->coords;
+						p.ab = v->next->coords - v->coords;
+						p.inv_len2 = 1.f / std::max(p.ab.squared_length(), 1e-12f);
+						p.light = l;
+					}
+				}
+				v = v->next;
+			} while (v && v != sect.get_verts());
+
+		const float log_falloff = logf(distance_falloff);
+		std::vector<float>& verts = sect.get_vertices();
+		for (size_t i = 0; i + section::vertex_size <= verts.size(); i += section::vertex_size) {
+			float l = own;
+			const vec2 p(verts[i], verts[i + 2]);
+			for (int k = 0; k < count; k++) {
+				const vec2 ap = p - portals[k].a;
+				float t = (ap.x() * portals[k].ab.x() + ap.y() * portals[k].ab.y()) * portals[k].inv_len2;
+				t = std::min(std::max(t, 0.f), 1.f);
+				const float d = (ap - portals[k].ab * t).length();
+				l = std::max(l, portals[k].light * expf(log_falloff * d));
+			}
+			verts[i + 3] = std::min(l, 1.f);
+		}
+	}
+
+	inline void SectorLighting::bake(std::vector<section>& sections) {
+		job_system.parallel_for((unsigned int)bake_list.size(), [&](unsigned int i, unsigned int) { bake_section(sections, bake_list[i]); });
+		stats.baked = (unsigned int)bake_list.size();
+		stats.vertices = 0;
+		for (unsigned int s : bake_list)
+			stats.vertices += (unsigned int)(sections[s].get_vertices().size() / section::vertex_size);
+	}
+
+	inline void SectorLighting::bake_all(std::vector<section>& sections) {
+		auto start = std::chrono::steady_clock::now();
+		in_region.assign(sections.size(), 1);
+		region.resize(sections.size());
+		for (unsigned int i = 0; i < region.size(); i++)
+			region[i] = i;
+		propagate(sections);
+		bake_list = region;
+		bake(sections);
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void SectorLighting::set_light_level(std::vector<section>& sections, const unsigned int id, const float level) {
+		auto start = std::chrono::steady_clock::now();
+		const float reach = std::max(sections[id].get_light(), level);
+		sections[id].set_light_level(level);
+
+		// Portals after which the brighter of the old and new light is below 1/256.
+		int hops = 0;
+		if (reach > 1.f / 256.f && portal_falloff > 0.f)
+			hops = portal_falloff < 1.f ? (int)ceilf(logf(1.f / (256.f * reach)) / logf(portal_falloff)) : (int)sections.size();
+
+		// Breadth first, up to that many portals away.
+		in_region.assign(sections.size(), 0);
+		region.clear();
+		region.push_back(id);
+		in_region[id] = 1;
+		for (size_t first = 0, depth = 0; first < region.size() && (int)depth < hops; depth++) {
+			const size_t last = region.size();
+			for (size_t i = first; i < last; i++) {
+				const wall_vert* v = sections[region[i]].get_verts();
+				if (v)
+					do {
+						if (v->neighbor >= 0 && !in_region[v->neighbor]) {
+							in_region[v->neighbor] = 1;
+							region.push_back(v->neighbor);
+						}
+						v = v->next;
+					} while (v && v != sections[region[i]].get_verts());
+			}
+			first = last;
+		}
+		propagate(sections);
+
+		// Vertices near a portal depend on the light on the other side too.
+		bake_list = region;
+		for (unsigned int s : region) {
+			const wall_vert* v = sections[s].get_verts();
+			if (v)
+				do {
+					if (v->neighbor >= 0 && !in_region[v->neighbor]) {
+						in_region[v->neighbor] = 1;
+						bake_list.push_back(v->neighbor);
+					}
+					v = v->next;
+				} while (v && v != sections[s].get_verts());
+		}
+		bake(sections);
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+#endif // !GEN_ENG_SECTOR_LIGHT_H
@@ -0,0 +1,346 @@
+#pragma once
+#ifndef GEN_ENG_SNAP_INDEX_H
+#define GEN_ENG_SNAP_INDEX_H
+
+#include "util/vec.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <math.h>
+
+/*	Snapping index.
+		The x,z coordinates of the level's wall vertices (wall_vert::coords) in a hash grid, for snapping while walls and sections are drawn:
+		the vertex nearest to the cursor, the k nearest, and every vertex within a radius. Vertices come and go one at a time as the level is
+		edited, in constant time.
+
+		- Space is divided in square cells of a fixed size, and only the cells with vertices in them exist, in an open addressing hash table
+		  of their coordinates. Each keeps its vertices together in a shared pool, so looking into a cell is two cache misses at most: its slot
+		  and its block. The cell size should be about the snapping radius (the editor's grid step), so a snap looks into 4 cells at most
+		  whatever the size of the level.
+		- Nearest neighbor searches go through rings of cells around the query, closest first, until no unvisited cell can hold anything
+		  closer than what was found. They never go past the cells ever occupied, so far away queries on an empty index stay cheap.
+		- Vertices are identified by the caller's IDs, meant to be dense (positions in the level's vertex list, for instance): the place of
+		  every ID in the grid is kept in an array indexed by it, so removing or moving one doesn't search for it.
+
+		Queries don't modify the index, so any number of threads can run them while nobody edits it.
+*/
+
+namespace GenEngine {
+
+	class SnapIndex {
+
+	public:
+
+		static const unsigned int	none = 0xffffffffu;		// No vertex (snap()).
+
+	private:
+
+		static const unsigned int	max_k = 16;				// Neighbors a single k_nearest() can return.
+
+		struct entry {
+			float			x, y;
+			unsigned int	id;
+		};
+
+		// A cell, in the slot of the hash table its coordinates lead to. Its vertices are a block of the pool, moved to the end with twice
+		// the room when it fills up.
+		struct cell {
+			int				x, y;
+			unsigned int	first;			// none: free slot.
+			unsigned short	count, capacity;
+		};
+		struct location {
+			unsigned int	slot;			// none: the ID isn't in the index.
+			unsigned int	index;			// In the cell.
+		};
+
+		float						cell_size, inv_cell;
+		std::vector<cell>			table;			// A power of two long, at most half full.
+		std::vector<entry>			pool;
+		std::vector<location>		locations;		// By ID.
+		size_t						count;
+		size_t						cell_count;
+		int							min_cx, min_cy, max_cx, max_cy;		// Cells ever occupied.
+
+		inline size_t		hash(const int cx, const int cy)	const	{ return (size_t)(((uint64_t)(uint32_t)cx * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uint32_t)cy * 0xc2b2ae3d27d4eb4full) >> 32) & (table.size() - 1); }
+		inline unsigned int	find_cell(const int cx, const int cy) const;
+		inline unsigned int	get_cell(const int cx, const int cy);
+		inline void			grow();
+		inline void			compact();
+		inline unsigned int	search(const vec2& p, const unsigned int k, const float max_dist, float* dist2, unsigned int* ids) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		SnapIndex(const float cell = 1.f) : cell_size(cell), inv_cell(1.f / cell), count(0), cell_count(0), min_cx(0), min_cy(0), max_cx(-1), max_cy(-1) { clear(); }
+
+		// Editing
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		insert(const unsigned int id, const vec2& p);		// Moves it if the ID is already in.
+		inline bool		remove(const unsigned int id);						// Returns 0 if it wasn't in.
+		inline void		move(const unsigned int id, const vec2& p)	{ insert(id, p); }
+		inline void		clear();
+
+		// Queries (any thread)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		nearest(const vec2& p, const float max_dist, unsigned int& id) const;
+		inline void		k_nearest(const vec2& p, const unsigned int k, std::vector<unsigned int>& out, const float max_dist = 1e30f) const;	// Nearest first.
+		inline void		radius(const vec2& p, const float r, std::vector<unsigned int>& out) const;		// In no particular order.
+		inline vec2		snap(const vec2& p, const float r, const float grid_step = 0.f, unsigned int* id = NULL) const;
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline size_t	size()							const	{ return count; }
+		inline bool		contains(const unsigned int id)	const	{ return id < locations.size() && locations[id].slot != none; }
+		inline vec2		get_position(const unsigned int id) const;
+	};
+
+
+	inline unsigned int SnapIndex::find_cell(const int cx, const int cy) const {
+		for (size_t s = hash(cx, cy);; s = (s + 1) & (table.size() - 1)) {
+			const cell& c = table[s];
+			if (c.first == none)
+				return none;
+			if (c.x == cx && c.y == cy)
+				return (unsigned int)s;
+		}
+	}
+
+	inline unsigned int SnapIndex::get_cell(const int cx, const int cy) {
+		size_t s = hash(cx, cy);
+		for (; table[s].first != none; s = (s + 1) & (table.size() - 1))
+			if (table[s].x == cx && table[s].y == cy)
+				return (unsigned int)s;
+
+		// Cells are never deleted, only emptied: vertices being dragged around keep coming back to the same ones.
+		if ((cell_count + 1) * 2 > table.size()) {
+			grow();
+			return get_cell(cx, cy);
+		}
+		cell& c = table[s];
+		c.x = cx;
+		c.y = cy;
+		c.first = (unsigned int)pool.size();
+		c.count = 0;
+		c.capacity = 1;
+		pool.resize(pool.size() + 1);
+		if (!cell_count++) {
+			min_cx = max_cx = cx;
+			min_cy = max_cy = cy;
+		}
+		else {
+			min_cx = std::min(min_cx, cx);
+			min_cy = std::min(min_cy, cy);
+			max_cx = std::max(max_cx, cx);
+			max_cy = std::max(max_cy, cy);
+		}
+		return (unsigned int)s;
+	}
+
+	// Twice the slots. The cells change places, so the locations of their vertices are updated.
+	inline void SnapIndex::grow() {
+		std::vector<cell> old;
+		old.swap(table);
+		table.resize(old.size() * 2);
+		for (cell& c : table)
+			c.first = none;
+		for (const cell& c : old) {
+			if (c.first == none)
+				continue;
+			size_t s = hash(c.x, c.y);
+			while (table[s].first != none)
+				s = (s + 1) & (table.size() - 1);
+			table[s] = c;
+			for (unsigned int i = 0; i < c.count; i++)
+				locations[pool[c.first + i].id].slot = (unsigned int)s;
+		}
+	}
+
+	// Blocks left behind by cells that outgrew them are reclaimed once they're half the pool.
+	inline void SnapIndex::compact() {
+		std::vector<entry> packed;
+		packed.reserve(count + cell_count);
+		for (cell& c : table) {
+			if (c.first == none)
+				continue;
+			const unsigned int first = (unsigned int)packed.size();
+			packed.insert(packed.end(), pool.begin() + c.first, pool.begin() + c.first + c.count);
+			packed.resize(first + std::max<unsigned int>(c.count, 1));
+			c.first = first;
+			c.capacity = (unsigned short)std::max<unsigned int>(c.count, 1);
+		}
+		pool.swap(packed);
+	}
+
+	inline void SnapIndex::insert(const unsigned int id, const vec2& p) {
+		remove(id);
+		if (id >= locations.size())
+			locations.resize(std::max((size_t)id + 1, locations.size() * 2), { none, 0 });
+		const unsigned int s = get_cell((int)floorf(p.x() * inv_cell), (int)floorf(p.y() * inv_cell));
+		cell& c = table[s];
+		if (c.count == c.capacity) {
+			if (c.capacity == 0xffff) {
+				std::cout << "SnapIndex: too many vertices in a cell, (" << p.x() << ", " << p.y() << ") not inserted.\n";
+				return;
+			}
+			const unsigned int first = (unsigned int)pool.size();
+			pool.resize(pool.size() + std::min(c.capacity * 2, 0xffff));
+			std::copy(pool.begin() + c.first, pool.begin() + c.first + c.count, pool.begin() + first);
+			c.first = first;
+			c.capacity = (unsigned short)std::min(c.capacity * 2, 0xffff);
+		}
+		locations[id].slot = s;
+		locations[id].index = c.count;
+		pool[c.first + c.count++] = { p.x(), p.y(), id };
+		count++;
+		if (pool.size() > 2 * (count + cell_count) + 1024)
+			compact();
+	}
+
+	inline bool SnapIndex::remove(const unsigned int id) {
+		if (!contains(id))
+			return false;
+		location& l = locations[id];
+		cell& c = table[l.slot];
+		pool[c.first + l.index] = pool[c.first + c.count - 1];
+		locations[pool[c.first + l.index].id].index = l.index;
+		c.count--;
+		l.slot = none;
+		count--;
+		return true;
+	}
+
+	inline void SnapIndex::clear() {
+		table.resize(1024);
+		for (cell& c : table)
+			c.first = none;
+		pool.clear();
+		locations.clear();
+		count = cell_count = 0;
+		min_cx = min_cy = 0;
+		max_cx = max_cy = -1;
+	}
+
+	inline vec2 SnapIndex::get_position(const unsigned int id) const {
+		if (!contains(id))
+			return vec2();
+		const entry& e = pool[table[locations[id].slot].first + locations[id].index];
+		return vec2(e.x, e.y);
+	}
+
+	// Up to k nearest within max_dist, sorted, in ring order: ring r holds the cells at a Chebyshev distance r from the query's. Returns how
+	// many were found.
+	inline unsigned int SnapIndex::search(const vec2& p, const unsigned int k, const float max_dist, float* dist2, unsigned int* ids) const {
+		if (!count || !k)
+			return 0;
+		const int cx = (int)floorf(p.x() * inv_cell), cy = (int)floorf(p.y() * inv_cell);
+
+		// Distance from the query to the edges of its own cell: anything in ring r + 1 is at least r cells plus that away.
+		const float fx = p.x() - cx * cell_size, fy = p.y() - cy * cell_size;
+		const float inner = std::max(std::min(std::min(fx, cell_size - fx), std::min(fy, cell_size - fy)), 0.f);
+		const float max_d2 = max_dist * max_dist;
+		unsigned int found = 0;
+
+		auto visit = [&](const int x, const int y) {
+			if (x < min_cx || x > max_cx || y < min_cy || y > max_cy)
+				return;
+
+			// Cells farther than what's already been found (or than max_dist) aren't even looked up.
+			const float bx = std::max(std::max(x * cell_size - p.x(), p.x() - (x + 1) * cell_size), 0.f);
+			const float by = std::max(std::max(y * cell_size - p.y(), p.y() - (y + 1) * cell_size), 0.f);
+			const float box_d2 = bx * bx + by * by;
+			if (box_d2 > max_d2 || (found == k && box_d2 >= dist2[k - 1]))
+				return;
+			const unsigned int s = find_cell(x, y);
+			if (s == none)
+				return;
+			const cell& c = table[s];
+			for (const entry* e = &pool[c.first]; e != &pool[c.first] + c.count; e++) {
+				const float dx = e->x - p.x(), dy = e->y - p.y(), d2 = dx * dx + dy * dy;
+				if (d2 > max_d2 || (found == k && d2 >= dist2[k - 1]))
+					continue;
+				unsigned int i = found < k ? found++ : k - 1;
+				for (; i > 0 && dist2[i - 1] > d2; i--) {
+					dist2[i] = dist2[i - 1];
+					ids[i] = ids[i - 1];
+				}
+				dist2[i] = d2;
+				ids[i] = e->id;
+			}
+		};
+
+		for (int r = 0;; r++) {
+			if (!r)
+				visit(cx, cy);
+			else {
+				for (int x = cx - r; x <= cx + r; x++) {
+					visit(x, cy - r);
+					visit(x, cy + r);
+				}
+				for (int y = cy - r + 1; y < cy + r; y++) {
+					visit(cx - r, y);
+					visit(cx + r, y);
+				}
+			}
+			const float bound = r * cell_size + inner;
+			if (bound > max_dist || (found == k && dist2[k - 1] <= bound * bound))
+				break;
+			if (cx - r <= min_cx && cx + r >= max_cx && cy - r <= min_cy && cy + r >= max_cy)
+				break;		// Every occupied cell has been visited.
+		}
+		return found;
+	}
+
+	inline bool SnapIndex::nearest(const vec2& p, const float max_dist, unsigned int& id) const {
+		float d2;
+		return search(p, 1, max_dist, &d2, &id) == 1;
+	}
+
+	inline void SnapIndex::k_nearest(const vec2& p, const unsigned int k, std::vector<unsigned int>& out, const float max_dist) const {
+		float dist2[max_k];
+		unsigned int ids[max_k];
+		const unsigned int found = search(p, k < max_k ? k : max_k, max_dist, dist2, ids);
+		out.insert(out.end(), ids, ids + found);
+	}
+
+	inline void SnapIndex::radius(const vec2& p, const float r, std::vector<unsigned int>& out) const {
+		if (!count)
+			return;
+		const int x0 = std::max((int)floorf((p.x() - r) * inv_cell), min_cx), x1 = std::min((int)floorf((p.x() + r) * inv_cell), max_cx);
+		const int y0 = std::max((int)floorf((p.y() - r) * inv_cell), min_cy), y1 = std::min((int)floorf((p.y() + r) * inv_cell), max_cy);
+		const float r2 = r * r;
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++) {
+				const unsigned int s = find_cell(x, y);
+				if (s == none)
+					continue;
+				const cell& c = table[s];
+				for (const entry* e = &pool[c.first]; e != &pool[c.first] + c.count; e++) {
+					const float dx = e->x - p.x(), dy = e->y - p.y();
+					if (dx * dx + dy * dy <= r2)
+						out.push_back(e->id);
+				}
+			}
+	}
+
+	// The nearest vertex within r; failing that, the nearest point of the grid (if grid_step > 0), or p itself. id: the vertex snapped to,
+	// or SnapIndex::none.
+	inline vec2 SnapIndex::snap(const vec2& p, const float r, const float grid_step, unsigned int* id) const {
+		unsigned int v;
+		if (id)
+			*id = none;
+		if (nearest(p, r, v)) {
+			if (id)
+				*id = v;
+			return get_position(v);
+		}
+		if (grid_step > 0.f)
+			return vec2(floorf(p.x() / grid_step + 0.5f) * grid_step, floorf(p.y() / grid_step + 0.5f) * grid_step);
+		return p;
+	}
+}
+
+#endif // !GEN_ENG_SNAP_INDEX_H
@@ -1,17 +1,129 @@
 
 #include "renderer/renderer.h";
+#include "level_editor/ray_benchmark.h"
+#include "level_editor/sector_light.h"
+#include "level_editor/ao_baker.h"
 
 GLFWwindow *main_window;
 
 int monitors;
 
-int main() {
-	init_GLFW();
-	GLFWmonitor** m = glfwGetMonitors(&monitors);
-	if (create_render_window(main_window, 1366, 768, "Render Window", m[1]) == -1)
+int main(int argc, char** argv) {
+	GenEngine::CommandLine cmd(argc, argv);
+	if (!GenEngine::parse_headless_args(cmd) || !GenEngine::occlusion_culler.configure(cmd) || !GenEngine::hiz_query.configure(cmd) ||
+		!GenEngine::post_aa.configure(cmd) || !GenEngine::dynamic_resolution.configure(cmd, GenEngine::headless.enabled ? 0.0 : 1000.0 / 60.0) ||
+		!GenEngine::frame_capture.configure(cmd) || !GenEngine::level_optimizer.configure(cmd) || !GenEngine::obj_loader.configure(cmd) ||
+		!GenEngine::job_system.configure(cmd) || !engine_loop.configure(cmd)) {
+		std::cout << "Usage: GenEngine [--headless <frames>] [--size <w>x<h>] [--report <file>] [--software] [--egl] [--osmesa] [--cpu] [--image <file>]\n"
+			"                 [--no-occlusion] [--no-hiz] [--aa none|msaa|fxaa] [--no-prepass] [--walls <count>] [--dynres <ms>]\n"
+			"                 [--capture <prefix>] [--capture-format png|raw] [--lights <count>] [--optimize] [--obj <file>]\n"
+			"                 [--rooms <count>] [--jobs <threads>] [--on-demand]\n"
+			"       GenEngine --rays <triangles> [--report <file>] [--jobs <threads>]\n";
 		return -1;
+	}
+	GenEngine::job_system.start();
+
+	// Ray query benchmark: CPU only, so it runs on its own, with no window or context.
+	if (cmd.value("--rays")) {
+		const bool written = GenEngine::run_ray_benchmark_mode((unsigned int)atoi(cmd.value("--rays")), GenEngine::headless.report_path);
+		GenEngine::job_system.shutdown();
+		return written ? 0 : -1;
+	}
+	depth_prepass = !cmd.has("--no-prepass");
+	const unsigned int bench_walls = cmd.value("--walls") ? (unsigned int)atoi(cmd.value("--walls")) : 0;
+	const unsigned int bench_lights = cmd.value("--lights") ? (unsigned int)atoi(cmd.value("--lights")) : 0;
+	const unsigned int bench_rooms = cmd.value("--rooms") ? (unsigned int)atoi(cmd.value("--rooms")) : 0;
+
+	// The software rasterizer needs no window or GL context, so it also runs where GL isn't usable at all.
+	if (GenEngine::headless.cpu) {
+		fb_width = GenEngine::headless.width;
+		fb_height = GenEngine::headless.height;
+	}
+	else {
+		init_GLFW();
+		if (GenEngine::headless.enabled)
+			GenEngine::prepare_headless_context();
+		GLFWmonitor** m = glfwGetMonitors(&monitors);
+		GLFWmonitor* monitor = (monitors > 1 && !GenEngine::headless.enabled) ? m[1] : NULL;
+		int w = GenEngine::headless.enabled ? GenEngine::headless.width : 1366;
+		int h = GenEngine::headless.enabled ? GenEngine::headless.height : 768;
+		if (create_render_window(main_window, w, h, "Render Window", monitor) < 0) {
+			GenEngine::job_system.shutdown();
+			return -1;
+		}
+	}
 
 	walls.push_back(GenWall(0.5f, 0.f, 0.f, -0.5f, 0.0f, 0.f, 0.f, 0.5f));
 
+	// Benchmark scene: walls stacked behind the first one, farthest first, each shifted a bit so they only partly cover each other.
+	for (unsigned int i = 0; i < bench_walls; i++) {
+		float z = -0.25f * (bench_walls - i);
+		float x = 0.3f * ((i % 5) - 2.f);
+		walls.push_back(GenWall(x + 1.f, -0.5f, z, x - 1.f, -0.5f, z, 0.f, 1.5f));
+	}
+
+	// Benchmark lights: scattered in front of and among the walls with a fixed seed, every third one a spot pointing at them. Past 16, they
+	// shrink as they get more numerous, so the lights reaching each pixel stay about the same.
+	unsigned int seed = 12345;
+	auto random = [&seed](float lo, float hi) { seed = seed * 1664525u + 1013904223u; return lo + (hi - lo) * (seed >> 8) / 16777216.f; };
+	for (unsigned int i = 0; i < bench_lights; i++) {
+		GenEngine::light l;
+		l.position = vec3(random(-2.f, 2.f), random(-0.5f, 1.5f), random(-4.f, 1.f));
+		l.radius = random(0.3f, 0.8f) * std::min(1.f, cbrtf(16.f / bench_lights));
+		l.color = vec3(random(0.2f, 1.f), random(0.2f, 1.f), random(0.2f, 1.f)) * 1.5f;
+		l.direction = vec3(0.f, 0.f, -1.f);
+		l.cos_outer = i % 3 == 2 ? 0.866f : -2.f;		// 30 degrees.
+		l.cos_inner = i % 3 == 2 ? 0.94f : -1.f;		// 20 degrees.
+		lights.push_back(l);
+	}
+
+	// Benchmark level: a square grid of small rooms behind the walls, every 7th one bright and the rest dim, with the light spread through the
+	// portals and the ambient occlusion baked into the vertices.
+	if (bench_rooms) {
+		const int side = (int)ceilf(sqrtf((float)bench_rooms));
+		GenEngine::build_room_grid(side, 1.f, vec3(-0.5f * side, -1.f, -0.5f - side), seed, section_verts, sections);
+		for (size_t i = 0; i < sections.size(); i++)
+			sections[i].set_light_level(i % 7 == 0 ? 1.f : 0.1f);
+		GenEngine::SectorLighting sector_lighting;
+		sector_lighting.bake_all(sections);
+		GenEngine::AOBaker ao_baker;
+		ao_baker.prepare(sections);
+		ao_baker.bake(sections);
+		for (GenEngine::section& s : sections)
+			s.gen_vao();
+		std::cout << "Level: " << sections.size() << " rooms, light baked in " << sector_lighting.get_stats().ms << " ms, ambient occlusion in "
+			<< ao_baker.get_stats().ms << " ms.\n";
+	}
+
+	// Meshes from a file. Kept apart from the walls, the level optimizer and picking only know about walls.
+	if (GenEngine::obj_loader.get_file()) {
+		std::vector<GenEngine::obj_mesh> loaded;
+		if (!GenEngine::obj_loader.load(GenEngine::obj_loader.get_file(), loaded)) {
+			GenEngine::job_system.shutdown();
+			return -1;
+		}
+		meshes.resize(loaded.size());
+		for (size_t i = 0; i < loaded.size(); i++)
+			GenEngine::obj_loader.to_object(loaded[i], meshes[i]);
+		const GenEngine::obj_load_stats& ls = GenEngine::obj_loader.get_stats();
+		std::cout << "Loaded " << ls.meshes << " meshes, " << ls.triangles << " triangles from " << GenEngine::obj_loader.get_file() << " in " << ls.ms << " ms.\n";
+	}
+
+	// Level optimization, before the render thread starts: it changes the vector of walls.
+	if (GenEngine::level_optimizer.is_enabled()) {
+		GenEngine::level_optimizer.optimize_walls(walls);
+		GenEngine::level_optimizer.index_walls(walls, wall_batches);
+		const GenEngine::level_optimize_stats& os = GenEngine::level_optimizer.get_stats();
+		std::cout << "Level optimized: " << os.walls[0] << " -> " << os.walls[1] << " walls, " << os.vertices[0] << " -> " << os.vertices[1] << " vertices in "
+			<< os.ms << " ms, " << GenEngine::level_optimizer.get_index_stats().batches << " batches. ACMR " << GenEngine::level_optimizer.get_acmr(0) << " -> "
+			<< GenEngine::level_optimizer.get_acmr(2) << ".\n";
+	}
+
+	// Headless runs measure how fast frames can be produced, so they're never capped, and render every frame even with --on-demand.
+	engine_loop.set_frame_cap(GenEngine::headless.enabled ? 0.0 : 60.0);
+	if (GenEngine::headless.enabled)
+		engine_loop.set_render_on_demand(false);
+
 	render(main_window);
+	GenEngine::job_system.shutdown();
 }
\ No newline at end of file
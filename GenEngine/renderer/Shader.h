@@ -13,6 +13,7 @@
 #include <sstream>
 #include "util/vec.h"
 #include "util/glad/glad.h"
+#include "renderer/gl_state.h"
 class Shader 
 {
 public:
@@ -91,7 +92,7 @@ public:
 	}
 	inline void use() const //simplemente llama a usar el shaderProgram
 	{
-		glUseProgram(ID);
+		GenEngine::gl_state.use_program(ID);
 	}
 	//funciones de utilidad
 	//NOTA IMPORTANTE: SOLO DEBEN USARSE CON UNIFORMS QUE ESTN DECLARADOS. NO FUNCIONAN CON UNIFORMS NO DECLARADOS NI DECLARAN LOS UNIFORMS QUE NO EXISTAN!!!!!!
@@ -108,6 +109,14 @@ public:
 		glUniform4f(glGetUniformLocation(ID, name.c_str()),x,y,z,w);
 	}
 
+	void setVec2i(const std::string &name, int x, int y) const{
+		glUniform2i(glGetUniformLocation(ID, name.c_str()), x, y);
+	}
+
+	void setVec2f(const std::string &name, float x, float y) const{
+		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+	}
+
 	void setVec3f(const std::string &name, float x, float y, float z) const{
 		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
 	}
@@ -125,6 +134,12 @@ public:
 	void setMat4f(const std::string &name, const mat4x4 &matrix) const {
 		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &matrix.e[0]); //se seala el puntero de donde inicia la matriz. tambin funciona value_ptr(matrix)
 	}
+	//asigna un uniform block del programa a un binding point de GL_UNIFORM_BUFFER
+	void bindUniformBlock(const std::string &name, GLuint binding) const {
+		GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
 private:
 	void checkCompileErrors(unsigned int programID, const char* argumentType)
 	{
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef GEN_ENG_ANTIALIASING_H
+#define GEN_ENG_ANTIALIASING_H
+
+#include "glad/glad.h"
+#include "renderer/Shader.h"
+#include "renderer/gl_state.h"
+#include "renderer/gpu_timer.h"
+#include "util/options.h"
+
+#include <algorithm>
+#include <string.h>
+
+/*	Anti-aliasing.
+		The scene is always drawn offscreen; this is the step that takes it from there to the screen. Replaces GL_POLYGON_SMOOTH/GL_LINE_SMOOTH,
+		which many drivers implement with slow paths or software fallbacks (and which need sorted geometry to look right anyway).
+
+		- AA_NONE: the scene target is copied to the screen as it is.
+		- AA_MSAA: the scene is drawn into multisampled textures instead (get_samples(): 4, or GL_MAX_SAMPLES if lower), which are resolved into
+		  single sampled ones before anything else reads them, then copied to the screen. Most of its cost is in the scene pass itself.
+		- AA_FXAA: a fullscreen triangle runs shaders/fs_fxaa.fs over the scene target's color on its way to the screen. Fixed cost of one pass
+		  over the screen, with at most 20 fetches per pixel and 5 for pixels that aren't on an edge.
+
+		The final pass also upscales the scene when it was drawn at a lower resolution than the window's (dynamic resolution): FXAA samples it
+		bilinearly, the plain copy is filtered linearly.
+
+		The time the GPU spends in the resolve and the final pass is measured every frame (get_timer()), so the modes can be compared. Both run as
+		passes of the render graph, which binds the framebuffer they draw into.
+
+		--aa selects the mode (none, msaa or fxaa; fxaa by default, also outside headless runs). Headless reports give the GPU time of the
+		resolve and final pass as "aa", which is part of the "gpu" time.
+
+		Render thread only. The mode can be changed at any time.
+*/
+
+namespace GenEngine {
+
+	enum aa_mode { AA_NONE, AA_MSAA, AA_FXAA };
+
+	class PostAA {
+
+		static const int	msaa_samples = 4;
+
+		aa_mode			mode;
+		int				samples;			// MSAA samples actually used, once the context was asked for its maximum.
+		Shader			fxaa;
+		GLuint			vao;
+		GpuTimer		timer;
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		PostAA() : mode(AA_FXAA), samples(0), vao(0), timer(GL_TIMESTAMP) {}
+		~PostAA() {}		// GL objects can only be released with the context current; call destroy() from the render thread.
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void			set_mode(const aa_mode m)	{ mode = m; }
+		inline bool			set_mode(const char* name);		// "none", "msaa" or "fxaa". Returns 0 if the name is unknown.
+		inline bool			configure(const CommandLine& cmd)	{ return !cmd.value("--aa") || set_mode(cmd.value("--aa")); }
+
+		// Frame (render thread)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline int			get_samples();		// Samples the scene has to be drawn with, 0 for single sampled.
+		inline void			resolve(const GLuint src_fbo, const int w, const int h, const unsigned long long id = 0);
+		inline void			present(const GLuint src_color, const GLuint src_fbo, const int src_w, const int src_h, const int w, const int h,
+								const unsigned long long id = 0);
+		inline void			destroy();
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline aa_mode		get_mode()		const	{ return mode; }
+		inline const char*	get_name()		const	{ return mode == AA_MSAA ? "msaa" : (mode == AA_FXAA ? "fxaa" : "none"); }
+		inline GpuTimer&	get_timer()				{ return timer; }		// GPU time of resolve() and present(), tagged with their id.
+	};
+
+	PostAA post_aa;		// Render thread only, set up before it starts.
+
+
+	inline bool PostAA::set_mode(const char* name) {
+		if (!strcmp(name, "none"))
+			mode = AA_NONE;
+		else if (!strcmp(name, "msaa"))
+			mode = AA_MSAA;
+		else if (!strcmp(name, "fxaa"))
+			mode = AA_FXAA;
+		else
+			return false;
+		return true;
+	}
+
+	inline int PostAA::get_samples() {
+		if (mode != AA_MSAA)
+			return 0;
+		if (!samples) {
+			GLint max_samples = 0;
+			glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+			samples = max_samples < msaa_samples ? std::max(1, max_samples) : msaa_samples;
+		}
+		return samples;
+	}
+
+	// MSAA only: resolves the multisampled color and depth of src_fbo into the framebuffer bound for drawing. Depth samples can't be averaged,
+	// so the depth resolve keeps one of them per pixel; it's still a depth that was really drawn there, which is all later passes need.
+	inline void PostAA::resolve(const GLuint src_fbo, const int w, const int h, const unsigned long long id) {
+		timer.begin(id);
+		gl_state.bind_framebuffer(GL_READ_FRAMEBUFFER, src_fbo);
+		glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+
+	// Puts the scene (src_color, also attached to src_fbo) on the framebuffer bound for drawing, of size w x h, scaled if its size is different.
+	inline void PostAA::present(const GLuint src_color, const GLuint src_fbo, const int src_w, const int src_h, const int w, const int h,
+		const unsigned long long id) {
+		if (mode != AA_MSAA)
+			timer.begin(id);
+
+		if (mode == AA_FXAA) {
+			if (!vao) {
+				glGenVertexArrays(1, &vao);
+				fxaa.compile("shaders/vs_fullscreen.vs", "shaders/fs_fxaa.fs");
+			}
+			gl_state.disable(GL_DEPTH_TEST);
+			gl_state.disable(GL_BLEND);
+			gl_state.bind_vertex_array(vao);
+			fxaa.use();
+			fxaa.setInt("src", 0);
+			fxaa.setVec2f("texel", 1.f / src_w, 1.f / src_h);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, src_color);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		else {
+			gl_state.bind_framebuffer(GL_READ_FRAMEBUFFER, src_fbo);
+			glBlitFramebuffer(0, 0, src_w, src_h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, src_w == w && src_h == h ? GL_NEAREST : GL_LINEAR);
+		}
+		timer.end();
+	}
+
+	inline void PostAA::destroy() {
+		timer.destroy();
+		if (vao) {
+			gl_state.forget_vertex_array(vao);
+			glDeleteVertexArrays(1, &vao);
+			vao = 0;
+		}
+	}
+}
+
+#endif // !GEN_ENG_ANTIALIASING_H
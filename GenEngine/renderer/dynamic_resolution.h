@@ -0,0 +1,133 @@
+#pragma once
+#ifndef GEN_ENG_DYNAMIC_RESOLUTION_H
+#define GEN_ENG_DYNAMIC_RESOLUTION_H
+
+#include "util/options.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+/*	Dynamic resolution.
+		The scene is rendered at a fraction of the window's size, chosen every frame to keep the GPU frame time under a budget, and upscaled by
+		the anti-aliasing pass. On weak GPUs (or software GL) the frame rate holds under heavy scenes instead of dropping; the image gets softer.
+
+		The controller follows a smoothed frame time. GPU cost is taken as proportional to the pixel count, so the scale of each side moves by
+		the square root of (target / measured):
+		- Over budget, it drops right away, as far as needed.
+		- Under 80% of the budget, it grows back by at most 10% per step, so a short quiet moment doesn't cause an oscillation.
+		- After every change it waits a few frames, since GPU times arrive that late, and the frames in between were still drawn at the old size.
+
+		The scale is rounded to 1/32 steps, so the render graph doesn't reallocate its textures for changes nobody would notice.
+
+		--dynres sets the budget in milliseconds. Without it, windowed runs aim at 60 fps and headless ones keep a fixed resolution, so runs are
+		repeatable. The report gives the average and minimum scale and how many times it changed.
+
+		Render thread only.
+*/
+
+namespace GenEngine {
+
+	struct dynamic_resolution_stats {
+		unsigned int	frames;			// Frames measured.
+		double			scale_sum;		// For the average.
+		double			scale_min;
+		unsigned int	changes;
+	};
+
+	class DynamicResolution {
+
+		static const int	settle_frames = 4;		// Frames to wait after a change (as long as the GPU timer's ring).
+
+		double		budget_ms;			// 0: disabled, always at max_scale.
+		double		min_scale, max_scale;
+		double		scale;				// Of each side of the window.
+		double		smoothed_ms;		// Negative until the first measure.
+		int			cooldown;
+		dynamic_resolution_stats	stats;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		DynamicResolution() : budget_ms(0.0), min_scale(0.5), max_scale(1.0), scale(1.0), smoothed_ms(-1.0), cooldown(0), stats{ 0, 0.0, 1.0, 0 } {}
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_budget(const double ms)							{ budget_ms = ms; }
+		inline void		set_limits(const double min_s, const double max_s)	{ min_scale = min_s; max_scale = max_s; scale = std::min(std::max(scale, min_s), max_s); }
+		inline bool		configure(const CommandLine& cmd, const double default_ms);
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		update(const double frame_ms);		// Call with each new frame time measured.
+		inline void		get_size(const int w, const int h, int& sw, int& sh) const;
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool								is_enabled()	const	{ return budget_ms > 0.0; }
+		inline double							get_scale()		const	{ return is_enabled() ? scale : max_scale; }
+		inline const dynamic_resolution_stats&	get_stats()		const	{ return stats; }
+		inline void								report(report_counters& counters) const;
+	};
+
+	DynamicResolution dynamic_resolution;		// Render thread only, set up before it starts.
+
+
+	inline bool DynamicResolution::configure(const CommandLine& cmd, const double default_ms) {
+		budget_ms = cmd.value("--dynres") ? atof(cmd.value("--dynres")) : default_ms;
+		return budget_ms >= 0.0;
+	}
+
+
+	inline void DynamicResolution::update(const double frame_ms) {
+		if (!is_enabled())
+			return;
+
+		// A single hitch (a shader being compiled, a resize...) shouldn't throw the scale to its minimum.
+		const double ms = std::min(frame_ms, 2.0 * budget_ms);
+		smoothed_ms = smoothed_ms < 0.0 ? ms : smoothed_ms + 0.2 * (ms - smoothed_ms);
+
+		stats.frames++;
+		stats.scale_sum += scale;
+		stats.scale_min = std::min(stats.scale_min, scale);
+
+		if (cooldown > 0) {
+			cooldown--;
+			return;
+		}
+
+		// Aim a bit under the budget, and leave it alone while it's between 80% and 100% of it.
+		double wanted = scale;
+		const double target = 0.9 * budget_ms;
+		if (smoothed_ms > budget_ms)
+			wanted = scale * sqrt(target / smoothed_ms);
+		else if (smoothed_ms < 0.8 * budget_ms)
+			wanted = std::min(scale * 1.1, scale * sqrt(target / smoothed_ms));
+		wanted = std::min(std::max(floor(wanted * 32.0 + 0.5) / 32.0, min_scale), max_scale);
+		if (wanted == scale)
+			return;
+
+		// The next frames will be cheaper (or more expensive) roughly by the change in pixel count.
+		smoothed_ms *= (wanted * wanted) / (scale * scale);
+		scale = wanted;
+		cooldown = settle_frames;
+		stats.changes++;
+	}
+
+	inline void DynamicResolution::get_size(const int w, const int h, int& sw, int& sh) const {
+		const double s = get_scale();
+		sw = std::max(1, (int)(w * s + 0.5));
+		sh = std::max(1, (int)(h * s + 0.5));
+	}
+
+	inline void DynamicResolution::report(report_counters& counters) const {
+		if (!is_enabled())
+			return;
+		counters.push_back(std::make_pair("resolution scale avg", stats.scale_sum / std::max(stats.frames, 1u)));
+		counters.push_back(std::make_pair("resolution scale min", stats.scale_min));
+		counters.push_back(std::make_pair("resolution changes", (double)stats.changes));
+	}
+}
+
+#endif // !GEN_ENG_DYNAMIC_RESOLUTION_H
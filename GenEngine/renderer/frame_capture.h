@@ -0,0 +1,305 @@
+#pragma once
+#ifndef GEN_ENG_FRAME_CAPTURE_H
+#define GEN_ENG_FRAME_CAPTURE_H
+
+#include "glad/glad.h"
+#include "renderer/gl_state.h"
+#include "util/image_write.h"
+#include "util/options.h"
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+/*	Frame capture.
+		Writes rendered frames to disk (PNG or binary PPM, one file per frame) for regression comparisons and offline profiling, without
+		stalling the render thread:
+
+		- capture() only queues a glReadPixels of the finished frame into a pixel buffer object and fences it; the copy happens on the GPU's
+		  time. There's a ring of 3 of them, so a readback is mapped 2 frames after it was started, when the GPU finished it long ago. If the
+		  ring is full (the GPU is more than 3 frames behind), the frame is dropped rather than waited for.
+		- Mapped readbacks are copied into a buffer and handed to a worker thread, which flips the rows, drops the alpha channel and encodes the
+		  file (util/image_write.h). The buffers are reused. If the encoder falls behind by more than 8 frames, new frames are dropped instead of
+		  piling up in memory.
+
+		Files are named <prefix><frame number, 6 digits>.png (or .ppm). --capture <prefix> captures every frame from the start (--capture-format
+		raw: binary PPM); outside headless runs, F12 toggles it. The report counts the frames written and dropped, and the encoding time.
+
+		capture(), poll() and finish() need the context current: the render thread, or the main thread once the render thread stopped. finish()
+		is the only call that waits, for the readbacks still in flight and the frames still being encoded.
+*/
+
+namespace GenEngine {
+
+	enum capture_format { CAPTURE_PNG, CAPTURE_RAW };
+
+	struct frame_capture_stats {
+		unsigned int	queued;			// Readbacks started.
+		unsigned int	written;		// Files written.
+		unsigned int	dropped;		// Frames skipped because the readbacks or the encoder were too far behind.
+		unsigned int	failed;			// Files that couldn't be written.
+		double			bytes;			// Written, total.
+		double			encode_ms;		// Worker time, total.
+	};
+
+	class FrameCapture {
+
+		static const int	readback_slots = 3;
+		static const size_t	max_pending = 8;		// Frames waiting for the encoder.
+
+		struct readback {
+			GLuint				pbo;
+			GLsizeiptr			size;
+			GLsync				fence;			// NULL if the slot is free.
+			int					width, height;
+			unsigned long long	frame;
+		};
+
+		struct image {
+			std::vector<unsigned char>	rgba;	// As read, rows bottom to top.
+			int							width, height;
+			unsigned long long			frame;
+		};
+
+		readback		slots[readback_slots];
+		int				next_slot;
+		std::string		prefix;
+		capture_format	format;
+
+		std::thread					worker;
+		std::mutex					mutex;			// Guards everything below.
+		std::condition_variable		wake;
+		std::deque<image>			pending;
+		std::vector<std::vector<unsigned char>>	spare;		// Buffers of frames already written.
+		bool						quit;
+		frame_capture_stats			stats;
+		bool						requested;		// Main thread: captures asked for the packets built.
+
+		inline void		collect(const bool wait);	// Hands the readbacks the GPU finished to the worker.
+		inline void		worker_loop();
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		FrameCapture() : next_slot(0), prefix("capture_"), format(CAPTURE_PNG), quit(false), stats{ 0, 0, 0, 0, 0.0, 0.0 }, requested(false) {
+			for (int i = 0; i < readback_slots; i++)
+				slots[i] = { 0, 0, NULL, 0, 0, 0 };
+		}
+		~FrameCapture() {}		// finish() must have been called; GL objects can only be released with the context current (destroy()).
+
+		// Settings (before the first capture)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_prefix(const char* p)				{ prefix = p; }
+		inline bool		set_format(const char* name);		// "png" or "raw". Returns 0 if the name is unknown.
+		inline bool		configure(const CommandLine& cmd);
+
+		// Main thread
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_requested(const bool r)		{ requested = r; }
+		inline bool		is_requested()			const	{ return requested; }
+
+		// Frame (context current)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		capture(const GLuint fbo, const int w, const int h, const unsigned long long frame);		// Color of fbo, as it's now.
+		inline void		poll()		{ collect(false); }		// Every frame, to write the frames captured earlier.
+		inline void		finish();
+		inline void		destroy();
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline frame_capture_stats	get_stats()		{ std::lock_guard<std::mutex> lock(mutex); return stats; }
+		inline void					report(report_counters& counters);		// After finish().
+	};
+
+	FrameCapture frame_capture;		// Used by the render thread, finished by the main thread after it stops. Packets ask for captures.
+
+
+	inline bool FrameCapture::set_format(const char* name) {
+		if (!strcmp(name, "png"))
+			format = CAPTURE_PNG;
+		else if (!strcmp(name, "raw"))
+			format = CAPTURE_RAW;
+		else
+			return false;
+		return true;
+	}
+
+	inline bool FrameCapture::configure(const CommandLine& cmd) {
+		if (cmd.value("--capture-format") && !set_format(cmd.value("--capture-format")))
+			return false;
+		if (cmd.value("--capture")) {
+			set_prefix(cmd.value("--capture"));
+			requested = true;
+		}
+		return true;
+	}
+
+	inline void FrameCapture::capture(const GLuint fbo, const int w, const int h, const unsigned long long frame) {
+		collect(false);
+		if (!worker.joinable()) {
+			quit = false;
+			worker = std::thread(&FrameCapture::worker_loop, this);
+		}
+
+		readback& rb = slots[next_slot];
+		if (rb.fence) {
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.dropped++;
+			return;
+		}
+
+		const GLsizeiptr bytes = (GLsizeiptr)w * h * 4;
+		if (!rb.pbo)
+			glGenBuffers(1, &rb.pbo);
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+		if (rb.size < bytes) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			rb.size = bytes;
+		}
+		gl_state.bind_framebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+		rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		rb.width = w;
+		rb.height = h;
+		rb.frame = frame;
+		next_slot = (next_slot + 1) % readback_slots;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.queued++;
+	}
+
+	// Oldest first, so the frames reach the worker in order. Without wait, stops at the first readback the GPU hasn't finished.
+	inline void FrameCapture::collect(const bool wait) {
+		for (int n = 0; n < readback_slots; n++) {
+			readback& rb = slots[(next_slot + n) % readback_slots];
+			if (!rb.fence)
+				continue;
+			const GLenum status = glClientWaitSync(rb.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(rb.fence);
+			rb.fence = NULL;
+
+			image img;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (pending.size() >= max_pending && !wait) {
+					stats.dropped++;
+					continue;
+				}
+				if (!spare.empty()) {
+					img.rgba.swap(spare.back());
+					spare.pop_back();
+				}
+			}
+
+			const size_t bytes = (size_t)rb.width * rb.height * 4;
+			gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+			const unsigned char* data = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+			if (data) {
+				img.rgba.assign(data, data + bytes);
+				img.width = rb.width;
+				img.height = rb.height;
+				img.frame = rb.frame;
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back(std::move(img));
+				wake.notify_one();
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	inline void FrameCapture::worker_loop() {
+		std::vector<unsigned char> rgb;
+		char path[1024];
+		for (;;) {
+			image img;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return quit || !pending.empty(); });
+				if (pending.empty())
+					return;
+				img = std::move(pending.front());
+				pending.pop_front();
+			}
+			auto start = std::chrono::steady_clock::now();
+
+			// GL rows go bottom to top, image files top to bottom.
+			const int w = img.width, h = img.height;
+			rgb.resize((size_t)w * h * 3);
+			for (int y = 0; y < h; y++) {
+				const unsigned char* src = &img.rgba[(size_t)(h - 1 - y) * w * 4];
+				unsigned char* dst = &rgb[(size_t)y * w * 3];
+				for (int x = 0; x < w; x++, src += 4, dst += 3) {
+					dst[0] = src[0];
+					dst[1] = src[1];
+					dst[2] = src[2];
+				}
+			}
+			snprintf(path, sizeof(path), "%s%06llu.%s", prefix.c_str(), img.frame, format == CAPTURE_PNG ? "png" : "ppm");
+			const size_t size = format == CAPTURE_PNG ? write_png(path, rgb.data(), w, h) : write_ppm(path, rgb.data(), w, h);
+			if (!size)
+				std::cout << "FrameCapture: \"" << path << "\" could not be written.\n";
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (size) {
+				stats.written++;
+				stats.bytes += size;
+			}
+			else
+				stats.failed++;
+			stats.encode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (spare.size() < max_pending)
+				spare.push_back(std::move(img.rgba));
+		}
+	}
+
+	// Waits for every readback in flight, writes them and everything pending, and stops the worker. Capturing can start again afterwards.
+	inline void FrameCapture::finish() {
+		collect(true);
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+			wake.notify_one();
+		}
+		worker.join();
+	}
+
+	inline void FrameCapture::destroy() {
+		finish();
+		for (int i = 0; i < readback_slots; i++) {
+			if (slots[i].pbo) {
+				gl_state.forget_buffer(slots[i].pbo);
+				glDeleteBuffers(1, &slots[i].pbo);
+			}
+			slots[i] = { 0, 0, NULL, 0, 0, 0 };
+		}
+		spare.clear();
+	}
+
+	inline void FrameCapture::report(report_counters& counters) {
+		const frame_capture_stats s = get_stats();
+		if (!s.queued)
+			return;
+		counters.push_back(std::make_pair("frames captured", (double)s.written));
+		counters.push_back(std::make_pair("frames dropped by capture", (double)s.dropped));
+		counters.push_back(std::make_pair("capture encode ms per frame", s.encode_ms / std::max(s.written, 1u)));
+		counters.push_back(std::make_pair("capture MB per frame", s.bytes / (1024.0 * 1024.0) / std::max(s.written, 1u)));
+	}
+}
+
+#endif // !GEN_ENG_FRAME_CAPTURE_H
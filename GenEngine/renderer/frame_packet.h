@@ -0,0 +1,74 @@
+#pragma once
+#ifndef GEN_ENG_FRAME_PACKET_H
+#define GEN_ENG_FRAME_PACKET_H
+
+#include "util/vec.h"
+#include <vector>
+
+class GenObject;
+
+namespace GenEngine {
+
+	// A single draw of an object already known by the render thread.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct draw_cmd {
+		GenObject*	obj;		// Object to draw. Only its GL handles are touched by the render thread.
+		vec3		color;		// Flat color the object is shaded with.
+	};
+
+	// An instance of a mesh drawn many times. Instances are grouped by mesh and drawn with a single instanced draw call each.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct instance_cmd {
+		GenObject*	mesh;
+		mat4x4		model;		// Column-major model matrix.
+		vec3		color;
+	};
+
+	// Vertex data that must be (re)uploaded to an object's buffers before it's drawn.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct upload_cmd {
+		GenObject*					obj;
+		std::vector<float>			verts;		// Copy of the vertex data at the moment the packet was built.
+		std::vector<unsigned int>	indices;	// And of its indices, empty if the object isn't indexed.
+	};
+
+	// A point or spot light, in world space. Lit surfaces are shaded by the lights of their cluster (lighting.h).
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct light {
+		vec3	position;
+		float	radius;					// No light reaches beyond it.
+		vec3	color;					// Times the intensity.
+		vec3	direction;				// Spot lights only, unit length.
+		float	cos_outer, cos_inner;	// Spot cone, fading from inner to outer. cos_outer <= -1: point light.
+	};
+
+	/*	Frame packet.
+			Everything the render thread needs to draw a frame, produced by the main thread once per frame. Once published, a packet is immutable: the
+			render thread only reads from it and the main thread doesn't touch it until the triple buffer gives the slot back.
+			The draw list is cleared but not freed between frames, so after the first few frames building a packet doesn't allocate unless geometry
+			changed and has to be uploaded. If a packet is dropped because a newer one replaced it, its uploads are carried over to the next one.
+	*/
+	struct FramePacket {
+		unsigned long long		frame;				// Frame number, increased by the producer.
+		double					time;				// Simulation time the packet was built at.
+		int						width, height;		// Framebuffer size.
+		mat4x4					view, projection;	// Camera matrices.
+		vec3					bg_top, bg_bot;		// Background gradient colors.
+		std::vector<upload_cmd>	uploads;			// Applied before any draw.
+		std::vector<draw_cmd>	draws;				// Draw list, submitted in order.
+		std::vector<instance_cmd>	instances;		// Repeated meshes, drawn after the draw list.
+		std::vector<light>		lights;
+		bool					capture;			// Write the finished frame to disk (frame_capture.h).
+
+		FramePacket() : frame(0), time(0.0), width(0), height(0), capture(false) {}
+
+		inline void clear() {
+			uploads.clear();
+			draws.clear();
+			instances.clear();
+			lights.clear();
+		}
+	};
+}
+
+#endif // !GEN_ENG_FRAME_PACKET_H
@@ -0,0 +1,277 @@
+#pragma once
+#ifndef GEN_ENG_GL_STATE_H
+#define GEN_ENG_GL_STATE_H
+
+#include "util/glad/glad.h"
+#include <iostream>
+
+/*	Cached OpenGL state.
+		Every state change that goes through this object is compared against the last value sent to the driver, and redundant calls are dropped
+		before reaching it. Only state that the engine changes often is tracked: bound program, VAO, buffers, framebuffer, enable bits and the
+		blend/depth functions.
+
+		If the context is modified behind the cache's back (third party code, glDelete* of a bound object, a new context...) invalidate() must be
+		called so the next request of every state is sent to the driver again.
+
+		Defining GEN_ENG_GL_STATE_DEBUG makes every call validate the cache against the values returned by glGet*, printing any mismatch found.
+*/
+
+namespace GenEngine {
+
+	class GLState {
+
+		static const GLuint	unknown = 0xFFFFFFFFu;	// Value stored when the real state is unknown, forcing the next call to reach the driver.
+
+		// Enable bits tracked by the cache. Any other capability is forwarded to the driver without caching.
+		enum cap_index { CAP_DEPTH_TEST, CAP_BLEND, CAP_CULL_FACE, CAP_SCISSOR_TEST, CAP_LINE_SMOOTH, CAP_POLYGON_SMOOTH, CAP_MULTISAMPLE, CAP_COUNT };
+
+		GLuint	program;
+		GLuint	vao;
+		GLuint	array_buffer;
+		GLuint	element_buffer;						// Element buffer binding is part of the VAO state, so it's reset every time the VAO changes.
+		GLuint	uniform_buffer;
+		GLuint	read_fbo, draw_fbo;
+		GLuint	caps[CAP_COUNT];					// 0: disabled, 1: enabled, unknown: not known yet.
+		GLenum	blend_src, blend_dst;
+		GLenum	depth_fn;
+		GLuint	depth_write;
+
+		// Statistics, reset every frame by the user.
+		unsigned int	calls_issued;
+		unsigned int	calls_skipped;
+
+		inline static int	cap_to_index(const GLenum cap);
+		inline void			issued()	{ calls_issued++; validate(); }
+		inline void			skipped()	{ calls_skipped++; validate(); }
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		GLState() : calls_issued(0), calls_skipped(0) { invalidate(); }
+
+		// Bindings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		use_program(const GLuint id);
+		inline void		bind_vertex_array(const GLuint id);
+		inline void		bind_buffer(const GLenum target, const GLuint id);
+		inline void		bind_buffer_range(const GLenum target, const GLuint index, const GLuint id, const GLintptr offset, const GLsizeiptr size);
+		inline void		bind_framebuffer(const GLenum target, const GLuint id);
+
+		// Fixed function state
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		enable(const GLenum cap);
+		inline void		disable(const GLenum cap);
+		inline void		set(const GLenum cap, const bool on)	{ on ? enable(cap) : disable(cap); }
+		inline void		blend_func(const GLenum src, const GLenum dst);
+		inline void		depth_func(const GLenum fn);
+		inline void		depth_mask(const GLboolean write);
+
+		// Cache management
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		invalidate();													// Marks every cached value as unknown.
+		inline void		forget_buffer(const GLuint id);									// Call before deleting a buffer that may be bound.
+		inline void		forget_vertex_array(const GLuint id);							// Call before deleting a VAO that may be bound.
+		inline void		forget_program(const GLuint id);								// Call before deleting a program that may be in use.
+		inline void		forget_framebuffer(const GLuint id);							// Call before deleting a FBO that may be bound.
+		inline void		validate() const;												// Compares the cache against the driver (debug mode only).
+
+		// Statistics
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline unsigned int	get_calls_issued()	const	{ return calls_issued; }
+		inline unsigned int	get_calls_skipped()	const	{ return calls_skipped; }
+		inline void			reset_stats()				{ calls_issued = calls_skipped = 0; }
+	};
+
+	// Global state cache of the (single) rendering context. Only the thread owning the context may use it.
+	GLState gl_state;
+
+
+	inline int GLState::cap_to_index(const GLenum cap) {
+		switch (cap) {
+		case GL_DEPTH_TEST:			return CAP_DEPTH_TEST;
+		case GL_BLEND:				return CAP_BLEND;
+		case GL_CULL_FACE:			return CAP_CULL_FACE;
+		case GL_SCISSOR_TEST:		return CAP_SCISSOR_TEST;
+		case GL_LINE_SMOOTH:		return CAP_LINE_SMOOTH;
+		case GL_POLYGON_SMOOTH:		return CAP_POLYGON_SMOOTH;
+		case GL_MULTISAMPLE:		return CAP_MULTISAMPLE;
+		default:					return -1;
+		}
+	}
+
+	inline void GLState::use_program(const GLuint id) {
+		if (program == id) {
+			skipped();
+			return;
+		}
+		glUseProgram(id);
+		program = id;
+		issued();
+	}
+
+	inline void GLState::bind_vertex_array(const GLuint id) {
+		if (vao == id) {
+			skipped();
+			return;
+		}
+		glBindVertexArray(id);
+		vao = id;
+		element_buffer = unknown;
+		issued();
+	}
+
+	inline void GLState::bind_buffer(const GLenum target, const GLuint id) {
+		GLuint* cached;
+		switch (target) {
+		case GL_ARRAY_BUFFER:			cached = &array_buffer;		break;
+		case GL_ELEMENT_ARRAY_BUFFER:	cached = &element_buffer;	break;
+		case GL_UNIFORM_BUFFER:			cached = &uniform_buffer;	break;
+		default:
+			glBindBuffer(target, id);
+			issued();
+			return;
+		}
+		if (*cached == id) {
+			skipped();
+			return;
+		}
+		glBindBuffer(target, id);
+		*cached = id;
+		issued();
+	}
+
+	// Indexed bindings aren't cached (offsets change every frame), but they also replace the generic binding of the target, which is.
+	inline void GLState::bind_buffer_range(const GLenum target, const GLuint index, const GLuint id, const GLintptr offset, const GLsizeiptr size) {
+		glBindBufferRange(target, index, id, offset, size);
+		if (target == GL_UNIFORM_BUFFER)
+			uniform_buffer = id;
+		issued();
+	}
+
+	inline void GLState::bind_framebuffer(const GLenum target, const GLuint id) {
+		bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+		bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+		if ((!read || read_fbo == id) && (!draw || draw_fbo == id)) {
+			skipped();
+			return;
+		}
+		glBindFramebuffer(target, id);
+		if (read) read_fbo = id;
+		if (draw) draw_fbo = id;
+		issued();
+	}
+
+	inline void GLState::enable(const GLenum cap) {
+		int i = cap_to_index(cap);
+		if (i >= 0 && caps[i] == 1) {
+			skipped();
+			return;
+		}
+		glEnable(cap);
+		if (i >= 0) caps[i] = 1;
+		issued();
+	}
+
+	inline void GLState::disable(const GLenum cap) {
+		int i = cap_to_index(cap);
+		if (i >= 0 && caps[i] == 0) {
+			skipped();
+			return;
+		}
+		glDisable(cap);
+		if (i >= 0) caps[i] = 0;
+		issued();
+	}
+
+	inline void GLState::blend_func(const GLenum src, const GLenum dst) {
+		if (blend_src == src && blend_dst == dst) {
+			skipped();
+			return;
+		}
+		glBlendFunc(src, dst);
+		blend_src = src;
+		blend_dst = dst;
+		issued();
+	}
+
+	inline void GLState::depth_func(const GLenum fn) {
+		if (depth_fn == fn) {
+			skipped();
+			return;
+		}
+		glDepthFunc(fn);
+		depth_fn = fn;
+		issued();
+	}
+
+	inline void GLState::depth_mask(const GLboolean write) {
+		if (depth_write == (GLuint)write) {
+			skipped();
+			return;
+		}
+		glDepthMask(write);
+		depth_write = write;
+		issued();
+	}
+
+	inline void GLState::invalidate() {
+		program = vao = array_buffer = element_buffer = uniform_buffer = read_fbo = draw_fbo = unknown;
+		for (int i = 0; i < CAP_COUNT; i++)
+			caps[i] = unknown;
+		blend_src = blend_dst = depth_fn = unknown;
+		depth_write = unknown;
+	}
+
+	inline void GLState::forget_buffer(const GLuint id) {
+		if (array_buffer == id)		array_buffer = unknown;
+		if (element_buffer == id)	element_buffer = unknown;
+		if (uniform_buffer == id)	uniform_buffer = unknown;
+	}
+
+	inline void GLState::forget_vertex_array(const GLuint id) {
+		if (vao == id) {
+			vao = unknown;
+			element_buffer = unknown;
+		}
+	}
+
+	inline void GLState::forget_program(const GLuint id) {
+		if (program == id) program = unknown;
+	}
+
+	inline void GLState::forget_framebuffer(const GLuint id) {
+		if (read_fbo == id) read_fbo = unknown;
+		if (draw_fbo == id) draw_fbo = unknown;
+	}
+
+	inline void GLState::validate() const {
+#ifdef GEN_ENG_GL_STATE_DEBUG
+		GLint value;
+
+		// Compares a cached value with the one reported by the driver. Unknown values are skipped since they are allowed to differ.
+		auto check = [](const char* name, const GLuint cached, const GLint real) {
+			if (cached != unknown && cached != (GLuint)real)
+				std::cout << "GLState: cached " << name << " (" << cached << ") doesn't match the driver (" << real << ").\n";
+		};
+
+		glGetIntegerv(GL_CURRENT_PROGRAM, &value);				check("program", program, value);
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &value);			check("vertex array", vao, value);
+		glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &value);			check("array buffer", array_buffer, value);
+		glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &value);	check("element buffer", element_buffer, value);
+		glGetIntegerv(GL_UNIFORM_BUFFER_BINDING, &value);		check("uniform buffer", uniform_buffer, value);
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &value);		check("read framebuffer", read_fbo, value);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &value);		check("draw framebuffer", draw_fbo, value);
+		glGetIntegerv(GL_BLEND_SRC_RGB, &value);				check("blend src", blend_src, value);
+		glGetIntegerv(GL_BLEND_DST_RGB, &value);				check("blend dst", blend_dst, value);
+		glGetIntegerv(GL_DEPTH_FUNC, &value);					check("depth func", depth_fn, value);
+		glGetIntegerv(GL_DEPTH_WRITEMASK, &value);				check("depth mask", depth_write, value);
+
+		const GLenum cap_enums[CAP_COUNT] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST, GL_LINE_SMOOTH, GL_POLYGON_SMOOTH, GL_MULTISAMPLE };
+		for (int i = 0; i < CAP_COUNT; i++)
+			check("enable bit", caps[i], glIsEnabled(cap_enums[i]));
+#endif
+	}
+}
+
+#endif // !GEN_ENG_GL_STATE_H
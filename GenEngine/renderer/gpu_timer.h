@@ -0,0 +1,135 @@
+#pragma once
+#ifndef GEN_ENG_GPU_TIMER_H
+#define GEN_ENG_GPU_TIMER_H
+
+#include "glad/glad.h"
+
+/*	GPU timer.
+		Measures the GPU time spent between begin() and end() with GL_TIME_ELAPSED queries. Results arrive a few frames late, so the timer keeps a
+		small ring of queries and only reads back the ones that are already available: reading a query the GPU hasn't finished would stall the
+		CPU until it does.
+
+		Only one GL_TIME_ELAPSED query can be active at a time. A timer created with GL_TIMESTAMP measures with a pair of timestamp queries
+		instead, so it can time a part of what an outer timer is measuring (e.g. one pass of the frame). One created with GL_SAMPLES_PASSED
+		counts the samples that pass the depth test between begin() and end() (fragments shaded, with early depth testing); its results are
+		counts instead of milliseconds.
+*/
+
+namespace GenEngine {
+
+	class GpuTimer {
+
+		static const int	ring_size = 4;
+
+		GLuint		queries[ring_size * 2];	// Elapsed time queries use the first half; timestamp pairs use all of it.
+		bool		pending[ring_size];		// Query issued and not read back yet.
+		unsigned long long	ids[ring_size];	// Caller's tag of each query, usually the frame number.
+		int			current;				// Query used by the next begin().
+		double		last_ms;				// Latest result available, in milliseconds.
+		bool		has_result;
+		GLenum		target;					// GL_TIME_ELAPSED, GL_TIMESTAMP (pairs) or GL_SAMPLES_PASSED.
+
+		inline GLuint	last_query(const int i)	const	{ return target == GL_TIMESTAMP ? queries[i * 2 + 1] : queries[i]; }
+		inline double	read_ms(const int i)	const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		GpuTimer(const GLenum target = GL_TIME_ELAPSED) : queries{ 0 }, pending{ false }, ids{ 0 }, current(0), last_ms(0.0), has_result(false),
+			target(target) {}
+
+		// Creation and destruction (render thread, context current)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		create()		{ if (!queries[0]) glGenQueries(ring_size * 2, queries); }
+		inline void		destroy()		{ if (queries[0]) glDeleteQueries(ring_size * 2, queries); queries[0] = 0; }
+
+		// Measuring
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		begin(const unsigned long long id = 0);
+		inline void		end();
+		inline bool		poll();											// Reads back every finished query. Returns 1 if a new result arrived.
+		inline bool		next_result(double& ms, unsigned long long& id);	// Reads back the oldest query, only if it's finished. For per frame logs.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline double	get_ms()		const	{ return last_ms; }		// Latest GPU time measured (a few frames old).
+		inline bool		is_valid()		const	{ return has_result; }
+	};
+
+
+	inline void GpuTimer::begin(const unsigned long long id) {
+		create();
+		ids[current] = id;
+
+		// If the whole ring is still in flight the oldest result is dropped rather than waited for.
+		pending[current] = false;
+		if (target == GL_TIMESTAMP)
+			glQueryCounter(queries[current * 2], GL_TIMESTAMP);
+		else
+			glBeginQuery(target, queries[current]);
+	}
+
+	inline void GpuTimer::end() {
+		if (target == GL_TIMESTAMP)
+			glQueryCounter(queries[current * 2 + 1], GL_TIMESTAMP);
+		else
+			glEndQuery(target);
+		pending[current] = true;
+		current = (current + 1) % ring_size;
+	}
+
+	// Result of a finished query, in milliseconds (or samples). The second timestamp of a pair is written after the first, so it being available
+	// is enough.
+	inline double GpuTimer::read_ms(const int i) const {
+		GLuint64 ns = 0;
+		if (target == GL_TIMESTAMP) {
+			GLuint64 start = 0;
+			glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &ns);
+			ns -= start;
+		}
+		else
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+		return target == GL_SAMPLES_PASSED ? (double)ns : ns / 1e6;
+	}
+
+	inline bool GpuTimer::poll() {
+		bool updated = false;
+
+		// Oldest first, so the latest result available is the one kept.
+		for (int n = 0; n < ring_size; n++) {
+			int i = (current + n) % ring_size;
+			if (!pending[i])
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(last_query(i), GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+			last_ms = read_ms(i);
+			pending[i] = false;
+			has_result = updated = true;
+		}
+		return updated;
+	}
+
+	inline bool GpuTimer::next_result(double& ms, unsigned long long& id) {
+		for (int n = 0; n < ring_size; n++) {
+			int i = (current + n) % ring_size;
+			if (!pending[i])
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(last_query(i), GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return false;
+			last_ms = ms = read_ms(i);
+			id = ids[i];
+			pending[i] = false;
+			has_result = true;
+			return true;
+		}
+		return false;
+	}
+}
+
+#endif // !GEN_ENG_GPU_TIMER_H
@@ -0,0 +1,192 @@
+#pragma once
+#ifndef GEN_ENG_HEADLESS_H
+#define GEN_ENG_HEADLESS_H
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "util/options.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*	Headless mode.
+		Runs the whole render() path (main thread simulation, frame packets, render thread) for a fixed number of frames without showing anything,
+		and writes the frame timings to a report. Meant for benchmarks, profiling and regression runs on machines with no display or GPU.
+
+		- The window is created hidden and the scene is drawn into an offscreen framebuffer of the requested size, so the result doesn't depend on
+		  the window system's default framebuffer.
+		- --software asks Mesa for its software rasterizer (llvmpipe) through LIBGL_ALWAYS_SOFTWARE/GALLIUM_DRIVER. On Windows, Mesa's opengl32.dll
+		  has to be placed next to the executable for this to have any effect.
+		- --egl creates the context through EGL instead of GLX/WGL. --osmesa uses OSMesa's fully surfaceless contexts when GLFW is 3.3 or newer;
+		  with older GLFW versions a window system (e.g. Xvfb on Linux build machines) is still needed to create the hidden window.
+		- Time is driven by the frame number instead of the clock, so every run renders exactly the same frames.
+		- The main thread waits for each packet to be drawn before building the next one, so none is dropped and the frames drawn don't depend
+		  on thread timing. Simulation and rendering therefore run one after the other instead of overlapping: the cpu and submit columns are
+		  each thread's own work, and the frame rate is lower than that of the pipelined path of windowed runs.
+		- --cpu draws the frames with the software rasterizer instead of GL, without creating a window or a GL context, and adds its stage and
+		  per tile timings to the report. --image writes the last frame it drew as a PPM, to be compared against a reference image.
+		- Every module reads its own options and adds its own counters to the report (util/options.h); they're documented in each module's
+		  header. The renderer's own: --no-prepass disables the depth pre-pass, and the report counts the samples shaded per frame by the
+		  color passes, to measure what it saves. The scene's: --walls adds a stack of overlapping walls, farthest first (the worst order for
+		  overdraw), and --lights scatters point and spot lights over the scene (also outside headless runs).
+
+		Command line:
+			GenEngine --headless <frames> [--size <w>x<h>] [--report <file>] [--software] [--egl] [--osmesa] [--cpu] [--image <file>]
+				[module options]
+*/
+
+namespace GenEngine {
+
+	// Headless run settings, filled from the command line.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct headless_config {
+		bool			enabled;
+		unsigned int	frames;				// Frames to render before render() returns.
+		int				width, height;		// Size of the offscreen target.
+		bool			software;
+		bool			egl;
+		bool			osmesa;
+		bool			cpu;				// Software rasterizer instead of GL.
+		const char*		report_path;
+		const char*		image_path;			// Last frame of the software rasterizer, NULL to skip.
+
+		headless_config() : enabled(false), frames(300), width(1366), height(768), software(false), egl(false), osmesa(false), cpu(false),
+			report_path("headless_report.txt"), image_path(NULL) {}
+	};
+
+	// Timings of a single frame, in milliseconds.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct frame_timing {
+		double	cpu_ms;			// Main thread: input, simulation and packet building.
+		double	submit_ms;		// Render thread: executing the packet.
+		double	gpu_ms;			// GPU time of the frame (negative if not available).
+		double	setup_ms;		// Software rasterizer stages (negative if not used).
+		double	bin_ms;
+		double	raster_ms;
+		double	tile_avg_ms;	// Rasterization time per tile, average and slowest.
+		double	tile_max_ms;
+		double	aa_ms;			// GPU time of the anti-aliasing resolve and final pass (negative if not available).
+	};
+
+	headless_config headless;
+
+	inline bool	parse_headless_args(const CommandLine& cmd);
+	inline void	prepare_headless_context();
+
+	inline void	write_headless_report(const std::vector<frame_timing>& cpu, const std::vector<frame_timing>& render, const char* renderer_name,
+		const report_counters& counters = report_counters());
+
+
+	// Reads the headless options from the command line. Returns 0 if any option is malformed, or if --cpu is given outside a headless run.
+	inline bool parse_headless_args(const CommandLine& cmd) {
+		if (cmd.value("--headless")) {
+			headless.enabled = true;
+			headless.frames = (unsigned int)atoi(cmd.value("--headless"));
+		}
+		if (cmd.value("--size") && sscanf(cmd.value("--size"), "%dx%d", &headless.width, &headless.height) != 2)
+			return false;
+		if (cmd.value("--report"))
+			headless.report_path = cmd.value("--report");
+		headless.software = cmd.has("--software");
+		headless.egl = cmd.has("--egl");
+		headless.osmesa = cmd.has("--osmesa");
+		headless.cpu = cmd.has("--cpu");
+		headless.image_path = cmd.value("--image");
+		if (headless.cpu && !headless.enabled)
+			return false;
+		return headless.frames > 0 && headless.width > 0 && headless.height > 0;
+	}
+
+	// Sets the environment and window hints for a headless context. Must be called after init_GLFW() and before creating the window; the
+	// software rasterizer variables are read when the GL driver is loaded, so they're also set before anything touches GL.
+	inline void prepare_headless_context() {
+		if (headless.software) {
+#ifdef _WIN32
+			_putenv_s("LIBGL_ALWAYS_SOFTWARE", "1");
+			_putenv_s("GALLIUM_DRIVER", "llvmpipe");
+#else
+			setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+			setenv("GALLIUM_DRIVER", "llvmpipe", 1);
+#endif
+		}
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		if (headless.egl)
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#ifdef GLFW_OSMESA_CONTEXT_API
+		if (headless.osmesa)
+			glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#else
+		if (headless.osmesa)
+			std::cout << "Headless: this GLFW version has no OSMesa support, --osmesa ignored.\n";
+#endif
+	}
+
+	// Writes per frame timings, a summary (min/avg/p95/max) of each column and the counters the modules reported.
+	inline void write_headless_report(const std::vector<frame_timing>& cpu, const std::vector<frame_timing>& render, const char* renderer_name,
+		const report_counters& counters) {
+		std::ofstream out(headless.report_path);
+		if (!out) {
+			std::cout << "Headless: report \"" << headless.report_path << "\" could not be written.\n";
+			return;
+		}
+
+		// Summary of a column; negative values (not measured) are skipped.
+		auto summary = [&out](const char* name, std::vector<double> v) {
+			v.erase(std::remove_if(v.begin(), v.end(), [](double x) { return x < 0.0; }), v.end());
+			if (v.empty()) {
+				out << name << ": n/a\n";
+				return;
+			}
+			std::sort(v.begin(), v.end());
+			double sum = 0.0;
+			for (double x : v)
+				sum += x;
+			out << name << ": min " << v.front() << " ms, avg " << sum / v.size() << " ms, p95 " << v[(v.size() * 95) / 100] << " ms, max " << v.back() << " ms\n";
+		};
+
+		std::vector<double> cpu_ms, submit_ms, gpu_ms, setup_ms, bin_ms, raster_ms, tile_avg_ms, tile_max_ms, aa_ms;
+		for (auto& t : cpu)		cpu_ms.push_back(t.cpu_ms);
+		for (auto& t : render) {
+			submit_ms.push_back(t.submit_ms);
+			gpu_ms.push_back(t.gpu_ms);
+			setup_ms.push_back(t.setup_ms);
+			bin_ms.push_back(t.bin_ms);
+			raster_ms.push_back(t.raster_ms);
+			tile_avg_ms.push_back(t.tile_avg_ms);
+			tile_max_ms.push_back(t.tile_max_ms);
+			aa_ms.push_back(t.aa_ms);
+		}
+
+		out << "renderer: " << (renderer_name ? renderer_name : "unknown") << "\n";
+		out << "size: " << headless.width << "x" << headless.height << "\n";
+		out << "frames built: " << cpu.size() << ", frames drawn: " << render.size() << "\n";
+		summary("cpu", cpu_ms);
+		summary("submit", submit_ms);
+		summary("gpu", gpu_ms);
+		if (headless.cpu) {
+			summary("cpu setup", setup_ms);
+			summary("cpu binning", bin_ms);
+			summary("cpu raster", raster_ms);
+			summary("cpu tile avg", tile_avg_ms);
+			summary("cpu tile max", tile_max_ms);
+		}
+		else
+			summary("aa", aa_ms);
+		write_counters(out, counters);
+
+		out << "\nframe\tsubmit_ms\tgpu_ms\tsetup_ms\tbin_ms\traster_ms\ttile_avg_ms\ttile_max_ms\taa_ms\n";
+		for (size_t i = 0; i < render.size(); i++)
+			out << i << "\t" << render[i].submit_ms << "\t" << render[i].gpu_ms << "\t" << render[i].setup_ms << "\t" << render[i].bin_ms << "\t"
+				<< render[i].raster_ms << "\t" << render[i].tile_avg_ms << "\t" << render[i].tile_max_ms << "\t" << render[i].aa_ms << "\n";
+
+		std::cout << "Headless: " << render.size() << " frames rendered, report written to " << headless.report_path << ".\n";
+	}
+}
+
+#endif // !GEN_ENG_HEADLESS_H
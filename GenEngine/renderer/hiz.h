@@ -0,0 +1,495 @@
+#pragma once
+#ifndef GEN_ENG_HIZ_H
+#define GEN_ENG_HIZ_H
+
+#include "glad/glad.h"
+#include "renderer/Shader.h"
+#include "renderer/gl_state.h"
+#include "renderer/occlusion.h"
+#include "util/options.h"
+#include "util/vec.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <string.h>
+
+/*	Hierarchical-Z pyramid.
+		After the main pass, the scene's depth buffer is reduced into a mip chain where every texel holds the nearest (min) and farthest (max)
+		depth of the screen area it covers. Level 0 is half the size of the depth buffer and every level halves the previous one, down to 1x1;
+		odd sizes are handled by letting the last column/row of a level cover 3 source texels.
+
+		It can be used in two ways:
+		- On the GPU: bind() it and fetch the level whose texels are about the size of the tested rectangle (RG = min/max). A rectangle is
+		  hidden if its nearest depth is farther than the max of every texel it touches.
+		- On the CPU: one of the coarse levels is copied every frame into a ring of pixel buffers and read back a few frames later, once its fence
+		  says the copy is done, so the render thread never waits for the GPU. HiZQuery rebuilds the coarser levels from it and answers the same
+		  question for boxes and screen rectangles, using the view-projection matrix of the frame the depth came from.
+
+		The readback is always at least a frame old. While the camera hasn't moved since, the test is conservative. Once it has, reproject()
+		moves the depth to the new view: every texel's center is taken back to world space at its farthest depth and projected with the new
+		camera, keeping the farthest depth that lands on each texel. Texels nothing lands on (uncovered by the motion, or off the old screen)
+		get the far plane, so they never hide anything. Since a texel can land up to one texel away from the area it stands for, the old depth
+		is first widened to the farthest of every 3x3 neighbourhood.
+
+		Geometry the old view never saw has no depth to be tested against, so to stay conservative a box is always visible when:
+		- Its box isn't entirely inside the frustum the depth was rendered with (or crosses its near plane).
+		- The readback is more than max_lag frames older than the frame being culled.
+		- The scene changed after the depth was rendered (invalidate()): readbacks of earlier frames are dropped.
+
+		HiZPyramid lives on the render thread; take_readback() is the only call that may be made from other threads. --no-hiz turns the test
+		off. The report counts the objects HiZQuery::cull() rejected per frame.
+*/
+
+namespace GenEngine {
+
+	// Coarse level of the pyramid copied back to the CPU.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct hiz_readback {
+		int						width, height;		// Texels.
+		int						shift;				// Each texel covers (1 << shift) screen pixels in each direction.
+		int						screen_w, screen_h;
+		std::vector<float>		minmax;				// width * height (min, max) pairs, rows bottom to top.
+		mat4x4					view_proj;			// Camera the depth was rendered with (operator order: view * projection).
+		unsigned long long		frame;
+
+		hiz_readback() : width(0), height(0), shift(0), screen_w(0), screen_h(0), frame(0) {}
+	};
+
+	class HiZPyramid {
+
+		static const int	readback_slots = 3;
+		static const int	readback_max_width = 160;		// The first level this narrow or narrower is the one read back.
+
+		GLuint		texture, fbo, vao;
+		int			src_w, src_h;
+		int			width, height, levels;
+		Shader		reduce;
+
+		// Readback ring
+		GLuint			pbo[readback_slots];
+		GLsizeiptr		pbo_size[readback_slots];
+		GLsync			fence[readback_slots];
+		hiz_readback	in_flight[readback_slots];		// Everything but the data, filled when the copy is queued.
+		int				next_slot;
+
+		std::mutex		mutex;							// Guards latest/fresh, shared with the thread taking the readbacks.
+		hiz_readback	latest;
+		bool			fresh;
+
+		inline void		allocate(const int w, const int h);
+		inline void		poll_readbacks();
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		HiZPyramid() : texture(0), fbo(0), vao(0), src_w(0), src_h(0), width(0), height(0), levels(0), pbo{ 0 }, pbo_size{ 0 }, fence{ NULL },
+			next_slot(0), fresh(false) {}
+		~HiZPyramid() {}		// GL objects can only be released with the context current; call destroy() from the render thread.
+
+		// Render thread
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		build(const GLuint depth_texture, const int w, const int h);		// Leaves its own FBO bound and the viewport changed.
+		inline void		readback(const mat4x4& view_proj, const unsigned long long frame);	// Queues a copy of the coarse level, collects finished ones.
+		inline void		bind(const GLenum unit)		const;									// For GPU tests: every level, RG = min/max.
+		inline void		destroy();
+
+		// Any thread
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		take_readback(hiz_readback& out);		// Returns 1 and swaps the newest readback into out if there's one not taken yet.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline GLuint	get_texture()	const	{ return texture; }
+		inline int		get_levels()	const	{ return levels; }
+		inline int		get_width()		const	{ return width; }
+		inline int		get_height()	const	{ return height; }
+	};
+
+	// CPU side of the pyramid: the read back level and every coarser one.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	class HiZQuery {
+
+		static const unsigned int	max_lag = 8;	// Frames a readback may be behind the frame being culled.
+
+		struct level {
+			int					width, height, shift;
+			std::vector<float>	z_max;
+		};
+
+		level				source;				// Level read back, as rendered.
+		mat4x4				source_view_proj;
+		mat4x4				source_inverse;		// From window space back to the world.
+		std::vector<level>	levels;				// Level read back, or reprojected, and the coarser ones built from it.
+		mat4x4				view_proj;			// Camera the levels are for.
+		int					screen_w, screen_h;
+		unsigned long long	frame;
+		unsigned long long	valid_from;			// Readbacks of earlier frames show a scene that changed since.
+		std::vector<float>	widened;			// Scratch of reproject().
+		bool				enabled;
+		unsigned long long	culled;				// By cull(), over every frame, for the report.
+		unsigned int		frames;
+
+		inline void		build_levels();
+
+	public:
+
+		HiZQuery() : screen_w(0), screen_h(0), frame(0), valid_from(0), enabled(true), culled(0), frames(0) {}
+
+		inline bool		configure(const CommandLine& cmd)	{ enabled = !cmd.has("--no-hiz"); return true; }
+		inline void		set_enabled(const bool e)	{ enabled = e; }
+
+		inline void		update(const hiz_readback& rb);
+		inline void		invalidate(const unsigned long long changed);	// The scene changed in that frame: no culling until a readback of it.
+		inline void		reproject(const mat4x4& camera);		// Moves the depth to another view-projection matrix (view * projection).
+		inline bool		is_rect_visible(const float x0, const float y0, const float x1, const float y1, const float z_near) const;	// Screen pixels.
+		inline bool		is_visible(const cull_box& box) const;
+		inline void		cull(const mat4x4& camera, const unsigned long long current, const std::vector<cull_box>& boxes, std::vector<uint8_t>& visible);	// Clears the hidden ones.
+
+		inline bool					is_enabled()		const	{ return enabled; }
+		inline bool					is_valid()			const	{ return !levels.empty(); }
+		inline const mat4x4&		get_view_proj()		const	{ return view_proj; }
+		inline unsigned long long	get_frame()			const	{ return frame; }
+		inline void					report(report_counters& counters) const;
+	};
+
+	HiZPyramid hiz_pyramid;		// Built by the render thread from the depth of every frame.
+	HiZQuery hiz_query;			// Main thread copy of its last readback.
+
+
+	inline void HiZPyramid::allocate(const int w, const int h) {
+		src_w = w;
+		src_h = h;
+		width = std::max(1, w >> 1);
+		height = std::max(1, h >> 1);
+
+		if (texture)
+			glDeleteTextures(1, &texture);
+		if (!fbo) {
+			glGenFramebuffers(1, &fbo);
+			glGenVertexArrays(1, &vao);
+			reduce.compile("shaders/vs_fullscreen.vs", "shaders/fs_hiz.fs");
+		}
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		levels = 0;
+		for (int lw = width, lh = height; ; lw = std::max(1, lw >> 1), lh = std::max(1, lh >> 1)) {
+			glTexImage2D(GL_TEXTURE_2D, levels++, GL_RG32F, lw, lh, 0, GL_RG, GL_FLOAT, NULL);
+			if (lw == 1 && lh == 1)
+				break;
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	}
+
+	inline void HiZPyramid::build(const GLuint depth_texture, const int w, const int h) {
+		if (w != src_w || h != src_h || !texture)
+			allocate(w, h);
+
+		gl_state.bind_framebuffer(GL_FRAMEBUFFER, fbo);
+		gl_state.disable(GL_DEPTH_TEST);
+		gl_state.disable(GL_BLEND);
+		gl_state.bind_vertex_array(vao);
+		reduce.use();
+		reduce.setInt("src", 0);
+		glActiveTexture(GL_TEXTURE0);
+
+		int sw = src_w, sh = src_h;
+		for (int level = 0, lw = width, lh = height; level < levels; level++) {
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+			glViewport(0, 0, lw, lh);
+
+			// Reading level - 1 while writing level is only defined if the sampled range excludes the level attached.
+			if (level == 0)
+				glBindTexture(GL_TEXTURE_2D, depth_texture);
+			else {
+				glBindTexture(GL_TEXTURE_2D, texture);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			}
+			reduce.setBool("from_depth", level == 0);
+			reduce.setVec2i("src_size", sw, sh);
+			reduce.setVec2i("dst_size", lw, lh);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			sw = lw;
+			sh = lh;
+			lw = std::max(1, lw >> 1);
+			lh = std::max(1, lh >> 1);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	}
+
+	inline void HiZPyramid::poll_readbacks() {
+		for (int n = 0; n < readback_slots; n++) {
+			int i = (next_slot + n) % readback_slots;		// Oldest first.
+			if (!fence[i])
+				continue;
+			GLenum status = glClientWaitSync(fence[i], 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(fence[i]);
+			fence[i] = NULL;
+
+			hiz_readback& rb = in_flight[i];
+			gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+			const float* data = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rb.width * rb.height * 2 * sizeof(float), GL_MAP_READ_BIT);
+			if (data) {
+				std::lock_guard<std::mutex> lock(mutex);
+				latest.width = rb.width;
+				latest.height = rb.height;
+				latest.shift = rb.shift;
+				latest.screen_w = rb.screen_w;
+				latest.screen_h = rb.screen_h;
+				latest.view_proj = rb.view_proj;
+				latest.frame = rb.frame;
+				latest.minmax.assign(data, data + rb.width * rb.height * 2);
+				fresh = true;
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	inline void HiZPyramid::readback(const mat4x4& view_proj, const unsigned long long frame) {
+		if (!texture)
+			return;
+		poll_readbacks();
+
+		// Every slot still in flight: skip this frame rather than wait.
+		int i = next_slot;
+		if (fence[i])
+			return;
+
+		int level = 0, lw = width, lh = height;
+		while (lw > readback_max_width && level + 1 < levels) {
+			level++;
+			lw = std::max(1, lw >> 1);
+			lh = std::max(1, lh >> 1);
+		}
+
+		GLsizeiptr bytes = lw * lh * 2 * sizeof(float);
+		if (!pbo[i])
+			glGenBuffers(1, &pbo[i]);
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+		if (pbo_size[i] < bytes) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			pbo_size[i] = bytes;
+		}
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGetTexImage(GL_TEXTURE_2D, level, GL_RG, GL_FLOAT, 0);
+		gl_state.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+		fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		hiz_readback& rb = in_flight[i];
+		rb.width = lw;
+		rb.height = lh;
+		rb.shift = level + 1;
+		rb.screen_w = src_w;
+		rb.screen_h = src_h;
+		rb.view_proj = view_proj;
+		rb.frame = frame;
+		next_slot = (i + 1) % readback_slots;
+	}
+
+	inline void HiZPyramid::bind(const GLenum unit) const {
+		glActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+
+	inline void HiZPyramid::destroy() {
+		for (int i = 0; i < readback_slots; i++) {
+			if (fence[i])
+				glDeleteSync(fence[i]);
+			if (pbo[i]) {
+				gl_state.forget_buffer(pbo[i]);
+				glDeleteBuffers(1, &pbo[i]);
+			}
+			fence[i] = NULL;
+			pbo[i] = 0;
+			pbo_size[i] = 0;
+		}
+		if (fbo) {
+			gl_state.forget_framebuffer(fbo);
+			gl_state.forget_vertex_array(vao);
+			glDeleteFramebuffers(1, &fbo);
+			glDeleteVertexArrays(1, &vao);
+			glDeleteTextures(1, &texture);
+		}
+		texture = fbo = vao = 0;
+		src_w = src_h = width = height = levels = 0;
+	}
+
+	inline bool HiZPyramid::take_readback(hiz_readback& out) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!fresh)
+			return false;
+		std::swap(out, latest);
+		fresh = false;
+		return true;
+	}
+
+	inline void HiZQuery::update(const hiz_readback& rb) {
+		if (rb.frame < valid_from)
+			return;
+		source_view_proj = view_proj = rb.view_proj;
+		source_inverse = mat4x4(rb.view_proj).inverse();
+		screen_w = rb.screen_w;
+		screen_h = rb.screen_h;
+		frame = rb.frame;
+
+		// Only the max is needed to reject.
+		source.width = rb.width;
+		source.height = rb.height;
+		source.shift = rb.shift;
+		source.z_max.resize(rb.width * rb.height);
+		for (int i = 0; i < rb.width * rb.height; i++)
+			source.z_max[i] = rb.minmax[i * 2 + 1];
+		levels.resize(1);
+		levels[0] = source;
+		build_levels();
+	}
+
+	inline void HiZQuery::invalidate(const unsigned long long changed) {
+		valid_from = std::max(valid_from, changed);
+		if (frame < valid_from)
+			levels.clear();
+	}
+
+	inline void HiZQuery::reproject(const mat4x4& camera) {
+		if (levels.empty() || !memcmp(camera.e, view_proj.e, sizeof(camera.e)))
+			return;
+		view_proj = camera;
+		levels.resize(1);
+		if (!memcmp(camera.e, source_view_proj.e, sizeof(camera.e))) {
+			levels[0] = source;
+			build_levels();
+			return;
+		}
+
+		const int w = source.width, h = source.height;
+		widened.resize(w * h);
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++) {
+				float z = 0.f;
+				for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, h - 1); ny++)
+					for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, w - 1); nx++)
+						z = std::max(z, source.z_max[ny * w + nx]);
+				widened[y * w + x] = z;
+			}
+
+		// Negative: nothing landed there yet.
+		level& l = levels[0];
+		l.z_max.assign(w * h, -1.f);
+		const float texel = (float)(1 << source.shift);
+		const float* inv = source_inverse.e;
+		const float* vp = camera.e;
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++) {
+				const float ndc[3] = { (x + 0.5f) * texel / screen_w * 2.f - 1.f, (y + 0.5f) * texel / screen_h * 2.f - 1.f, widened[y * w + x] * 2.f - 1.f };
+				float p[4], c[4];
+				for (int r = 0; r < 4; r++)
+					p[r] = inv[r] * ndc[0] + inv[4 + r] * ndc[1] + inv[8 + r] * ndc[2] + inv[12 + r];
+				if (p[3] == 0.f)
+					continue;
+				for (int r = 0; r < 4; r++)
+					c[r] = (vp[r] * p[0] + vp[4 + r] * p[1] + vp[8 + r] * p[2] + vp[12 + r] * p[3]) / p[3];
+				if (c[3] <= 0.f || c[2] < -c[3])
+					continue;
+				const float sx = (c[0] / c[3] * 0.5f + 0.5f) * screen_w, sy = (c[1] / c[3] * 0.5f + 0.5f) * screen_h;
+				if (sx < 0.f || sy < 0.f || sx >= (float)screen_w || sy >= (float)screen_h)
+					continue;
+				float& dst = l.z_max[std::min((int)sx >> source.shift, w - 1) + std::min((int)sy >> source.shift, h - 1) * w];
+				dst = std::max(dst, std::min(c[2] / c[3] * 0.5f + 0.5f, 1.f));
+			}
+		for (auto i = l.z_max.begin(); i != l.z_max.end(); i++)
+			if (*i < 0.f)
+				*i = 1.f;
+		build_levels();
+	}
+
+	// Coarser levels from the first one, the same way the GPU builds them.
+	inline void HiZQuery::build_levels() {
+		level* l = &levels[0];
+		while (l->width > 1 || l->height > 1) {
+			level next;
+			next.width = std::max(1, l->width >> 1);
+			next.height = std::max(1, l->height >> 1);
+			next.shift = l->shift + 1;
+			next.z_max.assign(next.width * next.height, 0.f);
+			for (int y = 0; y < l->height; y++)
+				for (int x = 0; x < l->width; x++) {
+					float& dst = next.z_max[std::min(y >> 1, next.height - 1) * next.width + std::min(x >> 1, next.width - 1)];
+					dst = std::max(dst, l->z_max[y * l->width + x]);
+				}
+			levels.push_back(next);
+			l = &levels.back();
+		}
+	}
+
+	inline bool HiZQuery::is_rect_visible(const float x0, const float y0, const float x1, const float y1, const float z_near) const {
+		if (levels.empty())
+			return true;
+		int px0 = std::max(0, (int)floorf(x0)), py0 = std::max(0, (int)floorf(y0));
+		int px1 = std::min(screen_w - 1, (int)floorf(x1)), py1 = std::min(screen_h - 1, (int)floorf(y1));
+		if (px0 > px1 || py0 > py1)
+			return true;		// Off screen: not this test's job.
+
+		// Finest level where the rectangle touches at most 4x4 texels.
+		size_t li = 0;
+		while (li + 1 < levels.size() && (((px1 >> levels[li].shift) - (px0 >> levels[li].shift)) > 3 || ((py1 >> levels[li].shift) - (py0 >> levels[li].shift)) > 3))
+			li++;
+		const level& l = levels[li];
+
+		// Texels past the last one belong to it (odd sizes), hence the clamps.
+		int tx0 = std::min(px0 >> l.shift, l.width - 1), tx1 = std::min(px1 >> l.shift, l.width - 1);
+		int ty0 = std::min(py0 >> l.shift, l.height - 1), ty1 = std::min(py1 >> l.shift, l.height - 1);
+		for (int y = ty0; y <= ty1; y++)
+			for (int x = tx0; x <= tx1; x++)
+				if (z_near <= l.z_max[y * l.width + x])
+					return true;
+		return false;
+	}
+
+	inline bool HiZQuery::is_visible(const cull_box& box) const {
+		float rect[4], z_near;
+		if (levels.empty() || !project_cull_box(box, view_proj, (float)screen_w, (float)screen_h, rect, z_near))
+			return true;
+
+		// Anything the old view didn't see whole may be in front of what it did see.
+		float old_rect[4], old_z;
+		if (!project_cull_box(box, source_view_proj, (float)screen_w, (float)screen_h, old_rect, old_z) || old_z < 0.f || old_z > 1.f ||
+			old_rect[0] < 0.f || old_rect[1] < 0.f || old_rect[2] > (float)screen_w || old_rect[3] > (float)screen_h)
+			return true;
+		return is_rect_visible(rect[0], rect[1], rect[2], rect[3], z_near);
+	}
+
+	// Second test of the boxes still visible, against the depth moved to this frame's camera. Nothing is rejected until there's a recent enough
+	// readback.
+	inline void HiZQuery::cull(const mat4x4& camera, const unsigned long long current, const std::vector<cull_box>& boxes, std::vector<uint8_t>& visible) {
+		frames++;
+		if (levels.empty() || current > frame + max_lag)
+			return;
+		reproject(camera);
+		for (size_t i = 0; i < boxes.size() && i < visible.size(); i++)
+			if (visible[i] && !is_visible(boxes[i])) {
+				visible[i] = 0;
+				culled++;
+			}
+	}
+
+	inline void HiZQuery::report(report_counters& counters) const {
+		counters.push_back(std::make_pair("objects rejected by hi-z per frame", culled / (double)std::max(frames, 1u)));
+	}
+}
+
+#endif // !GEN_ENG_HIZ_H
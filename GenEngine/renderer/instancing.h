@@ -0,0 +1,146 @@
+#pragma once
+#ifndef GEN_ENG_INSTANCING_H
+#define GEN_ENG_INSTANCING_H
+
+#include "glad/glad.h"
+#include "level_editor/3dobj.h"
+#include "renderer/Shader.h"
+#include "renderer/gl_state.h"
+#include "renderer/stream_buffer.h"
+#include "util/vec.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+
+/*	Instanced renderer.
+		Draws of the same mesh are grouped automatically: submit() only records the per-instance transform and color, and flush() writes every
+		group's instance stream into the streaming ring and issues a single glDrawArraysInstanced per mesh, however many instances it has.
+
+		Instance streams use attribute locations 1-4 (model matrix, one column each) and 5 (color) with a divisor of 1, as expected by
+		shaders/vs_inst.vs. Since the stream lives at a different offset of the ring every frame, the attribute pointers are set again on every
+		flush.
+*/
+
+namespace GenEngine {
+
+	// Per-instance data, exactly as read by the vertex shader.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct instance_data {
+		float	model[16];		// Column-major model matrix.
+		float	color[4];		// rgb + padding, keeps the stride a multiple of 16 bytes.
+	};
+
+	class InstancedRenderer {
+
+		struct batch {
+			GenObject*					mesh;
+			std::vector<instance_data>	instances;
+		};
+
+		std::vector<batch>							batches;		// Kept between frames so their storage is reused.
+		size_t										used;			// Batches used this frame.
+		std::unordered_map<GenObject*, size_t>		lookup;			// Mesh -> batch index.
+
+		// Statistics of the last flush.
+		unsigned int	draw_calls;
+		unsigned int	instances_drawn;
+
+		inline void		set_instance_attribs(const GLintptr offset) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		InstancedRenderer() : used(0), draw_calls(0), instances_drawn(0) {}
+
+		// Drawing
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		submit(GenObject* mesh, const mat4x4& model, const vec3& color);
+		inline void		flush(const Shader& shader);										// Draws and clears every batch. Expects the "Camera" block bound.
+
+		// Statistics
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline unsigned int	get_draw_calls()		const	{ return draw_calls; }
+		inline unsigned int	get_instances_drawn()	const	{ return instances_drawn; }
+	};
+
+
+	inline void InstancedRenderer::submit(GenObject* mesh, const mat4x4& model, const vec3& color) {
+		auto found = lookup.find(mesh);
+		size_t index;
+		if (found == lookup.end()) {
+			if (used == batches.size())
+				batches.push_back(batch());
+			index = used++;
+			batches[index].mesh = mesh;
+			batches[index].instances.clear();
+			lookup[mesh] = index;
+		}
+		else
+			index = found->second;
+
+		instance_data inst;
+		memcpy(inst.model, model.e, sizeof(inst.model));
+		inst.color[0] = color.x();
+		inst.color[1] = color.y();
+		inst.color[2] = color.z();
+		inst.color[3] = 1.f;
+		batches[index].instances.push_back(inst);
+	}
+
+	inline void InstancedRenderer::set_instance_attribs(const GLintptr offset) const {
+		for (GLuint c = 0; c < 4; c++) {
+			glVertexAttribPointer(1 + c, 4, GL_FLOAT, GL_FALSE, sizeof(instance_data), (void*)(offset + c * 4 * sizeof(float)));
+			glEnableVertexAttribArray(1 + c);
+			glVertexAttribDivisor(1 + c, 1);
+		}
+		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(instance_data), (void*)(offset + 16 * sizeof(float)));
+		glEnableVertexAttribArray(5);
+		glVertexAttribDivisor(5, 1);
+	}
+
+	inline void InstancedRenderer::flush(const Shader& shader) {
+		draw_calls = instances_drawn = 0;
+		shader.use();
+		gl_state.enable(GL_DEPTH_TEST);
+
+		for (size_t b = 0; b < used; b++) {
+			batch& bt = batches[b];
+			GenObject* mesh = bt.mesh;
+			if (!mesh->has_gpu_buffers())
+				mesh->set_v_buffer();
+			gl_state.bind_vertex_array(mesh->get_vao());
+			mesh->set_quantization(shader);
+
+			// Normally a single chunk; a batch too big for what's left of the frame's ring segment is split.
+			size_t first = 0, chunk = bt.instances.size();
+			while (first < bt.instances.size()) {
+				chunk = std::min(chunk, bt.instances.size() - first);
+				GLintptr offset;
+				void* dst = stream_ring.allocate(chunk * sizeof(instance_data), 16, offset);
+				if (!dst) {
+					if (chunk == 1)
+						break;
+					chunk /= 2;
+					continue;
+				}
+				memcpy(dst, &bt.instances[first], chunk * sizeof(instance_data));
+				stream_ring.commit();
+
+				gl_state.bind_buffer(GL_ARRAY_BUFFER, stream_ring.get_buffer());
+				set_instance_attribs(offset);
+				mesh->draw_instanced((GLsizei)chunk);
+				draw_calls++;
+				instances_drawn += (unsigned int)chunk;
+				first += chunk;
+			}
+		}
+
+		used = 0;
+		lookup.clear();
+	}
+}
+
+#endif // !GEN_ENG_INSTANCING_H
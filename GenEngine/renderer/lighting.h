@@ -0,0 +1,340 @@
+#pragma once
+#ifndef GEN_ENG_LIGHTING_H
+#define GEN_ENG_LIGHTING_H
+
+#include "glad/glad.h"
+#include "renderer/Shader.h"
+#include "renderer/gl_state.h"
+#include "renderer/frame_packet.h"
+#include "util/job_system.h"
+#include "util/options.h"
+#include "util/vec.h"
+
+#include <emmintrin.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+/*	Clustered lighting.
+		Point and spot lights with clustered forward shading. The view frustum is split into 16 x 9 screen tiles and 24 depth slices, with the
+		slices spaced exponentially between the near and far planes so clusters stay roughly cube shaped. Every frame:
+
+		- The lights are moved to view space, and each one gets a bounding sphere (for spot lights, the smallest one around the cone when it's
+		  narrow enough) and the range of slices that sphere spans.
+		- Lights are assigned to clusters on the job system, one depth slice per job, so no two jobs write the same cluster. Each light is
+		  tested only against the slices it spans, 4 clusters at a time with SSE2 (sphere vs the cluster's view space box).
+		- The lists are packed into a grid (first index and count per cluster) and an index list, and uploaded with the light data to texture
+		  buffers. shaders/fs_col.fs finds its cluster from gl_FragCoord and its view depth, and only loops over that cluster's lights.
+
+		The cost per pixel depends on the lights that reach it, not on how many there are in the level; the CPU cost grows with the lights times
+		the slices they span. A cluster takes up to 128 lights; more are dropped from it (counted in the stats). With no lights at all, surfaces
+		keep their flat color. The report gives the lights per cluster and the CPU time spent assigning them.
+
+		Render thread only.
+*/
+
+namespace GenEngine {
+
+	// Totals since the start, except lights.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct lighting_stats {
+		unsigned int	frames;
+		unsigned int	lights;				// Last frame.
+		double			visible;			// Lights in at least one cluster.
+		double			references;			// Light indices over all clusters.
+		double			clusters_lit;		// Clusters with at least one light.
+		unsigned int	max_per_cluster;	// Over all frames.
+		unsigned int	overflow;			// Lights dropped because their cluster was full.
+		double			cull_ms;			// Assignment, packing and upload on the CPU.
+	};
+
+	class ClusteredLighting {
+
+		static const int		grid_x = 16, grid_y = 9, grid_z = 24;
+		static const int		tiles = grid_x * grid_y;
+		static const int		cluster_count = tiles * grid_z;
+		static const int		max_cluster_lights = 128;
+		static const int		first_unit = 4;			// Texture units of the light buffers (three of them).
+
+		// As stored in the light texture buffer: 3 RGBA texels.
+		struct view_light {
+			float	position[3], radius;
+			float	color[3], cos_outer;
+			float	direction[3], cos_inner;
+		};
+
+		struct bounds {
+			float	center[3], radius;		// View space.
+			int		first_slice, last_slice;
+		};
+
+		float			proj[4];				// The projection terms the cluster boxes were built for.
+		float			near_z, far_z;
+		float			slice_scale, slice_bias;	// slice = log(depth) * scale + bias.
+		std::vector<float>		box_min[3], box_max[3];	// Per cluster, view space. Clusters of a slice are contiguous, row by row.
+
+		std::vector<view_light>	view_lights;
+		std::vector<bounds>		spheres;
+		std::vector<uint16_t>	cluster_lights;		// max_cluster_lights per cluster.
+		std::vector<int>		cluster_sizes;
+		std::vector<unsigned int>	slice_overflow;
+		std::vector<uint32_t>	grid;				// First index and count per cluster.
+		std::vector<uint16_t>	indices;
+		std::vector<uint8_t>	light_visible;
+
+		GLuint			buffers[3];				// Light data, grid, indices.
+		GLuint			textures[3];
+		vec3			ambient;
+		lighting_stats	stats;
+
+		inline void		build_clusters(const mat4x4& projection);
+		inline void		assign_slice(const int slice);
+		inline void		upload(const int i, const GLenum format, const void* data, const size_t bytes);
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		ClusteredLighting() : near_z(0.f), far_z(0.f), slice_scale(0.f), slice_bias(0.f), ambient(0.15f, 0.15f, 0.15f),
+			stats{ 0, 0, 0.0, 0.0, 0.0, 0, 0, 0.0 } {
+			for (int i = 0; i < 4; i++)
+				proj[i] = 0.f;
+			for (int i = 0; i < 3; i++)
+				buffers[i] = textures[i] = 0;
+		}
+		~ClusteredLighting() {}		// GL objects can only be released with the context current; call destroy() from the render thread.
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_ambient(const vec3& a)		{ ambient = a; }
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		update(const std::vector<light>& lights, const mat4x4& view, const mat4x4& projection);
+		inline void		bind(const Shader& shader, const int w, const int h);		// Shader in use, drawing into a w x h target.
+		inline void		destroy();
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const lighting_stats&	get_stats()		const	{ return stats; }
+		inline void						report(report_counters& counters) const;
+	};
+
+	ClusteredLighting clustered_lighting;		// Render thread only. Its stats are read after it stops.
+
+
+	// Cluster boxes only depend on the projection: tiles are fractions of the screen, not pixels.
+	inline void ClusteredLighting::build_clusters(const mat4x4& projection) {
+		proj[0] = projection.e[0];
+		proj[1] = projection.e[5];
+		proj[2] = projection.e[10];
+		proj[3] = projection.e[14];
+		near_z = proj[3] / (proj[2] - 1.f);
+		far_z = proj[3] / (proj[2] + 1.f);
+		slice_scale = grid_z / logf(far_z / near_z);
+		slice_bias = -logf(near_z) * slice_scale;
+
+		for (int a = 0; a < 3; a++) {
+			box_min[a].resize(cluster_count);
+			box_max[a].resize(cluster_count);
+		}
+		for (int z = 0; z < grid_z; z++) {
+			const float d0 = near_z * powf(far_z / near_z, (float)z / grid_z);
+			const float d1 = near_z * powf(far_z / near_z, (float)(z + 1) / grid_z);
+			for (int y = 0; y < grid_y; y++)
+				for (int x = 0; x < grid_x; x++) {
+					const int c = z * tiles + y * grid_x + x;
+					const float x0 = -1.f + 2.f * x / grid_x, x1 = -1.f + 2.f * (x + 1) / grid_x;
+					const float y0 = -1.f + 2.f * y / grid_y, y1 = -1.f + 2.f * (y + 1) / grid_y;
+
+					// A tile's sides are planes through the eye, so the box of its frustum piece is spanned by the corners at both depths.
+					box_min[0][c] = std::min(std::min(x0 * d0, x0 * d1), std::min(x1 * d0, x1 * d1)) / proj[0];
+					box_max[0][c] = std::max(std::max(x0 * d0, x0 * d1), std::max(x1 * d0, x1 * d1)) / proj[0];
+					box_min[1][c] = std::min(std::min(y0 * d0, y0 * d1), std::min(y1 * d0, y1 * d1)) / proj[1];
+					box_max[1][c] = std::max(std::max(y0 * d0, y0 * d1), std::max(y1 * d0, y1 * d1)) / proj[1];
+					box_min[2][c] = -d1;
+					box_max[2][c] = -d0;
+				}
+		}
+	}
+
+	// Tests every light spanning the slice against its clusters, 4 at a time (a row of tiles is a multiple of 4).
+	inline void ClusteredLighting::assign_slice(const int slice) {
+		int* sizes = &cluster_sizes[slice * tiles];
+		uint16_t* lists = &cluster_lights[(size_t)slice * tiles * max_cluster_lights];
+		std::fill(sizes, sizes + tiles, 0);
+		unsigned int overflow = 0;
+
+		const __m128 zero = _mm_setzero_ps();
+		for (size_t i = 0; i < spheres.size(); i++) {
+			const bounds& s = spheres[i];
+			if (slice < s.first_slice || slice > s.last_slice)
+				continue;
+			const __m128 cx = _mm_set1_ps(s.center[0]), cy = _mm_set1_ps(s.center[1]), cz = _mm_set1_ps(s.center[2]);
+			const __m128 r2 = _mm_set1_ps(s.radius * s.radius);
+			for (int t = 0; t < tiles; t += 4) {
+				const int c = slice * tiles + t;
+
+				// Distance from the center to the box, per axis: 0 inside, else to the nearest face.
+				__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[0][c]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&box_max[0][c]))), zero);
+				__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[1][c]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&box_max[1][c]))), zero);
+				__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[2][c]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&box_max[2][c]))), zero);
+				__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				int hit = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+				while (hit) {
+					int k = 0;
+					while (!(hit & (1 << k)))
+						k++;
+					hit &= ~(1 << k);
+					if (sizes[t + k] < max_cluster_lights)
+						lists[(t + k) * max_cluster_lights + sizes[t + k]++] = (uint16_t)i;
+					else
+						overflow++;
+				}
+			}
+		}
+		slice_overflow[slice] = overflow;
+	}
+
+	inline void ClusteredLighting::update(const std::vector<light>& lights, const mat4x4& view, const mat4x4& projection) {
+		auto start = std::chrono::steady_clock::now();
+		if (projection.e[0] != proj[0] || projection.e[5] != proj[1] || projection.e[10] != proj[2] || projection.e[14] != proj[3])
+			build_clusters(projection);
+
+		const size_t count = std::min<size_t>(lights.size(), 65535);
+		view_lights.resize(count);
+		spheres.resize(count);
+		const float* m = view.e;
+		for (size_t i = 0; i < count; i++) {
+			const light& l = lights[i];
+			view_light& v = view_lights[i];
+			for (int r = 0; r < 3; r++) {
+				v.position[r] = m[r] * l.position.x() + m[4 + r] * l.position.y() + m[8 + r] * l.position.z() + m[12 + r];
+				v.direction[r] = m[r] * l.direction.x() + m[4 + r] * l.direction.y() + m[8 + r] * l.direction.z();
+				v.color[r] = l.color[r];
+			}
+			v.radius = l.radius;
+			const bool spot = l.cos_outer > -1.f;
+			v.cos_outer = spot ? l.cos_outer : -2.f;		// The shader's smoothstep gives 1 for any direction.
+			v.cos_inner = spot ? std::max(l.cos_inner, l.cos_outer + 1e-3f) : -1.f;
+
+			// A cone up to 45 degrees wide fits in the sphere through its apex and the rim of its cap.
+			bounds& b = spheres[i];
+			if (spot && l.cos_outer >= 0.7071f) {
+				b.radius = l.radius / (2.f * l.cos_outer);
+				for (int r = 0; r < 3; r++)
+					b.center[r] = v.position[r] + v.direction[r] * b.radius;
+			}
+			else {
+				b.radius = l.radius;
+				for (int r = 0; r < 3; r++)
+					b.center[r] = v.position[r];
+			}
+			const float d0 = -b.center[2] - b.radius, d1 = -b.center[2] + b.radius;
+			if (d1 < near_z || d0 > far_z) {
+				b.first_slice = grid_z;		// Out of range: in no slice.
+				b.last_slice = -1;
+				continue;
+			}
+			b.first_slice = std::max(0, (int)floorf(logf(std::max(d0, near_z)) * slice_scale + slice_bias));
+			b.last_slice = std::min(grid_z - 1, (int)floorf(logf(std::min(d1, far_z)) * slice_scale + slice_bias));
+		}
+
+		cluster_sizes.resize(cluster_count);
+		cluster_lights.resize((size_t)cluster_count * max_cluster_lights);
+		slice_overflow.resize(grid_z);
+		if (count)
+			job_system.parallel_for(grid_z, [this](unsigned int slice, unsigned int) { assign_slice((int)slice); });
+		else
+			std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0);
+
+		// Packed lists, in cluster order.
+		grid.resize(cluster_count * 2);
+		indices.clear();
+		light_visible.assign(count, 0);
+		unsigned int lit = 0;
+		for (int c = 0; c < cluster_count; c++) {
+			const uint16_t* list = &cluster_lights[(size_t)c * max_cluster_lights];
+			grid[c * 2] = (uint32_t)indices.size();
+			grid[c * 2 + 1] = (uint32_t)cluster_sizes[c];
+			indices.insert(indices.end(), list, list + cluster_sizes[c]);
+			for (int k = 0; k < cluster_sizes[c]; k++)
+				light_visible[list[k]] = 1;
+			lit += cluster_sizes[c] > 0;
+			stats.max_per_cluster = std::max(stats.max_per_cluster, (unsigned int)cluster_sizes[c]);
+		}
+		if (indices.empty())
+			indices.push_back(0);		// Buffers can't be empty.
+		if (view_lights.empty())
+			view_lights.resize(1);
+
+		upload(0, GL_RGBA32F, view_lights.data(), view_lights.size() * sizeof(view_light));
+		upload(1, GL_RG32UI, grid.data(), grid.size() * sizeof(uint32_t));
+		upload(2, GL_R16UI, indices.data(), indices.size() * sizeof(uint16_t));
+		view_lights.resize(count);
+
+		stats.frames++;
+		stats.lights = (unsigned int)count;
+		stats.references += count ? (double)indices.size() : 0.0;
+		stats.clusters_lit += lit;
+		for (size_t i = 0; i < count; i++)
+			stats.visible += light_visible[i];
+		for (int z = 0; z < grid_z; z++)
+			stats.overflow += count ? slice_overflow[z] : 0;
+		stats.cull_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// The whole buffer is respecified every frame, so the driver can hand out fresh storage instead of waiting for the frames still reading it.
+	inline void ClusteredLighting::upload(const int i, const GLenum format, const void* data, const size_t bytes) {
+		if (!buffers[i]) {
+			glGenBuffers(1, &buffers[i]);
+			glGenTextures(1, &textures[i]);
+		}
+		gl_state.bind_buffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+		glActiveTexture(GL_TEXTURE0 + first_unit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffers[i]);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	inline void ClusteredLighting::bind(const Shader& shader, const int w, const int h) {
+		static const char* names[3] = { "light_data", "light_grid", "light_index" };
+		for (int i = 0; i < 3; i++) {
+			glActiveTexture(GL_TEXTURE0 + first_unit + i);
+			glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+			shader.setInt(names[i], first_unit + i);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		shader.setVec3f("ambient", stats.lights ? ambient : vec3(1.f, 1.f, 1.f));
+		shader.setVec2f("cluster_scale", (float)grid_x / w, (float)grid_y / h);
+		shader.setVec2f("slice_params", slice_scale, slice_bias);
+		shader.setVec2i("cluster_count", grid_x, grid_y);
+		shader.setInt("slice_count", grid_z);
+	}
+
+	inline void ClusteredLighting::destroy() {
+		for (int i = 0; i < 3; i++) {
+			if (buffers[i]) {
+				gl_state.forget_buffer(buffers[i]);
+				glDeleteBuffers(1, &buffers[i]);
+				glDeleteTextures(1, &textures[i]);
+			}
+			buffers[i] = textures[i] = 0;
+		}
+	}
+
+	inline void ClusteredLighting::report(report_counters& counters) const {
+		const double frames = (double)std::max(stats.frames, 1u);
+		counters.push_back(std::make_pair("lights", (double)stats.lights));
+		counters.push_back(std::make_pair("lights in view per frame", stats.visible / frames));
+		counters.push_back(std::make_pair("lights per lit cluster", stats.references / std::max(stats.clusters_lit, 1.0)));
+		counters.push_back(std::make_pair("max lights per cluster", (double)stats.max_per_cluster));
+		counters.push_back(std::make_pair("lights dropped from full clusters", (double)stats.overflow));
+		counters.push_back(std::make_pair("light culling ms per frame", stats.cull_ms / frames));
+	}
+}
+
+#endif // !GEN_ENG_LIGHTING_H
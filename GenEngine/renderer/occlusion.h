@@ -0,0 +1,380 @@
+#pragma once
+#ifndef GEN_ENG_OCCLUSION_H
+#define GEN_ENG_OCCLUSION_H
+
+#include "glad/glad.h"
+#include "util/job_system.h"
+#include "util/options.h"
+#include "util/vec.h"
+
+#include <emmintrin.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+/*	Masked occlusion culling.
+		A few large occluders (the biggest walls close to the camera) are rasterized on the CPU into a low resolution depth buffer, and the
+		bounding boxes of everything else are tested against it before anything is submitted. Objects completely hidden behind the occluders never
+		reach the GPU.
+
+		The buffer is split in tiles of 8x4 pixels. Instead of a depth per pixel, each tile keeps two layers (as in masked software occlusion
+		culling):
+		- z_max0: farthest depth of the tile that is known to be completely covered.
+		- z_max1 + mask: farthest depth and coverage (one bit per pixel) of the triangles drawn since the tile was last fully covered.
+		When the mask becomes full, the working layer is merged into the reference one, which keeps the nearer of the two depths. If a triangle
+		is much closer than the working layer, the working layer is thrown away (keeping it would only make the tile's depth less useful). This
+		keeps the buffer conservative: a tile's z_max0 is never closer than what's actually drawn there.
+
+		A box is occluded if its nearest depth is farther than z_max0 in every tile its screen rectangle touches. Occluder rasterization and box
+		tests run on the job system (bands of tile rows, batches of boxes), and coverage is computed 4 pixels at a time with SSE2.
+
+		Depths are window space z (0 near, 1 far), which is linear in screen space. Anything crossing the near plane is never an occluder and is
+		always visible.
+
+		--no-occlusion disables it, to measure what it saves; the report counts occluders drawn and objects tested and rejected per frame.
+*/
+
+namespace GenEngine {
+
+	// Axis aligned box in world space.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct cull_box {
+		vec3	min, max;
+	};
+
+	// Screen rectangle (min x, min y, max x, max y, in pixels of a w x h screen) and nearest window space depth of a box. Returns 0 if the box
+	// crosses the near plane, in which case it can't be tested and must be considered visible.
+	inline bool project_cull_box(const cull_box& box, const mat4x4& view_proj, const float w, const float h, float rect[4], float& z_near) {
+		rect[0] = rect[1] = 1e30f;
+		rect[2] = rect[3] = -1e30f;
+		z_near = 1.f;
+		for (int i = 0; i < 8; i++) {
+			float p[3] = { i & 1 ? box.max.x() : box.min.x(), i & 2 ? box.max.y() : box.min.y(), i & 4 ? box.max.z() : box.min.z() };
+			float c[4];
+			for (int r = 0; r < 4; r++)
+				c[r] = view_proj.e[r] * p[0] + view_proj.e[4 + r] * p[1] + view_proj.e[8 + r] * p[2] + view_proj.e[12 + r];
+			if (c[3] <= 0.f || c[2] < -c[3])
+				return false;
+			float inv_w = 1.f / c[3];
+			float x = (c[0] * inv_w * 0.5f + 0.5f) * w, y = (c[1] * inv_w * 0.5f + 0.5f) * h;
+			rect[0] = std::min(rect[0], x);
+			rect[1] = std::min(rect[1], y);
+			rect[2] = std::max(rect[2], x);
+			rect[3] = std::max(rect[3], y);
+			z_near = std::min(z_near, c[2] * inv_w * 0.5f + 0.5f);
+		}
+		return true;
+	}
+
+	// Counters of the last frame.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct occlusion_stats {
+		unsigned int	occluders;			// Occluder objects drawn.
+		unsigned int	occluder_tris;		// Occluder triangles that reached the buffer.
+		unsigned int	tested;				// Boxes tested.
+		unsigned int	culled;				// Boxes rejected.
+	};
+
+	class OcclusionCuller {
+
+		static const int	tile_w = 8, tile_h = 4;
+		static const int	band_tiles = 8;				// Tile rows per rasterization job.
+
+		struct occluder_tri {
+			float	a[3], b[3], c[3];					// Edge equations, positive inside.
+			bool	top_left[3];						// Edge owns the pixels lying exactly on it, so shared edges leave no gaps.
+			float	za, zb, zc;							// Depth plane.
+			float	z_min, z_max;
+			int		min_x, min_y, max_x, max_y;			// Pixel bounds, clamped to the buffer.
+		};
+
+		int							width, height;
+		int							tiles_x, tiles_y;
+		std::vector<float>			z_max0;
+		std::vector<float>			z_max1;
+		std::vector<uint32_t>		mask;
+
+		mat4x4						view_proj;
+		std::vector<occluder_tri>	tris;
+		occlusion_stats				stats;
+		occlusion_stats				totals;				// Over every frame tested, for the report.
+		unsigned int				frames;
+		bool						enabled;
+
+		inline void		setup_triangle(const float* v0, const float* v1, const float* v2);
+		inline void		raster_band(const int band);
+		inline void		update_tile(const int tile, const uint32_t coverage, const float z);
+		inline bool		project_box(const cull_box& box, int rect[4], float& z_near) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		OcclusionCuller(const int w = 320, const int h = 192) : width(0), height(0), tiles_x(0), tiles_y(0), stats(), totals(), frames(0), enabled(true) {
+			resize(w, h);
+		}
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		configure(const CommandLine& cmd)	{ enabled = !cmd.has("--no-occlusion"); return true; }
+		inline void		set_enabled(const bool e)			{ enabled = e; }
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		resize(const int w, const int h);		// Rounded up to whole tiles.
+		inline void		begin_frame(const mat4x4& vp);			// Clears the buffer. vp: projection * view (operator order: view * projection).
+		inline void		add_occluder(const float* verts, const size_t vertex_count, const GLenum primitive,
+			const std::vector<unsigned int>& indices = std::vector<unsigned int>());		// Indexed: GL_TRIANGLES only.
+		inline void		render_occluders();
+
+		// Queries (after render_occluders())
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		is_visible(const cull_box& box);
+		inline void		test_boxes(const std::vector<cull_box>& boxes, std::vector<uint8_t>& visible);		// In parallel.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool						is_enabled()	const	{ return enabled; }
+		inline const occlusion_stats&	get_stats()		const	{ return stats; }
+		inline void						report(report_counters& counters) const;
+	};
+
+	OcclusionCuller occlusion_culler;		// Main thread only: culling is done while the packet is built.
+
+
+	inline void OcclusionCuller::resize(const int w, const int h) {
+		tiles_x = (w + tile_w - 1) / tile_w;
+		tiles_y = (h + tile_h - 1) / tile_h;
+		width = tiles_x * tile_w;
+		height = tiles_y * tile_h;
+		z_max0.assign(tiles_x * tiles_y, 1.f);
+		z_max1.assign(tiles_x * tiles_y, 0.f);
+		mask.assign(tiles_x * tiles_y, 0);
+	}
+
+	inline void OcclusionCuller::begin_frame(const mat4x4& vp) {
+		view_proj = vp;
+		std::fill(z_max0.begin(), z_max0.end(), 1.f);
+		std::fill(z_max1.begin(), z_max1.end(), 0.f);
+		std::fill(mask.begin(), mask.end(), 0);
+		tris.clear();
+		stats = occlusion_stats();
+	}
+
+	inline void OcclusionCuller::add_occluder(const float* verts, const size_t vertex_count, const GLenum primitive, const std::vector<unsigned int>& indices) {
+		std::vector<float> clip(vertex_count * 4);
+		for (size_t i = 0; i < vertex_count; i++) {
+			const float* p = verts + i * 3;
+			for (int r = 0; r < 4; r++)
+				clip[i * 4 + r] = view_proj.e[r] * p[0] + view_proj.e[4 + r] * p[1] + view_proj.e[8 + r] * p[2] + view_proj.e[12 + r];
+		}
+
+		const float* c = clip.data();
+		if (!indices.empty() && primitive == GL_TRIANGLES)
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+				setup_triangle(c + indices[i] * 4, c + indices[i + 1] * 4, c + indices[i + 2] * 4);
+		else if (!indices.empty())
+			return;
+		else if (primitive == GL_TRIANGLES)
+			for (size_t i = 0; i + 2 < vertex_count; i += 3)
+				setup_triangle(c + i * 4, c + (i + 1) * 4, c + (i + 2) * 4);
+		else if (primitive == GL_TRIANGLE_STRIP)
+			for (size_t i = 0; i + 2 < vertex_count; i++)
+				setup_triangle(c + i * 4, c + (i + 1) * 4, c + (i + 2) * 4);
+		else if (primitive == GL_TRIANGLE_FAN)
+			for (size_t i = 1; i + 1 < vertex_count; i++)
+				setup_triangle(c, c + i * 4, c + (i + 1) * 4);
+		else
+			return;
+		stats.occluders++;
+	}
+
+	inline void OcclusionCuller::setup_triangle(const float* v0, const float* v1, const float* v2) {
+		const float* in[3] = { v0, v1, v2 };
+		float x[3], y[3], z[3];
+		for (int i = 0; i < 3; i++) {
+
+			// Not drawing part of an occluder is always safe, clipping it isn't worth it.
+			if (in[i][2] < -in[i][3] || in[i][3] <= 0.f)
+				return;
+			float inv_w = 1.f / in[i][3];
+			x[i] = (in[i][0] * inv_w * 0.5f + 0.5f) * width;
+			y[i] = (in[i][1] * inv_w * 0.5f + 0.5f) * height;
+			z[i] = in[i][2] * inv_w * 0.5f + 0.5f;
+		}
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area == 0.f || area != area)
+			return;
+		if (area < 0.f) {
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		occluder_tri t;
+		t.min_x = std::max(0, (int)floorf(std::min(x[0], std::min(x[1], x[2]))));
+		t.min_y = std::max(0, (int)floorf(std::min(y[0], std::min(y[1], y[2]))));
+		t.max_x = std::min(width - 1, (int)ceilf(std::max(x[0], std::max(x[1], x[2]))));
+		t.max_y = std::min(height - 1, (int)ceilf(std::max(y[0], std::max(y[1], y[2]))));
+		if (t.min_x > t.max_x || t.min_y > t.max_y)
+			return;
+
+		for (int i = 0; i < 3; i++) {
+			int s = (i + 1) % 3, e = (i + 2) % 3;
+			t.a[i] = y[s] - y[e];
+			t.b[i] = x[e] - x[s];
+			t.c[i] = x[s] * y[e] - x[e] * y[s];
+			t.top_left[i] = (y[s] == y[e] && x[e] < x[s]) || y[e] < y[s];
+		}
+		float inv_area = 1.f / area;
+		t.za = (t.a[0] * z[0] + t.a[1] * z[1] + t.a[2] * z[2]) * inv_area;
+		t.zb = (t.b[0] * z[0] + t.b[1] * z[1] + t.b[2] * z[2]) * inv_area;
+		t.zc = (t.c[0] * z[0] + t.c[1] * z[1] + t.c[2] * z[2]) * inv_area;
+		t.z_min = std::min(z[0], std::min(z[1], z[2]));
+		t.z_max = std::max(z[0], std::max(z[1], z[2]));
+		tris.push_back(t);
+	}
+
+	inline void OcclusionCuller::update_tile(const int tile, const uint32_t coverage, const float z) {
+		float& z0 = z_max0[tile];
+		float& z1 = z_max1[tile];
+		uint32_t& m = mask[tile];
+
+		// A working layer much farther than the new triangle would only drag the tile's depth back when merged.
+		if (z1 - z > z0 - z1) {
+			z1 = 0.f;
+			m = 0;
+		}
+		z1 = std::max(z1, z);
+		m |= coverage;
+		// Both layers cover the whole tile, so no pixel is farther than the nearer of the two.
+		if (m == 0xffffffffu) {
+			z0 = std::min(z0, z1);
+			z1 = 0.f;
+			m = 0;
+		}
+	}
+
+	inline void OcclusionCuller::raster_band(const int band) {
+		const int ty0 = band * band_tiles, ty1 = std::min(tiles_y, ty0 + band_tiles);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+		for (auto t = tris.begin(); t != tris.end(); t++) {
+			int tx_min = t->min_x / tile_w, tx_max = t->max_x / tile_w;
+			int ty_min = std::max(ty0, t->min_y / tile_h), ty_max = std::min(ty1 - 1, t->max_y / tile_h);
+
+			__m128 a[3], tl[3];
+			for (int i = 0; i < 3; i++) {
+				a[i] = _mm_set1_ps(t->a[i]);
+				tl[i] = _mm_castsi128_ps(_mm_set1_epi32(t->top_left[i] ? -1 : 0));
+			}
+
+			for (int ty = ty_min; ty <= ty_max; ty++) {
+				for (int tx = tx_min; tx <= tx_max; tx++) {
+					const int tile = ty * tiles_x + tx;
+					if (t->z_min >= z_max0[tile])
+						continue;		// Behind what's already there.
+
+					// Coverage: bit (row * 8 + column), 4 rows of two 4-pixel steps.
+					uint32_t coverage = 0;
+					const float px = (float)(tx * tile_w), py = (float)(ty * tile_h);
+					for (int row = 0; row < tile_h; row++) {
+						float yc = py + row + 0.5f;
+						for (int half = 0; half < 2; half++) {
+							__m128 xs = _mm_add_ps(_mm_set1_ps(px + half * 4), lane);
+							__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+							for (int i = 0; i < 3; i++) {
+								__m128 e = _mm_add_ps(_mm_mul_ps(a[i], xs), _mm_set1_ps(t->b[i] * yc + t->c[i]));
+								inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), tl[i])));
+							}
+							coverage |= (uint32_t)_mm_movemask_ps(inside) << (row * 8 + half * 4);
+						}
+					}
+					if (!coverage)
+						continue;
+
+					// Farthest depth of the triangle inside the tile: the plane at the tile corners, bounded by the triangle's own farthest vertex.
+					float zc = t->za * px + t->zb * py + t->zc;
+					float z = std::max(std::max(zc, zc + t->za * tile_w), std::max(zc + t->zb * tile_h, zc + t->za * tile_w + t->zb * tile_h));
+					update_tile(tile, coverage, std::min(z, t->z_max));
+				}
+			}
+		}
+	}
+
+	inline void OcclusionCuller::render_occluders() {
+		stats.occluder_tris = (unsigned int)tris.size();
+		if (tris.empty())
+			return;
+		job_system.parallel_for((tiles_y + band_tiles - 1) / band_tiles, [this](unsigned int band, unsigned int) { raster_band((int)band); });
+	}
+
+	// Screen rectangle (inclusive tiles) and nearest depth of a box. Returns 0 if the box crosses the near plane.
+	inline bool OcclusionCuller::project_box(const cull_box& box, int rect[4], float& z_near) const {
+		float r[4];
+		if (!project_cull_box(box, view_proj, (float)width, (float)height, r, z_near))
+			return false;
+		rect[0] = std::max(0, (int)floorf(r[0] / tile_w));
+		rect[1] = std::max(0, (int)floorf(r[1] / tile_h));
+		rect[2] = std::min(tiles_x - 1, (int)floorf(r[2] / tile_w));
+		rect[3] = std::min(tiles_y - 1, (int)floorf(r[3] / tile_h));
+		return true;
+	}
+
+	inline bool OcclusionCuller::is_visible(const cull_box& box) {
+		int rect[4];
+		float z_near;
+		if (!project_box(box, rect, z_near))
+			return true;
+
+		// Off screen: frustum culling isn't this class' job.
+		if (rect[0] > rect[2] || rect[1] > rect[3])
+			return true;
+
+		// Visible as soon as one tile has its reference depth behind the box, 4 tiles at a time.
+		const __m128 zb = _mm_set1_ps(z_near);
+		for (int ty = rect[1]; ty <= rect[3]; ty++) {
+			const float* row = &z_max0[ty * tiles_x];
+			int tx = rect[0];
+			for (; tx + 3 <= rect[2]; tx += 4)
+				if (_mm_movemask_ps(_mm_cmple_ps(zb, _mm_loadu_ps(row + tx))))
+					return true;
+			for (; tx <= rect[2]; tx++)
+				if (z_near <= row[tx])
+					return true;
+		}
+		return false;
+	}
+
+	inline void OcclusionCuller::test_boxes(const std::vector<cull_box>& boxes, std::vector<uint8_t>& visible) {
+		const unsigned int batch = 64;
+		visible.resize(boxes.size());
+		job_system.parallel_for((unsigned int)((boxes.size() + batch - 1) / batch), [&](unsigned int b, unsigned int) {
+			size_t last = std::min(boxes.size(), (size_t)(b + 1) * batch);
+			for (size_t i = (size_t)b * batch; i < last; i++)
+				visible[i] = is_visible(boxes[i]);
+		});
+
+		stats.tested += (unsigned int)boxes.size();
+		for (auto i = visible.begin(); i != visible.end(); i++)
+			stats.culled += !*i;
+
+		totals.occluders += stats.occluders;
+		totals.tested += stats.tested;
+		totals.culled += stats.culled;
+		frames++;
+	}
+
+	inline void OcclusionCuller::report(report_counters& counters) const {
+		const double n = (double)std::max(frames, 1u);
+		counters.push_back(std::make_pair("occluders drawn per frame", totals.occluders / n));
+		counters.push_back(std::make_pair("objects tested per frame", totals.tested / n));
+		counters.push_back(std::make_pair("objects rejected per frame", totals.culled / n));
+	}
+}
+
+#endif // !GEN_ENG_OCCLUSION_H
@@ -0,0 +1,457 @@
+#pragma once
+#ifndef GEN_ENG_RENDER_GRAPH_H
+#define GEN_ENG_RENDER_GRAPH_H
+
+#include "glad/glad.h"
+#include "renderer/gl_state.h"
+#include "util/options.h"
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+/*	Render graph.
+		The frame is described as a list of passes, each declaring the textures it reads and writes, instead of hand-managed framebuffers. It's
+		rebuilt every frame (declaring it is cheap) and then:
+
+		- Ordered: every write makes a new version of a resource, and a pass runs after the passes that produced what it reads, after the one
+		  that produced what it overwrites, and after the ones that read the version it overwrites. Passes declared in a valid order keep it.
+		- Culled: only passes that lead to an output (an imported framebuffer, a resource marked as output, or a pass marked as having side
+		  effects, like a readback) are executed.
+		- Allocated: transient textures live from the first to the last pass that uses them. Textures of the same description whose lifetimes
+		  don't overlap share the same GL texture, and the textures are kept from one frame to the next, so memory only grows with the largest
+		  set of textures alive at the same time, not with the number of passes. Textures no longer used are released at the next frame.
+
+		Before a pass runs, the graph binds a framebuffer with what it writes (one color and/or one depth attachment, or an imported framebuffer)
+		and sets the viewport to its size. A transient texture has undefined contents when it's first written, since it may have belonged to
+		another resource: the pass writing it first must clear it or cover every pixel.
+
+		Render thread only. Passes capture what they need by reference, so the graph has to be executed before those go out of scope.
+*/
+
+namespace GenEngine {
+
+	// Transient texture description. Textures are only shared between resources with equal descriptions.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct rg_texture_desc {
+		int		width, height;
+		GLenum	format;			// Sized internal format: GL_RGBA8, GL_DEPTH_COMPONENT24...
+		int		samples;		// 0: single sampled.
+
+		inline bool operator==(const rg_texture_desc& d) const { return width == d.width && height == d.height && format == d.format && samples == d.samples; }
+	};
+
+	typedef unsigned int rg_handle;			// A version of a resource. Every write returns a new one.
+	const rg_handle rg_none = ~0u;
+
+	struct render_graph_stats {
+		unsigned int	passes;			// Declared in the last frame.
+		unsigned int	culled;			// Of those, not executed.
+		unsigned int	resources;		// Transient resources declared.
+		unsigned int	textures;		// GL textures backing them.
+		size_t			bytes;			// Memory of those textures.
+	};
+
+	class RenderGraph {
+	public:
+		class Builder;
+		typedef std::function<void(Builder&)>		setup_fn;
+		typedef std::function<void(RenderGraph&)>	execute_fn;
+
+	private:
+		struct resource {
+			const char*			name;
+			rg_texture_desc		desc;
+			bool				imported;		// Imported framebuffer, not allocated by the graph.
+			GLuint				fbo;
+			bool				output;
+			unsigned int		versions;		// Versions created so far.
+			int					texture;		// Index in textures, -1 if not allocated this frame.
+			int					first, last;	// First and last position in the execution order where it's used.
+		};
+		struct version {
+			unsigned int		resource;
+			unsigned int		number;
+			int					producer;		// Pass that wrote it, -1 for the initial version.
+		};
+		struct pass {
+			const char*				name;
+			execute_fn				execute;
+			std::vector<rg_handle>	reads, writes;
+			bool					side_effect;
+			bool					alive;
+		};
+		struct texture {
+			rg_texture_desc		desc;
+			GLuint				id;
+			int					busy_until;		// Position in the execution order after which it can be reused, -1 if free this frame.
+			bool				used;			// Used this frame; textures left unused are released.
+		};
+		struct framebuffer {
+			GLuint				color, depth, fbo;
+		};
+
+		std::vector<resource>		resources;
+		std::vector<version>		versions;
+		std::vector<pass>			passes;
+		std::vector<unsigned int>	order;			// Alive passes, in execution order.
+		std::vector<texture>		textures;		// Kept between frames.
+		std::vector<framebuffer>	framebuffers;	// One per attachment combination, kept while its textures are.
+		render_graph_stats			stats;
+
+		inline rg_handle		new_version(const unsigned int r, const int producer);
+		inline bool				is_latest(const rg_handle h) const;
+		inline bool				depends_on(const unsigned int p, const unsigned int q) const;		// p has to run after q.
+		inline void				allocate();
+		inline void				release_unused();
+		inline GLuint			get_framebuffer_ids(const GLuint color, const GLuint depth);
+
+		static inline bool		is_depth_format(const GLenum format);
+		static inline size_t	format_size(const GLenum format);
+
+	public:
+
+		// Declaring passes
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		class Builder {
+			RenderGraph&	graph;
+			unsigned int	index;
+		public:
+			Builder(RenderGraph& g, const unsigned int p) : graph(g), index(p) {}
+			inline void			read(const rg_handle h)		{ graph.passes[index].reads.push_back(h); }
+			inline rg_handle	write(const rg_handle h);		// Returns the version written, to be read by later passes.
+			inline void			side_effect()				{ graph.passes[index].side_effect = true; }		// Never culled.
+		};
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		RenderGraph() : stats{ 0, 0, 0, 0, 0 } {}
+		~RenderGraph() {}		// GL objects can only be released with the context current; call destroy() from the render thread.
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void			reset();															// Forgets the passes and resources of the last frame.
+		inline rg_handle	create_texture(const char* name, const rg_texture_desc& desc);
+		inline rg_handle	import_framebuffer(const char* name, const GLuint fbo, const int width, const int height);	// Always an output.
+		inline void			mark_output(const rg_handle h)		{ resources[versions[h].resource].output = true; }
+		inline void			add_pass(const char* name, const setup_fn& setup, const execute_fn& execute);
+		inline bool			compile();															// Orders, culls and allocates. 0 if there's a cycle.
+		inline void			execute();
+		inline void			destroy();
+
+		// Inside passes
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline GLuint		get_texture(const rg_handle h)	const	{ const resource& r = resources[versions[h].resource]; return r.texture < 0 ? 0 : textures[r.texture].id; }
+		inline GLuint		get_framebuffer(const rg_handle color, const rg_handle depth);		// Either can be rg_none. For blits.
+		inline const rg_texture_desc&	get_desc(const rg_handle h)	const	{ return resources[versions[h].resource].desc; }
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline const render_graph_stats&	get_stats()		const	{ return stats; }
+		inline void							report(report_counters& counters) const;
+	};
+
+	RenderGraph render_graph;		// Rebuilt by the render thread every frame. Its stats are read after it stops.
+
+
+	inline bool RenderGraph::is_depth_format(const GLenum format) {
+		return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8;
+	}
+
+	inline size_t RenderGraph::format_size(const GLenum format) {
+		switch (format) {
+		case GL_R8:					return 1;
+		case GL_RG8:				return 2;
+		case GL_DEPTH_COMPONENT16:	return 2;
+		case GL_RGBA16F:			return 8;
+		case GL_RG32F:				return 8;
+		case GL_RGBA32F:			return 16;
+		default:					return 4;
+		}
+	}
+
+	inline rg_handle RenderGraph::new_version(const unsigned int r, const int producer) {
+		versions.push_back({ r, resources[r].versions++, producer });
+		return (rg_handle)versions.size() - 1;
+	}
+
+	inline bool RenderGraph::is_latest(const rg_handle h) const {
+		return versions[h].number + 1 == resources[versions[h].resource].versions;
+	}
+
+	inline rg_handle RenderGraph::Builder::write(const rg_handle h) {
+		pass& p = graph.passes[index];
+		if (!graph.is_latest(h))
+			std::cout << "RenderGraph: pass \"" << p.name << "\" writes an old version of \"" << graph.resources[graph.versions[h].resource].name << "\".\n";
+		p.writes.push_back(h);
+		return graph.new_version(graph.versions[h].resource, (int)index);
+	}
+
+	inline void RenderGraph::reset() {
+		resources.clear();
+		versions.clear();
+		passes.clear();
+		order.clear();
+	}
+
+	inline rg_handle RenderGraph::create_texture(const char* name, const rg_texture_desc& desc) {
+		resources.push_back({ name, desc, false, 0, false, 0, -1, -1, -1 });
+		return new_version((unsigned int)resources.size() - 1, -1);
+	}
+
+	inline rg_handle RenderGraph::import_framebuffer(const char* name, const GLuint fbo, const int width, const int height) {
+		rg_texture_desc desc = { width, height, GL_RGBA8, 0 };
+		resources.push_back({ name, desc, true, fbo, true, 0, -1, -1, -1 });
+		return new_version((unsigned int)resources.size() - 1, -1);
+	}
+
+	inline void RenderGraph::add_pass(const char* name, const setup_fn& setup, const execute_fn& execute) {
+		passes.push_back({ name, execute, std::vector<rg_handle>(), std::vector<rg_handle>(), false, false });
+		Builder builder(*this, (unsigned int)passes.size() - 1);
+		setup(builder);
+	}
+
+	// Writes are stored as the version they overwrite; the version they create is the next one of the same resource.
+	inline bool RenderGraph::depends_on(const unsigned int p, const unsigned int q) const {
+		const pass& a = passes[p];
+		const pass& b = passes[q];
+		for (rg_handle r : a.reads)
+			if (versions[r].producer == (int)q)
+				return true;
+		for (rg_handle w : a.writes) {
+			if (versions[w].producer == (int)q)
+				return true;
+			for (rg_handle r : b.reads)
+				if (r == w)
+					return true;		// q reads what p overwrites.
+		}
+		return false;
+	}
+
+	inline bool RenderGraph::compile() {
+		const unsigned int n = (unsigned int)passes.size();
+
+		// Culling: walk back from the passes that produce something visible outside the graph.
+		std::vector<unsigned int> stack;
+		for (unsigned int p = 0; p < n; p++) {
+			bool output = passes[p].side_effect;
+			for (rg_handle w : passes[p].writes)
+				output |= resources[versions[w].resource].output;
+			passes[p].alive = output;
+			if (output)
+				stack.push_back(p);
+		}
+		while (!stack.empty()) {
+			const pass& p = passes[stack.back()];
+			stack.pop_back();
+			auto keep = [&](const rg_handle h) {
+				int producer = versions[h].producer;
+				if (producer >= 0 && !passes[producer].alive) {
+					passes[producer].alive = true;
+					stack.push_back(producer);
+				}
+			};
+			for (rg_handle r : p.reads)
+				keep(r);
+			for (rg_handle w : p.writes)
+				keep(w);		// Writes keep what was there before.
+		}
+
+		// Ordering: repeatedly take the first declared alive pass whose dependencies already ran.
+		std::vector<bool> done(n, false);
+		unsigned int alive = 0;
+		for (unsigned int p = 0; p < n; p++)
+			alive += passes[p].alive;
+		order.clear();
+		while (order.size() < alive) {
+			unsigned int next = n;
+			for (unsigned int p = 0; p < n && next == n; p++) {
+				if (!passes[p].alive || done[p])
+					continue;
+				bool ready = true;
+				for (unsigned int q = 0; q < n && ready; q++)
+					if (q != p && passes[q].alive && !done[q] && depends_on(p, q))
+						ready = false;
+				if (ready)
+					next = p;
+			}
+			if (next == n) {
+				std::cout << "RenderGraph: passes depend on each other, the frame can't be ordered.\n";
+				order.clear();
+				return false;
+			}
+			done[next] = true;
+			order.push_back(next);
+		}
+
+		// Lifetimes of the transient resources, in execution order.
+		for (auto& r : resources)
+			r.first = r.last = -1;
+		for (unsigned int i = 0; i < order.size(); i++) {
+			const pass& p = passes[order[i]];
+			auto use = [&](const rg_handle h) {
+				resource& r = resources[versions[h].resource];
+				if (r.first < 0)
+					r.first = (int)i;
+				r.last = (int)i;
+			};
+			for (rg_handle r : p.reads)
+				use(r);
+			for (rg_handle w : p.writes)
+				use(w);
+		}
+
+		allocate();
+
+		stats.passes = n;
+		stats.culled = n - alive;
+		stats.resources = 0;
+		for (auto& r : resources)
+			stats.resources += !r.imported && r.first >= 0;
+		stats.textures = (unsigned int)textures.size();
+		stats.bytes = 0;
+		for (auto& t : textures)
+			stats.bytes += (size_t)t.desc.width * t.desc.height * format_size(t.desc.format) * std::max(1, t.desc.samples);
+		return true;
+	}
+
+	// Assigns a texture to every transient resource, reusing the ones whose resource is already dead at that point of the frame.
+	inline void RenderGraph::allocate() {
+		for (auto& t : textures) {
+			t.busy_until = -1;
+			t.used = false;
+		}
+		for (unsigned int i = 0; i < order.size(); i++)
+			for (auto& r : resources) {
+				if (r.imported || r.first != (int)i)
+					continue;
+				int found = -1;
+				for (size_t t = 0; t < textures.size() && found < 0; t++)
+					if (textures[t].busy_until < (int)i && textures[t].desc == r.desc)
+						found = (int)t;
+				if (found < 0) {
+					texture t = { r.desc, 0, -1, false };
+					const GLenum target = r.desc.samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+					const bool depth = is_depth_format(r.desc.format);
+					glGenTextures(1, &t.id);
+					glBindTexture(target, t.id);
+					if (r.desc.samples > 0)
+						glTexImage2DMultisample(target, r.desc.samples, r.desc.format, r.desc.width, r.desc.height, GL_TRUE);
+					else {
+						// Color is filtered linearly for passes that read between texels; depth is only read with texelFetch.
+						glTexImage2D(target, 0, r.desc.format, r.desc.width, r.desc.height, 0, depth ? GL_DEPTH_COMPONENT : GL_RGBA,
+							depth ? GL_UNSIGNED_INT : GL_UNSIGNED_BYTE, NULL);
+						glTexParameteri(target, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+						glTexParameteri(target, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+						glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+						glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+						glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+					}
+					textures.push_back(t);
+					found = (int)textures.size() - 1;
+				}
+				textures[found].busy_until = r.last;
+				textures[found].used = true;
+				r.texture = found;
+			}
+		release_unused();
+	}
+
+	inline void RenderGraph::release_unused() {
+		for (size_t t = 0; t < textures.size(); ) {
+			if (textures[t].used) {
+				t++;
+				continue;
+			}
+			const GLuint id = textures[t].id;
+			for (size_t f = 0; f < framebuffers.size(); ) {
+				if (framebuffers[f].color == id || framebuffers[f].depth == id) {
+					gl_state.forget_framebuffer(framebuffers[f].fbo);
+					glDeleteFramebuffers(1, &framebuffers[f].fbo);
+					framebuffers.erase(framebuffers.begin() + f);
+				}
+				else
+					f++;
+			}
+			glDeleteTextures(1, &textures[t].id);
+			textures.erase(textures.begin() + t);
+
+			// Resources point to textures by index.
+			for (auto& r : resources)
+				if (r.texture > (int)t)
+					r.texture--;
+		}
+	}
+
+	inline GLuint RenderGraph::get_framebuffer_ids(const GLuint color, const GLuint depth) {
+		for (auto& f : framebuffers)
+			if (f.color == color && f.depth == depth)
+				return f.fbo;
+
+		framebuffer f = { color, depth, 0 };
+		glGenFramebuffers(1, &f.fbo);
+		gl_state.bind_framebuffer(GL_FRAMEBUFFER, f.fbo);
+		auto attach = [this](const GLenum attachment, const GLuint id) {
+			for (auto& t : textures)
+				if (t.id == id)
+					glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, t.desc.samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, id, 0);
+		};
+		if (color)
+			attach(GL_COLOR_ATTACHMENT0, color);
+		else {
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+		}
+		if (depth)
+			attach(GL_DEPTH_ATTACHMENT, depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "RenderGraph: framebuffer is incomplete.\n";
+		framebuffers.push_back(f);
+		return f.fbo;
+	}
+
+	inline GLuint RenderGraph::get_framebuffer(const rg_handle color, const rg_handle depth) {
+		const resource* c = color == rg_none ? NULL : &resources[versions[color].resource];
+		if (c && c->imported)
+			return c->fbo;
+		return get_framebuffer_ids(color == rg_none ? 0 : get_texture(color), depth == rg_none ? 0 : get_texture(depth));
+	}
+
+	inline void RenderGraph::execute() {
+		for (unsigned int i = 0; i < order.size(); i++) {
+			const pass& p = passes[order[i]];
+			rg_handle color = rg_none, depth = rg_none;
+			for (rg_handle w : p.writes) {
+				if (is_depth_format(resources[versions[w].resource].desc.format))
+					depth = w;
+				else
+					color = w;
+			}
+			if (color != rg_none || depth != rg_none) {
+				const rg_texture_desc& desc = get_desc(color != rg_none ? color : depth);
+				gl_state.bind_framebuffer(GL_FRAMEBUFFER, get_framebuffer(color, depth));
+				glViewport(0, 0, desc.width, desc.height);
+			}
+			p.execute(*this);
+		}
+	}
+
+	inline void RenderGraph::destroy() {
+		reset();
+		for (auto& t : textures)
+			t.used = false;
+		release_unused();
+	}
+
+	// Of the last frame.
+	inline void RenderGraph::report(report_counters& counters) const {
+		counters.push_back(std::make_pair("render graph passes", (double)stats.passes));
+		counters.push_back(std::make_pair("render graph passes culled", (double)stats.culled));
+		counters.push_back(std::make_pair("render graph transient resources", (double)stats.resources));
+		counters.push_back(std::make_pair("render graph textures", (double)stats.textures));
+		counters.push_back(std::make_pair("render graph texture memory (MB)", stats.bytes / (1024.0 * 1024.0)));
+	}
+}
+
+#endif // !GEN_ENG_RENDER_GRAPH_H
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef GEN_ENG_RENDER_THREAD_H
+#define GEN_ENG_RENDER_THREAD_H
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+#include "renderer/frame_packet.h"
+#include "renderer/gl_state.h"
+#include "util/triple_buffer.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*	Render thread.
+		Owns the GL context of a window and submits the frame packets produced by the main thread. The main thread fills the packet returned by
+		begin_packet() and hands it over with submit(); the render thread picks the newest packet available, executes it through the function given
+		on start() and swaps buffers. Since the handoff goes through a lock-free triple buffer, neither thread blocks the other and frame time tends
+		to max(simulation, rendering) instead of their sum.
+
+		The mutex/condition variable pair is only used to put the render thread to sleep when there's no new packet; it's never held during the
+		handoff itself.
+
+		Started with no window, the thread touches neither GLFW nor GL: it's how the software rasterizer backend (soft_raster.h) renders where
+		there's no usable GL.
+*/
+
+namespace GenEngine {
+
+	class RenderThread {
+	public:
+		typedef void (*execute_fn)(const FramePacket& packet);
+
+	private:
+		GLFWwindow*					window;
+		execute_fn					execute;
+		std::thread					worker;
+		std::atomic<bool>			running;
+		TripleBuffer<FramePacket>	packets;
+		bool						dropped;			// The slot being written was never consumed, so its uploads must be kept.
+
+		std::mutex					wake_mutex;
+		std::condition_variable		wake;
+
+		// Statistics
+		std::atomic<unsigned long long>	frames_drawn;
+
+		inline void		loop();
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		RenderThread() : window(NULL), execute(NULL), running(false), dropped(false), frames_drawn(0) {}
+		~RenderThread() { stop(); }
+
+		// Thread control
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void				start(GLFWwindow* w, execute_fn fn);	// Detaches the window's context (if any) from the calling thread and starts rendering.
+		inline void				stop();									// Stops the thread and gives the context back to the calling thread.
+		inline bool				is_running()		const	{ return running.load(); }
+
+		// Packet production (main thread only)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline FramePacket&		begin_packet();							// Returns the packet to fill for the next frame, already cleared.
+		inline void				submit();								// Publishes the packet filled since the last begin_packet().
+
+		inline unsigned long long	get_frames_drawn()	const	{ return frames_drawn.load(); }
+	};
+
+
+	inline void RenderThread::start(GLFWwindow* w, execute_fn fn) {
+		if (running.load())
+			return;
+		window = w;
+		execute = fn;
+		running = true;
+
+		// A context can only be current in one thread at a time.
+		if (window)
+			glfwMakeContextCurrent(NULL);
+		worker = std::thread(&RenderThread::loop, this);
+	}
+
+	inline void RenderThread::stop() {
+		if (!running.load())
+			return;
+		running = false;
+		wake.notify_one();
+		worker.join();
+		if (window)
+			glfwMakeContextCurrent(window);
+	}
+
+	inline FramePacket& RenderThread::begin_packet() {
+		FramePacket& packet = packets.write_slot();
+
+		// Uploads of a packet the render thread never saw must still reach the GPU, so they're carried over into the new frame.
+		if (dropped) {
+			packet.draws.clear();
+			packet.instances.clear();
+		}
+		else
+			packet.clear();
+		return packet;
+	}
+
+	inline void RenderThread::submit() {
+		dropped = packets.publish();
+		wake.notify_one();
+	}
+
+	inline void RenderThread::loop() {
+		if (window) {
+			glfwMakeContextCurrent(window);
+
+			// The context is now owned by a different thread; whatever the cache knew about it may be stale.
+			gl_state.invalidate();
+		}
+
+		while (running.load()) {
+			if (!packets.acquire()) {
+				std::unique_lock<std::mutex> lock(wake_mutex);
+				wake.wait_for(lock, std::chrono::milliseconds(5), [this] { return packets.has_fresh() || !running.load(); });
+				continue;
+			}
+			execute(packets.read_slot());
+			if (window)
+				glfwSwapBuffers(window);
+			frames_drawn++;
+		}
+
+		// Finish any pending command before the context is handed back.
+		if (window) {
+			glFinish();
+			glfwMakeContextCurrent(NULL);
+		}
+	}
+}
+
+#endif // !GEN_ENG_RENDER_THREAD_H
@@ -7,29 +7,81 @@
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 #include "level_editor/3dobj.h"
+#include "level_editor/level_optimize.h"
+#include "level_editor/obj_loader.h"
+#include "level_editor/picking.h"
 #include "renderer/view.h"
 #include "renderer/shader.h"
+#include "renderer/gl_state.h"
+#include "renderer/frame_packet.h"
+#include "renderer/render_thread.h"
+#include "renderer/stream_buffer.h"
+#include "renderer/instancing.h"
+#include "renderer/render_graph.h"
+#include "renderer/gpu_timer.h"
+#include "renderer/headless.h"
+#include "renderer/soft_raster.h"
+#include "renderer/occlusion.h"
+#include "renderer/hiz.h"
+#include "renderer/antialiasing.h"
+#include "renderer/dynamic_resolution.h"
+#include "renderer/frame_capture.h"
+#include "renderer/lighting.h"
 #include "util/vec.h"
 #include "util/camera.h"
+#include "util/engine_loop.h"
 
 #include <iostream>
 #include <algorithm>
 #include <math.h>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <string.h>
 
-std::vector<GenWall>walls;
+std::vector<GenWall>walls;		// Must not be resized while the render thread is running: frame packets point to its elements.
+GenEngine::wall_batch_set wall_batches;		// Made by --optimize: each batch draws its walls in one draw.
+std::vector<GenObject>meshes;		// Loaded from a file (--obj). Same rule as walls; not walls, so never optimized, culled or picked.
+std::vector<GenEngine::section> sections;		// Level (--rooms), drawn from each section's mesh with its baked light. Same rule as walls.
+std::vector<GenEngine::wall_vert> section_verts;	// What the sections' vertex lists point into.
+std::vector<GenEngine::light> lights;		// Level lights, main thread. Copied into every frame packet.
+
+GenEngine::EngineLoop engine_loop;	// Main loop timing: fixed simulation step, frame cap and render on demand mode for the editor.
+
+int fb_width = 0, fb_height = 0;	// Framebuffer size, updated on the main thread and sent to the render thread in every frame packet.
+
+std::vector<GenEngine::frame_timing> render_timings;	// Headless runs only. Written by the render thread, read after it stops.
+
+const unsigned int max_occluders = 32;			// Walls rasterized as occluders each frame, largest on screen first.
+
+bool depth_prepass = true;					// Walls are drawn depth only first, so the color pass shades each covered pixel once.
+double samples_shaded = 0.0, prepass_samples = 0.0;		// Headless runs: totals over the frames measured, written by the render thread.
+unsigned int sample_frames = 0;
+
+int hovered_wall = -1;						// Main thread: wall under the cursor, drawn highlighted.
+
+const int x_divisions = 10;					// Division marks on each side of the x axis, drawn instanced.
 
 // REMOVE
 void framebuffer_callback(GLFWwindow* window, int w, int h) {
-	glViewport(0, 0, w, h);
+	// Called from glfwPollEvents on the main thread, which doesn't own the context. The viewport is set by the render thread.
+	fb_width = w;
+	fb_height = h;
+	engine_loop.request_redraw();
 }
 /// DELETE
-void	drawFloorPlane(const Shader& shader, const mat4x4 view, const mat4x4 projection);
+void	drawFloorPlane(const Shader& shader);
 void	drawAxis(const Shader& shader);
+void	xMeasures(GenEngine::FramePacket& packet, const int divisions);
 
 int		init_OpenGL_APIs();
 int		create_render_window(GLFWwindow *&p_window, const int w, const int h, const char *title, GLFWmonitor *monitor);
 int		render();
+void	build_frame_packet(GenEngine::FramePacket& packet, GenEngine::Camera& camera, const double time, const vec2& cursor);
+void	execute_frame_packet(const GenEngine::FramePacket& packet);
+void	bind_camera_block(const mat4x4& view, const mat4x4& projection);
+void	cull_walls(const mat4x4& view_proj, const vec3& eye, const unsigned long long frame, std::vector<uint8_t>& visible);
 
 void	setGradientColor(const vec3& top, const vec3& bot);
 
@@ -66,49 +118,469 @@ int create_render_window(GLFWwindow *&p_window, const int w, const int h, const
 		return -2;
 	}
 	glfwSetFramebufferSizeCallback(p_window, framebuffer_callback);
+	glfwGetFramebufferSize(p_window, &fb_width, &fb_height);
+
+	// Headless runs draw offscreen at a fixed size and must never wait for vsync.
+	if (GenEngine::headless.enabled) {
+		fb_width = GenEngine::headless.width;
+		fb_height = GenEngine::headless.height;
+		glfwSwapInterval(0);
+	}
+
+	// New context: nothing of what the state cache knows is valid anymore.
+	GenEngine::gl_state.invalidate();
 
 	glViewport(0, 0, w, h);
-	glDisable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_LINE_SMOOTH);
-	glEnable(GL_POLYGON_SMOOTH);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-	glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
+	GenEngine::gl_state.disable(GL_CULL_FACE);
+	GenEngine::gl_state.enable(GL_DEPTH_TEST);
+	GenEngine::gl_state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	return 1;
 }
 
-// Main render function
+// Main render function. The calling (main) thread polls input, runs the simulation at a fixed step and produces one frame packet per frame
+// from the interpolated simulation state, while a render thread that owns the GL context submits them. With no window (headless --cpu),
+// there's no input and no context: the render thread draws the packets with the software rasterizer.
 int render(GLFWwindow*& p_window) {
-	static mat4x4 view, projection;
-	static Shader plane("shaders/vs_proj.vs", "shaders/fs_col.fs");
+	static GenEngine::RenderThread render_thread;
 	GenEngine::Camera camera(vec3(0.f, 0.f, 6.f), vec3(0.f, 180.f, 180.f));
-	glfwSetInputMode(p_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-	while (true) {
-		camera.move_camera(p_window);
-		camera.cursor_offset_to_angle(p_window);
+	GenEngine::Camera prev_camera = camera;
+	unsigned long long frame = 0;
+	std::vector<GenEngine::frame_timing> cpu_timings;
+	bool capture_key = false;
+	if (!GenEngine::headless.enabled)
+		glfwSetInputMode(p_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+	engine_loop.request_redraw();
+	render_thread.start(p_window, execute_frame_packet);
+
+	while (!p_window || !glfwWindowShouldClose(p_window)) {
+		// Headless runs draw every packet, so the frames rendered don't depend on how fast each thread happens to run.
+		if (GenEngine::headless.enabled) {
+			while (render_thread.get_frames_drawn() < frame)
+				std::this_thread::yield();
+			if (frame >= GenEngine::headless.frames)
+				break;
+		}
+		auto cpu_start = std::chrono::steady_clock::now();
+		engine_loop.begin_frame();
+
+		// When rendering on demand and nothing changed, block until there's input instead of spinning. Windowless runs have no input.
+		if (p_window && engine_loop.is_idle())
+			glfwWaitEventsTimeout(0.5);
+		else if (p_window)
+			glfwPollEvents();
+
+		vec3 last_pos = camera.get_pos(), last_angle = camera.get_angle();
+		if (!GenEngine::headless.enabled) {
+			camera.cursor_offset_to_angle(p_window);
+
+			// F12 starts and stops capturing frames to disk.
+			bool key = glfwGetKey(p_window, GLFW_KEY_F12) == GLFW_PRESS;
+			if (key && !capture_key) {
+				GenEngine::frame_capture.set_requested(!GenEngine::frame_capture.is_requested());
+				engine_loop.request_redraw();
+				std::cout << (GenEngine::frame_capture.is_requested() ? "Capturing frames.\n" : "Frame capture stopped.\n");
+			}
+			capture_key = key;
+		}
 		camera.angles_to_axis();
-		view = camera.look_at();
-		projection = getProjMatrix(1366, 768, 0.01f, 10.f, 90.f);
-
+		while (engine_loop.step_simulation()) {
+			prev_camera = camera;
+			if (p_window)
+				camera.move_camera(p_window, (float)engine_loop.get_step());
+		}
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		setGradientColor(vec3(0.f, 1.f, 0.f) * std::max(0.1f, sin((float)glfwGetTime())), vec3(0.f, 0.f, 1.f) * std::max(0.1f, cos((float)glfwGetTime())));
+		// Anything that changes what's on screen asks for a redraw (only matters in render on demand mode).
+		if (camera.get_pos() != last_pos || camera.get_angle() != last_angle)
+			engine_loop.request_redraw();
+		for (auto i = walls.begin(); i != walls.end(); i++)
+			if (i->needs_upload())
+				engine_loop.request_redraw();
+		for (auto i = meshes.begin(); i != meshes.end(); i++)
+			if (i->needs_upload())
+				engine_loop.request_redraw();
+		for (auto i = sections.begin(); i != sections.end(); i++)
+			if (i->get_mesh().needs_upload())
+				engine_loop.request_redraw();
+
+		if (engine_loop.should_render()) {
+			GenEngine::Camera view_camera = GenEngine::interpolate(prev_camera, camera, engine_loop.alpha());
+			GenEngine::FramePacket& packet = render_thread.begin_packet();
+			packet.frame = frame++;
+			packet.capture = GenEngine::frame_capture.is_requested();
+
+			// Headless runs are driven by the frame number so every run renders the same frames, and hover the center of the screen.
+			vec2 cursor((float)fb_width * 0.5f, (float)fb_height * 0.5f);
+			if (!GenEngine::headless.enabled)
+				GenEngine::cursor_position(p_window, fb_width, fb_height, cursor[0], cursor[1]);
+			build_frame_packet(packet, view_camera, GenEngine::headless.enabled ? packet.frame / 60.0 : glfwGetTime(), cursor);
+			render_thread.submit();
+
+			// Only the headless report reads them; a windowed run would grow the list for as long as it runs.
+			if (GenEngine::headless.enabled)
+				cpu_timings.push_back({ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpu_start).count(), -1.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0 });
+		}
+		engine_loop.end_frame();
+	}
 
-		for (auto i = walls.begin(); i != walls.end(); i++) {
-			i->draw(plane, view, projection);
+	render_thread.stop();
+
+	// The context is current on this thread again after stop(). Windowless runs never captured anything.
+	if (p_window)
+		GenEngine::frame_capture.finish();
+	if (GenEngine::headless.enabled) {
+		GenEngine::report_counters counters;
+		GenEngine::occlusion_culler.report(counters);
+		GenEngine::hiz_query.report(counters);
+		GenEngine::scene_picker.report(counters);
+		std::string renderer_name = "software rasterizer";
+		if (!GenEngine::headless.cpu) {
+			double measured = (double)std::max(sample_frames, 1u);
+			counters.push_back(std::make_pair("samples shaded per frame", samples_shaded / measured));
+			counters.push_back(std::make_pair("depth pre-pass samples per frame", prepass_samples / measured));
+			GenEngine::render_graph.report(counters);
+			GenEngine::dynamic_resolution.report(counters);
+			GenEngine::clustered_lighting.report(counters);
+			GenEngine::frame_capture.report(counters);
+			renderer_name = std::string((const char*)glGetString(GL_RENDERER)) + ", " + GenEngine::post_aa.get_name() + " anti-aliasing";
 		}
-		//drawFloorPlane(plane, view, projection);
-		glfwSwapBuffers(p_window);
-		glfwPollEvents();
+		GenEngine::level_optimizer.report(counters);
+		GenEngine::obj_loader.report(counters);
+		GenEngine::write_headless_report(cpu_timings, render_timings, renderer_name.c_str(), counters);
 	}
+	if (GenEngine::headless.cpu && GenEngine::headless.image_path && !GenEngine::soft_raster.write_ppm(GenEngine::headless.image_path))
+		std::cout << "Headless: image \"" << GenEngine::headless.image_path << "\" could not be written.\n";
 	return 1;
 }
 
+// Fills a frame packet with everything needed to draw the current state of the scene. Runs on the main thread.
+void build_frame_packet(GenEngine::FramePacket& packet, GenEngine::Camera& camera, const double time, const vec2& cursor) {
+	packet.time = time;
+	packet.width = fb_width;
+	packet.height = fb_height;
+	packet.view = camera.look_at();
+	packet.projection = getProjMatrix((float)std::max(fb_width, 1), (float)std::max(fb_height, 1), 0.01f, 10.f, 90.f);
+	packet.bg_top = vec3(0.f, 1.f, 0.f) * std::max(0.1f, sin((float)time));
+	packet.bg_bot = vec3(0.f, 0.f, 1.f) * std::max(0.1f, cos((float)time));
+	packet.lights.assign(lights.begin(), lights.end());
+
+	static std::vector<uint8_t> visible;
+	if (GenEngine::occlusion_culler.is_enabled())
+		cull_walls(packet.view * packet.projection, camera.get_pos(), packet.frame, visible);
+	else
+		visible.assign(walls.size(), 1);
+
+	// Wall under the cursor. The picking BVH only needs rebuilding when some wall's vertices changed, the same as their GL buffers.
+	bool changed = GenEngine::scene_picker.get_wall_count() != walls.size();
+	for (size_t i = 0; i < walls.size() && !changed; i++)
+		changed = walls[i].needs_upload();
+	if (changed)
+		GenEngine::scene_picker.build(walls);
+	GenEngine::pick_ray ray;
+	GenEngine::scene_pick pick;
+	hovered_wall = GenEngine::screen_ray(cursor.x(), cursor.y(), fb_width, fb_height, packet.view * packet.projection, ray) &&
+		GenEngine::scene_picker.pick(walls, ray, pick) ? pick.wall : -1;
+
+	auto upload = [&packet](GenObject& obj) {
+		if (!obj.needs_upload())
+			return;
+		packet.uploads.push_back(GenEngine::upload_cmd());
+		packet.uploads.back().obj = &obj;
+		packet.uploads.back().verts = obj.vbo_verts;
+		packet.uploads.back().indices = obj.indices;
+		obj.mark_clean();
+	};
+
+	// A batch is rebuilt from its walls when one of them changed, before they're marked clean. One not uploaded yet was just built from them.
+	for (GenEngine::wall_batch& b : wall_batches.batches)
+		for (const unsigned int w : b.walls)
+			if (!b.mesh.needs_upload() && walls[w].needs_upload()) {
+				GenEngine::level_optimizer.build_batch(walls, b);
+				break;
+			}
+
+	// Hidden walls still get their uploads, the render thread needs the data whenever they come into view. Visible walls in a batch are
+	// drawn by it, unless it holds the hovered wall: then they're drawn one by one, so that one can be highlighted.
+	const unsigned int hovered_batch = hovered_wall >= 0 && (size_t)hovered_wall < wall_batches.batch_of.size() ? wall_batches.batch_of[hovered_wall] : ~0u;
+	static std::vector<uint8_t> batch_visible;
+	batch_visible.assign(wall_batches.batches.size(), 0);
+	for (size_t i = 0; i < walls.size(); i++) {
+		upload(walls[i]);
+		if (!visible[i])
+			continue;
+		const unsigned int b = i < wall_batches.batch_of.size() ? wall_batches.batch_of[i] : ~0u;
+		if (b != ~0u && b != hovered_batch)
+			batch_visible[b] = 1;
+		else
+			packet.draws.push_back({ &walls[i], (int)i == hovered_wall ? vec3(1.f, 0.75f, 0.3f) : vec3(0.8f, 0.8f, 0.8f) });
+	}
+	for (size_t b = 0; b < wall_batches.batches.size(); b++) {
+		upload(wall_batches.batches[b].mesh);
+		if (batch_visible[b])
+			packet.draws.push_back({ &wall_batches.batches[b].mesh, vec3(0.8f, 0.8f, 0.8f) });
+	}
+
+	// Loaded meshes and the level aren't culled: the occlusion tests and the Hi-Z boxes are per wall.
+	for (GenObject& mesh : meshes) {
+		upload(mesh);
+		packet.draws.push_back({ &mesh, vec3(0.8f, 0.8f, 0.8f) });
+	}
+	for (GenEngine::section& s : sections) {
+		upload(s.get_mesh());
+		packet.draws.push_back({ &s.get_mesh(), vec3(0.8f, 0.8f, 0.8f) });
+	}
+
+	// Repeated meshes go to the instance list, one instanced draw per mesh.
+	xMeasures(packet, x_divisions);
+}
+
+// Occlusion culling of the walls: the ones that look biggest from the camera are drawn as occluders, then every wall's box is tested. A wall
+// never hides itself, since its own depth is never in front of its box.
+void cull_walls(const mat4x4& view_proj, const vec3& eye, const unsigned long long frame, std::vector<uint8_t>& visible) {
+	static std::vector<GenEngine::cull_box> boxes;
+	static std::vector<std::pair<float, size_t>> candidates;		// (apparent size, wall)
+	boxes.resize(walls.size());
+	candidates.clear();
+
+	for (size_t i = 0; i < walls.size(); i++) {
+		if (!walls[i].get_bounds(boxes[i].min, boxes[i].max)) {
+			boxes[i].min = boxes[i].max = vec3(0.f, 0.f, 0.f);
+			continue;
+		}
+
+		// Apparent size: squared box diagonal over squared distance to its center.
+		vec3 extent = boxes[i].max - boxes[i].min;
+		vec3 to_center = (boxes[i].min + boxes[i].max) * 0.5f - eye;
+		float d2 = std::max(dot(to_center, to_center), 0.01f);
+		candidates.push_back(std::make_pair(dot(extent, extent) / d2, i));
+	}
+
+	size_t n = std::min<size_t>(max_occluders, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(),
+		[](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first > b.first; });
+
+	GenEngine::occlusion_culler.begin_frame(view_proj);
+	for (size_t i = 0; i < n; i++) {
+		const GenWall& wall = walls[candidates[i].second];
+		GenEngine::occlusion_culler.add_occluder(wall.vbo_verts.data(), wall.vbo_verts.size() / 3, wall.primitive, wall.indices);
+	}
+	GenEngine::occlusion_culler.render_occluders();
+	GenEngine::occlusion_culler.test_boxes(boxes, visible);
+
+	// What survived is tested against the depth of an earlier frame, moved to this frame's camera if it changed since (hiz.h).
+	// Walls about to be uploaded aren't in the depth of any earlier frame.
+	static GenEngine::hiz_readback readback;
+	for (size_t i = 0; i < walls.size(); i++)
+		if (walls[i].needs_upload()) {
+			GenEngine::hiz_query.invalidate(frame);
+			break;
+		}
+	if (GenEngine::hiz_pyramid.take_readback(readback))
+		GenEngine::hiz_query.update(readback);
+	if (GenEngine::hiz_query.is_enabled())
+		GenEngine::hiz_query.cull(view_proj, frame, boxes, visible);
+}
+
+// Submits a frame packet to the GPU. Runs on the render thread, which owns the context.
+void execute_frame_packet(const GenEngine::FramePacket& packet) {
+	auto submit_start = std::chrono::steady_clock::now();
+
+	// CPU backend: nothing goes through GL, there's no context. It returns before the GL objects below are created.
+	if (GenEngine::headless.cpu) {
+		GenEngine::soft_raster.render(packet);
+		const GenEngine::soft_raster_stats& st = GenEngine::soft_raster.get_stats();
+		render_timings.push_back({ -1.0, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submit_start).count(), -1.0,
+			st.setup_ms, st.bin_ms, st.raster_ms, st.tile_avg_ms, st.tile_max_ms, -1.0 });
+		return;
+	}
+
+	static Shader plane("shaders/vs_proj.vs", "shaders/fs_col.fs");
+	static Shader instanced("shaders/vs_inst.vs", "shaders/fs_inst.fs");
+	static GenEngine::InstancedRenderer instancer;
+	static GenEngine::GpuTimer gpu_timer;
+	static GenEngine::GpuTimer shaded_counter(GL_SAMPLES_PASSED), prepass_counter(GL_SAMPLES_PASSED);
+	static Shader depth_only("shaders/vs_proj.vs", "shaders/fs_depth.fs");
+
+	if (!GenEngine::stream_ring.is_created()) {
+		GenEngine::stream_ring.create(4 * 1024 * 1024);
+		plane.bindUniformBlock("Camera", 0);
+		instanced.bindUniformBlock("Camera", 0);
+		depth_only.bindUniformBlock("Camera", 0);
+	}
+	GenEngine::stream_ring.begin_frame();
+
+	GenEngine::gl_state.reset_stats();
+	gpu_timer.begin(render_timings.size());
+	for (auto i = packet.uploads.begin(); i != packet.uploads.end(); i++)
+		i->obj->upload(i->verts, i->indices);
+	bind_camera_block(packet.view, packet.projection);
+	GenEngine::clustered_lighting.update(packet.lights, packet.view, packet.projection);
+
+	// The frame as a render graph: the scene is drawn offscreen, at the size chosen by the dynamic resolution controller, so its depth can be
+	// sampled afterwards. Then it's anti-aliased and upscaled on its way to the window (headless runs: to a texture that stands in for it, so
+	// the final pass costs the same).
+	int w, h;
+	GenEngine::dynamic_resolution.get_size(std::max(packet.width, 1), std::max(packet.height, 1), w, h);
+	const int samples = GenEngine::post_aa.get_samples();
+	const unsigned long long id = render_timings.size();
+	const bool measure = GenEngine::headless.enabled;
+	GenEngine::render_graph.reset();
+	GenEngine::rg_handle color = GenEngine::render_graph.create_texture("scene color", { w, h, GL_RGBA8, samples });
+	GenEngine::rg_handle depth = GenEngine::render_graph.create_texture("scene depth", { w, h, GL_DEPTH_COMPONENT24, samples });
+	GenEngine::rg_handle screen;
+	if (GenEngine::headless.enabled) {
+		screen = GenEngine::render_graph.create_texture("screen", { std::max(packet.width, 1), std::max(packet.height, 1), GL_RGBA8, 0 });
+		GenEngine::render_graph.mark_output(screen);
+	}
+	else
+		screen = GenEngine::render_graph.import_framebuffer("window", 0, packet.width, packet.height);
+
+	// Depth pre-pass: the walls' depth is laid down first, so in the color pass every pixel is shaded only by the wall that ends up visible.
+	if (depth_prepass)
+		GenEngine::render_graph.add_pass("depth pre-pass", [&](GenEngine::RenderGraph::Builder& b) { depth = b.write(depth); }, [&](GenEngine::RenderGraph&) {
+			if (measure)
+				prepass_counter.begin(id);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			for (auto i = packet.draws.begin(); i != packet.draws.end(); i++)
+				i->obj->draw(depth_only, i->color);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			if (measure)
+				prepass_counter.end();
+		});
+
+	GenEngine::render_graph.add_pass("scene", [&](GenEngine::RenderGraph::Builder& b) {
+		color = b.write(color);
+		depth = b.write(depth);
+	}, [&](GenEngine::RenderGraph&) {
+		if (measure)
+			shaded_counter.begin(id);
+		if (depth_prepass) {
+			glClear(GL_COLOR_BUFFER_BIT);
+			GenEngine::gl_state.depth_func(GL_LEQUAL);
+			GenEngine::gl_state.depth_mask(GL_FALSE);
+		}
+		else
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		plane.use();
+		GenEngine::clustered_lighting.bind(plane, w, h);
+		for (auto i = packet.draws.begin(); i != packet.draws.end(); i++)
+			i->obj->draw(plane, i->color);
+		GenEngine::gl_state.depth_func(GL_LESS);
+		GenEngine::gl_state.depth_mask(GL_TRUE);
+
+		// Repeated geometry: grouped by mesh, one instanced draw each.
+		for (auto i = packet.instances.begin(); i != packet.instances.end(); i++)
+			instancer.submit(i->mesh, i->model, i->color);
+		instancer.flush(instanced);
+		//drawFloorPlane(plane);
+
+		// Background last, at the far plane: only what no geometry covered is shaded.
+		setGradientColor(packet.bg_top, packet.bg_bot);
+		if (measure)
+			shaded_counter.end();
+	});
+
+	// MSAA: everything after this reads the resolved textures.
+	const GenEngine::rg_handle ms_color = color, ms_depth = depth;
+	if (samples) {
+		color = GenEngine::render_graph.create_texture("resolved color", { w, h, GL_RGBA8, 0 });
+		depth = GenEngine::render_graph.create_texture("resolved depth", { w, h, GL_DEPTH_COMPONENT24, 0 });
+		GenEngine::render_graph.add_pass("msaa resolve", [&](GenEngine::RenderGraph::Builder& b) {
+			b.read(ms_color);
+			b.read(ms_depth);
+			color = b.write(color);
+			depth = b.write(depth);
+		}, [&](GenEngine::RenderGraph& g) {
+			GenEngine::post_aa.resolve(g.get_framebuffer(ms_color, ms_depth), w, h, id);
+		});
+	}
+
+	const GenEngine::rg_handle scene_color = color, scene_depth = depth;
+	GenEngine::render_graph.add_pass("anti-aliasing", [&](GenEngine::RenderGraph::Builder& b) {
+		b.read(scene_color);
+		screen = b.write(screen);
+	}, [&](GenEngine::RenderGraph& g) {
+		GenEngine::post_aa.present(g.get_texture(scene_color), g.get_framebuffer(scene_color, GenEngine::rg_none), w, h, packet.width, packet.height, id);
+	});
+
+	// Only needed while the main thread uses its readback.
+	GenEngine::render_graph.add_pass("hi-z", [&](GenEngine::RenderGraph::Builder& b) {
+		b.read(scene_depth);
+		if (GenEngine::hiz_query.is_enabled())
+			b.side_effect();
+	}, [&](GenEngine::RenderGraph& g) {
+		GenEngine::hiz_pyramid.build(g.get_texture(scene_depth), w, h);
+		GenEngine::hiz_pyramid.readback(packet.view * packet.projection, packet.frame);
+	});
+
+	// Frame capture: only queues the readback of the final image; it's written a few frames later by frame_capture's own thread.
+	GenEngine::render_graph.add_pass("capture", [&](GenEngine::RenderGraph::Builder& b) {
+		b.read(screen);
+		if (packet.capture)
+			b.side_effect();
+	}, [&](GenEngine::RenderGraph& g) {
+		GenEngine::frame_capture.capture(g.get_framebuffer(screen, GenEngine::rg_none), std::max(packet.width, 1), std::max(packet.height, 1), packet.frame);
+	});
+
+	if (GenEngine::render_graph.compile())
+		GenEngine::render_graph.execute();
+
+	GenEngine::stream_ring.end_frame();
+	gpu_timer.end();
+	GenEngine::frame_capture.poll();
+
+	// Headless runs log every frame's results; otherwise only the latest GPU time is needed, for the resolution controller.
+	bool measured = false;
+	if (GenEngine::headless.enabled) {
+		render_timings.push_back({ -1.0, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submit_start).count(), -1.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0 });
+		double ms, count;
+		unsigned long long frame;
+		while (gpu_timer.next_result(ms, frame)) {
+			render_timings[frame].gpu_ms = ms;
+			measured = true;
+		}
+		while (GenEngine::post_aa.get_timer().next_result(ms, frame))
+			render_timings[frame].aa_ms = ms;
+
+		while (shaded_counter.next_result(count, frame)) {
+			samples_shaded += count;
+			sample_frames++;
+		}
+		while (prepass_counter.next_result(count, frame))
+			prepass_samples += count;
+	}
+	else
+		measured = gpu_timer.poll();
+	if (measured)
+		GenEngine::dynamic_resolution.update(gpu_timer.get_ms());
+}
+
+// Writes the camera matrices of the frame into the streaming ring and binds them to the "Camera" uniform block (binding point 0), shared by
+// every shader that transforms world geometry.
+void bind_camera_block(const mat4x4& view, const mat4x4& projection) {
+	static GLint alignment = 0;
+	if (!alignment)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	const GLsizeiptr size = 2 * sizeof(mat4x4);
+	GLintptr offset;
+	float* block = (float*)GenEngine::stream_ring.allocate(size, alignment, offset);
+	if (!block)
+		return;
+	memcpy(block, view.e, sizeof(mat4x4));
+	memcpy(block + 16, projection.e, sizeof(mat4x4));
+	GenEngine::stream_ring.commit();
+	GenEngine::gl_state.bind_buffer_range(GL_UNIFORM_BUFFER, 0, GenEngine::stream_ring.get_buffer(), offset, size);
+}
+
+// Draws the background gradient at the far plane, after everything else. GL_LEQUAL lets it pass against the cleared depth (1.0) and
+// nowhere else, so it's only shaded where the screen is still empty; it doesn't write depth, which the hierarchical-Z pyramid reads afterwards.
 void setGradientColor(const vec3& top, const vec3& bot) {
-	glDisable(GL_DEPTH_TEST);
+	GenEngine::gl_state.enable(GL_DEPTH_TEST);
+	GenEngine::gl_state.depth_func(GL_LEQUAL);
+	GenEngine::gl_state.depth_mask(GL_FALSE);
 	static unsigned int backgroundVAO = 0;
 	static Shader background;
 
@@ -119,10 +591,10 @@ void setGradientColor(const vec3& top, const vec3& bot) {
 	background.use();
 	background.setVec3f("topColor", top.x(), top.y(), top.z());
 	background.setVec3f("botColor", bot.x(), bot.y(), bot.z());
-	glBindVertexArray(backgroundVAO);
+	GenEngine::gl_state.bind_vertex_array(backgroundVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 3);
-	glBindVertexArray(0);
-	glEnable(GL_DEPTH_TEST);
+	GenEngine::gl_state.depth_func(GL_LESS);
+	GenEngine::gl_state.depth_mask(GL_TRUE);
 }
 
 // DELETE THIS-------------------------------------!!!!!!!!!!!!!!
@@ -153,63 +625,51 @@ const unsigned int iAxis[] = { 0,1,	2,3, 4,5 };
 const unsigned int iX[] = { 0,1 };
 
 
-void xMeasures(const Shader& shader) {
-
-	static unsigned int xmVao = 0;
-	static unsigned int xmVbo = 0;
-	static unsigned int xmEbo = 0;
-	static mat4x4 model;
-	if (!xmVao) {
-		glGenVertexArrays(1, &xmVao);
-		glGenBuffers(1, &xmVbo);
-		glGenBuffers(1, &xmEbo);
-		glBindVertexArray(xmVao);
-		glBindBuffer(GL_VERTEX_ARRAY, xmVbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(xDivisions), &xDivisions[0].e[0], GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, xmEbo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(iX), iX, GL_DYNAMIC_DRAW);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
+// Adds the x axis division marks to a packet as instances of a single line mesh, so all of them cost one draw call on the render thread.
+// Runs on the main thread, like the rest of build_frame_packet().
+void xMeasures(GenEngine::FramePacket& packet, const int divisions) {
+	static GenObject mark;
+	mat4x4 model;
+	if (mark.vbo_verts.empty()) {
+		mark.primitive = GL_LINES;
+		for (int v = 0; v < 4; v += 2)
+			mark.vbo_verts.insert(mark.vbo_verts.end(), xDivisions[v].e, xDivisions[v].e + 3);
+		mark.mark_dirty();
 	}
-	shader.use();
-	glBindVertexArray(xmVao);
-	for (int i = 1; i < 2; i++) {
+	if (mark.needs_upload()) {
+		packet.uploads.push_back(GenEngine::upload_cmd());
+		packet.uploads.back().obj = &mark;
+		packet.uploads.back().verts = mark.vbo_verts;
+		mark.mark_clean();
+	}
+	for (int i = 1; i <= divisions; i++) {
 		model(3, 0) = ((float)i);
-		shader.setMat4f("model", model);
-		glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, 0);
+		packet.instances.push_back({ &mark, model, xDivisions[1] });
 		model(3, 0) = ((float)(-i));
-		shader.setMat4f("model", model);
-		glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, 0);
+		packet.instances.push_back({ &mark, model, xDivisions[1] });
 	}
-
 }
 
-void drawFloorPlane(const Shader& shader, const mat4x4 view, const mat4x4 projection) {
+void drawFloorPlane(const Shader& shader) {
 	static unsigned int vao = 0;
 	static unsigned int vbo = 0;
 	if (!vao) {
 		glGenVertexArrays(1, &vao);
 		glGenBuffers(1, &vbo);
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GenEngine::gl_state.bind_vertex_array(vao);
+		GenEngine::gl_state.bind_buffer(GL_ARRAY_BUFFER, vbo);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(square), square, GL_STATIC_DRAW);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
 		glEnableVertexAttribArray(0);
-		glBindVertexArray(0);
 	}
 	shader.use();
-	shader.setMat4f("view", view);
-	shader.setMat4f("projection", projection);
 	shader.setVec3f("color", 0.8f, 0.8f, 0.8f);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glBindVertexArray(vao);
+	GenEngine::gl_state.enable(GL_BLEND);
+	GenEngine::gl_state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GenEngine::gl_state.bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
-	glDisable(GL_BLEND);
+	GenEngine::gl_state.disable(GL_BLEND);
 }
 
 // MOVE THIS FUNCTION OUT OF HERE NEXT TIME YOU EDIT THIS YOU LAZY PIECE OF SHIT
@@ -222,12 +682,12 @@ void drawAxis(const Shader& shader) {
 		glGenVertexArrays(1, &axisVAO);
 		glGenBuffers(1, &axisVBO);
 		glGenBuffers(1, &axisEBO);
-		glBindVertexArray(axisVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, axisVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(axis), &axis[0].e[0], GL_DYNAMIC_DRAW);
+		GenEngine::gl_state.bind_vertex_array(axisVAO);
+		GenEngine::gl_state.bind_buffer(GL_ARRAY_BUFFER, axisVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(axis), &axis[0].e[0], GL_STATIC_DRAW);
 		//buffer data: target, sizeof, data of array where info is, mode
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, axisEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(iAxis), iAxis, GL_DYNAMIC_DRAW);
+		GenEngine::gl_state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, axisEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(iAxis), iAxis, GL_STATIC_DRAW);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -235,7 +695,7 @@ void drawAxis(const Shader& shader) {
 	}
 	shader.use();
 	shader.setMat4f("model", modelA);
-	glBindVertexArray(axisVAO);
+	GenEngine::gl_state.bind_vertex_array(axisVAO);
 	glDrawElements(GL_LINES, 6, GL_UNSIGNED_INT, 0);
 }
 
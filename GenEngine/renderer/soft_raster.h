@@ -0,0 +1,426 @@
+#pragma once
+#ifndef GEN_ENG_SOFT_RASTER_H
+#define GEN_ENG_SOFT_RASTER_H
+
+#include "glad/glad.h"
+#include "level_editor/3dobj.h"
+#include "renderer/frame_packet.h"
+#include "util/job_system.h"
+#include "util/vec.h"
+
+#include <emmintrin.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string.h>
+#include <math.h>
+
+/*	Software rasterizer.
+		CPU backend for the wall/floor geometry, used as a reference image for regressions and as a fallback where GL isn't usable. It renders the
+		same frame packets as the GL path over the background gradient of setGradientColor(), unlit: flat color with a GL_LESS depth test. That
+		matches vs_proj.vs + fs_col.fs only while the packet has no lights (fs_col.fs then gets an ambient of 1); the packet's lights are
+		ignored, so lit frames differ from the GL ones.
+
+		A frame goes through three stages:
+		- Setup (caller thread): vertices are transformed, triangles clipped against the near plane, and their edge and depth equations computed.
+		- Binning (parallel over chunks of triangles): every triangle is added to the list of each 64x64 tile its bounding box touches. Every chunk
+		  has its own lists, so no locking is needed and submission order is kept.
+		- Rasterization (parallel over tiles): each tile clears itself and draws its triangles, 4 pixels at a time with SSE2 edge functions and
+		  depth test. A tile is only ever touched by one thread.
+
+		The color buffer is RGBA8 with rows bottom to top, the layout glReadPixels returns, so both backends can be compared directly. Only
+		triangles (GL_TRIANGLES, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN) are drawn; lines and points are skipped.
+*/
+
+namespace GenEngine {
+
+	// Statistics of the last frame. Stage times are wall clock; tile times are per tile, to see how evenly the work was spread.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct soft_raster_stats {
+		double			setup_ms;
+		double			bin_ms;
+		double			raster_ms;
+		double			tile_avg_ms;
+		double			tile_max_ms;
+		unsigned int	triangles;			// Triangles that reached binning (after clipping and culling of degenerate ones).
+		unsigned int	bin_entries;		// Triangle-tile pairs.
+		unsigned int	threads;
+	};
+
+	class SoftRasterizer {
+
+		static const int		tile_size = 64;
+		static const unsigned	chunk_size = 1024;		// Triangles per binning job.
+
+		// Triangle ready to rasterize: E_i(x, y) = a[i] * x + b[i] * y + c[i] is >= 0 inside, z(x, y) = za * x + zb * y + zc.
+		struct raster_tri {
+			float		a[3], b[3], c[3];
+			float		za, zb, zc;
+			int			min_x, min_y, max_x, max_y;		// Inclusive pixel bounds, clamped to the screen.
+			uint32_t	color;
+			uint8_t		top_left[3];					// Edge owns the pixels lying exactly on it.
+		};
+
+		int									width, height;
+		int									tiles_x, tiles_y;
+		int									stride;				// Row length of the buffers, padded to whole tiles.
+		std::vector<uint32_t>				color_buf;
+		std::vector<float>					depth_buf;
+		vec3								bg_top, bg_bot;
+
+		std::vector<raster_tri>								tris;
+		std::vector<std::vector<std::vector<uint32_t>>>		bins;		// [chunk][tile] -> triangle indices.
+		std::vector<double>									tile_ms;
+
+		std::unordered_map<const GenObject*, std::vector<float>>	meshes;		// Vertex data received through frame packet uploads.
+
+		soft_raster_stats					stats;
+
+		inline void		setup_triangle(const float* v0, const float* v1, const float* v2, const uint32_t color);
+		inline void		clip_triangle(const float* v0, const float* v1, const float* v2, const uint32_t color);
+		inline void		bin_chunk(const unsigned int chunk);
+		inline void		raster_tile(const int tile);
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		SoftRasterizer() : width(0), height(0), tiles_x(0), tiles_y(0), stride(0), stats() {}
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		resize(const int w, const int h);
+		inline void		begin_frame(const vec3& top, const vec3& bot);
+		inline void		draw(const float* verts, const size_t vertex_count, const GLenum primitive, const mat4x4& mvp, const vec3& color);
+		inline void		end_frame();																			// Bins and rasterizes everything drawn.
+		inline void		render(const FramePacket& packet);														// Whole frame packet.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		read_pixels(std::vector<uint32_t>& out)		const;		// width * height RGBA8 pixels, rows bottom to top.
+		inline bool		write_ppm(const char* path)					const;
+		inline int		get_width()		const	{ return width; }
+		inline int		get_height()	const	{ return height; }
+		inline const soft_raster_stats&	get_stats()	const	{ return stats; }
+	};
+
+	SoftRasterizer soft_raster;		// CPU backend (headless --cpu). Used by the render thread, read after it stops.
+
+
+	// Packs a color the way a RGBA8 framebuffer stores it.
+	inline uint32_t pack_rgba8(const float r, const float g, const float b) {
+		auto to8 = [](float x) { return (uint32_t)(std::min(std::max(x, 0.f), 1.f) * 255.f + 0.5f); };
+		return to8(r) | (to8(g) << 8) | (to8(b) << 16) | (255u << 24);
+	}
+
+	inline void SoftRasterizer::resize(const int w, const int h) {
+		if (w == width && h == height)
+			return;
+		width = w;
+		height = h;
+		tiles_x = (w + tile_size - 1) / tile_size;
+		tiles_y = (h + tile_size - 1) / tile_size;
+		stride = tiles_x * tile_size;
+		color_buf.assign((size_t)stride * tiles_y * tile_size, 0);
+		depth_buf.assign((size_t)stride * tiles_y * tile_size, 1.f);
+		tile_ms.assign(tiles_x * tiles_y, 0.0);
+	}
+
+	inline void SoftRasterizer::begin_frame(const vec3& top, const vec3& bot) {
+		bg_top = top;
+		bg_bot = bot;
+		tris.clear();
+		stats = soft_raster_stats();
+	}
+
+	inline void SoftRasterizer::draw(const float* verts, const size_t vertex_count, const GLenum primitive, const mat4x4& mvp, const vec3& color) {
+		auto start = std::chrono::steady_clock::now();
+		const uint32_t col = pack_rgba8(color.x(), color.y(), color.z());
+
+		// Vertex stage: object space to clip space. mvp is column-major, as sent to the shaders.
+		static thread_local std::vector<float> clip;
+		clip.resize(vertex_count * 4);
+		for (size_t i = 0; i < vertex_count; i++) {
+			const float* p = verts + i * 3;
+			for (int r = 0; r < 4; r++)
+				clip[i * 4 + r] = mvp.e[r] * p[0] + mvp.e[4 + r] * p[1] + mvp.e[8 + r] * p[2] + mvp.e[12 + r];
+		}
+
+		// Primitive assembly.
+		const float* c = clip.data();
+		if (primitive == GL_TRIANGLES) {
+			for (size_t i = 0; i + 2 < vertex_count; i += 3)
+				clip_triangle(c + i * 4, c + (i + 1) * 4, c + (i + 2) * 4, col);
+		}
+		else if (primitive == GL_TRIANGLE_STRIP) {
+			for (size_t i = 0; i + 2 < vertex_count; i++)
+				clip_triangle(c + i * 4, c + (i + 1) * 4, c + (i + 2) * 4, col);
+		}
+		else if (primitive == GL_TRIANGLE_FAN) {
+			for (size_t i = 1; i + 1 < vertex_count; i++)
+				clip_triangle(c, c + i * 4, c + (i + 1) * 4, col);
+		}
+		stats.setup_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Clips against the near plane (z >= -w), the only one that can't be handled by the screen bounds and the depth test.
+	inline void SoftRasterizer::clip_triangle(const float* v0, const float* v1, const float* v2, const uint32_t color) {
+		const float* in[3] = { v0, v1, v2 };
+		float d[3];
+		int inside = 0;
+		for (int i = 0; i < 3; i++) {
+			d[i] = in[i][2] + in[i][3];
+			inside += d[i] >= 0.f;
+		}
+		if (inside == 3) {
+			setup_triangle(v0, v1, v2, color);
+			return;
+		}
+		if (inside == 0)
+			return;
+
+		float out[4][4];
+		int n = 0;
+		for (int i = 0; i < 3; i++) {
+			int j = (i + 1) % 3;
+			if (d[i] >= 0.f)
+				std::copy(in[i], in[i] + 4, out[n++]);
+			if ((d[i] >= 0.f) != (d[j] >= 0.f)) {
+				float t = d[i] / (d[i] - d[j]);
+				for (int k = 0; k < 4; k++)
+					out[n][k] = in[i][k] + (in[j][k] - in[i][k]) * t;
+				n++;
+			}
+		}
+		for (int i = 1; i + 1 < n; i++)
+			setup_triangle(out[0], out[i], out[i + 1], color);
+	}
+
+	inline void SoftRasterizer::setup_triangle(const float* v0, const float* v1, const float* v2, const uint32_t color) {
+		const float* in[3] = { v0, v1, v2 };
+		float x[3], y[3], z[3];
+		for (int i = 0; i < 3; i++) {
+			float inv_w = 1.f / in[i][3];
+			x[i] = (in[i][0] * inv_w * 0.5f + 0.5f) * width;
+			y[i] = (in[i][1] * inv_w * 0.5f + 0.5f) * height;
+			z[i] = in[i][2] * inv_w * 0.5f + 0.5f;
+		}
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area == 0.f || area != area)
+			return;
+
+		// Face culling is disabled in the GL path, so clockwise triangles are just turned around.
+		if (area < 0.f) {
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		raster_tri t;
+		t.min_x = std::max(0, (int)floorf(std::min(x[0], std::min(x[1], x[2]))));
+		t.min_y = std::max(0, (int)floorf(std::min(y[0], std::min(y[1], y[2]))));
+		t.max_x = std::min(width - 1, (int)ceilf(std::max(x[0], std::max(x[1], x[2]))));
+		t.max_y = std::min(height - 1, (int)ceilf(std::max(y[0], std::max(y[1], y[2]))));
+		if (t.min_x > t.max_x || t.min_y > t.max_y)
+			return;
+
+		// Edge i goes from vertex i+1 to vertex i+2, so it's 0 on that edge and area at vertex i.
+		for (int i = 0; i < 3; i++) {
+			int s = (i + 1) % 3, e = (i + 2) % 3;
+			t.a[i] = y[s] - y[e];
+			t.b[i] = x[e] - x[s];
+			t.c[i] = x[s] * y[e] - x[e] * y[s];
+			t.top_left[i] = (y[s] == y[e] && x[e] < x[s]) || y[e] < y[s];
+		}
+
+		float inv_area = 1.f / area;
+		t.za = (t.a[0] * z[0] + t.a[1] * z[1] + t.a[2] * z[2]) * inv_area;
+		t.zb = (t.b[0] * z[0] + t.b[1] * z[1] + t.b[2] * z[2]) * inv_area;
+		t.zc = (t.c[0] * z[0] + t.c[1] * z[1] + t.c[2] * z[2]) * inv_area;
+		t.color = color;
+		tris.push_back(t);
+	}
+
+	inline void SoftRasterizer::bin_chunk(const unsigned int chunk) {
+		std::vector<std::vector<uint32_t>>& tile_bins = bins[chunk];
+		for (auto i = tile_bins.begin(); i != tile_bins.end(); i++)
+			i->clear();
+
+		size_t last = std::min(tris.size(), (size_t)(chunk + 1) * chunk_size);
+		for (size_t i = (size_t)chunk * chunk_size; i < last; i++) {
+			const raster_tri& t = tris[i];
+			for (int ty = t.min_y / tile_size; ty <= t.max_y / tile_size; ty++)
+				for (int tx = t.min_x / tile_size; tx <= t.max_x / tile_size; tx++)
+					tile_bins[ty * tiles_x + tx].push_back((uint32_t)i);
+		}
+	}
+
+	inline void SoftRasterizer::raster_tile(const int tile) {
+		auto start = std::chrono::steady_clock::now();
+		const int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+
+		// Clear: background gradient, interpolated bottom to top across the whole screen like the fullscreen triangle does.
+		for (int y = y0; y < y0 + tile_size; y++) {
+			float lv = (y + 0.5f) / height;
+			uint32_t bg = pack_rgba8(bg_bot.x() * (1.f - lv) + bg_top.x() * lv, bg_bot.y() * (1.f - lv) + bg_top.y() * lv,
+				bg_bot.z() * (1.f - lv) + bg_top.z() * lv);
+			std::fill(&color_buf[(size_t)y * stride + x0], &color_buf[(size_t)y * stride + x0] + tile_size, bg);
+			std::fill(&depth_buf[(size_t)y * stride + x0], &depth_buf[(size_t)y * stride + x0] + tile_size, 1.f);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);		// Pixel centers of the 4 pixels of a step.
+
+		for (size_t chunk = 0; chunk < bins.size(); chunk++) {
+			const std::vector<uint32_t>& bin = bins[chunk][tile];
+			for (auto idx = bin.begin(); idx != bin.end(); idx++) {
+				const raster_tri& t = tris[*idx];
+
+				// Triangle bounds inside this tile; x is aligned down to a step of 4 (tiles are aligned, so a step never leaves the tile).
+				int min_x = std::max(t.min_x, x0) & ~3, max_x = std::min(t.max_x, x0 + tile_size - 1);
+				int min_y = std::max(t.min_y, y0), max_y = std::min(t.max_y, y0 + tile_size - 1);
+
+				__m128 a[3], step[3], tl[3];
+				for (int i = 0; i < 3; i++) {
+					a[i] = _mm_set1_ps(t.a[i]);
+					step[i] = _mm_set1_ps(t.a[i] * 4.f);
+					tl[i] = _mm_castsi128_ps(_mm_set1_epi32(t.top_left[i] ? -1 : 0));
+				}
+				const __m128 za = _mm_set1_ps(t.za), zstep = _mm_set1_ps(t.za * 4.f);
+				const __m128i color = _mm_set1_epi32((int)t.color);
+				const __m128 xs = _mm_add_ps(_mm_set1_ps((float)min_x), lane);
+
+				for (int y = min_y; y <= max_y; y++) {
+					float yc = y + 0.5f;
+					__m128 e[3];
+					for (int i = 0; i < 3; i++)
+						e[i] = _mm_add_ps(_mm_mul_ps(a[i], xs), _mm_set1_ps(t.b[i] * yc + t.c[i]));
+					__m128 z = _mm_add_ps(_mm_mul_ps(za, xs), _mm_set1_ps(t.zb * yc + t.zc));
+
+					float* depth = &depth_buf[(size_t)y * stride];
+					uint32_t* pixels = &color_buf[(size_t)y * stride];
+					for (int x = min_x; x <= max_x; x += 4) {
+
+						// Inside if every edge is positive, or zero on an edge that owns its pixels (top-left rule).
+						__m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+						for (int i = 0; i < 3; i++)
+							mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpgt_ps(e[i], zero), _mm_and_ps(_mm_cmpeq_ps(e[i], zero), tl[i])));
+
+						if (_mm_movemask_ps(mask)) {
+							__m128 d = _mm_loadu_ps(depth + x);
+							mask = _mm_and_ps(mask, _mm_cmplt_ps(z, d));
+							_mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+							__m128i m = _mm_castps_si128(mask);
+							__m128i p = _mm_loadu_si128((const __m128i*)(pixels + x));
+							_mm_storeu_si128((__m128i*)(pixels + x), _mm_or_si128(_mm_and_si128(m, color), _mm_andnot_si128(m, p)));
+						}
+
+						for (int i = 0; i < 3; i++)
+							e[i] = _mm_add_ps(e[i], step[i]);
+						z = _mm_add_ps(z, zstep);
+					}
+				}
+			}
+		}
+		tile_ms[tile] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void SoftRasterizer::end_frame() {
+		typedef std::chrono::steady_clock clock;
+		stats.triangles = (unsigned int)tris.size();
+		stats.threads = job_system.get_thread_count();
+
+		// Binning.
+		auto start = clock::now();
+		unsigned int chunks = (unsigned int)((tris.size() + chunk_size - 1) / chunk_size);
+		if (bins.size() != chunks)
+			bins.resize(chunks);
+		for (auto i = bins.begin(); i != bins.end(); i++)
+			i->resize(tiles_x * tiles_y);
+		job_system.parallel_for(chunks, [this](unsigned int chunk, unsigned int) { bin_chunk(chunk); });
+		for (auto c = bins.begin(); c != bins.end(); c++)
+			for (auto b = c->begin(); b != c->end(); b++)
+				stats.bin_entries += (unsigned int)b->size();
+		stats.bin_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		// Rasterization.
+		start = clock::now();
+		job_system.parallel_for(tiles_x * tiles_y, [this](unsigned int tile, unsigned int) { raster_tile((int)tile); });
+		stats.raster_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		for (auto i = tile_ms.begin(); i != tile_ms.end(); i++) {
+			stats.tile_avg_ms += *i;
+			stats.tile_max_ms = std::max(stats.tile_max_ms, *i);
+		}
+		if (!tile_ms.empty())
+			stats.tile_avg_ms /= tile_ms.size();
+	}
+
+	inline void SoftRasterizer::render(const FramePacket& packet) {
+		resize(packet.width, packet.height);
+		// Indexed meshes are kept expanded to the triangle list they index, and only the positions of longer vertices (stride) are kept.
+		for (auto i = packet.uploads.begin(); i != packet.uploads.end(); i++) {
+			std::vector<float>& v = meshes[i->obj];
+			const unsigned int stride = i->obj->stride;
+			if (i->indices.empty() && stride == 3) {
+				v = i->verts;
+				continue;
+			}
+			const size_t count = i->indices.empty() ? i->verts.size() / stride : i->indices.size();
+			v.resize(count * 3);
+			for (size_t k = 0; k < count; k++)
+				memcpy(&v[k * 3], &i->verts[(i->indices.empty() ? k : (size_t)i->indices[k]) * stride], 3 * sizeof(float));
+		}
+
+		// Meshes never uploaded through a packet (static editor helpers) are read directly; they don't change after creation.
+		auto mesh_verts = [this](const GenObject* obj) -> const std::vector<float>& {
+			auto found = meshes.find(obj);
+			return found != meshes.end() ? found->second : obj->vbo_verts;
+		};
+
+		begin_frame(packet.bg_top, packet.bg_bot);
+		const mat4x4 view_proj = packet.view * packet.projection;		// projection * view, in the operator's row-major order.
+		for (auto i = packet.draws.begin(); i != packet.draws.end(); i++) {
+			const std::vector<float>& v = mesh_verts(i->obj);
+			draw(v.data(), v.size() / 3, i->obj->primitive, view_proj, i->color);
+		}
+		for (auto i = packet.instances.begin(); i != packet.instances.end(); i++) {
+			const std::vector<float>& v = mesh_verts(i->mesh);
+			draw(v.data(), v.size() / 3, i->mesh->primitive, i->model * view_proj, i->color);
+		}
+		end_frame();
+	}
+
+	inline void SoftRasterizer::read_pixels(std::vector<uint32_t>& out) const {
+		out.resize((size_t)width * height);
+		for (int y = 0; y < height; y++)
+			std::copy(&color_buf[(size_t)y * stride], &color_buf[(size_t)y * stride] + width, &out[(size_t)y * width]);
+	}
+
+	inline bool SoftRasterizer::write_ppm(const char* path) const {
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+			return false;
+		out << "P6\n" << width << " " << height << "\n255\n";
+
+		// PPM rows go top to bottom.
+		std::vector<unsigned char> row((size_t)width * 3);
+		for (int y = height - 1; y >= 0; y--) {
+			const uint32_t* p = &color_buf[(size_t)y * stride];
+			for (int x = 0; x < width; x++) {
+				row[x * 3] = p[x] & 0xff;
+				row[x * 3 + 1] = (p[x] >> 8) & 0xff;
+				row[x * 3 + 2] = (p[x] >> 16) & 0xff;
+			}
+			out.write((const char*)row.data(), row.size());
+		}
+		return (bool)out;
+	}
+}
+
+#endif // !GEN_ENG_SOFT_RASTER_H
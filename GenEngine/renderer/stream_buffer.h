@@ -0,0 +1,195 @@
+#pragma once
+#ifndef GEN_ENG_STREAM_BUFFER_H
+#define GEN_ENG_STREAM_BUFFER_H
+
+#include "glad/glad.h"
+#include "renderer/gl_state.h"
+#include <iostream>
+
+/*	Streaming ring buffer for per-frame dynamic data (vertices, instance data, uniform blocks, staging for buffer updates).
+		Two implementations behind the same interface:
+
+		- Persistent: when ARB_buffer_storage is available the buffer is allocated once with glBufferStorage and mapped persistently and coherently.
+		  It's split in one segment per frame in flight; writing a frame's data is just a memcpy into the segment, and a fence inserted at the end of
+		  the frame tells when the GPU is done with it. Waiting only happens if the CPU gets more than frames_in_flight frames ahead.
+		- Orphaning (GL 3.3 fallback): every allocation maps its range unsynchronized; when the buffer is full it's orphaned with glBufferData(NULL)
+		  so the driver hands out fresh storage instead of waiting for the GPU.
+
+		Usage, render thread only:
+
+			ring.begin_frame();
+			GLintptr offset;
+			void* p = ring.allocate(bytes, alignment, offset);	// NULL if the frame ran out of space
+			memcpy(p, data, bytes);
+			ring.commit();										// Must be called before the data is used by a draw
+			... draw using ring.get_buffer() at offset ...
+			ring.end_frame();
+
+		stream_ring is the ring shared by every per-frame upload of the render thread; it's created with the first frame.
+*/
+
+namespace GenEngine {
+
+	class StreamBuffer {
+
+		static const int	frames_in_flight = 3;
+
+		GLuint			buffer;
+		GLsizeiptr		segment_size;					// Bytes available per frame (persistent mode).
+		GLsizeiptr		total_size;
+		unsigned char*	mapped;							// Persistent mapping. NULL in orphaning mode.
+		bool			mapped_range;					// Orphaning mode: a range is currently mapped and must be committed.
+		int				segment;						// Segment of the current frame.
+		GLsizeiptr		head;							// Next free byte (inside the segment in persistent mode, inside the buffer otherwise).
+		GLsync			fences[frames_in_flight];
+
+		// Statistics
+		GLsizeiptr		bytes_this_frame;
+		unsigned int	waits;							// Times the CPU had to wait for the GPU to release a segment.
+		unsigned int	orphans;						// Times the buffer was orphaned.
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		StreamBuffer() : buffer(0), segment_size(0), total_size(0), mapped(NULL), mapped_range(false), segment(0), head(0), fences{ 0, 0, 0 },
+			bytes_this_frame(0), waits(0), orphans(0) {}
+		~StreamBuffer() {}		// GL objects can only be released with the context current; call destroy() from the render thread.
+
+		// Creation and destruction
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		create(const GLsizeiptr bytes_per_frame);
+		inline void		destroy();
+		inline bool		is_created()		const	{ return buffer != 0; }
+		inline bool		is_persistent()		const	{ return mapped != NULL; }
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		begin_frame();											// Waits (if needed) until the GPU released this frame's segment.
+		inline void*	allocate(const GLsizeiptr bytes, const GLsizeiptr alignment, GLintptr& offset);
+		inline void		commit();												// Makes the written data visible to the GPU.
+		inline void		end_frame();											// Fences the data written this frame.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline GLuint		get_buffer()			const	{ return buffer; }
+		inline GLsizeiptr	get_bytes_this_frame()	const	{ return bytes_this_frame; }
+		inline unsigned int	get_waits()				const	{ return waits; }
+		inline unsigned int	get_orphans()			const	{ return orphans; }
+	};
+
+	StreamBuffer stream_ring;
+
+
+	inline void StreamBuffer::create(const GLsizeiptr bytes_per_frame) {
+		// Segments start at multiples of 256 bytes, which satisfies the offset alignment of uniform buffers on every implementation.
+		segment_size = (bytes_per_frame + 255) / 256 * 256;
+		total_size = segment_size * frames_in_flight;
+		glGenBuffers(1, &buffer);
+		gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+
+		if (GLAD_GL_ARB_buffer_storage && glBufferStorage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, total_size, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total_size, flags);
+			if (mapped)
+				return;
+
+			// Immutable storage can't be orphaned, so the fallback needs a new buffer.
+			std::cout << "StreamBuffer: persistent mapping failed, falling back to orphaning.\n";
+			gl_state.forget_buffer(buffer);
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+		}
+		glBufferData(GL_COPY_WRITE_BUFFER, total_size, NULL, GL_STREAM_DRAW);
+	}
+
+	inline void StreamBuffer::destroy() {
+		if (!buffer)
+			return;
+		for (int i = 0; i < frames_in_flight; i++)
+			if (fences[i]) {
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		if (mapped || mapped_range) {
+			gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		gl_state.forget_buffer(buffer);
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+		mapped = NULL;
+		mapped_range = false;
+	}
+
+	inline void StreamBuffer::begin_frame() {
+		bytes_this_frame = 0;
+		if (!mapped)
+			return;
+
+		segment = (segment + 1) % frames_in_flight;
+		head = 0;
+		if (fences[segment]) {
+			// Usually already signaled; if not, the CPU is too far ahead and has to wait for the GPU.
+			GLenum r = glClientWaitSync(fences[segment], 0, 0);
+			if (r == GL_TIMEOUT_EXPIRED) {
+				waits++;
+				while ((r = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000)) == GL_TIMEOUT_EXPIRED);
+			}
+			glDeleteSync(fences[segment]);
+			fences[segment] = 0;
+		}
+	}
+
+	inline void* StreamBuffer::allocate(const GLsizeiptr bytes, const GLsizeiptr alignment, GLintptr& offset) {
+		GLsizeiptr start = (head + alignment - 1) / alignment * alignment;
+
+		if (mapped) {
+			if (start + bytes > segment_size)
+				return NULL;
+			head = start + bytes;
+			bytes_this_frame += bytes;
+			offset = segment * segment_size + start;
+			return mapped + offset;
+		}
+
+		if (bytes > total_size)
+			return NULL;
+		gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (mapped_range)
+			commit();
+		if (start + bytes > total_size) {
+			// Orphan: the driver gives us new storage and frees the old one once the GPU is done with it.
+			glBufferData(GL_COPY_WRITE_BUFFER, total_size, NULL, GL_STREAM_DRAW);
+			orphans++;
+			start = 0;
+		}
+		void* p = glMapBufferRange(GL_COPY_WRITE_BUFFER, start, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (!p)
+			return NULL;
+		mapped_range = true;
+		head = start + bytes;
+		bytes_this_frame += bytes;
+		offset = start;
+		return p;
+	}
+
+	inline void StreamBuffer::commit() {
+		// Coherent persistent mappings need nothing; the fallback has to unmap before the data can be used.
+		if (!mapped_range)
+			return;
+		gl_state.bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		mapped_range = false;
+	}
+
+	inline void StreamBuffer::end_frame() {
+		commit();
+		if (mapped)
+			fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+#endif // !GEN_ENG_STREAM_BUFFER_H
@@ -0,0 +1,115 @@
+#pragma once
+#ifndef GEN_ENG_VERTEX_FORMAT_H
+#define GEN_ENG_VERTEX_FORMAT_H
+
+#include "glad/glad.h"
+#include "glm/gtc/packing.hpp"
+#include "util/vec.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+/*	Compact vertex format.
+		What the GL buffers of every GenObject hold:
+		- Position: 3 unsigned 16 bit integers, quantized over the box of the mesh. The box is passed to the vertex shader as an offset and a
+		  scale (uniforms quant_offset and quant_scale), which turn the normalized attribute back into a position. Over a 64 unit box the
+		  step is 1/1024 of a unit. Objects with nothing else (walls, OBJ meshes) take 6 bytes a vertex instead of the 12 of vbo_verts, half.
+		- Baked light and ambient occlusion, only for vertices that have them (the sections' streams, 5 floats: section::gen_vao()):
+		  unsigned 8 bit each, normalized, 8 bytes a vertex instead of 20. The others leave the attribute off, and draw with a constant 1
+		  (lit, not occluded), which leaves the color as it is.
+
+		Meshes that share vertices with others (the pieces of an OBJ file, for instance) must be quantized over a box common to all of them:
+		with a box each, a shared vertex rounds to a different step in each mesh and a crack opens between them.
+		GenObject::set_shared_quantization() gives an object such a box.
+		The packing is done with glm's (util/glm/gtc/packing.hpp), the same rounding GLSL's pack functions have. Attributes: position at
+		location 0, light and occlusion at location 6 (1 to 5 are the instance streams of instancing.h). The data on the CPU side (picking,
+		culling, the software rasterizer) stays in floats.
+*/
+
+namespace GenEngine {
+
+	struct packed_position {
+		uint16_t	position[3];		// Normalized over the mesh's box.
+	};
+
+	struct packed_vertex {
+		uint16_t	position[3];
+		uint16_t	light_ao;			// Light in the low byte, ambient occlusion in the high one.
+	};
+
+	// position = offset + normalized * scale.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct vertex_quantization {
+		vec3	offset;
+		vec3	scale;
+	};
+
+	// Box of count vertices of stride floats, the first 3 being the position.
+	inline vertex_quantization quantize_bounds(const float* verts, const size_t count, const unsigned int stride) {
+		vertex_quantization q = { vec3(0.f, 0.f, 0.f), vec3(1.f, 1.f, 1.f) };
+		if (!count)
+			return q;
+		vec3 min(verts[0], verts[1], verts[2]), max = min;
+		for (size_t i = 1; i < count; i++)
+			for (int k = 0; k < 3; k++) {
+				min[k] = std::min(min[k], verts[i * stride + k]);
+				max[k] = std::max(max[k], verts[i * stride + k]);
+			}
+		q.offset = min;
+		q.scale = max - min;
+		return q;
+	}
+
+	// Whether every position of inner's box is inside outer's.
+	inline bool quantization_contains(const vertex_quantization& outer, const vertex_quantization& inner) {
+		for (int k = 0; k < 3; k++)
+			if (inner.offset[k] < outer.offset[k] || inner.offset[k] + inner.scale[k] > outer.offset[k] + outer.scale[k])
+				return false;
+		return true;
+	}
+
+	// Any stride of at least 3, the position first. Whatever follows it is dropped.
+	inline void pack_positions(const float* verts, const size_t count, const unsigned int stride, const vertex_quantization& q, packed_position* out) {
+		float inv[3];
+		for (int k = 0; k < 3; k++)
+			inv[k] = q.scale[k] > 0.f ? 1.f / q.scale[k] : 0.f;
+		for (size_t i = 0; i < count; i++)
+			for (int k = 0; k < 3; k++)
+				out[i].position[k] = glm::packUnorm1x16((verts[i * stride + k] - q.offset[k]) * inv[k]);
+	}
+
+	// stride 5 or more: the position followed by light and occlusion.
+	inline void pack_vertices(const float* verts, const size_t count, const unsigned int stride, const vertex_quantization& q, packed_vertex* out) {
+		float inv[3];
+		for (int k = 0; k < 3; k++)
+			inv[k] = q.scale[k] > 0.f ? 1.f / q.scale[k] : 0.f;
+		for (size_t i = 0; i < count; i++) {
+			const float* v = verts + i * stride;
+			for (int k = 0; k < 3; k++)
+				out[i].position[k] = glm::packUnorm1x16((v[k] - q.offset[k]) * inv[k]);
+			out[i].light_ao = glm::packUnorm2x8(glm::vec2(v[3], v[4]));
+		}
+	}
+
+	// For the VAO, with the buffer bound to GL_ARRAY_BUFFER. Without light, attribute 6 is left off and takes the constant value set before
+	// drawing (set_unlit_attrib()).
+	inline void set_packed_attribs(const bool light) {
+		const GLsizei size = light ? sizeof(packed_vertex) : sizeof(packed_position);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, size, (void*)offsetof(packed_vertex, position));
+		glEnableVertexAttribArray(0);
+		if (light) {
+			glVertexAttribPointer(6, 2, GL_UNSIGNED_BYTE, GL_TRUE, size, (void*)offsetof(packed_vertex, light_ao));
+			glEnableVertexAttribArray(6);
+		}
+		else
+			glDisableVertexAttribArray(6);
+	}
+
+	// Fully lit, not occluded. Current attribute values aren't VAO state, and may be left undefined by draws with the array on.
+	inline void set_unlit_attrib() {
+		glVertexAttrib2f(6, 1.f, 1.f);
+	}
+}
+
+#endif // !GEN_ENG_VERTEX_FORMAT_H
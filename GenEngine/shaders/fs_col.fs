@@ -1,8 +1,43 @@
 #version 330 core
+// Flat color, lit by the point and spot lights of the fragment's cluster (renderer/lighting.h). Everything is in view space.
 
 uniform vec3 color;
+uniform vec3 ambient;
+uniform samplerBuffer light_data;		// 3 texels per light: position and radius, color and cos outer, direction and cos inner.
+uniform usamplerBuffer light_grid;		// Per cluster: first entry in light_index, light count.
+uniform usamplerBuffer light_index;
+uniform vec2 cluster_scale;				// Clusters per pixel, in x and y.
+uniform vec2 slice_params;				// slice = log(depth) * x + y.
+uniform ivec2 cluster_count;
+uniform int slice_count;
+
+in vec3 view_pos;
+in float baked;							// Light and ambient occlusion baked in the vertices.
 out vec4 fin_color;
 
 void main(){
-    fin_color = vec4(color,1.0);
-}
\ No newline at end of file
+    // Walls are flat and seen from both sides: the normal comes from the screen derivatives, facing the camera.
+    vec3 n = normalize(cross(dFdx(view_pos), dFdy(view_pos)));
+    if (dot(n, view_pos) > 0.0)
+        n = -n;
+
+    int slice = clamp(int(log(-view_pos.z) * slice_params.x + slice_params.y), 0, slice_count - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy * cluster_scale), ivec2(0), cluster_count - 1);
+    uvec2 range = texelFetch(light_grid, (slice * cluster_count.y + tile.y) * cluster_count.x + tile.x).xy;
+
+    vec3 lit = ambient;
+    for (uint i = 0u; i < range.y; i++) {
+        int l = int(texelFetch(light_index, int(range.x + i)).x) * 3;
+        vec4 position = texelFetch(light_data, l);
+        vec4 light_color = texelFetch(light_data, l + 1);
+        vec4 direction = texelFetch(light_data, l + 2);
+
+        vec3 to_light = position.xyz - view_pos;
+        float d2 = dot(to_light, to_light);
+        vec3 dir = to_light * inversesqrt(max(d2, 1e-8));
+        float falloff = clamp(1.0 - d2 / (position.w * position.w), 0.0, 1.0);
+        float spot = smoothstep(light_color.w, direction.w, dot(-dir, direction.xyz));
+        lit += light_color.rgb * (max(dot(n, dir), 0.0) * falloff * falloff * spot);
+    }
+    fin_color = vec4(color * lit * baked, 1.0);
+}
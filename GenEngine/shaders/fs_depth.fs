@@ -0,0 +1,4 @@
+#version 330 core
+// Depth pre-pass: no color output, only the depth of the geometry is written.
+void main(){
+}
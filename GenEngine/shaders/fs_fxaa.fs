@@ -0,0 +1,101 @@
+#version 330 core
+// FXAA (after Lottes' FXAA 3.11, quality preset 12): finds the local edge from the luma of the 3x3 neighbourhood, walks along it a fixed
+// number of steps in both directions to find where it ends, and blends across the edge by how close the pixel is to that end. Pixels with
+// low local contrast leave after 5 fetches; edge pixels take at most 10 + 2 * STEPS, so the cost is bounded.
+uniform sampler2D src;
+uniform vec2 texel;			// 1 / size of src.
+in vec2 uv;
+out vec4 color;
+
+#define EDGE_THRESHOLD		0.125		// Minimum contrast, relative to the local maximum luma, to be treated as an edge.
+#define EDGE_THRESHOLD_MIN	0.0312		// Absolute minimum contrast; skips dark areas.
+#define SUBPIX				0.75		// Amount of subpixel aliasing removal.
+#define STEPS				5
+
+const float step_size[STEPS] = float[](1.0, 1.5, 2.0, 4.0, 12.0);
+
+float luma(vec3 c){
+    return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+void main(){
+    vec4 center = texture(src, uv);
+    float lm = luma(center.rgb);
+    float ln = luma(textureOffset(src, uv, ivec2( 0,  1)).rgb);
+    float ls = luma(textureOffset(src, uv, ivec2( 0, -1)).rgb);
+    float le = luma(textureOffset(src, uv, ivec2( 1,  0)).rgb);
+    float lw = luma(textureOffset(src, uv, ivec2(-1,  0)).rgb);
+
+    float range_max = max(lm, max(max(ln, ls), max(le, lw)));
+    float range_min = min(lm, min(min(ln, ls), min(le, lw)));
+    float range = range_max - range_min;
+    if (range < max(EDGE_THRESHOLD_MIN, range_max * EDGE_THRESHOLD)) {
+        color = center;
+        return;
+    }
+
+    float lne = luma(textureOffset(src, uv, ivec2( 1,  1)).rgb);
+    float lnw = luma(textureOffset(src, uv, ivec2(-1,  1)).rgb);
+    float lse = luma(textureOffset(src, uv, ivec2( 1, -1)).rgb);
+    float lsw = luma(textureOffset(src, uv, ivec2(-1, -1)).rgb);
+
+    // Subpixel blend: how much the center differs from the average of its neighbourhood.
+    float average = (2.0 * (ln + ls + le + lw) + lne + lnw + lse + lsw) / 12.0;
+    float subpix = clamp(abs(average - lm) / range, 0.0, 1.0);
+    subpix = smoothstep(0.0, 1.0, subpix);
+    subpix = subpix * subpix * SUBPIX;
+
+    // Edge orientation: compare the horizontal and vertical second derivatives.
+    float edge_h = abs(lnw - 2.0 * lw + lsw) + 2.0 * abs(ln - 2.0 * lm + ls) + abs(lne - 2.0 * le + lse);
+    float edge_v = abs(lnw - 2.0 * ln + lne) + 2.0 * abs(lw - 2.0 * lm + le) + abs(lsw - 2.0 * ls + lse);
+    bool horizontal = edge_h >= edge_v;
+
+    // Which side of the pixel the edge is on, and the luma on that side.
+    float l_neg = horizontal ? ls : lw;
+    float l_pos = horizontal ? ln : le;
+    float grad_neg = abs(l_neg - lm);
+    float grad_pos = abs(l_pos - lm);
+    float step_len = horizontal ? texel.y : texel.x;
+    float l_side = l_pos;
+    if (grad_neg >= grad_pos) {
+        step_len = -step_len;
+        l_side = l_neg;
+    }
+    float gradient = max(grad_neg, grad_pos) * 0.25;
+    float l_edge = (lm + l_side) * 0.5;
+
+    // Walk along the edge, half a texel off the center towards it, until the luma no longer matches the edge's.
+    vec2 pos = uv;
+    vec2 dir = horizontal ? vec2(texel.x, 0.0) : vec2(0.0, texel.y);
+    if (horizontal) pos.y += step_len * 0.5;
+    else pos.x += step_len * 0.5;
+
+    vec2 p1 = pos - dir, p2 = pos + dir;
+    float d1 = luma(texture(src, p1).rgb) - l_edge;
+    float d2 = luma(texture(src, p2).rgb) - l_edge;
+    bool done1 = abs(d1) >= gradient, done2 = abs(d2) >= gradient;
+    for (int i = 1; i < STEPS && !(done1 && done2); i++) {
+        if (!done1) {
+            p1 -= dir * step_size[i];
+            d1 = luma(texture(src, p1).rgb) - l_edge;
+            done1 = abs(d1) >= gradient;
+        }
+        if (!done2) {
+            p2 += dir * step_size[i];
+            d2 = luma(texture(src, p2).rgb) - l_edge;
+            done2 = abs(d2) >= gradient;
+        }
+    }
+
+    // Distance to the nearest end; only blend if the center is on the side of the edge that end belongs to.
+    float dist1 = horizontal ? uv.x - p1.x : uv.y - p1.y;
+    float dist2 = horizontal ? p2.x - uv.x : p2.y - uv.y;
+    bool nearest1 = dist1 < dist2;
+    float d_end = nearest1 ? d1 : d2;
+    bool center_below = lm - l_edge < 0.0;
+    float edge_blend = ((d_end < 0.0) != center_below) ? 0.5 - min(dist1, dist2) / (dist1 + dist2) : 0.0;
+
+    float blend = max(edge_blend, subpix);
+    vec2 offset = horizontal ? vec2(0.0, blend * step_len) : vec2(blend * step_len, 0.0);
+    color = texture(src, uv + offset);
+}
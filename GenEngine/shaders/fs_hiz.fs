@@ -0,0 +1,22 @@
+#version 330 core
+// One level of the hierarchical-Z pyramid: min/max of the 2x2 source texels under each texel (3 wide/tall on the last column/row when the
+// source size is odd, so nothing is skipped). The source is the depth buffer for level 0 and the previous level otherwise.
+uniform sampler2D src;
+uniform bool from_depth;
+uniform ivec2 src_size;
+uniform ivec2 dst_size;
+out vec2 minmax;
+
+void main(){
+    ivec2 dst = ivec2(gl_FragCoord.xy);
+    ivec2 base = dst * 2;
+    ivec2 extent = ivec2(2) + ivec2(dst.x == dst_size.x - 1 ? src_size.x & 1 : 0, dst.y == dst_size.y - 1 ? src_size.y & 1 : 0);
+    vec2 r = vec2(1.0, 0.0);
+    for (int y = 0; y < extent.y; y++)
+        for (int x = 0; x < extent.x; x++) {
+            vec4 t = texelFetch(src, min(base + ivec2(x, y), src_size - 1), 0);
+            vec2 s = from_depth ? t.rr : t.rg;
+            r = vec2(min(r.x, s.x), max(r.y, s.y));
+        }
+    minmax = r;
+}
@@ -0,0 +1,8 @@
+#version 330 core
+
+in vec3 inst_color;
+out vec4 fin_color;
+
+void main(){
+    fin_color = vec4(inst_color,1.0);
+}
\ No newline at end of file
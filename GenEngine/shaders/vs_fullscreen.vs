@@ -0,0 +1,7 @@
+#version 330 core
+// Fullscreen triangle, no vertex buffer needed: draw 3 vertices with any VAO bound.
+out vec2 uv;
+void main(){
+    gl_Position = vec4(gl_VertexID & 1, gl_VertexID >> 1, 0.0, 0.5) * 4.0 - 1.0;
+    uv = gl_Position.xy * 0.5 + 0.5;
+}
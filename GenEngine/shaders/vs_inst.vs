@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;		// Normalized over the mesh's box (renderer/vertex_format.h).
+layout (location = 1) in mat4 aModel;	// per instance, locations 1-4
+layout (location = 5) in vec3 aColor;	// per instance
+
+layout (std140) uniform Camera {
+	mat4 view;
+	mat4 projection;
+};
+
+uniform vec3 quant_offset;
+uniform vec3 quant_scale;
+
+out vec3 inst_color;
+
+void main()
+{
+	inst_color = aColor;
+	gl_Position = projection * view * aModel * vec4(quant_offset + aPos * quant_scale, 1.0f);
+}
\ No newline at end of file
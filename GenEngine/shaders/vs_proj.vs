@@ -1,10 +1,25 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec3 aPos;		// Normalized over the mesh's box (renderer/vertex_format.h).
+layout (location = 6) in vec2 aLight;		// Baked light and ambient occlusion, a constant (1, 1) for unlit objects.
 
-uniform mat4 view;
-uniform mat4 projection;
+// Shared by the depth pre-pass and the color pass, which must compute exactly the same depths.
+invariant gl_Position;
+
+layout (std140) uniform Camera {
+	mat4 view;
+	mat4 projection;
+};
+
+uniform vec3 quant_offset;
+uniform vec3 quant_scale;
+
+out vec3 view_pos;		// For lighting.
+out float baked;
 
 void main()
 {
-	gl_Position = projection * view * vec4(aPos.x,aPos.y,aPos.z, 1.0f);
+	baked = aLight.x * aLight.y;
+	vec4 v = view * vec4(quant_offset + aPos * quant_scale, 1.0f);
+	view_pos = v.xyz;
+	gl_Position = projection * v;
 }
\ No newline at end of file
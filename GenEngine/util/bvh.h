@@ -0,0 +1,541 @@
+#pragma once
+#ifndef GEN_ENG_BVH_H
+#define GEN_ENG_BVH_H
+
+#include <emmintrin.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+/*	Bounding volume hierarchy over triangles.
+		Built once over a triangle soup, then queried by any number of threads at the same time (queries don't modify it):
+		- intersect(): closest hit of a ray.
+		- occluded(): any hit closer than a distance, for shadow and occlusion rays; stops at the first one found.
+		- intersect4() and occluded4(): the same for a packet of 4 rays at once with SSE2. Each node's box is tested against all 4 rays, and the
+		  packet goes down while any of them still needs it; works best with rays that start close to each other and go roughly the same way.
+		- overlap(): triangles that may touch a box (those of every leaf whose box touches it).
+
+		The build uses the surface area heuristic, binned: the centroids of a node are sorted into 16 bins along each axis, and the node is split
+		at the bin boundary with the lowest expected cost (area times triangles on each side, relative to the node's), or made a leaf if that's
+		cheaper, up to 8 triangles. Past a depth limit, or if all centroids are in the same place, nodes are split at the median instead, which
+		keeps the depth (and the traversal stacks) bounded.
+
+		Nodes are stored depth first in a single array: the left child of a node is the next one, and inner nodes keep the index of the right
+		child. Triangles are copied in leaf order as a vertex and two edges, what the ray test needs. Queries report them by their original index.
+
+		refit() takes the same triangles moved, and only recomputes the boxes, bottom up (children always come after their parent). It's much
+		cheaper than a build, but the tree gets worse the farther things move from where they were when it was built.
+*/
+
+namespace GenEngine {
+
+	// 32 bytes, two per cache line.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct bvh_node {
+		float			min[3];
+		unsigned int	first;		// Leaf: first triangle. Inner node: right child.
+		float			max[3];
+		unsigned int	count;		// Triangles of a leaf, 0 for inner nodes.
+	};
+
+	// 4 rays in SSE lanes. tmax is the distance to search up to (in units of dir).
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct bvh_ray4 {
+		__m128	ox, oy, oz;
+		__m128	dx, dy, dz;
+		__m128	tmax;
+	};
+
+	class BVH {
+
+		static const unsigned int	max_leaf_size = 8;
+		static const unsigned int	bin_count = 16;
+		static const unsigned int	sah_depth = 64;			// Median splits below it.
+		static const int			stack_size = 96;
+
+		std::vector<bvh_node>		nodes;
+		std::vector<float>			tris;		// Leaf order, 9 floats each: v0, v1 - v0, v2 - v0.
+		std::vector<unsigned int>	prims;		// Original index of each triangle.
+
+		// Build scratch.
+		std::vector<float>			centroids;
+		std::vector<float>			boxes;		// min and max of each input triangle.
+
+		inline unsigned int	build_node(const unsigned int first, const unsigned int count, const unsigned int depth);
+		inline void			copy_triangles(const float* positions);
+
+	public:
+
+		// Construction
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		build(const float* positions, const size_t triangle_count);		// 9 floats per triangle.
+		inline void		refit(const float* positions);		// The same triangles, in the same order, moved.
+		inline void		clear()		{ nodes.clear(); tris.clear(); prims.clear(); }
+
+		// Queries (any thread)
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		intersect(const float origin[3], const float dir[3], float& t, unsigned int& prim) const;		// t: in, the farthest; out, the hit.
+		inline bool		occluded(const float origin[3], const float dir[3], const float tmax) const;
+		inline int		intersect4(const bvh_ray4& rays, float t[4], unsigned int prim[4], int active = 0xf) const;	// Bit i set: ray i hit; t[i] its distance.
+		inline int		occluded4(const bvh_ray4& rays, int active = 0xf) const;		// Bit i set: ray i hit something.
+		inline void		overlap(const float min[3], const float max[3], std::vector<unsigned int>& out) const;
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline size_t	get_node_count()		const	{ return nodes.size(); }
+		inline size_t	get_triangle_count()	const	{ return prims.size(); }
+		inline bool		is_empty()				const	{ return nodes.empty(); }
+	};
+
+
+	inline void BVH::build(const float* positions, const size_t triangle_count) {
+		clear();
+		if (!triangle_count)
+			return;
+
+		prims.resize(triangle_count);
+		centroids.resize(triangle_count * 3);
+		boxes.resize(triangle_count * 6);
+		for (size_t i = 0; i < triangle_count; i++) {
+			const float* v = positions + i * 9;
+			prims[i] = (unsigned int)i;
+			for (int a = 0; a < 3; a++) {
+				boxes[i * 6 + a] = std::min(std::min(v[a], v[3 + a]), v[6 + a]);
+				boxes[i * 6 + 3 + a] = std::max(std::max(v[a], v[3 + a]), v[6 + a]);
+				centroids[i * 3 + a] = (v[a] + v[3 + a] + v[6 + a]) / 3.f;
+			}
+		}
+		nodes.reserve(triangle_count / 2 + 1);
+		build_node(0, (unsigned int)triangle_count, 0);
+		copy_triangles(positions);
+		centroids.clear();
+		boxes.clear();
+	}
+
+	inline void BVH::copy_triangles(const float* positions) {
+		tris.resize(prims.size() * 9);
+		for (size_t i = 0; i < prims.size(); i++) {
+			const float* v = positions + (size_t)prims[i] * 9;
+			float* t = &tris[i * 9];
+			for (int a = 0; a < 3; a++) {
+				t[a] = v[a];
+				t[3 + a] = v[3 + a] - v[a];
+				t[6 + a] = v[6 + a] - v[a];
+			}
+		}
+	}
+
+	inline float bvh_half_area(const float* min, const float* max) {
+		const float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+		return x * y + y * z + z * x;
+	}
+
+	inline unsigned int BVH::build_node(const unsigned int first, const unsigned int count, const unsigned int depth) {
+		const unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back(bvh_node());
+		bvh_node n;
+		float cmin[3] = { 1e30f, 1e30f, 1e30f }, cmax[3] = { -1e30f, -1e30f, -1e30f };
+		for (int a = 0; a < 3; a++) {
+			n.min[a] = 1e30f;
+			n.max[a] = -1e30f;
+		}
+		for (unsigned int i = first; i < first + count; i++) {
+			const unsigned int p = prims[i];
+			for (int a = 0; a < 3; a++) {
+				n.min[a] = std::min(n.min[a], boxes[p * 6 + a]);
+				n.max[a] = std::max(n.max[a], boxes[p * 6 + 3 + a]);
+				cmin[a] = std::min(cmin[a], centroids[p * 3 + a]);
+				cmax[a] = std::max(cmax[a], centroids[p * 3 + a]);
+			}
+		}
+		n.first = first;
+		n.count = count;
+		if (count <= 1) {
+			nodes[index] = n;
+			return index;
+		}
+
+		// Binned SAH. Costs are relative to the node's area, with a triangle test costing as much as a box test.
+		int axis = -1;
+		unsigned int split_bin = 0;
+		float best = 1e30f;
+		const float area = std::max(bvh_half_area(n.min, n.max), 1e-20f);
+		if (depth < sah_depth)
+			for (int a = 0; a < 3; a++) {
+				if (cmax[a] <= cmin[a])
+					continue;
+				unsigned int bin_tris[bin_count] = {};
+				float bin_min[bin_count][3], bin_max[bin_count][3];
+				for (unsigned int b = 0; b < bin_count; b++)
+					for (int k = 0; k < 3; k++) {
+						bin_min[b][k] = 1e30f;
+						bin_max[b][k] = -1e30f;
+					}
+				const float scale = bin_count * 0.9999f / (cmax[a] - cmin[a]);
+				for (unsigned int i = first; i < first + count; i++) {
+					const unsigned int p = prims[i];
+					const unsigned int b = (unsigned int)((centroids[p * 3 + a] - cmin[a]) * scale);
+					bin_tris[b]++;
+					for (int k = 0; k < 3; k++) {
+						bin_min[b][k] = std::min(bin_min[b][k], boxes[p * 6 + k]);
+						bin_max[b][k] = std::max(bin_max[b][k], boxes[p * 6 + 3 + k]);
+					}
+				}
+
+				// Sweep from the right, then from the left, evaluating the split after each bin.
+				float right_area[bin_count];
+				unsigned int right_tris[bin_count];
+				float lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+				unsigned int tally = 0;
+				for (unsigned int b = bin_count - 1; b > 0; b--) {
+					for (int k = 0; k < 3; k++) {
+						lo[k] = std::min(lo[k], bin_min[b][k]);
+						hi[k] = std::max(hi[k], bin_max[b][k]);
+					}
+					tally += bin_tris[b];
+					right_tris[b] = tally;
+					right_area[b] = tally ? bvh_half_area(lo, hi) : 0.f;
+				}
+				for (int k = 0; k < 3; k++) {
+					lo[k] = 1e30f;
+					hi[k] = -1e30f;
+				}
+				tally = 0;
+				for (unsigned int b = 0; b + 1 < bin_count; b++) {
+					for (int k = 0; k < 3; k++) {
+						lo[k] = std::min(lo[k], bin_min[b][k]);
+						hi[k] = std::max(hi[k], bin_max[b][k]);
+					}
+					tally += bin_tris[b];
+					if (!tally || !right_tris[b + 1])
+						continue;
+					const float cost = 1.f + (bvh_half_area(lo, hi) * tally + right_area[b + 1] * right_tris[b + 1]) / area;
+					if (cost < best) {
+						best = cost;
+						axis = a;
+						split_bin = b;
+					}
+				}
+			}
+
+		unsigned int half;
+		if (axis >= 0) {
+			if (count <= max_leaf_size && (float)count <= best) {
+				nodes[index] = n;
+				return index;
+			}
+			const float scale = bin_count * 0.9999f / (cmax[axis] - cmin[axis]), lo = cmin[axis];
+			const unsigned int* middle = std::partition(&prims[first], &prims[first] + count, [this, axis, scale, lo, split_bin](unsigned int p) {
+				return (unsigned int)((centroids[p * 3 + axis] - lo) * scale) <= split_bin; });
+			half = (unsigned int)(middle - &prims[first]);
+		}
+		else {
+			// Median of the longest axis; or, with every centroid in the same place, just halves.
+			if (count <= max_leaf_size) {
+				nodes[index] = n;
+				return index;
+			}
+			axis = 0;
+			for (int a = 1; a < 3; a++)
+				if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis])
+					axis = a;
+			half = count / 2;
+			std::nth_element(prims.begin() + first, prims.begin() + first + half, prims.begin() + first + count,
+				[this, axis](unsigned int a, unsigned int b) { return centroids[a * 3 + axis] < centroids[b * 3 + axis]; });
+		}
+		build_node(first, half, depth + 1);
+		n.first = build_node(first + half, count - half, depth + 1);
+		n.count = 0;
+		nodes[index] = n;
+		return index;
+	}
+
+	inline void BVH::refit(const float* positions) {
+		if (nodes.empty())
+			return;
+		copy_triangles(positions);
+		for (size_t index = nodes.size(); index-- > 0;) {
+			bvh_node& n = nodes[index];
+			if (n.count) {
+				for (int a = 0; a < 3; a++) {
+					n.min[a] = 1e30f;
+					n.max[a] = -1e30f;
+				}
+				for (unsigned int i = n.first; i < n.first + n.count; i++) {
+					const float* t = &tris[(size_t)i * 9];
+					for (int a = 0; a < 3; a++) {
+						n.min[a] = std::min(std::min(n.min[a], t[a]), std::min(t[a] + t[3 + a], t[a] + t[6 + a]));
+						n.max[a] = std::max(std::max(n.max[a], t[a]), std::max(t[a] + t[3 + a], t[a] + t[6 + a]));
+					}
+				}
+				continue;
+			}
+			const bvh_node& l = nodes[index + 1];
+			const bvh_node& r = nodes[n.first];
+			for (int a = 0; a < 3; a++) {
+				n.min[a] = std::min(l.min[a], r.min[a]);
+				n.max[a] = std::max(l.max[a], r.max[a]);
+			}
+		}
+	}
+
+	// Moller-Trumbore. Returns the distance, or a negative value if there's no hit.
+	inline float bvh_ray_triangle(const float* o, const float* d, const float* tri) {
+		const float* e1 = tri + 3;
+		const float* e2 = tri + 6;
+		const float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (fabsf(det) < 1e-12f)
+			return -1.f;
+		const float inv = 1.f / det;
+		const float s[3] = { o[0] - tri[0], o[1] - tri[1], o[2] - tri[2] };
+		const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+		if (u < 0.f || u > 1.f)
+			return -1.f;
+		const float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+		if (v < 0.f || u + v > 1.f)
+			return -1.f;
+		return (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+	}
+
+	// Slab test. Returns the entry distance, or a negative value if the box is missed or farther than tmax.
+	inline float bvh_ray_box(const bvh_node& n, const float* o, const float* inv_d, const float tmax) {
+		float t0 = 0.f, t1 = tmax;
+		for (int a = 0; a < 3; a++) {
+			float near_t = (n.min[a] - o[a]) * inv_d[a], far_t = (n.max[a] - o[a]) * inv_d[a];
+			if (near_t > far_t)
+				std::swap(near_t, far_t);
+			t0 = std::max(t0, near_t);
+			t1 = std::min(t1, far_t);
+		}
+		return t0 <= t1 ? t0 : -1.f;
+	}
+
+	inline bool BVH::intersect(const float origin[3], const float dir[3], float& t, unsigned int& prim) const {
+		if (nodes.empty())
+			return false;
+		const float inv_d[3] = { 1.f / dir[0], 1.f / dir[1], 1.f / dir[2] };
+		unsigned int stack[stack_size];
+		int top = 0;
+		stack[top++] = 0;
+		bool hit = false;
+		while (top) {
+			const bvh_node& n = nodes[stack[--top]];
+			if (bvh_ray_box(n, origin, inv_d, t) < 0.f)
+				continue;
+			if (n.count) {
+				for (unsigned int i = n.first; i < n.first + n.count; i++) {
+					const float d = bvh_ray_triangle(origin, dir, &tris[(size_t)i * 9]);
+					if (d > 0.f && d < t) {
+						t = d;
+						prim = prims[i];
+						hit = true;
+					}
+				}
+				continue;
+			}
+
+			// Nearest child last, so it's visited first.
+			const unsigned int left = (unsigned int)(&n - &nodes[0]) + 1, right = n.first;
+			const float tl = bvh_ray_box(nodes[left], origin, inv_d, t), tr = bvh_ray_box(nodes[right], origin, inv_d, t);
+			if (tl >= 0.f && tr >= 0.f) {
+				stack[top++] = tl < tr ? right : left;
+				stack[top++] = tl < tr ? left : right;
+			}
+			else if (tl >= 0.f)
+				stack[top++] = left;
+			else if (tr >= 0.f)
+				stack[top++] = right;
+		}
+		return hit;
+	}
+
+	inline bool BVH::occluded(const float origin[3], const float dir[3], const float tmax) const {
+		if (nodes.empty())
+			return false;
+		const float inv_d[3] = { 1.f / dir[0], 1.f / dir[1], 1.f / dir[2] };
+		unsigned int stack[stack_size];
+		int top = 0;
+		stack[top++] = 0;
+		while (top) {
+			const unsigned int index = stack[--top];
+			const bvh_node& n = nodes[index];
+			if (bvh_ray_box(n, origin, inv_d, tmax) < 0.f)
+				continue;
+			if (n.count) {
+				for (unsigned int i = n.first; i < n.first + n.count; i++) {
+					const float d = bvh_ray_triangle(origin, dir, &tris[(size_t)i * 9]);
+					if (d > 0.f && d < tmax)
+						return true;
+				}
+				continue;
+			}
+			stack[top++] = n.first;
+			stack[top++] = index + 1;
+		}
+		return false;
+	}
+
+	// A node's box against 4 rays (inverse directions precomputed). Returns the lanes that enter it before tmax, and their entry distances.
+	inline int bvh_box4(const bvh_node& n, const bvh_ray4& r, const __m128 idx, const __m128 idy, const __m128 idz, const __m128 tmax, __m128& entry) {
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[0]), r.ox), idx), t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[0]), r.ox), idx);
+		__m128 tn = _mm_min_ps(t0, t1), tf = _mm_max_ps(t0, t1);
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[1]), r.oy), idy);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[1]), r.oy), idy);
+		tn = _mm_max_ps(tn, _mm_min_ps(t0, t1));
+		tf = _mm_min_ps(tf, _mm_max_ps(t0, t1));
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min[2]), r.oz), idz);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max[2]), r.oz), idz);
+		tn = _mm_max_ps(_mm_max_ps(tn, _mm_min_ps(t0, t1)), _mm_setzero_ps());
+		tf = _mm_min_ps(_mm_min_ps(tf, _mm_max_ps(t0, t1)), tmax);
+		entry = tn;
+		return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+	}
+
+	// Moller-Trumbore on 4 rays. Returns the lanes that hit it closer than tmax, and their distances.
+	inline int bvh_triangle4(const float* tri, const bvh_ray4& r, const __m128 tmax, __m128& t) {
+		const __m128 one = _mm_set1_ps(1.f), zero = _mm_setzero_ps();
+		const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 e1x = _mm_set1_ps(tri[3]), e1y = _mm_set1_ps(tri[4]), e1z = _mm_set1_ps(tri[5]);
+		const __m128 e2x = _mm_set1_ps(tri[6]), e2y = _mm_set1_ps(tri[7]), e2z = _mm_set1_ps(tri[8]);
+		const __m128 px = _mm_sub_ps(_mm_mul_ps(r.dy, e2z), _mm_mul_ps(r.dz, e2y));
+		const __m128 py = _mm_sub_ps(_mm_mul_ps(r.dz, e2x), _mm_mul_ps(r.dx, e2z));
+		const __m128 pz = _mm_sub_ps(_mm_mul_ps(r.dx, e2y), _mm_mul_ps(r.dy, e2x));
+		const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		const __m128 inv = _mm_div_ps(one, det);
+		const __m128 sx = _mm_sub_ps(r.ox, _mm_set1_ps(tri[0])), sy = _mm_sub_ps(r.oy, _mm_set1_ps(tri[1])), sz = _mm_sub_ps(r.oz, _mm_set1_ps(tri[2]));
+		const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.dx, qx), _mm_mul_ps(r.dy, qy)), _mm_mul_ps(r.dz, qz)), inv);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+		__m128 m = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), _mm_set1_ps(1e-12f));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+		m = _mm_and_ps(m, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, tmax)));
+		return _mm_movemask_ps(m);
+	}
+
+	inline int BVH::intersect4(const bvh_ray4& r, float t[4], unsigned int prim[4], int active) const {
+		if (nodes.empty())
+			return 0;
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 idx = _mm_div_ps(one, r.dx), idy = _mm_div_ps(one, r.dy), idz = _mm_div_ps(one, r.dz);
+		__m128 tmax = r.tmax, entry, entry_r;
+		int hit = 0;
+
+		unsigned int stack[stack_size];
+		int top = 0;
+		if (bvh_box4(nodes[0], r, idx, idy, idz, tmax, entry) & active)
+			stack[top++] = 0;
+		while (top) {
+			const unsigned int index = stack[--top];
+			const bvh_node& n = nodes[index];
+
+			// Children were tested when pushed, but a closer hit may have been found since.
+			if (!(bvh_box4(n, r, idx, idy, idz, tmax, entry) & active))
+				continue;
+
+			if (n.count) {
+				for (unsigned int i = n.first; i < n.first + n.count; i++) {
+					__m128 d;
+					const int found = bvh_triangle4(&tris[(size_t)i * 9], r, tmax, d) & active;
+					if (!found)
+						continue;
+					const __m128 m = _mm_castsi128_ps(_mm_set_epi32(found & 8 ? -1 : 0, found & 4 ? -1 : 0, found & 2 ? -1 : 0, found & 1 ? -1 : 0));
+					tmax = _mm_or_ps(_mm_and_ps(m, d), _mm_andnot_ps(m, tmax));
+					for (int k = 0; k < 4; k++)
+						if (found & (1 << k))
+							prim[k] = prims[i];
+					hit |= found;
+				}
+				continue;
+			}
+
+			// Nearest child last, so it's visited first: the one the first ray that reaches both enters earlier.
+			const unsigned int left = index + 1, right = n.first;
+			const int ml = bvh_box4(nodes[left], r, idx, idy, idz, tmax, entry) & active;
+			const int mr = bvh_box4(nodes[right], r, idx, idy, idz, tmax, entry_r) & active;
+			if (ml && mr) {
+				bool left_first = true;
+				const int both = ml & mr;
+				if (both) {
+					float el[4], er[4];
+					_mm_storeu_ps(el, entry);
+					_mm_storeu_ps(er, entry_r);
+					int k = 0;
+					while (!(both & (1 << k)))
+						k++;
+					left_first = el[k] <= er[k];
+				}
+				stack[top++] = left_first ? right : left;
+				stack[top++] = left_first ? left : right;
+			}
+			else if (ml)
+				stack[top++] = left;
+			else if (mr)
+				stack[top++] = right;
+		}
+		_mm_storeu_ps(t, tmax);
+		return hit;
+	}
+
+	inline int BVH::occluded4(const bvh_ray4& r, int active) const {
+		if (nodes.empty())
+			return 0;
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 idx = _mm_div_ps(one, r.dx), idy = _mm_div_ps(one, r.dy), idz = _mm_div_ps(one, r.dz);
+		__m128 entry;
+		int hit = 0;
+
+		unsigned int stack[stack_size];
+		int top = 0;
+		stack[top++] = 0;
+		while (top && active) {
+			const unsigned int index = stack[--top];
+			const bvh_node& n = nodes[index];
+			if (!(bvh_box4(n, r, idx, idy, idz, r.tmax, entry) & active))
+				continue;
+
+			if (!n.count) {
+				stack[top++] = n.first;
+				stack[top++] = index + 1;
+				continue;
+			}
+
+			for (unsigned int i = n.first; i < n.first + n.count && active; i++) {
+				__m128 d;
+				const int found = bvh_triangle4(&tris[(size_t)i * 9], r, r.tmax, d) & active;
+				hit |= found;
+				active &= ~found;
+			}
+		}
+		return hit;
+	}
+
+	inline void BVH::overlap(const float min[3], const float max[3], std::vector<unsigned int>& out) const {
+		if (nodes.empty())
+			return;
+		unsigned int stack[stack_size];
+		int top = 0;
+		stack[top++] = 0;
+		while (top) {
+			const unsigned int index = stack[--top];
+			const bvh_node& n = nodes[index];
+			if (n.min[0] > max[0] || n.max[0] < min[0] || n.min[1] > max[1] || n.max[1] < min[1] || n.min[2] > max[2] || n.max[2] < min[2])
+				continue;
+			if (n.count) {
+				for (unsigned int i = n.first; i < n.first + n.count; i++)
+					out.push_back(prims[i]);
+				continue;
+			}
+			stack[top++] = n.first;
+			stack[top++] = index + 1;
+		}
+	}
+}
+
+#endif // !GEN_ENG_BVH_H
@@ -31,14 +31,15 @@ namespace GenEngine {
 		vec3	front, left, up;			// camera axis. when front is (0,0,-1), the camera is pointing towards -z and the yaw angle is 180. 
 		vec3	angle;						// pitch, yaw and roll angles respectively
 		float	fov;						// FOV angle
+		float	velocity;					// Current movement speed along the direction being pressed, in units per second.
 
 		// Flags
 		unsigned short int updated;			// Needs to be updated? Can be used to skip calculations, generating proj matrices, etc.
 
 	public:
-		Camera() : pos(vec3(0.f,0.f,0.f)), front(vec3(0.f,0.f,-1.f)), left(vec3(1.f,0.f,0.f)), up(vec3(0.f,1.f,0.f)), angle(vec3(0.f,180.f,0.f)), fov(75.f), updated(0) {};
-		Camera(const vec3& p, const float &y, const float &pit, const float &r) : pos(p), angle(r,y,pit), fov(75.f), updated(0) {};
-		Camera(const vec3& p, const vec3 &angl) : pos(p), angle(angl), fov(75.f), updated(0) {};
+		Camera() : pos(vec3(0.f,0.f,0.f)), front(vec3(0.f,0.f,-1.f)), left(vec3(1.f,0.f,0.f)), up(vec3(0.f,1.f,0.f)), angle(vec3(0.f,180.f,0.f)), fov(75.f), velocity(0.f), updated(0) {};
+		Camera(const vec3& p, const float &y, const float &pit, const float &r) : pos(p), angle(r,y,pit), fov(75.f), velocity(0.f), updated(0) {};
+		Camera(const vec3& p, const vec3 &angl) : pos(p), angle(angl), fov(75.f), velocity(0.f), updated(0) {};
 		~Camera() {}
 
 		inline const	vec3		get_pos()				const	{ return pos; }
@@ -53,7 +54,7 @@ namespace GenEngine {
 		inline			void		move_front(const vec3& p)		{ front += p; }
 		inline			void		set_angle(const vec3& ang)		{ angle = ang; }
 						void		cursor_offset_to_angle(GLFWwindow *w);
-						void		move_camera(GLFWwindow* w);
+						void		move_camera(GLFWwindow* w, const float delta_time);
 						void		angles_to_axis();
 						mat4x4		look_at(const vec3& target);
 						mat4x4		look_at();
@@ -98,17 +99,12 @@ namespace GenEngine {
 		else if (angle.x() < -89.f) angle.e[0] = -89.f;
 	}
 
-	void Camera::move_camera(GLFWwindow* w) {
+	// Moves the camera according to the keys pressed. Must be called once per fixed simulation step, delta_time being the step in seconds, so
+	// movement doesn't depend on the frame rate.
+	void Camera::move_camera(GLFWwindow* w, const float delta_time) {
 
-		const	float max_speed		= 0.001f;
-		const	float acceleration	= 0.0001f;
-		static	float velocity		= 0.0f;
-		static	float last_time		= 0.0f;
-				float current_time;
-				float delta_time;
-		
-		current_time = (float)glfwGetTime();
-		delta_time = current_time - last_time;
+		const	float max_speed		= 3.0f;		// units per second
+		const	float acceleration	= 12.0f;	// units per second^2
 
 		if (glfwGetKey(w, GLFW_KEY_W) == GLFW_PRESS) {
 			velocity += acceleration * delta_time;
@@ -283,6 +279,15 @@ namespace GenEngine {
 
 		return view;
 	}
+
+	// Returns a camera between two simulation states, t being in [0, 1]. Position is interpolated linearly; orientation is taken from the newest
+	// state since mouse look is applied once per rendered frame, not per simulation step.
+	inline Camera interpolate(const Camera& prev, const Camera& curr, const float t) {
+		Camera c = curr;
+		c.set_pos(prev.get_pos() * (1.f - t) + curr.get_pos() * t);
+		c.angles_to_axis();
+		return c;
+	}
 }
 #endif // !GEN_CAM_H
 
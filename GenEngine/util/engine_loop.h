@@ -0,0 +1,153 @@
+#pragma once
+#ifndef GEN_ENG_ENGINE_LOOP_H
+#define GEN_ENG_ENGINE_LOOP_H
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <math.h>
+#include "util/options.h"
+
+/*	Engine main loop timing.
+		Simulation runs at a fixed step, independent of the frame rate: every frame the real time elapsed is added to an accumulator, and
+		step_simulation() returns 1 once for every whole step it contains. What's left in the accumulator (alpha()) tells how far between the
+		last two simulation states the frame is, so the renderer can interpolate them instead of showing the simulation "stutter".
+
+		On top of that the loop can:
+		- Cap the frame rate. Waiting is done with precise_sleep(), which sleeps while it's safe and spins the last stretch.
+		- Render on demand (editor mode, --on-demand): frames are only produced when something asked for a redraw, so an idle scene doesn't
+		  keep the CPU and GPU at 100%. The caller asks for one whenever input, the camera or the scene changed.
+
+		Typical frame:
+
+			loop.begin_frame();
+			while (loop.step_simulation())
+				simulate(loop.get_step());
+			if (loop.should_render())
+				draw(interpolate(previous, current, loop.alpha()));
+			loop.end_frame();
+*/
+
+namespace GenEngine {
+
+	typedef std::chrono::steady_clock				loop_clock;
+	typedef std::chrono::duration<double>			loop_seconds;
+
+	inline void precise_sleep(double seconds);
+
+	class EngineLoop {
+
+		double					step;				// Fixed simulation step, in seconds.
+		double					max_frame;			// Frame deltas are clamped to this, so a long stall doesn't run hundreds of steps.
+		double					accumulator;		// Real time not simulated yet.
+		double					frame_delta;		// Real time between the last two begin_frame() calls.
+		double					min_frame;			// 1 / frame cap, or 0 if uncapped.
+		bool					on_demand;			// Render on demand mode.
+		bool					redraw;				// A redraw was requested since the last rendered frame.
+		loop_clock::time_point	last_frame;			// Time of the last begin_frame().
+		loop_clock::time_point	next_frame;			// Earliest time the next frame may start, used by the frame cap.
+		unsigned long long		steps;				// Total simulation steps run.
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		EngineLoop(const double sim_hz = 120.0) : step(1.0 / sim_hz), max_frame(0.25), accumulator(0.0), frame_delta(0.0), min_frame(0.0),
+			on_demand(false), redraw(true), last_frame(loop_clock::now()), next_frame(last_frame), steps(0) {}
+
+		// Configuration
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		configure(const CommandLine& cmd)		{ set_render_on_demand(cmd.has("--on-demand")); return true; }
+		inline void		set_fixed_step(const double sim_hz)		{ step = 1.0 / sim_hz; }
+		inline void		set_frame_cap(const double fps)			{ min_frame = fps > 0.0 ? 1.0 / fps : 0.0; }	// 0 removes the cap.
+		inline void		set_render_on_demand(const bool on)		{ on_demand = on; redraw = true; }
+		inline void		request_redraw()						{ redraw = true; }
+
+		// Frame
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		begin_frame();								// Measures the time since the last frame and feeds the accumulator.
+		inline bool		step_simulation();							// Returns 1 (and consumes a step) while a fixed step is due.
+		inline bool		should_render();							// Returns 1 if this frame must be rendered.
+		inline bool		is_idle()				const	{ return on_demand && !redraw; }	// Nothing to draw: the caller may block waiting for events.
+		inline void		end_frame();								// Waits until the frame cap allows the next frame.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline double				get_step()			const	{ return step; }
+		inline double				get_frame_delta()	const	{ return frame_delta; }
+		inline float				alpha()				const	{ return (float)(accumulator / step); }		// Interpolation factor between the last two states.
+		inline unsigned long long	get_steps()			const	{ return steps; }
+		inline double				get_min_frame()		const	{ return min_frame; }
+	};
+
+
+	inline void EngineLoop::begin_frame() {
+		loop_clock::time_point now = loop_clock::now();
+		frame_delta = std::min(loop_seconds(now - last_frame).count(), max_frame);
+		last_frame = now;
+		accumulator += frame_delta;
+	}
+
+	inline bool EngineLoop::step_simulation() {
+		if (accumulator < step)
+			return false;
+		accumulator -= step;
+		steps++;
+		return true;
+	}
+
+	inline bool EngineLoop::should_render() {
+		if (!on_demand)
+			return true;
+		bool r = redraw;
+		redraw = false;
+		return r;
+	}
+
+	inline void EngineLoop::end_frame() {
+		if (min_frame <= 0.0)
+			return;
+
+		// Frames are scheduled against a fixed timeline so sleep errors don't accumulate. If the frame took too long, the timeline restarts now
+		// instead of rushing the following frames to catch up.
+		loop_clock::time_point now = loop_clock::now();
+		next_frame += std::chrono::duration_cast<loop_clock::duration>(loop_seconds(min_frame));
+		if (next_frame < now)
+			next_frame = now;
+		else
+			precise_sleep(loop_seconds(next_frame - now).count());
+	}
+
+	/*	Hybrid sleep.
+			OS sleeps overshoot by an amount that depends on the scheduler (often 1-2 ms, sometimes far more on Windows without timeBeginPeriod). The
+			function keeps a running estimate (mean + stddev, Welford's method) of how long a 1 ms sleep really takes, sleeps in 1 ms slices while
+			the remaining time is larger than that estimate, and spins for the rest.
+	*/
+	inline void precise_sleep(double seconds) {
+		static double	estimate	= 5e-3;
+		static double	mean		= 5e-3;
+		static double	m2			= 0.0;
+		static long		count		= 1;
+
+		loop_clock::time_point end = loop_clock::now() + std::chrono::duration_cast<loop_clock::duration>(loop_seconds(seconds));
+
+		while (seconds > estimate) {
+			loop_clock::time_point start = loop_clock::now();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			double observed = loop_seconds(loop_clock::now() - start).count();
+			seconds -= observed;
+
+			count++;
+			double delta = observed - mean;
+			mean += delta / count;
+			m2 += delta * (observed - mean);
+			estimate = mean + sqrt(m2 / (count - 1));
+		}
+
+		// Spin lock for the remaining time.
+		while (loop_clock::now() < end)
+			std::this_thread::yield();
+	}
+}
+
+#endif // !GEN_ENG_ENGINE_LOOP_H
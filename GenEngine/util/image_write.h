@@ -0,0 +1,245 @@
+#pragma once
+#ifndef GEN_ENG_IMAGE_WRITE_H
+#define GEN_ENG_IMAGE_WRITE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+/*	Image writing.
+		PNG and binary PPM files from 8 bit RGB pixels, rows top to bottom. No zlib: the PNG's deflate stream is built here, with the fixed
+		Huffman codes and matches searched only at a few distances given by the caller (for images, the previous pixel and the pixel above).
+		Rendered frames are mostly flat colors and gradients along rows or columns, which that catches at a fraction of the cost of a real
+		LZ77 search; the files are larger than zlib's, but still much smaller than raw pixels.
+
+		Both functions return the size of the file written, 0 if it couldn't be written. They don't share any state and can be called from any
+		thread.
+*/
+
+namespace GenEngine {
+
+	// Fixed Huffman codes of deflate (RFC 1951, 3.2.6), bit reversed so they can be written LSB first like the rest of the stream.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct deflate_fixed_codes {
+		uint16_t	lit[288];				// Literals, end of block and length symbols.
+		uint8_t		lit_bits[288];
+		uint16_t	len_symbol[259];		// By match length (3..258).
+		uint8_t		len_extra_bits[259];
+		uint16_t	len_extra[259];
+
+		deflate_fixed_codes() {
+			auto reverse = [](unsigned int code, const int bits) {
+				unsigned int r = 0;
+				for (int i = 0; i < bits; i++, code >>= 1)
+					r = (r << 1) | (code & 1);
+				return (uint16_t)r;
+			};
+			for (int s = 0; s < 288; s++) {
+				if (s < 144)		{ lit[s] = reverse(0x30 + s, 8);			lit_bits[s] = 8; }
+				else if (s < 256)	{ lit[s] = reverse(0x190 + s - 144, 9);		lit_bits[s] = 9; }
+				else if (s < 280)	{ lit[s] = reverse(s - 256, 7);				lit_bits[s] = 7; }
+				else				{ lit[s] = reverse(0xc0 + s - 280, 8);		lit_bits[s] = 8; }
+			}
+			static const uint16_t base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163,
+				195, 227, 258 };
+			static const uint8_t extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			for (int len = 3, i = 0; len <= 258; len++) {
+				while (i < 28 && base[i + 1] <= len)
+					i++;
+				len_symbol[len] = (uint16_t)(257 + i);
+				len_extra_bits[len] = extra[i];
+				len_extra[len] = (uint16_t)(len - base[i]);
+			}
+		}
+	};
+
+	// Deflate bit stream, LSB first.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct deflate_bit_writer {
+		std::vector<unsigned char>&	out;
+		uint64_t					bits;
+		int							count;
+
+		deflate_bit_writer(std::vector<unsigned char>& o) : out(o), bits(0), count(0) {}
+
+		inline void put(const uint32_t value, const int n) {
+			bits |= (uint64_t)value << count;
+			count += n;
+			while (count >= 8) {
+				out.push_back((unsigned char)bits);
+				bits >>= 8;
+				count -= 8;
+			}
+		}
+		inline void flush() {
+			if (count > 0)
+				out.push_back((unsigned char)bits);
+			bits = 0;
+			count = 0;
+		}
+	};
+
+	inline uint32_t	crc32_update(uint32_t crc, const unsigned char* p, const size_t n);
+	inline uint32_t	adler32(const unsigned char* p, const size_t n);
+	inline void		zlib_compress(const unsigned char* data, const size_t n, const size_t* distances, const int distance_count, std::vector<unsigned char>& out);
+	inline size_t	write_png(const char* path, const unsigned char* rgb, const int w, const int h);
+	inline size_t	write_ppm(const char* path, const unsigned char* rgb, const int w, const int h);
+
+
+	inline uint32_t crc32_update(uint32_t crc, const unsigned char* p, const size_t n) {
+		struct crc_table {
+			uint32_t	e[256];
+			crc_table() {
+				for (uint32_t i = 0; i < 256; i++) {
+					uint32_t c = i;
+					for (int k = 0; k < 8; k++)
+						c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					e[i] = c;
+				}
+			}
+		};
+		static const crc_table table;
+		crc = ~crc;
+		for (size_t i = 0; i < n; i++)
+			crc = table.e[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	inline uint32_t adler32(const unsigned char* p, const size_t n) {
+		uint32_t a = 1, b = 0;
+		for (size_t i = 0; i < n;) {
+			const size_t end = std::min(n, i + 5552);		// Longest run that can't overflow before the modulo.
+			for (; i < end; i++) {
+				a += p[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+
+	// A zlib stream with a single fixed Huffman block. At every position, the longest match at any of the given distances is taken if it's at
+	// least 3 bytes long; otherwise the byte goes as a literal.
+	inline void zlib_compress(const unsigned char* data, const size_t n, const size_t* distances, const int distance_count, std::vector<unsigned char>& out) {
+		static const deflate_fixed_codes codes;
+		static const uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+			4097, 6145, 8193, 12289, 16385, 24577 };
+
+		out.push_back(0x78);		// Deflate, 32K window.
+		out.push_back(0x01);		// Fastest compression, no dictionary.
+		deflate_bit_writer bw(out);
+		bw.put(1, 1);				// Last block.
+		bw.put(1, 2);				// Fixed Huffman codes.
+
+		// Distance codes of each candidate, computed once.
+		uint16_t dist_code[8];
+		int count = 0;
+		size_t dist[8];
+		for (int d = 0; d < distance_count && count < 8; d++) {
+			if (distances[d] < 1 || distances[d] > 32768)
+				continue;
+			int c = 29;
+			while (dist_base[c] > distances[d])
+				c--;
+			dist[count] = distances[d];
+			dist_code[count++] = (uint16_t)c;
+		}
+
+		for (size_t i = 0; i < n;) {
+			size_t best = 0;
+			int best_d = 0;
+			const size_t longest = std::min<size_t>(258, n - i);
+			for (int d = 0; d < count; d++) {
+				if (dist[d] > i)
+					continue;
+				const unsigned char* a = data + i;
+				const unsigned char* b = a - dist[d];
+				size_t len = 0;
+				while (len < longest && a[len] == b[len])
+					len++;
+				if (len > best) {
+					best = len;
+					best_d = d;
+				}
+			}
+
+			if (best >= 3) {
+				const uint16_t sym = codes.len_symbol[best];
+				bw.put(codes.lit[sym], codes.lit_bits[sym]);
+				if (codes.len_extra_bits[best])
+					bw.put(codes.len_extra[best], codes.len_extra_bits[best]);
+				const int c = dist_code[best_d];
+				unsigned int rc = 0;		// 5 bit code, reversed.
+				for (int k = 0; k < 5; k++)
+					rc |= ((c >> k) & 1) << (4 - k);
+				bw.put(rc, 5);
+				const int extra_bits = c < 4 ? 0 : (c >> 1) - 1;
+				if (extra_bits)
+					bw.put((uint32_t)(dist[best_d] - dist_base[c]), extra_bits);
+				i += best;
+			}
+			else {
+				bw.put(codes.lit[data[i]], codes.lit_bits[data[i]]);
+				i++;
+			}
+		}
+		bw.put(codes.lit[256], codes.lit_bits[256]);		// End of block.
+		bw.flush();
+
+		const uint32_t check = adler32(data, n);
+		for (int s = 24; s >= 0; s -= 8)
+			out.push_back((unsigned char)(check >> s));
+	}
+
+	// 8 bit RGB PNG. Rows are stored unfiltered: the match at the previous row's distance already covers what the "up" filter would.
+	inline size_t write_png(const char* path, const unsigned char* rgb, const int w, const int h) {
+		const size_t row = (size_t)w * 3;
+		std::vector<unsigned char> scanlines((row + 1) * h);
+		for (int y = 0; y < h; y++) {
+			scanlines[y * (row + 1)] = 0;		// Filter: none.
+			std::copy(rgb + y * row, rgb + (y + 1) * row, scanlines.begin() + y * (row + 1) + 1);
+		}
+		const size_t distances[2] = { 3, row + 1 };
+		std::vector<unsigned char> idat;
+		idat.reserve(scanlines.size() / 4);
+		zlib_compress(scanlines.data(), scanlines.size(), distances, 2, idat);
+
+		FILE* f = fopen(path, "wb");
+		if (!f)
+			return 0;
+		size_t size = 0;
+		auto chunk = [&](const char* type, const unsigned char* data, const size_t n) {
+			unsigned char header[8] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n,
+				(unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3] };
+			const uint32_t crc = crc32_update(crc32_update(0, header + 4, 4), data, n);
+			const unsigned char footer[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc };
+			size += fwrite(header, 1, 8, f) + fwrite(data, 1, n, f) + fwrite(footer, 1, 4, f);
+		};
+		static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		const unsigned char ihdr[13] = { (unsigned char)(w >> 24), (unsigned char)(w >> 16), (unsigned char)(w >> 8), (unsigned char)w,
+			(unsigned char)(h >> 24), (unsigned char)(h >> 16), (unsigned char)(h >> 8), (unsigned char)h,
+			8, 2, 0, 0, 0 };		// 8 bits per channel, RGB, deflate, adaptive filtering, not interlaced.
+		size += fwrite(signature, 1, 8, f);
+		chunk("IHDR", ihdr, 13);
+		chunk("IDAT", idat.data(), idat.size());
+		chunk("IEND", NULL, 0);
+		const bool ok = !ferror(f);
+		fclose(f);
+		return ok ? size : 0;
+	}
+
+	inline size_t write_ppm(const char* path, const unsigned char* rgb, const int w, const int h) {
+		FILE* f = fopen(path, "wb");
+		if (!f)
+			return 0;
+		size_t size = (size_t)fprintf(f, "P6\n%d %d\n255\n", w, h);
+		size += fwrite(rgb, 1, (size_t)w * h * 3, f);
+		const bool ok = !ferror(f);
+		fclose(f);
+		return ok ? size : 0;
+	}
+}
+
+#endif // !GEN_ENG_IMAGE_WRITE_H
@@ -0,0 +1,175 @@
+#pragma once
+#ifndef GEN_ENG_JOB_SYSTEM_H
+#define GEN_ENG_JOB_SYSTEM_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include "util/options.h"
+
+/*	Job system.
+		A fixed pool of worker threads for data-parallel work. parallel_for() splits a range of indices between the workers and the calling thread
+		and returns once every index was processed; indices are handed out through an atomic counter, so uneven work (e.g. screen tiles with very
+		different triangle counts) balances itself.
+
+		Only one parallel_for() runs at a time; calls from different threads (e.g. the main thread culling while the render thread runs the
+		software rasterizer) are served one after the other. Calling parallel_for() from inside a job deadlocks. The function receives the index
+		and the number of the thread running it (0 is the caller, 1..get_worker_count() are the workers), which can be used to index per-thread
+		scratch data without locking.
+
+		The pool has one thread per hardware thread unless --jobs <threads> says otherwise (the caller counts as one, --jobs 1 runs everything
+		on it), which is how the parallel parts are timed against a serial run on the same machine.
+*/
+
+namespace GenEngine {
+
+	class JobSystem {
+	public:
+		typedef std::function<void(unsigned int index, unsigned int thread)> job_fn;
+
+	private:
+		std::vector<std::thread>	workers;
+		std::mutex					mutex;
+		std::mutex					batch_mutex;	// Held by the caller for a whole parallel_for().
+		std::condition_variable		wake;			// Workers wait here for a new batch.
+		std::condition_variable		done;			// The caller waits here for the workers to leave the batch.
+
+		const job_fn*				job;
+		unsigned int				count;
+		std::atomic<unsigned int>	next;			// Next index to hand out.
+		unsigned int				generation;		// Incremented for every batch, so workers don't run the same batch twice.
+		unsigned int				busy;			// Workers still inside the current batch.
+		bool						quit;
+		unsigned int				requested;		// Threads asked for with --jobs, 0 for one per hardware thread.
+
+		inline void		worker_loop(const unsigned int thread);
+		inline void		run(const job_fn& fn, const unsigned int n, const unsigned int thread);
+
+	public:
+
+		// Constructor and destructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		JobSystem() : job(NULL), count(0), next(0), generation(0), busy(0), quit(false), requested(0) {}
+		~JobSystem() { shutdown(); }
+
+		// Pool control
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool				configure(const CommandLine& cmd);		// --jobs <threads>. Before start().
+		inline void				start(unsigned int threads = 0);		// 0: as configured, else one worker per hardware thread, minus the caller.
+		inline void				shutdown();
+
+		// Work
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void				parallel_for(const unsigned int n, const job_fn& fn);
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline unsigned int		get_worker_count()	const	{ return (unsigned int)workers.size(); }
+		inline unsigned int		get_thread_count()	const	{ return (unsigned int)workers.size() + 1; }		// Workers plus the caller.
+	};
+
+	JobSystem job_system;
+
+
+	inline bool JobSystem::configure(const CommandLine& cmd) {
+		if (!cmd.has("--jobs"))
+			return true;
+		const int n = cmd.value("--jobs") ? atoi(cmd.value("--jobs")) : 0;
+		requested = (unsigned int)std::max(n, 0);
+		return n > 0;
+	}
+
+	inline void JobSystem::start(unsigned int threads) {
+		if (!workers.empty())
+			return;
+		if (!threads && requested)
+			threads = requested - 1;
+		else if (!threads)
+			threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+		quit = false;
+		for (unsigned int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&JobSystem::worker_loop, this, i + 1));
+	}
+
+	inline void JobSystem::shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto i = workers.begin(); i != workers.end(); i++)
+			i->join();
+		workers.clear();
+	}
+
+	inline void JobSystem::run(const job_fn& fn, const unsigned int n, const unsigned int thread) {
+		unsigned int i;
+		while ((i = next.fetch_add(1)) < n)
+			fn(i, thread);
+	}
+
+	inline void JobSystem::worker_loop(const unsigned int thread) {
+		unsigned int seen = 0;
+		for (;;) {
+			const job_fn* fn;
+			unsigned int n;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return quit || generation != seen; });
+				if (quit)
+					return;
+				seen = generation;
+
+				// Woke up after the batch was already finished and closed by the caller.
+				if (!job)
+					continue;
+				fn = job;
+				n = count;
+				busy++;
+			}
+			run(*fn, n, thread);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busy == 0)
+					done.notify_one();
+			}
+		}
+	}
+
+	inline void JobSystem::parallel_for(const unsigned int n, const job_fn& fn) {
+		if (!n)
+			return;
+
+		// Not worth waking anyone for a single index, or there's no one to wake.
+		if (workers.empty() || n == 1) {
+			for (unsigned int i = 0; i < n; i++)
+				fn(i, 0);
+			return;
+		}
+
+		std::lock_guard<std::mutex> batch_lock(batch_mutex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &fn;
+			count = n;
+			next = 0;
+			generation++;
+		}
+		wake.notify_all();
+		run(fn, n, 0);
+
+		// Every index has been handed out; wait for the workers still processing theirs. Workers that wake up late find nothing left to do.
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+
+		job = NULL;
+		count = 0;
+	}
+}
+
+#endif // !GEN_ENG_JOB_SYSTEM_H
@@ -0,0 +1,360 @@
+#pragma once
+#ifndef GEN_ENG_MESH_OPTIMIZE_H
+#define GEN_ENG_MESH_OPTIMIZE_H
+
+#include "glad/glad.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/*	Mesh optimization.
+		Turns the vertices of a draw (a triangle list, strip or fan of any number of floats per vertex, the first 3 being the position) into an
+		indexed triangle list that is cheap for the GPU to draw:
+		- weld(): vertices with the same floats are merged into one, and triangles with two corners on the same vertex (the ones strips use to
+		  join pieces) are dropped. Strips keep the facing of their odd triangles.
+		- optimize_vertex_cache(): triangles are reordered so the vertices they use are still in the post-transform cache when used again, with
+		  Tom Forsyth's linear-speed algorithm: every vertex gets a score from its position in a simulated LRU cache of 32 and from how many
+		  triangles still need it, and the next triangle is the best scored of those that use a vertex in the cache.
+		- optimize_overdraw(): the triangle order is cut into clusters where the cache runs dry anyway (a triangle with all 3 vertices missed),
+		  and the clusters are sorted so those facing out from the center of the mesh are drawn first. They're the likeliest to cover the rest
+		  from any point of view, and since the cuts fall on misses, the cache efficiency stays the same.
+		- optimize_vertex_fetch(): vertices are renumbered in the order the triangles first use them, so they're read from memory in order.
+		optimize() does all four.
+
+		Efficiency is measured as the average cache miss ratio (ACMR, vertices transformed per triangle; 0.5 at best, 3 at worst), simulating a
+		FIFO cache of cache_size vertices (16 by default, a common size). The stats keep it before welding (every vertex drawn is transformed:
+		glDrawArrays has no cache), after welding in the original order and after optimizing, summed over every mesh until reset_stats().
+*/
+
+namespace GenEngine {
+
+	// Totals over the meshes optimized since reset_stats().
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct mesh_optimize_stats {
+		unsigned int	meshes;
+		unsigned int	triangles;			// After welding.
+		unsigned int	vertices[2];		// Before and after welding.
+		unsigned int	clusters;			// Of optimize_overdraw().
+		double			misses[3];			// Vertices transformed: not indexed, welded and optimized.
+		double			ms;
+	};
+
+	class MeshOptimizer {
+
+		static const int	forsyth_cache = 32;		// Size of the LRU cache the scores are computed for.
+		static const int	max_valence = 32;		// Triangles left to a vertex that get a score of their own; more score the same.
+
+		unsigned int					cache_size;
+		float							cache_score[forsyth_cache];
+		float							valence_score[max_valence + 1];
+		std::vector<unsigned int>		table, remap, triangles, offsets, adjacent, order;
+		std::vector<int>				position;
+		std::vector<float>				score, tri_score, scratch;
+		std::vector<uint8_t>			emitted;
+		mesh_optimize_stats				stats;
+
+		inline float	vertex_score(const unsigned int v) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		MeshOptimizer(const unsigned int cache = 16) : cache_size(cache), stats() {
+			for (int i = 0; i < forsyth_cache; i++)
+				cache_score[i] = i < 3 ? 0.75f : powf(1.f - (i - 3) / (float)(forsyth_cache - 3), 1.5f);
+			valence_score[0] = 0.f;
+			for (int i = 1; i <= max_valence; i++)
+				valence_score[i] = 2.f / sqrtf((float)i);
+		}
+
+		// Settings
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline void		set_cache_size(const unsigned int cache)	{ cache_size = std::max(cache, 3u); }		// Of the ACMR simulation.
+		inline void		reset_stats()								{ stats = mesh_optimize_stats(); }
+
+		// Operations
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		// verts is replaced by the welded vertices, indices by the triangle list into them.
+		inline void			optimize(std::vector<float>& verts, const unsigned int stride, const GLenum primitive, std::vector<unsigned int>& indices);
+
+		inline void			weld(std::vector<float>& verts, const unsigned int stride, const GLenum primitive, std::vector<unsigned int>& indices);
+		inline void			optimize_vertex_cache(std::vector<unsigned int>& indices, const size_t vertex_count);
+		inline unsigned int	optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<float>& verts, const unsigned int stride);	// Returns the clusters.
+		inline void			optimize_vertex_fetch(std::vector<float>& verts, const unsigned int stride, std::vector<unsigned int>& indices);
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline unsigned int				count_misses(const std::vector<unsigned int>& indices, const size_t vertex_count);		// In the FIFO cache.
+		inline double					get_acmr(const int i)	const	{ return stats.triangles ? stats.misses[i] / stats.triangles : 0.0; }
+		inline const mesh_optimize_stats&	get_stats()			const	{ return stats; }
+	};
+
+
+	inline void MeshOptimizer::optimize(std::vector<float>& verts, const unsigned int stride, const GLenum primitive, std::vector<unsigned int>& indices) {
+		auto start = std::chrono::steady_clock::now();
+		const unsigned int vertex_count = (unsigned int)(verts.size() / stride);
+		weld(verts, stride, primitive, indices);
+		const unsigned int welded = (unsigned int)(verts.size() / stride);
+		stats.meshes++;
+		stats.triangles += (unsigned int)(indices.size() / 3);
+		stats.vertices[0] += vertex_count;
+		stats.vertices[1] += welded;
+		stats.misses[0] += indices.empty() ? 0 : vertex_count;
+		stats.misses[1] += count_misses(indices, welded);
+
+		optimize_vertex_cache(indices, welded);
+		stats.clusters += optimize_overdraw(indices, verts, stride);
+		optimize_vertex_fetch(verts, stride, indices);
+		stats.misses[2] += count_misses(indices, verts.size() / stride);
+		stats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void MeshOptimizer::weld(std::vector<float>& verts, const unsigned int stride, const GLenum primitive, std::vector<unsigned int>& indices) {
+		const size_t n = verts.size() / stride;
+		size_t size = 16;
+		while (size < n * 2)
+			size *= 2;
+		table.assign(size, ~0u);
+		remap.resize(n);
+
+		// Open addressing over the bits of the floats; -0 is made 0 first so it welds with it.
+		unsigned int unique = 0;
+		for (size_t i = 0; i < n; i++) {
+			float* v = &verts[i * stride];
+			uint32_t h = 2166136261u;
+			for (unsigned int k = 0; k < stride; k++) {
+				if (v[k] == 0.f)
+					v[k] = 0.f;
+				uint32_t bits;
+				memcpy(&bits, &v[k], 4);
+				h = (h ^ bits) * 16777619u;
+			}
+			size_t s = (h ^ (h >> 15)) & (size - 1);
+			for (; table[s] != ~0u; s = (s + 1) & (size - 1))
+				if (!memcmp(&verts[(size_t)table[s] * stride], v, stride * sizeof(float)))
+					break;
+			if (table[s] == ~0u) {
+				if (unique != i)
+					memmove(&verts[(size_t)unique * stride], v, stride * sizeof(float));
+				table[s] = unique++;
+			}
+			remap[i] = table[s];
+		}
+		verts.resize((size_t)unique * stride);
+
+		indices.clear();
+		auto add = [&](const size_t a, const size_t b, const size_t c) {
+			const unsigned int t[3] = { remap[a], remap[b], remap[c] };
+			if (t[0] != t[1] && t[1] != t[2] && t[0] != t[2])
+				indices.insert(indices.end(), t, t + 3);
+		};
+		if (primitive == GL_TRIANGLES)
+			for (size_t i = 0; i + 2 < n; i += 3)
+				add(i, i + 1, i + 2);
+		else if (primitive == GL_TRIANGLE_STRIP)
+			for (size_t i = 0; i + 2 < n; i++)
+				i & 1 ? add(i + 1, i, i + 2) : add(i, i + 1, i + 2);
+		else if (primitive == GL_TRIANGLE_FAN)
+			for (size_t i = 1; i + 1 < n; i++)
+				add(0, i, i + 1);
+	}
+
+	inline float MeshOptimizer::vertex_score(const unsigned int v) const {
+		const unsigned int left = triangles[v];
+		if (!left)
+			return -1.f;
+		return (position[v] < 0 ? 0.f : cache_score[position[v]]) + valence_score[std::min(left, (unsigned int)max_valence)];
+	}
+
+	inline void MeshOptimizer::optimize_vertex_cache(std::vector<unsigned int>& indices, const size_t vertex_count) {
+		const size_t tri_count = indices.size() / 3;
+		if (!tri_count)
+			return;
+
+		// Triangles of every vertex; the ones still to be drawn are kept at the front of each list.
+		triangles.assign(vertex_count, 0);
+		for (const unsigned int i : indices)
+			triangles[i]++;
+		offsets.resize(vertex_count + 1);
+		offsets[0] = 0;
+		for (size_t v = 0; v < vertex_count; v++)
+			offsets[v + 1] = offsets[v] + triangles[v];
+		adjacent.resize(indices.size());
+		std::vector<unsigned int>& fill = remap;
+		fill.assign(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < tri_count; t++)
+			for (int k = 0; k < 3; k++)
+				adjacent[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+		position.assign(vertex_count, -1);
+		score.resize(vertex_count);
+		for (size_t v = 0; v < vertex_count; v++)
+			score[v] = vertex_score((unsigned int)v);
+		tri_score.resize(tri_count);
+		emitted.assign(tri_count, 0);
+		unsigned int best = 0;
+		for (size_t t = 0; t < tri_count; t++) {
+			tri_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+			if (tri_score[t] > tri_score[best])
+				best = (unsigned int)t;
+		}
+
+		order.clear();
+		order.reserve(indices.size());
+		unsigned int cache[forsyth_cache + 3], next_cache[forsyth_cache + 3];
+		int cached = 0;
+		size_t cursor = 0;
+		for (size_t drawn = 0; drawn < tri_count; drawn++) {
+			// Nothing in the cache is used by a triangle left: the first one left in the original order.
+			if (best == ~0u) {
+				while (emitted[cursor])
+					cursor++;
+				best = (unsigned int)cursor;
+			}
+			const unsigned int* tri = &indices[(size_t)best * 3];
+			order.insert(order.end(), tri, tri + 3);
+			emitted[best] = 1;
+
+			// The triangle's vertices go to the front of the cache, pushing the rest back.
+			int next = 0;
+			for (int k = 0; k < 3; k++) {
+				const unsigned int v = tri[k];
+				unsigned int* first = &adjacent[offsets[v]];
+				unsigned int* last = first + triangles[v];
+				std::swap(*std::find(first, last, best), *(last - 1));
+				triangles[v]--;
+				next_cache[next++] = v;
+			}
+			for (int i = 0; i < cached; i++)
+				if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+					next_cache[next++] = cache[i];
+			for (int i = forsyth_cache; i < next; i++)
+				position[next_cache[i]] = -1;
+			cached = std::min(next, (int)forsyth_cache);
+			for (int i = 0; i < next; i++) {
+				cache[i] = next_cache[i];
+				if (i < forsyth_cache)
+					position[cache[i]] = i;
+				score[cache[i]] = vertex_score(cache[i]);
+			}
+
+			// Only the triangles of vertices whose score changed need theirs updated, and the next one is the best of them.
+			best = ~0u;
+			float best_score = -1.f;
+			for (int i = 0; i < next; i++) {
+				const unsigned int v = next_cache[i];
+				for (unsigned int a = offsets[v]; a < offsets[v] + triangles[v]; a++) {
+					const unsigned int t = adjacent[a];
+					const unsigned int* u = &indices[(size_t)t * 3];
+					tri_score[t] = score[u[0]] + score[u[1]] + score[u[2]];
+					if (tri_score[t] > best_score) {
+						best_score = tri_score[t];
+						best = t;
+					}
+				}
+			}
+		}
+		indices.swap(order);
+	}
+
+	inline unsigned int MeshOptimizer::optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<float>& verts, const unsigned int stride) {
+		const size_t tri_count = indices.size() / 3;
+		if (!tri_count)
+			return 0;
+
+		// Clusters start at the triangles that miss all 3 vertices.
+		std::vector<unsigned int>& starts = offsets;
+		starts.clear();
+		remap.assign(verts.size() / stride, 0);		// Time each vertex entered the cache, +1.
+		unsigned int time = 0;
+		for (size_t t = 0; t < tri_count; t++) {
+			int missed = 0;
+			for (int k = 0; k < 3; k++) {
+				const unsigned int v = indices[t * 3 + k];
+				if (remap[v] && time - remap[v] < cache_size)
+					continue;
+				missed++;
+				remap[v] = ++time;
+			}
+			if (missed == 3 || !t)
+				starts.push_back((unsigned int)t);
+		}
+		starts.push_back((unsigned int)tri_count);
+		const unsigned int clusters = (unsigned int)starts.size() - 1;
+		if (clusters < 2)
+			return clusters;
+
+		// Sort key: how far out the cluster's center is along its average normal, from the center of the mesh.
+		double center[3] = { 0.0, 0.0, 0.0 };
+		for (const unsigned int i : indices)
+			for (int k = 0; k < 3; k++)
+				center[k] += verts[(size_t)i * stride + k];
+		for (int k = 0; k < 3; k++)
+			center[k] /= (double)indices.size();
+		scratch.resize(clusters);
+		for (unsigned int c = 0; c < clusters; c++) {
+			float sum[3] = { 0.f, 0.f, 0.f }, normal[3] = { 0.f, 0.f, 0.f }, area = 0.f;
+			for (unsigned int t = starts[c]; t < starts[c + 1]; t++) {
+				const float* p0 = &verts[(size_t)indices[t * 3] * stride];
+				const float* p1 = &verts[(size_t)indices[t * 3 + 1] * stride];
+				const float* p2 = &verts[(size_t)indices[t * 3 + 2] * stride];
+				const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] }, e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				const float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int k = 0; k < 3; k++) {
+					normal[k] += n[k];
+					sum[k] += (p0[k] + p1[k] + p2[k]) * a / 3.f;
+				}
+				area += a;
+			}
+			const float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			float key = 0.f;
+			if (area > 0.f && len > 0.f)
+				for (int k = 0; k < 3; k++)
+					key += (sum[k] / area - (float)center[k]) * normal[k] / len;
+			scratch[c] = key;
+		}
+		std::vector<unsigned int>& sorted = table;
+		sorted.resize(clusters);
+		for (unsigned int c = 0; c < clusters; c++)
+			sorted[c] = c;
+		std::stable_sort(sorted.begin(), sorted.end(), [this](const unsigned int a, const unsigned int b) { return scratch[a] > scratch[b]; });
+
+		order.clear();
+		order.reserve(indices.size());
+		for (const unsigned int c : sorted)
+			order.insert(order.end(), indices.begin() + (size_t)starts[c] * 3, indices.begin() + (size_t)starts[c + 1] * 3);
+		indices.swap(order);
+		return clusters;
+	}
+
+	inline void MeshOptimizer::optimize_vertex_fetch(std::vector<float>& verts, const unsigned int stride, std::vector<unsigned int>& indices) {
+		remap.assign(verts.size() / stride, ~0u);
+		unsigned int used = 0;
+		scratch.resize((size_t)verts.size());
+		for (unsigned int& i : indices) {
+			if (remap[i] == ~0u) {
+				memcpy(&scratch[(size_t)used * stride], &verts[(size_t)i * stride], stride * sizeof(float));
+				remap[i] = used++;
+			}
+			i = remap[i];
+		}
+		scratch.resize((size_t)used * stride);
+		verts.swap(scratch);
+	}
+
+	inline unsigned int MeshOptimizer::count_misses(const std::vector<unsigned int>& indices, const size_t vertex_count) {
+		remap.assign(vertex_count, 0);		// Time each vertex entered the cache, +1.
+		unsigned int time = 0;
+		for (const unsigned int v : indices)
+			if (!remap[v] || time - remap[v] >= cache_size)
+				remap[v] = ++time;
+		return time;
+	}
+}
+
+#endif // !GEN_ENG_MESH_OPTIMIZE_H
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef GEN_ENG_OPTIONS_H
+#define GEN_ENG_OPTIONS_H
+
+#include <ostream>
+#include <vector>
+#include <utility>
+#include <string.h>
+
+/*	Command line options and report counters.
+		Every module reads its own options from the command line (its configure(const CommandLine&), which returns 0 if one of them is
+		malformed) and adds its own counters to the reports (its report(report_counters&)), so main() and the renderer only pass both along.
+		Options are "--name" or "--name <value>"; options nobody asks for are ignored.
+*/
+
+namespace GenEngine {
+
+	typedef std::vector<std::pair<const char*, double>> report_counters;		// Name and value, written in this order.
+
+	class CommandLine {
+
+		int				argc;
+		char**			argv;
+
+		inline int		find(const char* name)	const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		CommandLine(int c, char** v) : argc(c), argv(v) {}
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool			has(const char* name)	const	{ return find(name) > 0; }
+		inline const char*	value(const char* name)	const;		// What follows the option, NULL if it's missing or last.
+	};
+
+
+	inline int CommandLine::find(const char* name) const {
+		for (int i = 1; i < argc; i++)
+			if (!strcmp(argv[i], name))
+				return i;
+		return 0;
+	}
+
+	inline const char* CommandLine::value(const char* name) const {
+		const int i = find(name);
+		return i > 0 && i + 1 < argc ? argv[i + 1] : NULL;
+	}
+
+	// One "name: value" line per counter.
+	inline void write_counters(std::ostream& out, const report_counters& counters) {
+		for (auto i = counters.begin(); i != counters.end(); i++)
+			out << i->first << ": " << i->second << "\n";
+	}
+}
+
+#endif // !GEN_ENG_OPTIONS_H
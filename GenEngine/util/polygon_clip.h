@@ -0,0 +1,988 @@
+#pragma once
+#ifndef GEN_ENG_POLYGON_CLIP_H
+#define GEN_ENG_POLYGON_CLIP_H
+
+#include "util/vec.h"
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include <iostream>
+#include <chrono>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*	Polygon clipping.
+		Union, intersection and difference of two simple polygons, splitting one by a line, and cutting the result into convex pieces. Every
+		edge carries a tag (for sections, the neighbor on the other side: level_editor/sector_edit.h), and every edge of a result keeps the tag
+		of the input edge it's part of.
+
+		- Points are snapped to a grid (1/256 units by default) and handled as integers from there on, so every predicate (what side of a line
+		  a point is on, whether two edges cross, the order of edges around a vertex) is exact: no result can depend on rounding. Coordinates
+		  must stay within max_coord cells of the origin (65536 units with the default grid), which keeps every product within 64 bits.
+		- The edges of both polygons are swept left to right, each tested only against those whose x range it overlaps, to find where they
+		  cross. Then they're snap rounded: crossings are rounded to the grid, and every edge passing through the cell of a crossing or of an
+		  edge's end is bent through it, which can't make new crossings. Edges along each other end up split at the same points, so they're
+		  either the same edge or don't overlap at all.
+		- Each piece of edge then has the same winding numbers of both polygons all along each side, found at its middle against the edges of
+		  each polygon, sorted in horizontal bands so only those at the point's height are looked at. Pieces on the same segment are taken
+		  together, so edges snapped onto each other (even of the same polygon) cancel out or add up as they should. The operation decides
+		  what sides are in the result, and the pieces between in and out are linked back into rings: leaving each vertex by the first edge
+		  clockwise from the one that came in, so polygons that only touch at a point come out separate.
+		- Results go counterclockwise, holes clockwise. partition() triangulates them (holes joined to the outside first) by ear clipping and
+		  removes diagonals while both pieces stay convex (Hertel-Mehlhorn), which leaves at most 4 times the fewest convex pieces possible.
+
+		Self-intersecting input gives undefined (but not broken) results. Points in a row along an edge are only kept where the tag changes.
+*/
+
+namespace GenEngine {
+
+	enum clip_op {
+		CLIP_UNION,
+		CLIP_INTERSECTION,
+		CLIP_DIFFERENCE		// First minus second.
+	};
+
+	// Points in order (either way round), and the tag of the edge from each one to the next.
+	//-------------------------------------------------------------------------------------------------------------------------------------------
+	struct clip_polygon {
+		std::vector<vec2>	points;
+		std::vector<int>	tags;		// -1 for every edge if empty.
+	};
+
+	struct clip_stats {
+		unsigned int	operations;
+		unsigned int	edges;			// Totals, after splitting.
+		unsigned int	splits;			// Points where edges crossed or touched.
+		double			ms;
+	};
+
+	class PolygonClipper {
+
+	public:
+
+		static const int64_t	max_coord = 1 << 24;		// In grid cells.
+
+	private:
+
+		static const int		max_passes = 8;
+
+		struct ipoint {
+			int64_t		x, y;
+			bool operator==(const ipoint& p)	const	{ return x == p.x && y == p.y; }
+			bool operator!=(const ipoint& p)	const	{ return x != p.x || y != p.y; }
+		};
+		struct iedge {
+			ipoint			a, b;
+			int				tag;
+			unsigned int	poly;		// 0 or 1.
+		};
+		struct cut {
+			unsigned int	edge;
+			int64_t			along;		// Dot product with the edge, to sort the cuts of an edge.
+			ipoint			p;
+		};
+		// Edges of one polygon by horizontal band, for point in polygon tests.
+		struct band_index {
+			std::vector<unsigned int>	first;		// First edge of each band in list, and the total at the end.
+			std::vector<unsigned int>	list;
+			int64_t						y0, y1, height;
+		};
+
+		// Partition rings: a doubly linked list of points, each with the tag of the edge to the next.
+		struct ring_node {
+			ipoint			p;
+			int				tag;
+			unsigned int	prev, next;
+		};
+		struct piece {
+			std::vector<ipoint>	points;
+			std::vector<int>	tags;
+		};
+
+		float						grid, inv_grid;
+		std::vector<iedge>			edges;
+		std::vector<iedge>			kept;
+		std::vector<cut>			cuts;
+		std::vector<ipoint>			hot;			// Crossings and ends, where edges are snapped to.
+		std::vector<std::pair<int64_t, unsigned int> >	order;		// Sweep order: left end, edge.
+		std::vector<std::vector<unsigned int> >	rows[2];		// Active edges of the sweep by band: all, and those just split.
+		std::vector<iedge>			sorted;			// Edges by the segment they lie on; poly is 2 * polygon + 1 if going up.
+		band_index					bands[2];
+		clip_stats					stats;
+
+		static inline int64_t	cross(const ipoint& o, const ipoint& a, const ipoint& b)	{ return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x); }
+		static inline bool		inside_box(const ipoint& a, const ipoint& b, const ipoint& p);		// Strictly between a and b, p on their line.
+		static inline bool		clockwise_first(const ipoint& r, const ipoint& d1, const ipoint& d2);	// d1 comes before d2 turning clockwise from r.
+		static inline bool		locally_inside(const std::vector<ring_node>& ring, const unsigned int n, const ipoint& q);
+		static inline bool		segments_touch(const ipoint& a, const ipoint& b, const ipoint& c, const ipoint& d);
+
+		inline bool		to_grid(const vec2& v, ipoint& p)	const;
+		inline vec2		from_grid(const ipoint& p)			const	{ return vec2(p.x * grid, p.y * grid); }
+		inline bool		load(const clip_polygon& polygon, std::vector<ipoint>& points, std::vector<int>& tags) const;
+		inline void		add_ring(const std::vector<ipoint>& points, const std::vector<int>& tags, const unsigned int poly);
+		inline void		test_pair(const unsigned int i, const unsigned int j);
+		inline void		find_crossings(const std::vector<uint8_t>& dirty);
+		inline void		snap_edges();
+		inline void		split_edges();
+		inline void		build_bands(const unsigned int poly);
+		inline int		winding(const unsigned int poly, const ipoint& p2)	const;		// p2: point at twice its coordinates.
+		inline void		select(const clip_op op);
+		inline void		link(std::vector<clip_polygon>& out);
+		inline void		begin();
+		inline void		end();
+		inline bool		bridge_hole(std::vector<ring_node>& ring, const unsigned int start, const std::vector<ipoint>& hole, const std::vector<int>& hole_tags,
+							const std::vector<ipoint>* pending, const size_t pending_count, const int diagonal_tag) const;
+		inline bool		triangulate(std::vector<ring_node>& ring, unsigned int start, unsigned int count, const int diagonal_tag, std::vector<piece>& out) const;
+		inline void		merge_convex(std::vector<piece>& triangles, std::vector<clip_polygon>& pieces) const;
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		PolygonClipper(const float grid_size = 1.f / 256.f) : grid(grid_size), inv_grid(1.f / grid_size), stats{ 0, 0, 0, 0.0 } {}
+
+		// Operations. Return 0 (and leave out alone) if a point is out of range.
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		clip(const clip_op op, const clip_polygon& a, const clip_polygon& b, std::vector<clip_polygon>& out);
+		inline bool		split(const clip_polygon& a, const vec2& p0, const vec2& p1, const int cut_tag, std::vector<clip_polygon>& left, std::vector<clip_polygon>& right);
+		inline bool		partition(const std::vector<clip_polygon>& polygons, const int diagonal_tag, std::vector<clip_polygon>& pieces);	// Holes clockwise.
+
+		// Data retrieval
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline float				get_grid()		const	{ return grid; }
+		inline vec2					snap(const vec2& v)	const	{ return vec2(floorf(v.x() * inv_grid + 0.5f) * grid, floorf(v.y() * inv_grid + 0.5f) * grid); }
+		inline const clip_stats&	get_stats()		const	{ return stats; }
+	};
+
+
+	inline bool PolygonClipper::inside_box(const ipoint& a, const ipoint& b, const ipoint& p) {
+		return p != a && p != b && p.x >= std::min(a.x, b.x) && p.x <= std::max(a.x, b.x) && p.y >= std::min(a.y, b.y) && p.y <= std::max(a.y, b.y);
+	}
+
+	// Turning clockwise from r, a direction is in the first half turn if it's to the right of r (or straight back), in the second otherwise
+	// (or along r, the full turn). Within a half, the one more to the left comes first.
+	inline bool PolygonClipper::clockwise_first(const ipoint& r, const ipoint& d1, const ipoint& d2) {
+		const ipoint o = { 0, 0 };
+		auto half = [&r, &o](const ipoint& d) {
+			const int64_t c = cross(o, r, d);
+			return c < 0 || (c == 0 && r.x * d.x + r.y * d.y < 0) ? 0 : 1;
+		};
+		const int h1 = half(d1), h2 = half(d2);
+		if (h1 != h2)
+			return h1 < h2;
+		return cross(o, d1, d2) < 0;
+	}
+
+	// Whether q is toward the inside of the ring (on the left of its edges) right next to node n.
+	inline bool PolygonClipper::locally_inside(const std::vector<ring_node>& ring, const unsigned int n, const ipoint& q) {
+		const ipoint& p = ring[ring[n].prev].p;
+		const ipoint& x = ring[n].p;
+		const ipoint& nx = ring[ring[n].next].p;
+		if (cross(p, x, nx) >= 0)
+			return cross(x, nx, q) > 0 && cross(x, q, p) > 0;
+		return cross(x, nx, q) > 0 || cross(x, q, p) > 0;
+	}
+
+	inline bool PolygonClipper::segments_touch(const ipoint& a, const ipoint& b, const ipoint& c, const ipoint& d) {
+		const int64_t o1 = cross(a, b, c), o2 = cross(a, b, d), o3 = cross(c, d, a), o4 = cross(c, d, b);
+		if (((o1 > 0 && o2 < 0) || (o1 < 0 && o2 > 0)) && ((o3 > 0 && o4 < 0) || (o3 < 0 && o4 > 0)))
+			return true;
+		return (!o1 && (inside_box(a, b, c) || c == a || c == b)) || (!o2 && (inside_box(a, b, d) || d == a || d == b)) ||
+			(!o3 && inside_box(c, d, a)) || (!o4 && inside_box(c, d, b));
+	}
+
+	inline bool PolygonClipper::to_grid(const vec2& v, ipoint& p) const {
+		const double x = floor((double)v.x() * inv_grid + 0.5), y = floor((double)v.y() * inv_grid + 0.5);
+		if (!(fabs(x) <= (double)max_coord && fabs(y) <= (double)max_coord))
+			return false;
+		p.x = (int64_t)x;
+		p.y = (int64_t)y;
+		return true;
+	}
+
+	// Counterclockwise, with no points repeated one after the other. Empty if it has no area.
+	inline bool PolygonClipper::load(const clip_polygon& polygon, std::vector<ipoint>& points, std::vector<int>& tags) const {
+		points.clear();
+		tags.clear();
+		for (size_t i = 0; i < polygon.points.size(); i++) {
+			ipoint p;
+			if (!to_grid(polygon.points[i], p)) {
+				std::cout << "PolygonClipper: point (" << polygon.points[i].x() << ", " << polygon.points[i].y() << ") out of range.\n";
+				return false;
+			}
+			const int tag = i < polygon.tags.size() ? polygon.tags[i] : -1;
+			if (!points.empty() && points.back() == p)
+				tags.back() = tag;		// The edge from the first copy has no length.
+			else {
+				points.push_back(p);
+				tags.push_back(tag);
+			}
+		}
+		while (points.size() > 1 && points.back() == points.front()) {
+			points.pop_back();
+			tags.pop_back();
+		}
+
+		double area = 0.0;
+		for (size_t i = 0; i < points.size(); i++) {
+			const ipoint& a = points[i];
+			const ipoint& b = points[(i + 1) % points.size()];
+			area += (double)a.x * b.y - (double)a.y * b.x;
+		}
+		if (points.size() < 3 || area == 0.0) {
+			points.clear();
+			tags.clear();
+		}
+		else if (area < 0.0) {
+			// Reversed, the edge from i to i + 1 goes from i + 1 to i, and still has tag i.
+			std::reverse(points.begin(), points.end());
+			std::reverse(tags.begin(), tags.end());
+			std::rotate(tags.begin(), tags.begin() + 1, tags.end());
+		}
+		return true;
+	}
+
+	inline void PolygonClipper::add_ring(const std::vector<ipoint>& points, const std::vector<int>& tags, const unsigned int poly) {
+		for (size_t i = 0; i < points.size(); i++)
+			edges.push_back({ points[i], points[(i + 1) % points.size()], tags[i], poly });
+	}
+
+	// Only crossings in the middle of both: everything else meets at a point that's already on the grid, and snap() finds it.
+	inline void PolygonClipper::test_pair(const unsigned int i, const unsigned int j) {
+		const iedge& s = edges[i];
+		const iedge& t = edges[j];
+		const int64_t o1 = cross(s.a, s.b, t.a), o2 = cross(s.a, s.b, t.b);
+		if (!((o1 > 0 && o2 < 0) || (o1 < 0 && o2 > 0)))
+			return;
+		const int64_t o3 = cross(t.a, t.b, s.a), o4 = cross(t.a, t.b, s.b);
+		if (!((o3 > 0 && o4 < 0) || (o3 < 0 && o4 > 0)))
+			return;
+		const double f = (double)o3 / ((double)o3 - (double)o4);
+		hot.push_back({ s.a.x + (int64_t)floor((s.b.x - s.a.x) * f + 0.5), s.a.y + (int64_t)floor((s.b.y - s.a.y) * f + 0.5) });
+	}
+
+	// The sweep's active edges are kept in horizontal bands, so each edge only looks at those near its height. Pairs are tested in the first
+	// band they share. After the first pass only pieces that were just split can cross anything, and the rest only look at those.
+	inline void PolygonClipper::find_crossings(const std::vector<uint8_t>& dirty) {
+		int64_t y0 = max_coord * 8, y1 = -max_coord * 8;
+		double extent = 0.0;
+		for (const iedge& e : edges) {
+			y0 = std::min(y0, std::min(e.a.y, e.b.y));
+			y1 = std::max(y1, std::max(e.a.y, e.b.y));
+			extent += (double)std::abs(e.a.y - e.b.y);
+		}
+		const double n = (double)edges.size();
+		const unsigned int count = (unsigned int)std::max(1.0, std::min(4096.0, std::min(n / 4, 4 * n * (y1 - y0 + 1) / std::max(extent, 1.0))));
+		const int64_t height = (y1 - y0) / count + 1;
+		for (int r = 0; r < 2; r++) {
+			if (rows[r].size() < count)
+				rows[r].resize(count);
+			for (unsigned int k = 0; k < count; k++)
+				rows[r][k].clear();
+		}
+
+		order.resize(edges.size());
+		for (unsigned int i = 0; i < order.size(); i++)
+			order[i] = { std::min(edges[i].a.x, edges[i].b.x), i };
+		std::sort(order.begin(), order.end());
+		for (const std::pair<int64_t, unsigned int>& o : order) {
+			const unsigned int i = o.second;
+			const iedge& e = edges[i];
+			const int64_t x0 = o.first, ey0 = std::min(e.a.y, e.b.y), ey1 = std::max(e.a.y, e.b.y);
+			const unsigned int lo = (unsigned int)((ey0 - y0) / height), hi = (unsigned int)((ey1 - y0) / height);
+			for (unsigned int k = lo; k <= hi; k++) {
+				std::vector<unsigned int>& row = rows[dirty[i] ? 0 : 1][k];		// Clean edges only against dirty ones.
+				for (size_t r = 0; r < row.size();) {
+					const iedge& f = edges[row[r]];
+					if (std::max(f.a.x, f.b.x) < x0) {
+						row[r] = row.back();
+						row.pop_back();
+						continue;
+					}
+					const int64_t fy0 = std::min(f.a.y, f.b.y);
+					if (fy0 <= ey1 && std::max(f.a.y, f.b.y) >= ey0 && k == std::max(lo, (unsigned int)((fy0 - y0) / height)))
+						test_pair(i, row[r]);
+					r++;
+				}
+				rows[0][k].push_back(i);
+				if (dirty[i])
+					rows[1][k].push_back(i);
+			}
+		}
+	}
+
+	// Every edge that goes through the cell around a hot point (closed, one grid step wide) is cut there. Hot points are sorted by horizontal
+	// band and then by x, so an edge only looks at those in the stretch of each band it goes through.
+	inline void PolygonClipper::snap_edges() {
+		int64_t y0 = hot[0].y, y1 = hot[0].y;
+		for (const ipoint& h : hot) {
+			y0 = std::min(y0, h.y);
+			y1 = std::max(y1, h.y);
+		}
+		const unsigned int count = (unsigned int)std::max<size_t>(1, std::min<size_t>(65536, hot.size() / 8));
+		const int64_t height = (y1 - y0) / count + 1;
+		auto band_less = [y0, height](const ipoint& p, const ipoint& q) {
+			const int64_t bp = (p.y - y0) / height, bq = (q.y - y0) / height;
+			return bp != bq ? bp < bq : p.x != q.x ? p.x < q.x : p.y < q.y;
+		};
+		std::sort(hot.begin(), hot.end(), band_less);
+		hot.erase(std::unique(hot.begin(), hot.end()), hot.end());
+
+		for (unsigned int i = 0; i < edges.size(); i++) {
+			const iedge& e = edges[i];
+			const int64_t ex0 = std::min(e.a.x, e.b.x), ex1 = std::max(e.a.x, e.b.x);
+			const int64_t ey0 = std::max(std::min(e.a.y, e.b.y), y0), ey1 = std::min(std::max(e.a.y, e.b.y), y1);
+			if (ey0 > ey1)
+				continue;
+			const ipoint a2 = { e.a.x * 2, e.a.y * 2 }, b2 = { e.b.x * 2, e.b.y * 2 };
+			const double dy = (double)(e.b.y - e.a.y), dx = (double)(e.b.x - e.a.x);
+			for (int64_t band = (ey0 - y0) / height; band <= (ey1 - y0) / height; band++) {
+
+				// Where the edge is between the band's top and bottom (plus half a step), give or take one.
+				int64_t x0 = ex0, x1 = ex1;
+				if (dy != 0.0) {
+					const double t0 = (y0 + band * height - 0.5 - e.a.y) / dy, t1 = (y0 + (band + 1) * height - 0.5 - e.a.y) / dy;
+					const double xa = e.a.x + dx * std::max(0.0, std::min(1.0, std::min(t0, t1))), xb = e.a.x + dx * std::max(0.0, std::min(1.0, std::max(t0, t1)));
+					x0 = std::max(ex0, (int64_t)floor(std::min(xa, xb)) - 1);
+					x1 = std::min(ex1, (int64_t)ceil(std::max(xa, xb)) + 1);
+				}
+				const ipoint first = { x0, y0 + band * height };
+				for (auto it = std::lower_bound(hot.begin(), hot.end(), first, band_less); it != hot.end() && (it->y - y0) / height == band && it->x <= x1; ++it) {
+					const ipoint& h = *it;
+					if (h.y < std::min(e.a.y, e.b.y) || h.y > std::max(e.a.y, e.b.y) || h.x < x0 || h == e.a || h == e.b)
+						continue;
+
+					// The segment meets the cell if the cell's corners aren't all on one side of its line (its box already overlaps the cell).
+					const ipoint c[4] = { { h.x * 2 - 1, h.y * 2 - 1 }, { h.x * 2 + 1, h.y * 2 - 1 }, { h.x * 2 + 1, h.y * 2 + 1 }, { h.x * 2 - 1, h.y * 2 + 1 } };
+					int pos = 0, neg = 0;
+					for (int k = 0; k < 4; k++) {
+						const int64_t o = cross(a2, b2, c[k]);
+						pos += o > 0;
+						neg += o < 0;
+					}
+					if (pos == 4 || neg == 4)
+						continue;
+					cuts.push_back({ i, (h.x - e.a.x) * (e.b.x - e.a.x) + (h.y - e.a.y) * (e.b.y - e.a.y), h });
+				}
+			}
+		}
+	}
+
+	// Snap rounding (Hobby): crossings are rounded to the grid, and every edge that passes through the cell of a crossing or of any edge's end
+	// is bent through its center. Edges can then meet at their ends or lie along each other, but not cross. Later passes only look for
+	// crossings left by rounding the computations, which are very rare.
+	inline void PolygonClipper::split_edges() {
+		std::vector<uint8_t> dirty(edges.size(), 1), next_dirty;
+		for (int pass = 0; pass < max_passes; pass++) {
+			hot.clear();
+			cuts.clear();
+			find_crossings(dirty);
+			if (!pass)
+				for (const iedge& e : edges)
+					hot.push_back(e.a);
+			else if (hot.empty())
+				return;
+			snap_edges();
+			if (cuts.empty())
+				return;
+
+			stats.splits += (unsigned int)cuts.size();
+			std::sort(cuts.begin(), cuts.end(), [](const cut& c, const cut& d) { return c.edge != d.edge ? c.edge < d.edge : c.along < d.along; });
+			std::vector<iedge> pieces;
+			pieces.reserve(edges.size() + cuts.size());
+			next_dirty.clear();
+			size_t c = 0;
+			for (unsigned int i = 0; i < edges.size(); i++) {
+				const iedge& e = edges[i];
+				const uint8_t split = c < cuts.size() && cuts[c].edge == i;
+				ipoint from = e.a;
+				for (; c < cuts.size() && cuts[c].edge == i; c++)
+					if (cuts[c].p != from) {
+						pieces.push_back({ from, cuts[c].p, e.tag, e.poly });
+						next_dirty.push_back(split);
+						from = cuts[c].p;
+					}
+				pieces.push_back({ from, e.b, e.tag, e.poly });
+				next_dirty.push_back(split);
+			}
+			edges.swap(pieces);
+			dirty.swap(next_dirty);
+		}
+	}
+
+	inline void PolygonClipper::build_bands(const unsigned int poly) {
+		band_index& b = bands[poly];
+		double n = 0.0, extent = 0.0;
+		b.y0 = max_coord * 8;
+		b.y1 = -max_coord * 8;
+		for (const iedge& e : edges)
+			if (e.poly == poly) {
+				b.y0 = std::min(b.y0, std::min(e.a.y, e.b.y));
+				b.y1 = std::max(b.y1, std::max(e.a.y, e.b.y));
+				extent += (double)std::abs(e.a.y - e.b.y);
+				n++;
+			}
+
+		// A few edges per band, as long as that doesn't mean copying long edges into too many.
+		const unsigned int count = (unsigned int)std::max(1.0, std::min(65536.0, std::min(n / 4, 4 * n * (b.y1 - b.y0 + 1) / std::max(extent, 1.0))));
+		b.height = std::max<int64_t>(1, (b.y1 - b.y0) / count + 1);
+		b.first.assign(count + 1, 0);
+		auto range = [&b, count](const iedge& e, unsigned int& lo, unsigned int& hi) {
+			lo = (unsigned int)((std::min(e.a.y, e.b.y) - b.y0) / b.height);
+			hi = std::min(count - 1, (unsigned int)((std::max(e.a.y, e.b.y) - b.y0) / b.height));
+		};
+		unsigned int lo, hi;
+		for (const iedge& e : edges)
+			if (e.poly == poly) {
+				range(e, lo, hi);
+				for (unsigned int k = lo; k <= hi; k++)
+					b.first[k + 1]++;
+			}
+		for (unsigned int k = 0; k < count; k++)
+			b.first[k + 1] += b.first[k];
+		b.list.resize(b.first[count]);
+		std::vector<unsigned int> fill(b.first.begin(), b.first.end() - 1);
+		for (unsigned int i = 0; i < edges.size(); i++)
+			if (edges[i].poly == poly) {
+				range(edges[i], lo, hi);
+				for (unsigned int k = lo; k <= hi; k++)
+					b.list[fill[k]++] = i;
+			}
+	}
+
+	// Winding number: edges crossing a ray to the right, +1 going up and -1 going down. A vertex at the point's height counts as above it, and
+	// an edge through the point as to its left, so the point behaves as if moved a tiny bit right (and even less up).
+	inline int PolygonClipper::winding(const unsigned int poly, const ipoint& p2) const {
+		const band_index& b = bands[poly];
+		if (b.first.size() < 2 || p2.y < 2 * b.y0 || p2.y > 2 * b.y1)
+			return 0;
+		const unsigned int band = std::min((unsigned int)(b.first.size() - 2), (unsigned int)((p2.y - 2 * b.y0) / (2 * b.height)));
+		int w = 0;
+		for (unsigned int k = b.first[band]; k < b.first[band + 1]; k++) {
+			const iedge& e = edges[b.list[k]];
+			const ipoint a = { e.a.x * 2, e.a.y * 2 }, c = { e.b.x * 2, e.b.y * 2 };
+			if ((a.y > p2.y) == (c.y > p2.y))
+				continue;
+			const int64_t o = cross(a, c, p2);
+			if (c.y > a.y && o > 0)
+				w++;
+			else if (c.y < a.y && o < 0)
+				w--;
+		}
+		return w;
+	}
+
+	// Edges are grouped by the segment they lie on, pointing up (or right, if flat), counting those of each polygon going that way minus
+	// those going back: the jump in winding number from its right side to its left. The winding at its middle is that of the side the point
+	// is moved to, the right one for segments going up and the left one for flat ones. The segment is kept where the result is on one side
+	// only, going with it on its left.
+	inline void PolygonClipper::select(const clip_op op) {
+		sorted.resize(edges.size());
+		for (size_t i = 0; i < edges.size(); i++) {
+			const iedge& e = edges[i];
+			const bool up = e.b.y > e.a.y || (e.b.y == e.a.y && e.b.x > e.a.x);
+			sorted[i] = { up ? e.a : e.b, up ? e.b : e.a, e.tag, e.poly * 2 + (up ? 1u : 0u) };
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const iedge& e, const iedge& f) {
+			if (e.a.x != f.a.x) return e.a.x < f.a.x;
+			if (e.a.y != f.a.y) return e.a.y < f.a.y;
+			if (e.b.x != f.b.x) return e.b.x < f.b.x;
+			if (e.b.y != f.b.y) return e.b.y < f.b.y;
+			return e.poly < f.poly;
+		});
+
+		kept.clear();
+		for (size_t first = 0, last; first < sorted.size(); first = last) {
+			const iedge& s = sorted[first];
+			int jump[2] = { 0, 0 };
+			int tag[2][2] = { { 0, 0 }, { 0, 0 } };
+			bool tagged[2][2] = { { false, false }, { false, false } };
+			for (last = first; last < sorted.size() && sorted[last].a == s.a && sorted[last].b == s.b; last++) {
+				const unsigned int poly = sorted[last].poly >> 1, up = sorted[last].poly & 1;
+				jump[poly] += up ? 1 : -1;
+				if (!tagged[poly][up]) {
+					tagged[poly][up] = true;
+					tag[poly][up] = sorted[last].tag;
+				}
+			}
+
+			const ipoint m = { s.a.x + s.b.x, s.a.y + s.b.y };
+			bool in[2][2];		// [side: right, left][polygon]
+			for (unsigned int poly = 0; poly < 2; poly++) {
+				const int w = winding(poly, m);
+				const int right = s.b.y > s.a.y ? w : w - jump[poly];
+				in[0][poly] = right != 0;
+				in[1][poly] = right + jump[poly] != 0;
+			}
+			bool result[2];
+			for (int side = 0; side < 2; side++)
+				result[side] = op == CLIP_UNION ? in[side][0] || in[side][1] : op == CLIP_INTERSECTION ? in[side][0] && in[side][1] : in[side][0] && !in[side][1];
+			if (result[0] == result[1])
+				continue;
+
+			// The tag of an edge of the first polygon there, going the same way if possible, or else of the second's.
+			const unsigned int up = result[1] ? 1 : 0;
+			const unsigned int poly = tagged[0][0] || tagged[0][1] ? 0 : 1;
+			kept.push_back({ up ? s.a : s.b, up ? s.b : s.a, tagged[poly][up] ? tag[poly][up] : tag[poly][up ^ 1], (unsigned int)poly });
+		}
+	}
+
+	inline void PolygonClipper::link(std::vector<clip_polygon>& out) {
+		std::sort(kept.begin(), kept.end(), [](const iedge& e, const iedge& f) { return e.a.x != f.a.x ? e.a.x < f.a.x : e.a.y < f.a.y; });
+		std::vector<uint8_t> used(kept.size(), 0);
+		std::vector<ipoint> points;
+		std::vector<int> tags;
+		for (size_t s = 0; s < kept.size(); s++) {
+			if (used[s])
+				continue;
+			points.clear();
+			tags.clear();
+			size_t e = s;
+			bool closed = false;
+			for (size_t steps = 0; steps <= kept.size(); steps++) {
+				used[e] = 1;
+				points.push_back(kept[e].a);
+				tags.push_back(kept[e].tag);
+
+				// Every edge leaving where this one ends, then the first clockwise from the way back.
+				const ipoint& at = kept[e].b;
+				const ipoint back = { kept[e].a.x - at.x, kept[e].a.y - at.y };
+				auto it = std::lower_bound(kept.begin(), kept.end(), at, [](const iedge& f, const ipoint& p) { return f.a.x != p.x ? f.a.x < p.x : f.a.y < p.y; });
+				size_t next = kept.size();
+				for (size_t k = it - kept.begin(); k < kept.size() && kept[k].a == at; k++) {
+					const ipoint d = { kept[k].b.x - at.x, kept[k].b.y - at.y };
+					if (next == kept.size() || clockwise_first(back, d, { kept[next].b.x - at.x, kept[next].b.y - at.y }))
+						next = k;
+				}
+				if (next == s) {
+					closed = true;
+					break;
+				}
+				if (next == kept.size() || used[next])
+					break;		// Only if rounding left edges crossing.
+				e = next;
+			}
+			if (!closed)
+				continue;
+
+			// Snapping can fold an edge back over itself: those spikes go out and back to the same point.
+			for (bool folded = true; folded && points.size() >= 3;) {
+				folded = false;
+				for (size_t i = 0; i < points.size() && points.size() >= 3; i++) {
+					const size_t p = (i + points.size() - 1) % points.size(), n = (i + 1) % points.size();
+					if (points[p] == points[n]) {
+						tags[p] = tags[n];
+						const size_t first = std::min(i, n);
+						points.erase(points.begin() + first, points.begin() + first + (n > i ? 2 : 1));
+						tags.erase(tags.begin() + first, tags.begin() + first + (n > i ? 2 : 1));
+						if (n < i) {
+							points.pop_back();
+							tags.pop_back();
+						}
+						folded = true;
+						break;
+					}
+				}
+			}
+
+			// Points in a row with the same tag on both sides aren't needed.
+			clip_polygon ring;
+			for (size_t i = 0; i < points.size(); i++) {
+				const size_t p = (i + points.size() - 1) % points.size(), n = (i + 1) % points.size();
+				if (cross(points[p], points[i], points[n]) == 0 && tags[p] == tags[i] &&
+					(points[i].x - points[p].x) * (points[n].x - points[i].x) + (points[i].y - points[p].y) * (points[n].y - points[i].y) > 0)
+					continue;
+				ring.points.push_back(from_grid(points[i]));
+				ring.tags.push_back(tags[i]);
+			}
+			if (ring.points.size() >= 3)
+				out.push_back(ring);
+		}
+	}
+
+	inline void PolygonClipper::begin() {
+		edges.clear();
+		stats.operations++;
+	}
+
+	inline void PolygonClipper::end() {
+		build_bands(0);
+		build_bands(1);
+		stats.edges += (unsigned int)edges.size();
+	}
+
+	inline bool PolygonClipper::clip(const clip_op op, const clip_polygon& a, const clip_polygon& b, std::vector<clip_polygon>& out) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<ipoint> pa, pb;
+		std::vector<int> ta, tb;
+		if (!load(a, pa, ta) || !load(b, pb, tb))
+			return false;
+		begin();
+		add_ring(pa, ta, 0);
+		add_ring(pb, tb, 1);
+		split_edges();
+		end();
+		select(op);
+		link(out);
+		stats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	// The intersection and difference with a quad on the left of the line, big enough to hold the whole polygon on that side. Its corners are
+	// whole multiples of the line's direction away from its points, so the edge along it is exactly on the line.
+	inline bool PolygonClipper::split(const clip_polygon& a, const vec2& p0, const vec2& p1, const int cut_tag, std::vector<clip_polygon>& left,
+		std::vector<clip_polygon>& right) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<ipoint> pa;
+		std::vector<int> ta;
+		ipoint q0, q1;
+		if (!load(a, pa, ta) || !to_grid(p0, q0) || !to_grid(p1, q1) || q0 == q1)
+			return false;
+		const ipoint d = { q1.x - q0.x, q1.y - q0.y };
+		int64_t reach = 1;
+		for (const ipoint& p : pa)
+			reach = std::max(reach, std::max(std::abs(p.x - q0.x), std::abs(p.y - q0.y)));
+		const int64_t k = (2 * reach) / std::max(std::abs(d.x), std::abs(d.y)) + 1;
+		const std::vector<ipoint> quad = {
+			{ q0.x - k * d.x, q0.y - k * d.y }, { q1.x + k * d.x, q1.y + k * d.y },
+			{ q1.x + k * d.x - k * d.y, q1.y + k * d.y + k * d.x }, { q0.x - k * d.x - k * d.y, q0.y - k * d.y + k * d.x } };
+		const std::vector<int> quad_tags = { cut_tag, -1, -1, -1 };
+
+		begin();
+		add_ring(pa, ta, 0);
+		add_ring(quad, quad_tags, 1);
+		split_edges();
+		end();
+		select(CLIP_INTERSECTION);
+		link(left);
+		select(CLIP_DIFFERENCE);
+		link(right);
+		stats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	// A bridge from the hole's rightmost point to the nearest point of the ring it can see, going in and back out: the hole becomes part of the
+	// ring, which touches itself along the bridge.
+	inline bool PolygonClipper::bridge_hole(std::vector<ring_node>& ring, const unsigned int start, const std::vector<ipoint>& hole,
+		const std::vector<int>& hole_tags, const std::vector<ipoint>* pending, const size_t pending_count, const int diagonal_tag) const {
+		size_t h = 0;
+		for (size_t i = 1; i < hole.size(); i++)
+			if (hole[i].x > hole[h].x || (hole[i].x == hole[h].x && hole[i].y > hole[h].y))
+				h = i;
+		const ipoint& hp = hole[h];
+
+		// The hole's nodes go in first, so locally_inside() works at its end too.
+		const unsigned int first = (unsigned int)ring.size();
+		const unsigned int n = (unsigned int)hole.size();
+		for (unsigned int i = 0; i < n; i++) {
+			const unsigned int k = (unsigned int)((h + i) % n);
+			ring.push_back({ hole[k], hole_tags[k], first + (i + n - 1) % n, first + (i + 1) % n });
+		}
+
+		// Nearest first, off a heap: the first few usually do.
+		std::vector<std::pair<int64_t, unsigned int> > candidates;
+		unsigned int v = start;
+		do {
+			candidates.push_back({ (ring[v].p.x - hp.x) * (ring[v].p.x - hp.x) + (ring[v].p.y - hp.y) * (ring[v].p.y - hp.y), v });
+			v = ring[v].next;
+		} while (v != start);
+		std::make_heap(candidates.begin(), candidates.end(), std::greater<std::pair<int64_t, unsigned int> >());
+
+		auto clear = [&](const unsigned int c) {
+			const ipoint& cp = ring[c].p;
+			if (cp == hp || !locally_inside(ring, c, hp) || !locally_inside(ring, first, cp))
+				return false;
+			auto blocked = [&](const ipoint& a, const ipoint& b) {
+				if (a == hp || a == cp || b == hp || b == cp)
+					return false;
+				return segments_touch(hp, cp, a, b);
+			};
+			unsigned int u = start;
+			do {
+				if (blocked(ring[u].p, ring[ring[u].next].p))
+					return false;
+				u = ring[u].next;
+			} while (u != start);
+			for (size_t i = 0; i < hole.size(); i++)
+				if (blocked(hole[i], hole[(i + 1) % hole.size()]))
+					return false;
+			for (size_t k = 0; k < pending_count; k++)
+				for (size_t i = 0; i < pending[k].size(); i++)
+					if (blocked(pending[k][i], pending[k][(i + 1) % pending[k].size()]))
+						return false;
+			return true;
+		};
+		while (!candidates.empty()) {
+			std::pop_heap(candidates.begin(), candidates.end(), std::greater<std::pair<int64_t, unsigned int> >());
+			const unsigned int c = candidates.back().second;
+			candidates.pop_back();
+			if (!clear(c))
+				continue;
+
+			// c -> hole ... -> hole's start again (a copy) -> c (a copy) -> what came after c.
+			const unsigned int c_copy = (unsigned int)ring.size(), h_copy = c_copy + 1;
+			const unsigned int after = ring[c].next;
+			ring.push_back({ ring[c].p, ring[c].tag, h_copy, after });
+			ring.push_back({ hp, diagonal_tag, ring[first].prev, c_copy });
+			ring[ring[first].prev].next = h_copy;
+			ring[after].prev = c_copy;
+			ring[c].tag = diagonal_tag;
+			ring[c].next = first;
+			ring[first].prev = c;
+			return true;
+		}
+		ring.resize(first);
+		return false;
+	}
+
+	inline bool PolygonClipper::triangulate(std::vector<ring_node>& ring, unsigned int start, unsigned int count, const int diagonal_tag,
+		std::vector<piece>& out) const {
+		// Only reflex vertices can be inside an ear, and clipping ears never makes a convex vertex reflex: the list is made once and
+		// shrinks as its vertices are clipped or turn convex.
+		std::vector<unsigned int> reflex;
+		{
+			unsigned int k = start;
+			do {
+				if (cross(ring[ring[k].prev].p, ring[k].p, ring[ring[k].next].p) <= 0)
+					reflex.push_back(k);
+				k = ring[k].next;
+			} while (k != start);
+		}
+		auto still_reflex = [&ring](const unsigned int k) { return ring[k].prev != k && cross(ring[ring[k].prev].p, ring[k].p, ring[ring[k].next].p) <= 0; };
+
+		auto is_ear = [&ring, &reflex](const unsigned int b) {
+			const ipoint& a = ring[ring[b].prev].p;
+			const ipoint& p = ring[b].p;
+			const ipoint& c = ring[ring[b].next].p;
+			if (cross(a, p, c) <= 0)
+				return false;
+
+			// Nothing else may be inside, or on the diagonal.
+			const int64_t x0 = std::min(a.x, std::min(p.x, c.x)), x1 = std::max(a.x, std::max(p.x, c.x));
+			const int64_t y0 = std::min(a.y, std::min(p.y, c.y)), y1 = std::max(a.y, std::max(p.y, c.y));
+			for (const unsigned int k : reflex) {
+				const ipoint& q = ring[k].p;
+				if (q.x < x0 || q.x > x1 || q.y < y0 || q.y > y1 || k == b || ring[k].prev == k || q == a || q == p || q == c)
+					continue;
+				if (cross(a, p, q) >= 0 && cross(p, c, q) >= 0 && cross(c, a, q) >= 0)
+					return false;
+			}
+			return true;
+		};
+
+		unsigned int node = start, stop = start;
+		while (count > 3) {
+			if (is_ear(node)) {
+				const unsigned int a = ring[node].prev, c = ring[node].next;
+				out.push_back({ { ring[a].p, ring[node].p, ring[c].p }, { ring[a].tag, ring[node].tag, diagonal_tag } });
+				ring[a].tag = diagonal_tag;
+				ring[a].next = c;
+				ring[c].prev = a;
+				ring[node].prev = ring[node].next = node;		// Clipped.
+				count--;
+				node = stop = c;
+
+				// Drop what's no longer reflex now and then, the tests are over the whole list.
+				if ((count & 15) == 0)
+					reflex.erase(std::remove_if(reflex.begin(), reflex.end(), [&still_reflex](const unsigned int k) { return !still_reflex(k); }), reflex.end());
+				continue;
+			}
+			node = ring[node].next;
+			if (node == stop) {
+				// No ears left: only points in a row (no area), unless rounding broke the ring.
+				unsigned int k = node;
+				do {
+					if (cross(ring[ring[k].prev].p, ring[k].p, ring[ring[k].next].p) != 0)
+						return false;
+					k = ring[k].next;
+				} while (k != node);
+				return true;
+			}
+		}
+		const unsigned int a = ring[node].prev, c = ring[node].next;
+		if (cross(ring[a].p, ring[node].p, ring[c].p) > 0)
+			out.push_back({ { ring[a].p, ring[node].p, ring[c].p }, { ring[a].tag, ring[node].tag, ring[c].tag } });
+		return true;
+	}
+
+	// Hertel-Mehlhorn: every edge two triangles share (by its points, so bridges count) is removed if the pieces on both sides stay convex at
+	// its ends.
+	inline void PolygonClipper::merge_convex(std::vector<piece>& triangles, std::vector<clip_polygon>& pieces) const {
+		std::vector<unsigned int> parent(triangles.size());
+		for (unsigned int i = 0; i < parent.size(); i++)
+			parent[i] = i;
+		auto find = [&parent](unsigned int i) {
+			while (parent[i] != i)
+				i = parent[i] = parent[parent[i]];
+			return i;
+		};
+
+		// Every triangle's edges sorted by their points, to look up each one's twin going the other way.
+		auto less = [](const iedge& e, const iedge& f) {
+			if (e.a.x != f.a.x) return e.a.x < f.a.x;
+			if (e.a.y != f.a.y) return e.a.y < f.a.y;
+			if (e.b.x != f.b.x) return e.b.x < f.b.x;
+			return e.b.y < f.b.y;
+		};
+		std::vector<iedge> halves;
+		for (unsigned int t = 0; t < triangles.size(); t++)
+			for (unsigned int k = 0; k < 3; k++)
+				halves.push_back({ triangles[t].points[k], triangles[t].points[(k + 1) % 3], 0, t });
+		std::sort(halves.begin(), halves.end(), less);
+		struct diagonal { ipoint u, v; unsigned int t0, t1; };
+		std::vector<diagonal> diagonals;
+		for (const iedge& e : halves) {
+			const iedge r = { e.b, e.a, 0, 0 };
+			if (less(r, e))
+				continue;		// Each pair once.
+			auto it = std::lower_bound(halves.begin(), halves.end(), r, less);
+			if (it != halves.end() && it->a == r.a && it->b == r.b && it->poly != e.poly)
+				diagonals.push_back({ e.a, e.b, e.poly, it->poly });
+		}
+
+		for (const diagonal& d : diagonals) {
+			const unsigned int p = find(d.t0), q = find(d.t1);
+			if (p == q)
+				continue;
+			piece& P = triangles[p];
+			piece& Q = triangles[q];
+			const size_t np = P.points.size(), nq = Q.points.size();
+			size_t i = 0, j = 0;
+			while (i < np && !(P.points[i] == d.u && P.points[(i + 1) % np] == d.v))
+				i++;
+			while (j < nq && !(Q.points[j] == d.v && Q.points[(j + 1) % nq] == d.u))
+				j++;
+			if (i == np || j == nq)
+				continue;
+			if (cross(P.points[(i + np - 1) % np], d.u, Q.points[(j + 2) % nq]) < 0 || cross(Q.points[(j + nq - 1) % nq], d.v, P.points[(i + 2) % np]) < 0)
+				continue;
+
+			// P from v round to u, then Q from after u to before v.
+			piece merged;
+			for (size_t k = 1; k <= np; k++) {
+				merged.points.push_back(P.points[(i + k) % np]);
+				merged.tags.push_back(P.tags[(i + k) % np]);
+			}
+			merged.tags.back() = Q.tags[(j + 1) % nq];
+			for (size_t k = 2; k < nq; k++) {
+				merged.points.push_back(Q.points[(j + k) % nq]);
+				merged.tags.push_back(Q.tags[(j + k) % nq]);
+			}
+			parent[q] = p;
+			P = merged;
+			Q = piece();
+		}
+
+		for (unsigned int t = 0; t < triangles.size(); t++) {
+			if (find(t) != t)
+				continue;
+			const piece& P = triangles[t];
+			const size_t n = P.points.size();
+			clip_polygon out;
+			for (size_t i = 0; i < n; i++) {
+				const size_t a = (i + n - 1) % n;
+				if (cross(P.points[a], P.points[i], P.points[(i + 1) % n]) == 0 && P.tags[a] == P.tags[i])
+					continue;
+				out.points.push_back(from_grid(P.points[i]));
+				out.tags.push_back(P.tags[i]);
+			}
+			if (out.points.size() >= 3)
+				pieces.push_back(out);
+		}
+	}
+
+	inline bool PolygonClipper::partition(const std::vector<clip_polygon>& polygons, const int diagonal_tag, std::vector<clip_polygon>& pieces) {
+		auto start = std::chrono::steady_clock::now();
+		stats.operations++;
+
+		// Holes keep their way round: load() turns everything counterclockwise.
+		std::vector<std::vector<ipoint> > outers, holes;
+		std::vector<std::vector<int> > outer_tags, hole_tags;
+		std::vector<double> outer_area;
+		for (const clip_polygon& polygon : polygons) {
+			double area = 0.0;
+			for (size_t i = 0; i < polygon.points.size(); i++) {
+				const vec2& a = polygon.points[i];
+				const vec2& b = polygon.points[(i + 1) % polygon.points.size()];
+				area += (double)a.x() * b.y() - (double)a.y() * b.x();
+			}
+			std::vector<ipoint> points;
+			std::vector<int> tags;
+			if (!load(polygon, points, tags))
+				return false;
+			if (points.empty())
+				continue;
+			if (area > 0.0) {
+				outers.push_back(points);
+				outer_tags.push_back(tags);
+				outer_area.push_back(area);
+			}
+			else {
+				std::reverse(points.begin(), points.end());
+				std::reverse(tags.begin(), tags.end());
+				std::rotate(tags.begin(), tags.begin() + 1, tags.end());
+				holes.push_back(points);
+				hole_tags.push_back(tags);
+			}
+		}
+
+		// Each hole goes in the smallest outer ring around the middle of its first edge (which can't be on another ring's edge).
+		std::vector<std::vector<unsigned int> > outer_holes(outers.size());
+		for (unsigned int h = 0; h < holes.size(); h++) {
+			const ipoint m = { holes[h][0].x + holes[h][1].x, holes[h][0].y + holes[h][1].y };
+			int best = outers.size() == 1 ? 0 : -1;
+			for (unsigned int o = 0; o < outers.size() && outers.size() > 1; o++) {
+				bool in = false;
+				const std::vector<ipoint>& r = outers[o];
+				for (size_t i = 0; i < r.size(); i++) {
+					const ipoint a = { r[i].x * 2, r[i].y * 2 }, c = { r[(i + 1) % r.size()].x * 2, r[(i + 1) % r.size()].y * 2 };
+					if ((a.y > m.y) != (c.y > m.y) && (c.y > a.y ? cross(a, c, m) > 0 : cross(a, c, m) < 0))
+						in = !in;
+				}
+				if (in && (best < 0 || outer_area[o] < outer_area[best]))
+					best = (int)o;
+			}
+			if (best >= 0)
+				outer_holes[best].push_back(h);
+		}
+
+		std::vector<piece> triangles;
+		for (unsigned int o = 0; o < outers.size(); o++) {
+			std::vector<ring_node> ring;
+			const unsigned int n = (unsigned int)outers[o].size();
+			for (unsigned int i = 0; i < n; i++)
+				ring.push_back({ outers[o][i], outer_tags[o][i], (i + n - 1) % n, (i + 1) % n });
+
+			// Rightmost holes first, as their bridges are the likeliest to be blocked by the others.
+			std::vector<std::pair<int64_t, unsigned int> > hs;
+			for (unsigned int h : outer_holes[o]) {
+				int64_t x = holes[h][0].x;
+				for (const ipoint& p : holes[h])
+					x = std::max(x, p.x);
+				hs.push_back({ -x, h });
+			}
+			std::sort(hs.begin(), hs.end());
+			std::vector<std::vector<ipoint> > pending;
+			for (const std::pair<int64_t, unsigned int>& h : hs)
+				pending.push_back(holes[h.second]);
+			for (size_t k = 0; k < hs.size(); k++) {
+				if (!bridge_hole(ring, 0, pending[k], hole_tags[hs[k].second], pending.data() + k + 1, hs.size() - k - 1, diagonal_tag)) {
+					std::cout << "PolygonClipper: couldn't join a hole to its outline.\n";
+					return false;
+				}
+			}
+			if (!triangulate(ring, 0, (unsigned int)ring.size(), diagonal_tag, triangles)) {
+				std::cout << "PolygonClipper: couldn't triangulate a polygon.\n";
+				return false;
+			}
+		}
+		merge_convex(triangles, pieces);
+		stats.ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+}
+
+#endif // !GEN_ENG_POLYGON_CLIP_H
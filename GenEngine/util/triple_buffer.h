@@ -0,0 +1,70 @@
+#pragma once
+#ifndef GEN_ENG_TRIPLE_BUFFER_H
+#define GEN_ENG_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/*	Lock-free triple buffer for a single producer and a single consumer.
+		The producer always owns one slot to write in, the consumer always owns one slot to read from, and the third slot is the one being handed
+		over. Publishing swaps the producer's slot with the shared one, acquiring swaps the consumer's slot with the shared one if it holds newer data.
+		Neither side ever waits for the other: if the producer is faster, frames the consumer didn't pick up in time are simply overwritten.
+
+		The shared index is stored together with a "fresh" bit, so both values are exchanged in a single atomic operation.
+*/
+
+namespace GenEngine {
+
+	template <class T>
+	class TripleBuffer {
+
+		static const unsigned int fresh_bit = 4;	// Set in shared when the slot it points to was published and not acquired yet.
+
+		T							slots[3];
+		std::atomic<unsigned int>	shared;			// Index of the slot being handed over | fresh_bit.
+		unsigned int				write_idx;		// Slot owned by the producer.
+		unsigned int				read_idx;		// Slot owned by the consumer.
+
+	public:
+
+		// Constructor
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		TripleBuffer() : shared(1), write_idx(0), read_idx(2) {}
+
+		TripleBuffer(const TripleBuffer&) = delete;
+		TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+		// Producer side
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline T&		write_slot()		{ return slots[write_idx]; }		// Slot the producer may fill.
+		inline bool		publish();												// Hands the write slot over to the consumer. Returns 1 if the slot given back was never consumed.
+
+		// Consumer side
+		//-------------------------------------------------------------------------------------------------------------------------------------------
+		inline bool		acquire();												// Takes the newest published slot. Returns 0 if nothing new was published.
+		inline const T&	read_slot()	const	{ return slots[read_idx]; }			// Slot the consumer may read.
+		inline bool		has_fresh()	const	{ return (shared.load(std::memory_order_relaxed) & fresh_bit) != 0; }
+	};
+
+
+	template <class T>
+	inline bool TripleBuffer<T>::publish() {
+		// Release: everything written in the slot is visible to the consumer once it acquires the index.
+		unsigned int prev = shared.exchange(write_idx | fresh_bit, std::memory_order_acq_rel);
+		write_idx = prev & ~fresh_bit;
+
+		// If the slot still had the fresh bit the consumer never saw it, so whatever it carried was dropped. The producer gets it back and
+		// can carry over anything that must not be lost.
+		return (prev & fresh_bit) != 0;
+	}
+
+	template <class T>
+	inline bool TripleBuffer<T>::acquire() {
+		if (!(shared.load(std::memory_order_relaxed) & fresh_bit))
+			return false;
+		unsigned int prev = shared.exchange(read_idx, std::memory_order_acq_rel);
+		read_idx = prev & ~fresh_bit;
+		return true;
+	}
+}
+
+#endif // !GEN_ENG_TRIPLE_BUFFER_H
@@ -26,6 +26,8 @@ public:
 	inline vec3& operator/=(const vec3& v2);
 	inline vec3& operator*=(const float& t);
 	inline vec3& operator/=(const float& t);
+	inline int   operator==(const vec3& v2) const { return x() == v2.x() && y() == v2.y() && z() == v2.z(); };
+	inline int   operator!=(const vec3& v2) const { return !(*this == v2); };
 
 	// vector operations
 	inline float length() const { return (float) sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]); };			//return length of vector